@@ -29,6 +29,7 @@
 struct nmsg_alias {
 	size_t max_idx;
 	char **value;
+	struct nmsg_nameidx *names;
 };
 
 static int nmsg_alias_initialized = 0;
@@ -39,6 +40,7 @@ static struct nmsg_alias alias_group;
 
 static nmsg_res alias_init(struct nmsg_alias *, const char *fname);
 static nmsg_res alias_resize(struct nmsg_alias *, unsigned n); 
+static nmsg_res alias_index(struct nmsg_alias *);
 static void alias_free(struct nmsg_alias *); 
 
 /* Functions. */
@@ -63,6 +65,7 @@ nmsg_alias_by_key(nmsg_alias_e ae, unsigned key) {
 unsigned
 nmsg_alias_by_value(nmsg_alias_e ae, const char *value) {
 	struct nmsg_alias *al = NULL;
+	unsigned key;
 
 	if (ae == nmsg_alias_operator)
 		al = &alias_operator;
@@ -71,24 +74,29 @@ nmsg_alias_by_value(nmsg_alias_e ae, const char *value) {
 
 	assert(al != NULL);
 
-	for (unsigned i = 0; i <= al->max_idx; i++)
-		if (al->value[i] != NULL &&
-		    strcasecmp(value, al->value[i]) == 0)
-			return (i);
+	if (_nmsg_nameidx_lookup(al->names, value, &key))
+		return (key);
 
 	return (0);
 }
 
 nmsg_res
 _nmsg_alias_init(void) {
+	const char *fname;
 	nmsg_res res;
 
 	if (nmsg_alias_initialized == 0) {
-		res = alias_init(&alias_operator, ALIAS_FILE_OPERATOR);
+		fname = getenv("NMSG_OPALIAS_FILE");
+		if (fname == NULL)
+			fname = ALIAS_FILE_OPERATOR;
+		res = alias_init(&alias_operator, fname);
 		if (res != nmsg_res_success)
 			return (res);
 
-		res = alias_init(&alias_group, ALIAS_FILE_GROUP);
+		fname = getenv("NMSG_GRALIAS_FILE");
+		if (fname == NULL)
+			fname = ALIAS_FILE_GROUP;
+		res = alias_init(&alias_group, fname);
 		if (res != nmsg_res_success)
 			return (res);
 
@@ -157,6 +165,9 @@ alias_init(struct nmsg_alias *al, const char *fname) {
 	}
 
 	fclose(fp);
+
+	if (res == nmsg_res_success)
+		res = alias_index(al);
 	return (res);
 }
 
@@ -186,8 +197,28 @@ alias_resize(struct nmsg_alias *al, unsigned n) {
 	return (nmsg_res_success);
 }
 
+static nmsg_res
+alias_index(struct nmsg_alias *al) {
+	nmsg_res res;
+
+	al->names = _nmsg_nameidx_init();
+	if (al->names == NULL)
+		return (nmsg_res_memfail);
+
+	/* index in ascending key order, so that the lowest key wins */
+	for (unsigned i = 0; i <= al->max_idx; i++) {
+		if (al->value[i] != NULL) {
+			res = _nmsg_nameidx_insert(al->names, al->value[i], i);
+			if (res != nmsg_res_success)
+				return (res);
+		}
+	}
+	return (nmsg_res_success);
+}
+
 static void
 alias_free(struct nmsg_alias *al) {
+	_nmsg_nameidx_destroy(&al->names);
 	for (unsigned i = 0; i <= al->max_idx; i++)
 		if (al->value[i] != NULL)
 			free(al->value[i]);
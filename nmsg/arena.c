@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2013 by Farsight Security, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Bump allocator for unpacking protobuf messages. Everything protobuf-c
+ * allocates while unpacking a message (the message itself, repeated field
+ * arrays, bytes and string fields, nested messages) is carved out of a few
+ * large chunks, and freeing an individual allocation is a no-op. All of the
+ * memory is released at once by _nmsg_arena_destroy().
+ *
+ * The arena and its first chunk share a single allocation.
+ */
+
+/* Import. */
+
+#include "private.h"
+
+/* Macros. */
+
+#define ARENA_ALIGN		16
+#define ARENA_ROUND(sz)		(((sz) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+#define ARENA_CHUNKSZ_MIN	256
+
+/* Data structures. */
+
+struct nmsg_arena_chunk {
+	struct nmsg_arena_chunk	*next;
+	size_t			size;
+};
+
+#define CHUNK_HDRSZ		ARENA_ROUND(sizeof(struct nmsg_arena_chunk))
+#define ARENA_HDRSZ		ARENA_ROUND(sizeof(struct nmsg_arena))
+
+/* Forward. */
+
+static void *arena_alloc(void *, size_t);
+static void arena_free(void *, void *);
+
+/* Internal functions. */
+
+struct nmsg_arena *
+_nmsg_arena_init(size_t size) {
+	struct nmsg_arena *arena;
+
+	size = ARENA_ROUND(size < ARENA_CHUNKSZ_MIN ? ARENA_CHUNKSZ_MIN : size);
+	arena = malloc(ARENA_HDRSZ + size);
+	if (arena == NULL)
+		return (NULL);
+
+	arena->allocator.alloc = arena_alloc;
+	arena->allocator.free = arena_free;
+	arena->allocator.allocator_data = arena;
+	arena->chunks = NULL;
+	arena->pos = (uint8_t *) arena + ARENA_HDRSZ;
+	arena->end = arena->pos + size;
+	arena->chunk_size = size;
+
+	return (arena);
+}
+
+void
+_nmsg_arena_destroy(struct nmsg_arena **arena) {
+	struct nmsg_arena_chunk *chunk, *next;
+
+	if (*arena == NULL)
+		return;
+	for (chunk = (*arena)->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	free(*arena);
+	*arena = NULL;
+}
+
+ProtobufCAllocator *
+_nmsg_arena_allocator(struct nmsg_arena *arena) {
+	return (&arena->allocator);
+}
+
+/* Private functions. */
+
+static void *
+arena_alloc(void *data, size_t size) {
+	struct nmsg_arena *arena = data;
+	struct nmsg_arena_chunk *chunk;
+	void *ptr;
+
+	size = ARENA_ROUND(size == 0 ? 1 : size);
+	if (size > (size_t) (arena->end - arena->pos)) {
+		size_t chunk_size = 2 * arena->chunk_size;
+
+		/* large allocations get a chunk of their own, so that the
+		 * rest of the current chunk is not wasted */
+		if (size > chunk_size / 2) {
+			chunk = malloc(CHUNK_HDRSZ + size);
+			if (chunk == NULL)
+				return (NULL);
+			chunk->size = size;
+			chunk->next = arena->chunks;
+			arena->chunks = chunk;
+			return ((uint8_t *) chunk + CHUNK_HDRSZ);
+		}
+
+		chunk = malloc(CHUNK_HDRSZ + chunk_size);
+		if (chunk == NULL)
+			return (NULL);
+		chunk->size = chunk_size;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arena->chunk_size = chunk_size;
+		arena->pos = (uint8_t *) chunk + CHUNK_HDRSZ;
+		arena->end = arena->pos + chunk_size;
+	}
+
+	ptr = arena->pos;
+	arena->pos += size;
+	return (ptr);
+}
+
+static void
+arena_free(void *data, void *ptr) {
+	/* memory is released by _nmsg_arena_destroy() */
+	(void) data;
+	(void) ptr;
+}
@@ -19,11 +19,13 @@
 /* Import. */
 
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <ctype.h>
+#include <errno.h>
 #include <pthread.h>
 #include <string.h>
 
@@ -34,7 +36,6 @@
 
 #include "dnsqr.pb-c.h"
 
-#include "libmy/list.h"
 #include "libmy/lookup3.h"
 #include "libmy/my_alloc.h"
 #include "libmy/string_replace.h"
@@ -45,6 +46,20 @@
 #define DEFAULT_NUM_SLOTS	262144
 #define DEFAULT_MAX_VALUES	131072
 #define DEFAULT_QUERY_TIMEOUT	60
+#define DEFAULT_TIMER_RES_MS	100
+
+#define WHEEL_BITS		6
+#define WHEEL_SIZE		(1U << WHEEL_BITS)
+#define WHEEL_MASK		(WHEEL_SIZE - 1)
+#define WHEEL_LEVELS		4
+#define WHEEL_SPAN		(1U << (WHEEL_BITS * WHEEL_LEVELS))
+
+#define SLOT_DETACHED		UINT32_MAX
+
+#define MAX_THREADS		64
+#define DEFAULT_JOB_QUEUE_SZ	4096
+#define MSG_QUEUE_SZ		4096
+#define MSG_BATCH_SZ		64
 
 #define DNS_FLAG_QR(flags)	(((flags) >> 15) & 0x01)
 #define DNS_FLAG_RD(flags)	(((flags) >> 8) & 0x01)
@@ -52,28 +67,179 @@
 
 /* Data structures. */
 
-typedef struct list_entry list_entry_t;
-typedef struct hash_entry hash_entry_t;
+/*
+ * The 6-tuple of a query, stored inline in its state table slot so that
+ * probing the table does not have to chase the DnsQR pointer. IPv4
+ * addresses use the first 4 bytes of the address fields, the rest are zero.
+ */
+typedef struct {
+	uint16_t			query_port;
+	uint16_t			response_port;
+	uint16_t			id;
+	uint8_t				proto;
+	uint8_t				ip_len;
+	uint8_t				query_ip[16];
+	uint8_t				response_ip[16];
+} dnsqr_tuple_t;
+
+/*
+ * Backing store for the packets of one direction of a DnsQR. Packets are
+ * copied into the slab back to back, in the order of the packet array of
+ * the DnsQR, so a packet is located by the sum of the lengths of the
+ * packets before it, and the packet pointers can be recomputed whenever
+ * the slab moves.
+ */
+typedef struct {
+	uint8_t				*data;
+	size_t				len;
+	size_t				size;
+} dnsqr_slab_t;
 
-struct list_entry {
-	ISC_LINK(struct list_entry)	link;
-	hash_entry_t			*he;
-};
+/*
+ * A DnsQR as allocated by this module. 'dnsqr' must be the first member, so
+ * that the generated protobuf code can free the whole record, once the
+ * packet pointers into the slabs have been detached by dnsqr_free().
+ */
+typedef struct {
+	Nmsg__Base__DnsQR		dnsqr;
+	dnsqr_slab_t			query_slab;
+	dnsqr_slab_t			response_slab;
+} dnsqr_rec_t;
+
+/*
+ * Links of a circular doubly linked timer list. Link ids below num_slots
+ * are state table slots, the ids above are the list heads of the timing
+ * wheel buckets, so entries can move between slots and buckets without
+ * any allocation.
+ */
+typedef struct {
+	uint32_t			prev;
+	uint32_t			next;
+} dnsqr_link_t;
 
-struct hash_entry {
+/*
+ * A state table slot, 64 bytes on LP64. 'expire' is the low 32 bits of
+ * the timer tick at which the query times out.
+ */
+typedef struct {
 	Nmsg__Base__DnsQR		*dnsqr;
-	list_entry_t			*le;
-};
+	uint32_t			hash;
+	uint32_t			expire;
+	dnsqr_link_t			link;
+	dnsqr_tuple_t			tuple;
+} hash_entry_t;
 
+/*
+ * A UDP query or response whose correlation with the state table is still
+ * to be done. 'hash' is the dnsqr_hash() of the 9-tuple, which also selects
+ * the shard that owns the packet.
+ */
 typedef struct {
-	pthread_mutex_t			lock;
+	Nmsg__Base__DnsQR		*dnsqr;
+	struct timespec			ts;
+	uint32_t			hash;
+	uint16_t			flags;
+} dnsqr_job_t;
 
-	hash_entry_t			*table;
-	ISC_LIST(struct list_entry)	list;
-	struct reasm_ip			*reasm;
+typedef struct dnsqr_ctx dnsqr_ctx_t;
 
+/*
+ * A compiled qname filter: a flat, open-addressed set of downcased wire
+ * format names. Each slot holds the hash of a name and the offset of the
+ * name in 'names', where it is stored as a length byte followed by the
+ * name, so a probe usually touches only the slot array. 'lens' is a bitmap
+ * of the lengths of the names in the set, which rules out most suffixes of
+ * a qname without hashing them.
+ *
+ * Filters are immutable once built. A reload builds a new filter, and the
+ * old one is freed when the last thread that uses it lets go of it.
+ */
+typedef struct {
+	uint32_t			hash;
+	uint32_t			off;
+} dnsqr_qfilter_slot_t;
+
+typedef struct {
+	unsigned			refcount;
+	uint32_t			mask;
+	dnsqr_qfilter_slot_t		*slots;
+	uint8_t				*names;
+	uint64_t			lens[4];
+} dnsqr_qfilter_t;
+
+/* Where a filter is loaded from, and the state of its file. */
+typedef struct {
+	const char			*env_var;
+	char				*file;
+	time_t				mtime;
+	off_t				size;
+} dnsqr_filter_src_t;
+
+/* The filters used by one thread, see dnsqr_filter_sync(). */
+typedef struct {
+	unsigned			gen;
+	dnsqr_qfilter_t			*include;
+	dnsqr_qfilter_t			*exclude;
+} dnsqr_filters_t;
+
+/*
+ * One shard of the query/response correlation state. The state table,
+ * timing wheel and expiry queue of a shard are only ever touched by the
+ * thread that owns the shard, so they need no lock. The lock only protects
+ * the job queue, which the ingest thread fills when the shard has its own
+ * worker thread.
+ *
+ * Unanswered queries hang off a hierarchical timing wheel, driven by packet
+ * time. Level 0 has one bucket per tick, each level above covers WHEEL_SIZE
+ * times the span of the level below, and is cascaded down as time passes.
+ * Queries that time out or are evicted are moved from the state table to
+ * the 'expired' queue, from which dnsqr_trim() hands them out.
+ */
+typedef struct {
+	dnsqr_ctx_t			*ctx;
+
+	hash_entry_t			*table;
 	size_t				len_table;
 
+	dnsqr_link_t			wheel[WHEEL_LEVELS * WHEEL_SIZE];
+	uint64_t			wheel_map[WHEEL_LEVELS];
+	uint64_t			wheel_tick;
+	bool				wheel_running;
+
+	Nmsg__Base__DnsQR		**expired;
+	uint32_t			expired_head;
+	uint32_t			expired_count;
+
+	uint32_t			num_slots;
+	uint32_t			max_values;
+	uint32_t			count;
+	struct timespec			now;
+	bool				stop;
+#ifdef DEBUG
+	uint32_t			count_unanswered_query;
+	uint32_t			count_unsolicited_response;
+	uint32_t			count_query_response;
+#endif
+	dnsqr_filters_t			filters;
+
+	/* worker thread, only used with DNSQR_NUM_THREADS > 1 */
+	pthread_t			thr;
+	pthread_mutex_t			lock;
+	pthread_cond_t			cond;
+	dnsqr_job_t			*jobs;
+	unsigned			jobs_head;
+	unsigned			jobs_count;
+	bool				stop_req;
+} dnsqr_shard_t;
+
+struct dnsqr_ctx {
+	pthread_mutex_t			lock;
+
+	dnsqr_shard_t			*shards;
+	unsigned			num_shards;
+	struct reasm_ip			*reasm;
+	uint8_t				*reasm_buf;
+
 	bool				stop;
 	int				capture_qr;
 	int				capture_rd;
@@ -82,21 +248,34 @@ typedef struct {
 	uint32_t			num_slots;
 	uint32_t			max_values;
 	uint32_t			query_timeout;
-	uint32_t			count;
+	uint64_t			timer_res;
 #ifdef DEBUG
-	uint32_t			count_unanswered_query;
-	uint32_t			count_unsolicited_response;
-	uint32_t			count_query_response;
 	uint32_t			count_packet;
 #endif
-	struct timespec			now;
-
-	wdns_name_t			**filter_qnames_exclude;
-	uint32_t			filter_qnames_exclude_slots;
 
-	wdns_name_t			**filter_qnames_include;
-	uint32_t			filter_qnames_include_slots;
-} dnsqr_ctx_t;
+	/* messages emitted by the shard worker threads */
+	unsigned			num_threads;
+	unsigned			job_queue_sz;
+	pthread_mutex_t			msgs_lock;
+	pthread_cond_t			msgs_cond;
+	nmsg_message_t			*msgs;
+	unsigned			msgs_head;
+	unsigned			msgs_count;
+	unsigned			num_done;
+	bool				discard;
+	dnsqr_job_t			pending;
+	bool				stop_sent;
+	time_t				tick_sec;
+
+	/* current qname filters, 'filter_gen' changes on every reload */
+	pthread_mutex_t			filter_lock;
+	unsigned			filter_gen;
+	dnsqr_qfilter_t			*filter_include;
+	dnsqr_qfilter_t			*filter_exclude;
+	dnsqr_filter_src_t		filter_include_src;
+	dnsqr_filter_src_t		filter_exclude_src;
+	time_t				filter_check;
+};
 
 typedef struct {
 	uint32_t			query_ip;
@@ -306,6 +485,10 @@ struct nmsg_msgmod_plugin nmsg_msgmod_ctx = {
 /* Forward. */
 
 static void dnsqr_print_stats(dnsqr_ctx_t *ctx);
+static void dnsqr_free(Nmsg__Base__DnsQR *dnsqr);
+static void dnsqr_shard_init(dnsqr_ctx_t *ctx, dnsqr_shard_t *shard);
+static void dnsqr_shard_destroy(dnsqr_shard_t *shard);
+static void *dnsqr_shard_thr(void *user);
 
 /* Functions. */
 
@@ -500,136 +683,267 @@ getenv_int(const char *name, int64_t *value) {
 }
 
 static bool
-dnsqr_filter_lookup(wdns_name_t **table, uint32_t num_slots, wdns_name_t *name) {
-	unsigned slot, slot_stop;
+dnsqr_qfilter_lookup(const dnsqr_qfilter_t *f, const uint8_t *name, size_t len) {
+	const dnsqr_qfilter_slot_t *slot;
+	uint32_t hash, i;
 
-	slot = my_hashlittle(name->data, name->len, 0) % num_slots;
-	if (slot > 0)
-		slot_stop = slot - 1;
-	else
-		slot_stop = num_slots - 1;
+	if ((f->lens[len >> 6] & ((uint64_t) 1 << (len & 63))) == 0)
+		return (false);
 
-	for (;;) {
-		wdns_name_t *ent = table[slot];
+	hash = my_hashlittle(name, len, 0);
+	for (i = hash & f->mask; ; i = (i + 1) & f->mask) {
+		slot = &f->slots[i];
 
 		/* empty slot, not present */
-		if (ent == NULL)
+		if (slot->off == 0)
 			return (false);
 
 		/* hit */
-		if (ent != NULL &&
-		    ent->len == name->len &&
-		    memcmp(ent->data, name->data, name->len) == 0)
+		if (slot->hash == hash &&
+		    f->names[slot->off] == len &&
+		    memcmp(&f->names[slot->off + 1], name, len) == 0)
 		{
 			return (true);
 		}
+	}
+}
 
-		/* slot filled, but not our value */
-		assert(slot != slot_stop);
-		slot += 1;
-		if (slot >= num_slots)
-			slot = 0;
+static bool
+dnsqr_qfilter_match(const dnsqr_qfilter_t *f, const uint8_t *name, size_t len) {
+	size_t off = 0;
+
+	/* try the name, then each of its parent domains up to the root */
+	while (off < len) {
+		if (dnsqr_qfilter_lookup(f, name + off, len - off))
+			return (true);
+		if (name[off] == 0)
+			break;
+		off += name[off] + 1;
 	}
+
+	return (false);
 }
 
-static void
-dnsqr_filter_insert(wdns_name_t **table, uint32_t num_slots, wdns_name_t *name) {
-	unsigned slot, slot_stop;
-	wdns_name_t **ent;
+static dnsqr_qfilter_t *
+dnsqr_qfilter_build(wdns_name_t *names, size_t n_names) {
+	dnsqr_qfilter_t *f;
+	size_t num_slots, len_names;
 
-	slot = my_hashlittle(name->data, name->len, 0) % num_slots;
-	if (slot > 0)
-		slot_stop = slot - 1;
-	else
-		slot_stop = num_slots - 1;
+	f = my_calloc(1, sizeof(*f));
+	f->refcount = 1;
 
-	for (;;) {
-		ent = &table[slot];
+	for (num_slots = 2; num_slots < n_names * 2; num_slots *= 2);
+	f->mask = num_slots - 1;
+	f->slots = my_calloc(num_slots, sizeof(dnsqr_qfilter_slot_t));
 
-		/* empty slot, insert */
-		if (*ent == NULL) {
-			*ent = name;
-			break;
-		}
+	/* offset 0 marks an empty slot */
+	len_names = 1;
+	for (size_t n = 0; n < n_names; n++)
+		len_names += names[n].len + 1;
+	f->names = my_malloc(len_names);
+	len_names = 1;
 
-		/* slot filled */
-		assert(slot != slot_stop);
-		slot += 1;
-		if (slot >= num_slots)
-			slot = 0;
+	for (size_t n = 0; n < n_names; n++) {
+		wdns_name_t *name = &names[n];
+		uint32_t hash, i;
+
+		if (dnsqr_qfilter_lookup(f, name->data, name->len))
+			continue;
+
+		hash = my_hashlittle(name->data, name->len, 0);
+		for (i = hash & f->mask; f->slots[i].off != 0; i = (i + 1) & f->mask);
+		f->slots[i].hash = hash;
+		f->slots[i].off = len_names;
+
+		f->names[len_names] = name->len;
+		memcpy(&f->names[len_names + 1], name->data, name->len);
+		len_names += name->len + 1;
+		f->lens[name->len >> 6] |= (uint64_t) 1 << (name->len & 63);
+	}
+
+	return (f);
+}
+
+static void
+dnsqr_qfilter_release(dnsqr_qfilter_t *f) {
+	if (f != NULL && --f->refcount == 0) {
+		free(f->slots);
+		free(f->names);
+		free(f);
 	}
 }
 
 static void
-dnsqr_filter_init(const char *env_var, wdns_name_t ***table, uint32_t *num_slots) {
-	char *names, *saveptr, *token;
-	uint32_t num_names;
-	unsigned i;
+dnsqr_filter_add_name(const char *s, wdns_name_t **names, size_t *n_names) {
+	wdns_name_t name;
+	wdns_res res;
 
-	if (getenv(env_var) == NULL)
+	res = wdns_str_to_name(s, &name);
+	if (res != wdns_res_success || name.len > 255) {
+		if (nmsg_get_debug() >= 1)
+			fprintf(stderr,
+				"%s: wdns_str_to_name() failed, token='%s' res=%d\n",
+				__func__, s, res);
+		if (res == wdns_res_success)
+			free(name.data);
 		return;
+	}
+	wdns_downcase_name(&name);
 
-	num_names = 1;
+	/* grow the array at each power of two */
+	if ((*n_names & (*n_names - 1)) == 0)
+		*names = my_realloc(*names, (*n_names ? *n_names * 2 : 1) * sizeof(wdns_name_t));
+	(*names)[*n_names] = name;
+	*n_names += 1;
+}
 
-	names = strdup(getenv(env_var));
-	assert(names != NULL);
+static dnsqr_qfilter_t *
+dnsqr_filter_load(dnsqr_filter_src_t *src) {
+	dnsqr_qfilter_t *f;
+	wdns_name_t *names = NULL;
+	size_t n_names = 0;
 
-	for (i = 0; i < strlen(names); i++) {
-		if (names[i] == ':')
-			num_names += 1;
-	}
+	if (getenv(src->env_var) != NULL) {
+		char *list, *saveptr, *token;
 
-	*num_slots = num_names * 2;
+		list = strdup(getenv(src->env_var));
+		assert(list != NULL);
+		for (token = strtok_r(list, ":", &saveptr);
+		     token != NULL;
+		     token = strtok_r(NULL, ":", &saveptr))
+		{
+			dnsqr_filter_add_name(token, &names, &n_names);
+		}
+		free(list);
+	}
 
-	*table = my_calloc(1, sizeof(void *) * *num_slots);
+	if (src->file != NULL) {
+		/* one name per line, blank lines and '#' comments are skipped */
+		struct stat st;
+		char *line = NULL;
+		size_t len_line = 0;
+		FILE *fp;
 
-	token = strtok_r(names, ":", &saveptr);
-	do {
-		wdns_res res;
-		wdns_name_t *name;
-
-		name = my_malloc(sizeof(*name));
-		res = wdns_str_to_name(token, name);
-		if (res == wdns_res_success) {
-			wdns_downcase_name(name);
-			dnsqr_filter_insert(*table, *num_slots, name);
-		} else {
+		fp = fopen(src->file, "r");
+		if (fp == NULL) {
 			if (nmsg_get_debug() >= 1)
-				fprintf(stderr,
-					"%s: wdns_str_to_name() failed, token='%s' res=%d\n",
-					__func__, token, res);
+				fprintf(stderr, "%s: unable to open %s: %s\n",
+					__func__, src->file, strerror(errno));
+			src->mtime = 0;
+			src->size = 0;
+		} else {
+			if (fstat(fileno(fp), &st) == 0) {
+				src->mtime = st.st_mtime;
+				src->size = st.st_size;
+			}
+			while (getline(&line, &len_line, fp) != -1) {
+				char *s = line, *e;
+
+				while (isspace((unsigned char) *s))
+					s++;
+				for (e = s; *e != '\0' && *e != '#' &&
+				     !isspace((unsigned char) *e); e++);
+				*e = '\0';
+				if (*s != '\0')
+					dnsqr_filter_add_name(s, &names, &n_names);
+			}
+			free(line);
+			fclose(fp);
 		}
+	}
 
-	} while ((token = strtok_r(NULL, ":", &saveptr)) != NULL);
+	if (names == NULL && src->file == NULL)
+		return (NULL);
 
+	f = dnsqr_qfilter_build(names, n_names);
+	for (size_t n = 0; n < n_names; n++)
+		free(names[n].data);
 	free(names);
+
+	return (f);
 }
 
 static void
-dnsqr_filter_destroy(wdns_name_t **table, uint32_t num_slots) {
-	unsigned i;
-
-	for (i = 0; i < num_slots; i++) {
-		if (table[i] != NULL) {
-			free(table[i]->data);
-			free(table[i]);
-			table[i] = NULL;
-		}
+dnsqr_filter_init(dnsqr_filter_src_t *src, const char *env_var, const char *env_var_file,
+		  dnsqr_qfilter_t **filter)
+{
+	src->env_var = env_var;
+	if (getenv(env_var_file) != NULL) {
+		src->file = strdup(getenv(env_var_file));
+		assert(src->file != NULL);
 	}
+	*filter = dnsqr_filter_load(src);
+}
+
+static void
+dnsqr_filter_reload(dnsqr_ctx_t *ctx, dnsqr_filter_src_t *src, dnsqr_qfilter_t **filter) {
+	dnsqr_qfilter_t *f;
+	struct stat st;
+
+	if (src->file == NULL || stat(src->file, &st) != 0)
+		return;
+	if (st.st_mtime == src->mtime && st.st_size == src->size)
+		return;
+
+	f = dnsqr_filter_load(src);
+
+	pthread_mutex_lock(&ctx->filter_lock);
+	dnsqr_qfilter_release(*filter);
+	*filter = f;
+	__atomic_store_n(&ctx->filter_gen, ctx->filter_gen + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&ctx->filter_lock);
+
+	if (nmsg_get_debug() >= 1)
+		fprintf(stderr, "%s: reloaded %s\n", __func__, src->file);
+}
+
+static void
+dnsqr_filter_check(dnsqr_ctx_t *ctx) {
+	struct timespec now;
+
+	/* called from the ingest thread, stats the files at most once a second */
+	if (ctx->filter_include_src.file == NULL && ctx->filter_exclude_src.file == NULL)
+		return;
+
+	nmsg_timespec_get(&now);
+	if (now.tv_sec == ctx->filter_check)
+		return;
+	ctx->filter_check = now.tv_sec;
+
+	dnsqr_filter_reload(ctx, &ctx->filter_include_src, &ctx->filter_include);
+	dnsqr_filter_reload(ctx, &ctx->filter_exclude_src, &ctx->filter_exclude);
+}
+
+static void
+dnsqr_filter_sync(dnsqr_ctx_t *ctx, dnsqr_filters_t *filters) {
+	/* pick up the current filters, if they were reloaded since the last call */
+	if (__atomic_load_n(&ctx->filter_gen, __ATOMIC_ACQUIRE) == filters->gen)
+		return;
+
+	pthread_mutex_lock(&ctx->filter_lock);
+	dnsqr_qfilter_release(filters->include);
+	dnsqr_qfilter_release(filters->exclude);
+	filters->include = ctx->filter_include;
+	filters->exclude = ctx->filter_exclude;
+	if (filters->include != NULL)
+		filters->include->refcount += 1;
+	if (filters->exclude != NULL)
+		filters->exclude->refcount += 1;
+	filters->gen = ctx->filter_gen;
+	pthread_mutex_unlock(&ctx->filter_lock);
 }
 
 static nmsg_res
 dnsqr_init(void **clos) {
 	dnsqr_ctx_t *ctx;
-	int64_t qr, rd, max, timeout, zero;
+	int64_t qr, rd, max, timeout, res, zero, threads, jobs;
 
 	ctx = my_calloc(1, sizeof(*ctx));
 	pthread_mutex_init(&ctx->lock, NULL);
 
 	ctx->reasm = reasm_ip_new();
 	assert(ctx->reasm != NULL);
-
-	ISC_LIST_INIT(ctx->list);
+	ctx->reasm_buf = my_malloc(NMSG_IPSZ_MAX);
 
 	if (getenv_int("DNSQR_CAPTURE_QR", &qr) &&
 	    (qr == 0 || qr == 1))
@@ -663,18 +977,53 @@ dnsqr_init(void **clos) {
 	else
 		ctx->query_timeout = DEFAULT_QUERY_TIMEOUT;
 
-	dnsqr_filter_init("DNSQR_FILTER_QNAMES_INCLUDE",
-			  &ctx->filter_qnames_include,
-			  &ctx->filter_qnames_include_slots);
-	dnsqr_filter_init("DNSQR_FILTER_QNAMES_EXCLUDE",
-			  &ctx->filter_qnames_exclude,
-			  &ctx->filter_qnames_exclude_slots);
+	/* resolution of the query timeout timers, in milliseconds */
+	if (getenv_int("DNSQR_TIMER_RESOLUTION", &res) && res > 0)
+		ctx->timer_res = res * 1000000;
+	else
+		ctx->timer_res = DEFAULT_TIMER_RES_MS * 1000000;
+
+	pthread_mutex_init(&ctx->filter_lock, NULL);
+	dnsqr_filter_init(&ctx->filter_include_src,
+			  "DNSQR_FILTER_QNAMES_INCLUDE",
+			  "DNSQR_FILTER_QNAMES_INCLUDE_FILE",
+			  &ctx->filter_include);
+	dnsqr_filter_init(&ctx->filter_exclude_src,
+			  "DNSQR_FILTER_QNAMES_EXCLUDE",
+			  "DNSQR_FILTER_QNAMES_EXCLUDE_FILE",
+			  &ctx->filter_exclude);
+	ctx->filter_gen = 1;
+
+	if (getenv_int("DNSQR_NUM_THREADS", &threads) && threads > 1)
+		ctx->num_threads = threads < MAX_THREADS ? threads : MAX_THREADS;
+	else
+		ctx->num_threads = 0;
+
+	/* depth of each shard's job queue */
+	if (getenv_int("DNSQR_JOB_QUEUE_SIZE", &jobs) && jobs > 0)
+		ctx->job_queue_sz = jobs;
+	else
+		ctx->job_queue_sz = DEFAULT_JOB_QUEUE_SZ;
 
-	ctx->len_table = sizeof(hash_entry_t) * ctx->num_slots;
+	/* each worker thread owns one shard of the state table */
+	ctx->num_shards = ctx->num_threads > 0 ? ctx->num_threads : 1;
+	ctx->shards = my_calloc(ctx->num_shards, sizeof(dnsqr_shard_t));
+	for (unsigned i = 0; i < ctx->num_shards; i++)
+		dnsqr_shard_init(ctx, &ctx->shards[i]);
 
-	ctx->table = mmap(NULL, ctx->len_table,
-			  PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
-	assert(ctx->table != MAP_FAILED);
+	if (ctx->num_threads > 0) {
+		pthread_mutex_init(&ctx->msgs_lock, NULL);
+		pthread_cond_init(&ctx->msgs_cond, NULL);
+		ctx->msgs = my_calloc(MSG_QUEUE_SZ, sizeof(nmsg_message_t));
+
+		for (unsigned i = 0; i < ctx->num_shards; i++) {
+			int rc;
+
+			rc = pthread_create(&ctx->shards[i].thr, NULL,
+					    dnsqr_shard_thr, &ctx->shards[i]);
+			assert(rc == 0);
+		}
+	}
 
 	*clos = ctx;
 	return (nmsg_res_success);
@@ -682,25 +1031,56 @@ dnsqr_init(void **clos) {
 
 static nmsg_res
 dnsqr_fini(void **clos) {
-	size_t n;
 	dnsqr_ctx_t *ctx;
 
 	ctx = (dnsqr_ctx_t *) *clos;
 
-	for (n = 0; n < ctx->num_slots; n++) {
-		hash_entry_t *he = &ctx->table[n];
-		if (he->dnsqr != NULL)
-			nmsg__base__dns_qr__free_unpacked(he->dnsqr, NULL);
-	}
+	if (ctx->num_threads > 0) {
+		/* workers that are still emitting now discard their messages */
+		pthread_mutex_lock(&ctx->msgs_lock);
+		ctx->discard = true;
+		pthread_cond_broadcast(&ctx->msgs_cond);
+		pthread_mutex_unlock(&ctx->msgs_lock);
+
+		/* stop and join the worker threads */
+		for (unsigned i = 0; i < ctx->num_shards; i++) {
+			dnsqr_shard_t *shard = &ctx->shards[i];
+
+			pthread_mutex_lock(&shard->lock);
+			shard->stop_req = true;
+			pthread_cond_signal(&shard->cond);
+			pthread_mutex_unlock(&shard->lock);
+		}
+		for (unsigned i = 0; i < ctx->num_shards; i++)
+			pthread_join(ctx->shards[i].thr, NULL);
 
-	dnsqr_filter_destroy(ctx->filter_qnames_include, ctx->filter_qnames_include_slots);
-	dnsqr_filter_destroy(ctx->filter_qnames_exclude, ctx->filter_qnames_exclude_slots);
+		while (ctx->msgs_count > 0) {
+			nmsg_message_destroy(&ctx->msgs[ctx->msgs_head]);
+			ctx->msgs_head = (ctx->msgs_head + 1) % MSG_QUEUE_SZ;
+			ctx->msgs_count -= 1;
+		}
+		if (ctx->pending.dnsqr != NULL)
+			dnsqr_free(ctx->pending.dnsqr);
+		free(ctx->msgs);
+		pthread_cond_destroy(&ctx->msgs_cond);
+		pthread_mutex_destroy(&ctx->msgs_lock);
+	}
 
 	dnsqr_print_stats(ctx);
 
+	for (unsigned i = 0; i < ctx->num_shards; i++)
+		dnsqr_shard_destroy(&ctx->shards[i]);
+	free(ctx->shards);
+
+	dnsqr_qfilter_release(ctx->filter_include);
+	dnsqr_qfilter_release(ctx->filter_exclude);
+	free(ctx->filter_include_src.file);
+	free(ctx->filter_exclude_src.file);
+	pthread_mutex_destroy(&ctx->filter_lock);
+
 	reasm_ip_free(ctx->reasm);
+	free(ctx->reasm_buf);
 
-	munmap(ctx->table, ctx->len_table);
 	free(ctx);
 	*clos = NULL;
 
@@ -1280,59 +1660,46 @@ dnsqr_get_response(nmsg_message_t msg,
 	return (nmsg_res_success);
 }
 
-static bool
-dnsqr_eq6(Nmsg__Base__DnsQR *d1, Nmsg__Base__DnsQR *d2) {
-	if (d1->id == d2->id &&
-	    d1->query_port == d2->query_port &&
-	    d1->response_port == d2->response_port &&
-	    d1->proto == d2->proto &&
-	    d1->query_ip.len == d2->query_ip.len &&
-	    d1->response_ip.len == d2->response_ip.len)
-	{
-		if (memcmp(d1->query_ip.data, d2->query_ip.data, d1->query_ip.len) == 0 &&
-		    memcmp(d1->response_ip.data, d2->response_ip.data, d1->response_ip.len) == 0)
-		{
-			return (true);
-		}
-	}
-
-	return (false);
+static void
+dnsqr_tuple(Nmsg__Base__DnsQR *dnsqr, dnsqr_tuple_t *tuple) {
+	assert(dnsqr->query_ip.len == 4 || dnsqr->query_ip.len == 16);
+	assert(dnsqr->response_ip.len == dnsqr->query_ip.len);
+
+	memset(tuple, 0, sizeof(*tuple));
+	tuple->query_port = dnsqr->query_port;
+	tuple->response_port = dnsqr->response_port;
+	tuple->id = dnsqr->id;
+	tuple->proto = dnsqr->proto;
+	tuple->ip_len = dnsqr->query_ip.len;
+	memcpy(tuple->query_ip, dnsqr->query_ip.data, dnsqr->query_ip.len);
+	memcpy(tuple->response_ip, dnsqr->response_ip.data, dnsqr->response_ip.len);
 }
 
 static bool
-dnsqr_eq9(Nmsg__Base__DnsQR *d1, Nmsg__Base__DnsQR *d2) {
-	if (d1->id == d2->id &&
-	    d1->query_port == d2->query_port &&
-	    d1->response_port == d2->response_port &&
-	    d1->qname.len == d2->qname.len &&
-	    d1->qtype == d2->qtype &&
-	    d1->qclass == d2->qclass &&
-	    d1->proto == d2->proto &&
-	    d1->query_ip.len == d2->query_ip.len &&
-	    d1->response_ip.len == d2->response_ip.len)
-	{
-		if (memcmp(d1->query_ip.data, d2->query_ip.data, d1->query_ip.len) == 0 &&
-		    memcmp(d1->response_ip.data, d2->response_ip.data, d1->response_ip.len) == 0 &&
-		    memcmp(d1->qname.data, d2->qname.data, d1->qname.len) == 0)
-		{
-			return (true);
-		}
-	}
-
-	return (false);
+dnsqr_eq_question(Nmsg__Base__DnsQR *d1, Nmsg__Base__DnsQR *d2) {
+	return (d1->qname.len == d2->qname.len &&
+		d1->qtype == d2->qtype &&
+		d1->qclass == d2->qclass &&
+		memcmp(d1->qname.data, d2->qname.data, d1->qname.len) == 0);
 }
 
 static bool
-dnsqr_eq(Nmsg__Base__DnsQR *d1, Nmsg__Base__DnsQR *d2, uint16_t rcode) {
-	if (d1->qname.data != NULL && d2->qname.data != NULL) {
-		return (dnsqr_eq9(d1, d2));
+dnsqr_eq(hash_entry_t *he, uint32_t hash, const dnsqr_tuple_t *tuple,
+	 Nmsg__Base__DnsQR *dnsqr, uint16_t rcode)
+{
+	/* the 6-tuple is compared without touching the stored query */
+	if (he->hash != hash || memcmp(&he->tuple, tuple, sizeof(*tuple)) != 0)
+		return (false);
+
+	if (he->dnsqr->qname.data != NULL && dnsqr->qname.data != NULL) {
+		return (dnsqr_eq_question(he->dnsqr, dnsqr));
 	} else {
 		switch (rcode) {
 		case WDNS_R_FORMERR:
 		case WDNS_R_SERVFAIL:
 		case WDNS_R_NOTIMP:
 		case WDNS_R_REFUSED:
-			return (dnsqr_eq6(d1, d2));
+			return (true);
 		}
 	}
 	return (false);
@@ -1375,86 +1742,218 @@ dnsqr_hash(Nmsg__Base__DnsQR *dnsqr) {
 	return (hash);
 }
 
+static dnsqr_shard_t *
+dnsqr_shard_for(dnsqr_ctx_t *ctx, uint32_t hash) {
+	/* use the high bits of the hash, the state table slot uses the low bits */
+	return (&ctx->shards[((uint64_t) hash * ctx->num_shards) >> 32]);
+}
+
 static void
-dnsqr_insert_query(dnsqr_ctx_t *ctx, Nmsg__Base__DnsQR *dnsqr) {
-	list_entry_t *le;
-	uint32_t hash;
+dnsqr_shard_init(dnsqr_ctx_t *ctx, dnsqr_shard_t *shard) {
+	shard->ctx = ctx;
+
+	shard->num_slots = ctx->num_slots / ctx->num_shards;
+	shard->max_values = ctx->max_values / ctx->num_shards;
+	if (shard->num_slots < 2)
+		shard->num_slots = 2;
+	if (shard->max_values < 1)
+		shard->max_values = 1;
+	shard->len_table = sizeof(hash_entry_t) * shard->num_slots;
+
+	shard->table = mmap(NULL, shard->len_table,
+			    PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+	assert(shard->table != MAP_FAILED);
+
+	/* every wheel bucket starts out as an empty list */
+	for (unsigned i = 0; i < WHEEL_LEVELS * WHEEL_SIZE; i++) {
+		shard->wheel[i].prev = shard->num_slots + i;
+		shard->wheel[i].next = shard->num_slots + i;
+	}
+	shard->expired = my_calloc(shard->num_slots, sizeof(Nmsg__Base__DnsQR *));
+
+	if (ctx->num_threads > 0) {
+		pthread_mutex_init(&shard->lock, NULL);
+		pthread_cond_init(&shard->cond, NULL);
+		shard->jobs = my_calloc(ctx->job_queue_sz, sizeof(dnsqr_job_t));
+	}
+}
+
+static void
+dnsqr_shard_destroy(dnsqr_shard_t *shard) {
+	dnsqr_qfilter_release(shard->filters.include);
+	dnsqr_qfilter_release(shard->filters.exclude);
+
+	for (size_t n = 0; n < shard->num_slots; n++) {
+		hash_entry_t *he = &shard->table[n];
+		if (he->dnsqr != NULL)
+			dnsqr_free(he->dnsqr);
+	}
+	munmap(shard->table, shard->len_table);
+
+	while (shard->expired_count > 0) {
+		dnsqr_free(shard->expired[shard->expired_head]);
+		shard->expired_head = (shard->expired_head + 1) % shard->num_slots;
+		shard->expired_count -= 1;
+	}
+	free(shard->expired);
+
+	if (shard->ctx->num_threads > 0) {
+		while (shard->jobs_count > 0) {
+			dnsqr_job_t *job = &shard->jobs[shard->jobs_head];
+
+			if (job->dnsqr != NULL)
+				dnsqr_free(job->dnsqr);
+			shard->jobs_head = (shard->jobs_head + 1) % shard->ctx->job_queue_sz;
+			shard->jobs_count -= 1;
+		}
+		free(shard->jobs);
+		pthread_cond_destroy(&shard->cond);
+		pthread_mutex_destroy(&shard->lock);
+	}
+}
+
+static dnsqr_link_t *
+dnsqr_link(dnsqr_shard_t *shard, uint32_t id) {
+	if (id < shard->num_slots)
+		return (&shard->table[id].link);
+	return (&shard->wheel[id - shard->num_slots]);
+}
+
+static void
+dnsqr_link_append(dnsqr_shard_t *shard, uint32_t head, uint32_t id) {
+	dnsqr_link_t *h = dnsqr_link(shard, head);
+	dnsqr_link_t *l = dnsqr_link(shard, id);
+
+	l->prev = h->prev;
+	l->next = head;
+	dnsqr_link(shard, h->prev)->next = id;
+	h->prev = id;
+}
+
+static void
+dnsqr_link_unlink(dnsqr_shard_t *shard, uint32_t id) {
+	dnsqr_link_t *l = dnsqr_link(shard, id);
+
+	dnsqr_link(shard, l->prev)->next = l->next;
+	dnsqr_link(shard, l->next)->prev = l->prev;
+}
+
+static unsigned
+dnsqr_ffs64(uint64_t map) {
+	/* index of the lowest set bit, 'map' must not be zero */
+	return (__builtin_ctzll(map));
+}
+
+static uint64_t
+dnsqr_timer_tick(dnsqr_shard_t *shard, int64_t sec, int64_t nsec) {
+	return ((uint64_t) (sec * 1000000000 + nsec) / shard->ctx->timer_res);
+}
+
+static void
+dnsqr_wheel_add(dnsqr_shard_t *shard, uint32_t slot) {
+	uint32_t now = (uint32_t) shard->wheel_tick;
+	uint32_t expire = shard->table[slot].expire;
+	int32_t delta = (int32_t) (expire - now);
+	unsigned level, idx;
+
+	/* overdue timers fire at the next tick, far ones are capped */
+	if (delta < 0) {
+		expire = now;
+		delta = 0;
+	} else if ((uint32_t) delta >= WHEEL_SPAN) {
+		expire = now + WHEEL_SPAN - 1;
+		delta = WHEEL_SPAN - 1;
+	}
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if ((uint32_t) delta < (1U << (WHEEL_BITS * (level + 1))))
+			break;
+	}
+	idx = (expire >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+	dnsqr_link_append(shard, shard->num_slots + level * WHEEL_SIZE + idx, slot);
+	shard->wheel_map[level] |= (uint64_t) 1 << idx;
+}
+
+static void
+dnsqr_insert_query(dnsqr_shard_t *shard, Nmsg__Base__DnsQR *dnsqr, uint32_t hash) {
 	unsigned slot, slot_stop;
 
-	hash = dnsqr_hash(dnsqr);
-	slot = hash % ctx->num_slots;
+	slot = hash % shard->num_slots;
 
 	if (slot > 0)
 		slot_stop = slot - 1;
 	else
-		slot_stop = ctx->num_slots - 1;
+		slot_stop = shard->num_slots - 1;
 
-	/* lock hash table */
-	pthread_mutex_lock(&ctx->lock);
+	if (!shard->wheel_running) {
+		shard->wheel_tick = dnsqr_timer_tick(shard, shard->now.tv_sec, shard->now.tv_nsec);
+		shard->wheel_running = true;
+	}
 
 	for (;;) {
-		hash_entry_t *he = &ctx->table[slot];
+		hash_entry_t *he = &shard->table[slot];
 
 		/* empty slot, insert entry */
 		if (he->dnsqr == NULL) {
-			ctx->count += 1;
-			he->dnsqr = dnsqr;
+			uint64_t expire;
 
-			le = my_calloc(1, sizeof(*le));
-			le->he = he;
-			he->le = le;
-			ISC_LINK_INIT(le, link);
-			ISC_LIST_APPEND(ctx->list, le, link);
+			shard->count += 1;
+			he->dnsqr = dnsqr;
+			he->hash = hash;
+			dnsqr_tuple(dnsqr, &he->tuple);
+
+			/* round up, so that queries never time out early */
+			expire = dnsqr->query_time_sec[0] * 1000000000 + dnsqr->query_time_nsec[0];
+			expire += (uint64_t) shard->ctx->query_timeout * 1000000000;
+			he->expire = (expire + shard->ctx->timer_res - 1) / shard->ctx->timer_res;
+			dnsqr_wheel_add(shard, slot);
 			break;
 		}
 
 		/* slot filled */
 		assert(slot != slot_stop);
 		slot += 1;
-		if (slot >= ctx->num_slots)
+		if (slot >= shard->num_slots)
 			slot = 0;
 	}
-
-	/* unlock hash table */
-	pthread_mutex_unlock(&ctx->lock);
 }
 
 static void
-dnsqr_remove(dnsqr_ctx_t *ctx, hash_entry_t *he) {
+dnsqr_remove(dnsqr_shard_t *shard, hash_entry_t *he) {
 	unsigned slot;
 	unsigned i, j, k;
 
-	i = j = slot = (he - ctx->table);
+	i = j = slot = (he - shard->table);
 
 	assert(he->dnsqr != NULL);
 	he->dnsqr = NULL;
-	ctx->count -= 1;
-	ISC_LIST_UNLINK(ctx->list, he->le, link);
-	free(he->le);
-	he->le = NULL;
+	shard->count -= 1;
+	dnsqr_link_unlink(shard, slot);
 
 	for (;;) {
 		/* j is the current slot of the next value */
-		j = (j + 1) % ctx->num_slots;
-		if (ctx->table[j].dnsqr == NULL) {
+		j = (j + 1) % shard->num_slots;
+		if (shard->table[j].dnsqr == NULL) {
 			/* slot is unoccupied */
 			break;
 		}
 
 		/* k is the natural slot of the value at slot j */
-		k = dnsqr_hash(ctx->table[j].dnsqr) % ctx->num_slots;
+		k = shard->table[j].hash % shard->num_slots;
 		if ((j > i && (k <= i || k > j)) ||
 		    (j < i && (k <= i && k > j)))
 		{
 			/* this value needs to be moved up,
 			 * as k is cyclically between i and j */
-			memcpy(&ctx->table[i], &ctx->table[j], sizeof(hash_entry_t));
+			memcpy(&shard->table[i], &shard->table[j], sizeof(hash_entry_t));
 
 			/* delete the value at the old slot */
-			memset(&ctx->table[j], 0, sizeof(hash_entry_t));
+			shard->table[j].dnsqr = NULL;
 
-			/* fix up the list pointer */
-			ctx->table[i].le->he = &ctx->table[i];
+			/* point the timer list neighbours at the new slot */
+			dnsqr_link(shard, shard->table[i].link.prev)->next = i;
+			dnsqr_link(shard, shard->table[i].link.next)->prev = i;
 
 			/* check the next slot */
 			i = j;
@@ -1462,103 +1961,216 @@ dnsqr_remove(dnsqr_ctx_t *ctx, hash_entry_t *he) {
 	}
 }
 
-static Nmsg__Base__DnsQR *
-dnsqr_trim(dnsqr_ctx_t *ctx) {
-	Nmsg__Base__DnsQR *dnsqr = NULL;
-	list_entry_t *le;
-	hash_entry_t *he;
+static void
+dnsqr_expire(dnsqr_shard_t *shard, uint32_t slot) {
+	Nmsg__Base__DnsQR *dnsqr = shard->table[slot].dnsqr;
 	struct timespec timeout;
 
-	/* lock hash table */
-	pthread_mutex_lock(&ctx->lock);
+	assert(dnsqr != NULL);
+	assert(dnsqr->n_query_time_sec > 0);
+	assert(dnsqr->n_query_time_nsec > 0);
 
-	le = ISC_LIST_HEAD(ctx->list);
-
-	if (le != NULL) {
-		assert(le->he != NULL);
-		he = le->he;
-		assert(he->dnsqr != NULL);
-		assert(he->dnsqr->n_query_time_sec > 0);
-		assert(he->dnsqr->n_query_time_nsec > 0);
-		if (ctx->count > ctx->max_values ||
-		    ctx->stop == true ||
-		    ctx->now.tv_sec - he->dnsqr->query_time_sec[0] > ctx->query_timeout)
-		{
-			dnsqr = he->dnsqr;
-			dnsqr_remove(ctx, he);
-
-			timeout.tv_sec = ctx->now.tv_sec - dnsqr->query_time_sec[0];
-			timeout.tv_nsec = ctx->now.tv_nsec - dnsqr->query_time_nsec[0];
-			if (timeout.tv_nsec < 0) {
-				timeout.tv_sec -= 1;
-				timeout.tv_nsec += 1000000000;
-			}
-			dnsqr->timeout = timeout.tv_sec + (((double) timeout.tv_nsec) / 1E9);
-			dnsqr->has_timeout = true;
+	dnsqr_remove(shard, &shard->table[slot]);
 
-#ifdef DEBUG
-			ctx->count_unanswered_query += 1;
-#endif
-		}
+	timeout.tv_sec = shard->now.tv_sec - dnsqr->query_time_sec[0];
+	timeout.tv_nsec = shard->now.tv_nsec - dnsqr->query_time_nsec[0];
+	if (timeout.tv_nsec < 0) {
+		timeout.tv_sec -= 1;
+		timeout.tv_nsec += 1000000000;
 	}
+	dnsqr->timeout = timeout.tv_sec + (((double) timeout.tv_nsec) / 1E9);
+	dnsqr->has_timeout = true;
 
-	/* unlock hash table */
-	pthread_mutex_unlock(&ctx->lock);
+	assert(shard->expired_count < shard->num_slots);
+	shard->expired[(shard->expired_head + shard->expired_count) % shard->num_slots] = dnsqr;
+	shard->expired_count += 1;
 
-	return (dnsqr);
+#ifdef DEBUG
+	shard->count_unanswered_query += 1;
+#endif
 }
 
-static Nmsg__Base__DnsQR *
-dnsqr_retrieve(dnsqr_ctx_t *ctx, Nmsg__Base__DnsQR *dnsqr, uint16_t rcode) {
-	Nmsg__Base__DnsQR *query = NULL;
-	uint32_t hash;
-	unsigned slot, slot_stop;
+static void
+dnsqr_wheel_expire(dnsqr_shard_t *shard, unsigned level, unsigned idx) {
+	uint32_t head = shard->num_slots + level * WHEEL_SIZE + idx;
+	dnsqr_link_t *h = dnsqr_link(shard, head);
+
+	/* dnsqr_expire() unlinks the entry, and may move its neighbours */
+	while (h->next != head)
+		dnsqr_expire(shard, h->next);
+	shard->wheel_map[level] &= ~((uint64_t) 1 << idx);
+}
 
-	hash = dnsqr_hash(dnsqr);
-	slot = hash % ctx->num_slots;
+static void
+dnsqr_wheel_cascade(dnsqr_shard_t *shard, unsigned level, unsigned idx) {
+	uint32_t head = shard->num_slots + level * WHEEL_SIZE + idx;
+	dnsqr_link_t *h = dnsqr_link(shard, head);
+	uint32_t slot, next;
 
-	if (slot > 0)
+	if ((shard->wheel_map[level] & ((uint64_t) 1 << idx)) == 0)
+		return;
+	shard->wheel_map[level] &= ~((uint64_t) 1 << idx);
+
+	/* detach the bucket, then redistribute its entries to lower levels */
+	slot = h->next;
+	dnsqr_link(shard, h->prev)->next = SLOT_DETACHED;
+	h->next = h->prev = head;
+
+	for (; slot != SLOT_DETACHED; slot = next) {
+		next = shard->table[slot].link.next;
+		dnsqr_wheel_add(shard, slot);
+	}
+}
+
+static void
+dnsqr_wheel_advance(dnsqr_shard_t *shard) {
+	uint64_t target, tick, next, rest;
+	unsigned idx;
+
+	if (!shard->wheel_running)
+		return;
+
+	if (shard->stop) {
+		/* expire every remaining query */
+		for (unsigned level = 0; level < WHEEL_LEVELS; level++)
+			for (idx = 0; idx < WHEEL_SIZE; idx++)
+				dnsqr_wheel_expire(shard, level, idx);
+		return;
+	}
+
+	target = dnsqr_timer_tick(shard, shard->now.tv_sec, shard->now.tv_nsec);
+	if (target >= shard->wheel_tick + WHEEL_SPAN) {
+		/* the clock jumped beyond the span of the wheel */
+		for (unsigned level = 0; level < WHEEL_LEVELS; level++)
+			for (idx = 0; idx < WHEEL_SIZE; idx++)
+				dnsqr_wheel_expire(shard, level, idx);
+		shard->wheel_tick = target + 1;
+		return;
+	}
+
+	while (shard->wheel_tick <= target) {
+		tick = shard->wheel_tick;
+		idx = tick & WHEEL_MASK;
+
+		/* at each wrap of a level, cascade the next bucket of the level above */
+		if (idx == 0) {
+			for (unsigned level = 1; level < WHEEL_LEVELS; level++) {
+				unsigned lidx = (tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+				dnsqr_wheel_cascade(shard, level, lidx);
+				if (lidx != 0)
+					break;
+			}
+		}
+
+		if (shard->wheel_map[0] & ((uint64_t) 1 << idx))
+			dnsqr_wheel_expire(shard, 0, idx);
+
+		/* skip over empty level 0 buckets, up to the next wrap */
+		rest = (idx == WHEEL_MASK) ? 0 : shard->wheel_map[0] >> (idx + 1);
+		if (rest == 0)
+			next = (tick | WHEEL_MASK) + 1;
+		else
+			next = tick + 1 + dnsqr_ffs64(rest);
+		shard->wheel_tick = (next <= target) ? next : target + 1;
+	}
+}
+
+static bool
+dnsqr_wheel_evict(dnsqr_shard_t *shard) {
+	for (unsigned level = 0; level < WHEEL_LEVELS; level++) {
+		unsigned start = (shard->wheel_tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+		/* the current bucket of the upper levels holds their latest timers */
+		if (level > 0)
+			start = (start + 1) & WHEEL_MASK;
+
+		while (shard->wheel_map[level] != 0) {
+			uint64_t map = shard->wheel_map[level];
+			uint32_t head;
+			unsigned idx;
+
+			if (start != 0)
+				map = (map >> start) | (map << (WHEEL_SIZE - start));
+			idx = (start + dnsqr_ffs64(map)) & WHEEL_MASK;
+			head = shard->num_slots + level * WHEEL_SIZE + idx;
+
+			if (dnsqr_link(shard, head)->next != head) {
+				dnsqr_expire(shard, dnsqr_link(shard, head)->next);
+				return (true);
+			}
+			shard->wheel_map[level] &= ~((uint64_t) 1 << idx);
+		}
+	}
+	return (false);
+}
+
+static Nmsg__Base__DnsQR *
+dnsqr_trim(dnsqr_shard_t *shard) {
+	Nmsg__Base__DnsQR *dnsqr;
+
+	if (shard->expired_count == 0) {
+		dnsqr_wheel_advance(shard);
+
+		/* evict the queries closest to timing out, if over the limit */
+		while (shard->count > shard->max_values) {
+			if (!dnsqr_wheel_evict(shard))
+				break;
+		}
+
+		if (shard->expired_count == 0)
+			return (NULL);
+	}
+
+	dnsqr = shard->expired[shard->expired_head];
+	shard->expired_head = (shard->expired_head + 1) % shard->num_slots;
+	shard->expired_count -= 1;
+
+	return (dnsqr);
+}
+
+static Nmsg__Base__DnsQR *
+dnsqr_retrieve(dnsqr_shard_t *shard, Nmsg__Base__DnsQR *dnsqr, uint32_t hash,
+	       uint16_t rcode)
+{
+	dnsqr_tuple_t tuple;
+	unsigned slot, slot_stop;
+
+	dnsqr_tuple(dnsqr, &tuple);
+
+	slot = hash % shard->num_slots;
+
+	if (slot > 0)
 		slot_stop = slot - 1;
 	else
-		slot_stop = ctx->num_slots - 1;
-
-	/* lock hash table */
-	pthread_mutex_lock(&ctx->lock);
+		slot_stop = shard->num_slots - 1;
 
 	for (;;) {
-		hash_entry_t *he = &ctx->table[slot];
+		hash_entry_t *he = &shard->table[slot];
 
 		/* empty slot, return failure */
-		if (he->dnsqr == NULL) {
-			query = NULL;
-			goto out;
-		}
+		if (he->dnsqr == NULL)
+			return (NULL);
 
 		/* slot filled, compare */
-		if (dnsqr_eq(dnsqr, he->dnsqr, rcode) == true) {
-			query = he->dnsqr;
-			dnsqr_remove(ctx, he);
-			goto out;
+		if (dnsqr_eq(he, hash, &tuple, dnsqr, rcode) == true) {
+			Nmsg__Base__DnsQR *query = he->dnsqr;
+			dnsqr_remove(shard, he);
+			return (query);
 		}
 
 		/* slot filled, but not our slot */
 		assert(slot != slot_stop);
 		slot += 1;
-		if (slot >= ctx->num_slots)
+		if (slot >= shard->num_slots)
 			slot = 0;
 	}
-
-out:
-	/* unlock hash table */
-	pthread_mutex_unlock(&ctx->lock);
-
-	return (query);
 }
 
 static nmsg_message_t
 dnsqr_to_message(dnsqr_ctx_t *ctx, Nmsg__Base__DnsQR *dnsqr) {
-	ProtobufCBufferSimple sbuf;
 	nmsg_message_t m;
+	uint8_t *buf;
 	size_t buf_sz;
 	struct timespec ts;
 
@@ -1570,20 +2182,14 @@ dnsqr_to_message(dnsqr_ctx_t *ctx, Nmsg__Base__DnsQR *dnsqr) {
 	if (ctx->zero_resolver_address)
 		dnsqr_zero_resolver_address(dnsqr);
 
-	sbuf.base.append = protobuf_c_buffer_simple_append;
-	sbuf.len = 0;
-	sbuf.data = my_malloc(1024);
-	sbuf.must_free_data = 1;
-	sbuf.alloced = 1024;
-
-	buf_sz = protobuf_c_message_pack_to_buffer((ProtobufCMessage *) dnsqr,
-						   (ProtobufCBuffer *) &sbuf);
-	if (sbuf.data == NULL)
-		return (NULL);
+	/* serialize straight into an exactly sized buffer */
+	buf_sz = protobuf_c_message_get_packed_size((ProtobufCMessage *) dnsqr);
+	buf = my_malloc(buf_sz);
+	protobuf_c_message_pack((ProtobufCMessage *) dnsqr, buf);
 
 	m = nmsg_message_from_raw_payload(NMSG_VENDOR_BASE_ID,
 					  NMSG_VENDOR_BASE_DNSQR_ID,
-					  sbuf.data, buf_sz, NULL);
+					  buf, buf_sz, NULL);
 	assert(m != NULL);
 
 	if (dnsqr->n_query_time_sec > 0) {
@@ -1894,6 +2500,10 @@ dnsqr_merge(Nmsg__Base__DnsQR *d1, Nmsg__Base__DnsQR *d2) {
 	d1->query_time_sec = NULL;
 	d1->query_time_nsec = NULL;
 
+	/* the query packets live in the query slab, which moves along */
+	((dnsqr_rec_t *) d2)->query_slab = ((dnsqr_rec_t *) d1)->query_slab;
+	memset(&((dnsqr_rec_t *) d1)->query_slab, 0, sizeof(dnsqr_slab_t));
+
 	if (d2->has_qname == false && d1->has_qname == true) {
 		memcpy(&d2->qname, &d1->qname, sizeof(ProtobufCBinaryData));
 		memset(&d1->qname, 0, sizeof(ProtobufCBinaryData));
@@ -1908,7 +2518,7 @@ dnsqr_merge(Nmsg__Base__DnsQR *d1, Nmsg__Base__DnsQR *d2) {
 		d2->has_qclass = true;
 	}
 
-	nmsg__base__dns_qr__free_unpacked(d1, NULL);
+	dnsqr_free(d1);
 }
 
 #define extend_field_array(x, n) do { \
@@ -1916,6 +2526,60 @@ dnsqr_merge(Nmsg__Base__DnsQR *d1, Nmsg__Base__DnsQR *d2) {
 	assert((x) != NULL); \
 } while (0)
 
+static Nmsg__Base__DnsQR *
+dnsqr_new(void) {
+	dnsqr_rec_t *rec;
+
+	rec = my_calloc(1, sizeof(*rec));
+	nmsg__base__dns_qr__init(&rec->dnsqr);
+
+	return (&rec->dnsqr);
+}
+
+static void
+dnsqr_free(Nmsg__Base__DnsQR *dnsqr) {
+	dnsqr_rec_t *rec = (dnsqr_rec_t *) dnsqr;
+
+	/* the packet data belongs to the slabs, not to the protobuf */
+	for (size_t i = 0; i < dnsqr->n_query_packet; i++)
+		dnsqr->query_packet[i].data = NULL;
+	for (size_t i = 0; i < dnsqr->n_response_packet; i++)
+		dnsqr->response_packet[i].data = NULL;
+	free(rec->query_slab.data);
+	free(rec->response_slab.data);
+
+	nmsg__base__dns_qr__free_unpacked(dnsqr, NULL);
+}
+
+static uint8_t *
+dnsqr_slab_append(dnsqr_slab_t *slab, ProtobufCBinaryData *pkts, size_t n_pkts,
+		  const uint8_t *pkt, size_t pkt_len)
+{
+	uint8_t *pkt_copy;
+
+	if (slab->len + pkt_len > slab->size) {
+		size_t off = 0;
+
+		/* the first packet gets an exactly sized slab */
+		slab->size = slab->size * 2;
+		if (slab->size < slab->len + pkt_len)
+			slab->size = slab->len + pkt_len;
+		slab->data = my_realloc(slab->data, slab->size);
+
+		for (size_t i = 0; i < n_pkts; i++) {
+			pkts[i].data = slab->data + off;
+			off += pkts[i].len;
+		}
+		assert(off == slab->len);
+	}
+
+	pkt_copy = slab->data + slab->len;
+	memcpy(pkt_copy, pkt, pkt_len);
+	slab->len += pkt_len;
+
+	return (pkt_copy);
+}
+
 static nmsg_res
 dnsqr_append_query_packet(Nmsg__Base__DnsQR *dnsqr,
 			  const uint8_t *pkt, size_t pkt_len,
@@ -1931,8 +2595,8 @@ dnsqr_append_query_packet(Nmsg__Base__DnsQR *dnsqr,
 	extend_field_array(dnsqr->query_time_sec, n);
 	extend_field_array(dnsqr->query_time_nsec, n);
 
-	pkt_copy = my_malloc(pkt_len);
-	memcpy(pkt_copy, pkt, pkt_len);
+	pkt_copy = dnsqr_slab_append(&((dnsqr_rec_t *) dnsqr)->query_slab,
+				     dnsqr->query_packet, idx, pkt, pkt_len);
 
 	dnsqr->n_query_packet += 1;
 	dnsqr->n_query_time_sec += 1;
@@ -1961,8 +2625,8 @@ dnsqr_append_response_packet(Nmsg__Base__DnsQR *dnsqr,
 	extend_field_array(dnsqr->response_time_sec, n);
 	extend_field_array(dnsqr->response_time_nsec, n);
 
-	pkt_copy = my_malloc(pkt_len);
-	memcpy(pkt_copy, pkt, pkt_len);
+	pkt_copy = dnsqr_slab_append(&((dnsqr_rec_t *) dnsqr)->response_slab,
+				     dnsqr->response_packet, idx, pkt, pkt_len);
 
 	dnsqr->n_response_packet += 1;
 	dnsqr->n_response_time_sec += 1;
@@ -1996,15 +2660,22 @@ dnsqr_append_frag(dnsqr_append_fp func,
 static void
 dnsqr_print_stats(dnsqr_ctx_t *ctx) {
 #ifdef DEBUG
+	uint32_t count = 0, qr = 0, uq = 0, ur = 0;
+
+	/* with worker threads, these are only approximate */
+	for (unsigned i = 0; i < ctx->num_shards; i++) {
+		dnsqr_shard_t *shard = &ctx->shards[i];
+
+		count += shard->count;
+		qr += shard->count_query_response;
+		uq += shard->count_unanswered_query;
+		ur += shard->count_unsolicited_response;
+		shard->count_query_response = 0;
+		shard->count_unanswered_query = 0;
+		shard->count_unsolicited_response = 0;
+	}
 	fprintf(stderr, "%s: c= %u qr= %u uq= %u ur= %u p= %u\n", __func__,
-		ctx->count,
-		ctx->count_query_response,
-		ctx->count_unanswered_query,
-		ctx->count_unsolicited_response,
-		ctx->count_packet);
-	ctx->count_query_response = 0;
-	ctx->count_unanswered_query = 0;
-	ctx->count_unsolicited_response = 0;
+		count, qr, uq, ur, ctx->count_packet);
 #endif
 }
 
@@ -2029,64 +2700,244 @@ do_filter_rd(dnsqr_ctx_t *ctx, uint16_t flags) {
 }
 
 static bool
-do_filter_query_name(dnsqr_ctx_t *ctx, Nmsg__Base__DnsQR *dnsqr) {
+do_filter_query_name(dnsqr_filters_t *filters, Nmsg__Base__DnsQR *dnsqr) {
 	wdns_name_t name;
-	wdns_res res;
+	uint8_t buf[255];
 
 	if (dnsqr->has_qname == false)
 		return (false);
 
-	if (ctx->filter_qnames_include != NULL) {
-		name.len = dnsqr->qname.len;
-		name.data = alloca(name.len);
-		assert(name.data != NULL);
-		memcpy(name.data, dnsqr->qname.data, name.len);
-		wdns_downcase_name(&name);
-
-		for (;;) {
-			if (dnsqr_filter_lookup(ctx->filter_qnames_include,
-						ctx->filter_qnames_include_slots,
-						&name))
-			{
-				return (false);
-			}
-			if (name.len == 1)
-				break;
-			res = wdns_left_chop(&name, &name);
-			if (res != wdns_res_success)
-				break;
-		}
+	if (filters->include == NULL && filters->exclude == NULL)
+		return (false);
+
+	if (dnsqr->qname.len > sizeof(buf))
+		return (false);
+	name.len = dnsqr->qname.len;
+	name.data = buf;
+	memcpy(name.data, dnsqr->qname.data, name.len);
+	wdns_downcase_name(&name);
+
+	if (filters->include != NULL &&
+	    dnsqr_qfilter_match(filters->include, name.data, name.len))
+	{
+		return (false);
 	}
 
-	if (ctx->filter_qnames_exclude != NULL) {
-		name.len = dnsqr->qname.len;
-		name.data = alloca(name.len);
-		assert(name.data != NULL);
-		memcpy(name.data, dnsqr->qname.data, name.len);
-		wdns_downcase_name(&name);
+	if (filters->exclude != NULL &&
+	    dnsqr_qfilter_match(filters->exclude, name.data, name.len))
+	{
+		return (true);
+	}
 
-		for (;;) {
-			if (dnsqr_filter_lookup(ctx->filter_qnames_exclude,
-						ctx->filter_qnames_exclude_slots,
-						&name))
-			{
-				return (true);
-			}
-			if (name.len == 1)
-				break;
-			res = wdns_left_chop(&name, &name);
-			if (res != wdns_res_success)
-				break;
+	return (false);
+}
+
+static bool
+do_filter(dnsqr_shard_t *shard, Nmsg__Base__DnsQR *dnsqr) {
+	return (do_filter_query_rd(shard->ctx, dnsqr) ||
+		do_filter_query_name(&shard->filters, dnsqr));
+}
+
+static nmsg_res
+dnsqr_correlate(dnsqr_shard_t *shard, dnsqr_job_t *job, nmsg_message_t *m) {
+	dnsqr_ctx_t *ctx = shard->ctx;
+	Nmsg__Base__DnsQR *dnsqr = job->dnsqr;
+	Nmsg__Base__DnsQR *query;
+	nmsg_res res;
+
+	shard->now = job->ts;
+
+	if (DNS_FLAG_QR(job->flags) == false) {
+		/* message is a query */
+		dnsqr_insert_query(shard, dnsqr, job->hash);
+		return (nmsg_res_again);
+	}
+
+	/* message is a response */
+	query = dnsqr_retrieve(shard, dnsqr, job->hash, DNS_FLAG_RCODE(job->flags));
+	if (query == NULL) {
+		/* no corresponding query, this is an unsolicited response */
+
+		dnsqr->type = NMSG__BASE__DNS_QRTYPE__UDP_UNSOLICITED_RESPONSE;
+
+		if (do_filter_rd(ctx, job->flags)) {
+			res = nmsg_res_again;
+			goto out;
 		}
+
+		*m = dnsqr_to_message(ctx, dnsqr);
+		res = nmsg_res_success;
+#ifdef DEBUG
+		shard->count_unsolicited_response += 1;
+#endif
+	} else {
+		/* corresponding query, merge query and response */
+
+		dnsqr->type = NMSG__BASE__DNS_QRTYPE__UDP_QUERY_RESPONSE;
+		dnsqr_merge(query, dnsqr);
+
+		if (do_filter(shard, dnsqr)) {
+			res = nmsg_res_again;
+			goto out;
+		}
+
+		*m = dnsqr_to_message(ctx, dnsqr);
+		res = nmsg_res_success;
+#ifdef DEBUG
+		shard->count_query_response += 1;
+#endif
 	}
 
-	return (false);
+out:
+	dnsqr_free(dnsqr);
+	return (res);
 }
 
 static bool
-do_filter(dnsqr_ctx_t *ctx, Nmsg__Base__DnsQR *dnsqr) {
-	return (do_filter_query_rd(ctx, dnsqr) ||
-		do_filter_query_name(ctx, dnsqr));
+dnsqr_dispatch(dnsqr_ctx_t *ctx, dnsqr_job_t *job) {
+	dnsqr_shard_t *shard = dnsqr_shard_for(ctx, job->hash);
+	bool queued = false;
+
+	pthread_mutex_lock(&shard->lock);
+	if (shard->jobs_count < ctx->job_queue_sz) {
+		shard->jobs[(shard->jobs_head + shard->jobs_count) % ctx->job_queue_sz] = *job;
+		shard->jobs_count += 1;
+		if (shard->jobs_count == 1)
+			pthread_cond_signal(&shard->cond);
+		queued = true;
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	return (queued);
+}
+
+static void
+dnsqr_tick(dnsqr_ctx_t *ctx, const struct timespec *ts) {
+	dnsqr_job_t job;
+
+	/*
+	 * Once per second of packet time, advance the clock of every shard,
+	 * so that shards which see no traffic still time out their queries.
+	 * A shard whose queue is full is busy and does not need the tick.
+	 */
+	if (ts->tv_sec == ctx->tick_sec)
+		return;
+	ctx->tick_sec = ts->tv_sec;
+
+	memset(&job, 0, sizeof(job));
+	job.ts = *ts;
+	for (unsigned i = 0; i < ctx->num_shards; i++) {
+		dnsqr_shard_t *shard = &ctx->shards[i];
+
+		pthread_mutex_lock(&shard->lock);
+		if (shard->jobs_count < ctx->job_queue_sz) {
+			shard->jobs[(shard->jobs_head + shard->jobs_count) % ctx->job_queue_sz] = job;
+			shard->jobs_count += 1;
+			if (shard->jobs_count == 1)
+				pthread_cond_signal(&shard->cond);
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+static void
+dnsqr_emit(dnsqr_ctx_t *ctx, nmsg_message_t *msgs, unsigned n_msgs) {
+	pthread_mutex_lock(&ctx->msgs_lock);
+	for (unsigned i = 0; i < n_msgs; i++) {
+		while (ctx->msgs_count == MSG_QUEUE_SZ && ctx->discard == false)
+			pthread_cond_wait(&ctx->msgs_cond, &ctx->msgs_lock);
+		if (ctx->discard) {
+			nmsg_message_destroy(&msgs[i]);
+			continue;
+		}
+		ctx->msgs[(ctx->msgs_head + ctx->msgs_count) % MSG_QUEUE_SZ] = msgs[i];
+		ctx->msgs_count += 1;
+	}
+	pthread_cond_broadcast(&ctx->msgs_cond);
+	pthread_mutex_unlock(&ctx->msgs_lock);
+}
+
+static void
+dnsqr_shard_expire(dnsqr_shard_t *shard, nmsg_message_t *msgs, unsigned *n_msgs) {
+	Nmsg__Base__DnsQR *dnsqr;
+
+	while ((dnsqr = dnsqr_trim(shard)) != NULL) {
+		if (!do_filter(shard, dnsqr)) {
+			msgs[(*n_msgs)++] = dnsqr_to_message(shard->ctx, dnsqr);
+			if (*n_msgs == MSG_BATCH_SZ) {
+				dnsqr_emit(shard->ctx, msgs, *n_msgs);
+				*n_msgs = 0;
+			}
+		}
+		dnsqr_free(dnsqr);
+	}
+}
+
+static void *
+dnsqr_shard_thr(void *user) {
+	dnsqr_shard_t *shard = (dnsqr_shard_t *) user;
+	dnsqr_ctx_t *ctx = shard->ctx;
+	dnsqr_job_t jobs[MSG_BATCH_SZ];
+	nmsg_message_t msgs[MSG_BATCH_SZ];
+	unsigned n_jobs, n_msgs = 0;
+	bool was_full, stop;
+
+	for (;;) {
+		pthread_mutex_lock(&shard->lock);
+		while (shard->jobs_count == 0 && shard->stop_req == false)
+			pthread_cond_wait(&shard->cond, &shard->lock);
+		was_full = (shard->jobs_count == ctx->job_queue_sz);
+		for (n_jobs = 0; n_jobs < MSG_BATCH_SZ && shard->jobs_count > 0; n_jobs++) {
+			jobs[n_jobs] = shard->jobs[shard->jobs_head];
+			shard->jobs_head = (shard->jobs_head + 1) % ctx->job_queue_sz;
+			shard->jobs_count -= 1;
+		}
+		stop = (shard->stop_req && shard->jobs_count == 0);
+		pthread_mutex_unlock(&shard->lock);
+
+		dnsqr_filter_sync(ctx, &shard->filters);
+
+		if (was_full) {
+			/* the ingest thread may be waiting to dispatch a job */
+			pthread_mutex_lock(&ctx->msgs_lock);
+			pthread_cond_broadcast(&ctx->msgs_cond);
+			pthread_mutex_unlock(&ctx->msgs_lock);
+		}
+
+		for (unsigned i = 0; i < n_jobs; i++) {
+			nmsg_message_t m;
+
+			if (jobs[i].dnsqr == NULL) {
+				shard->now = jobs[i].ts;
+			} else if (dnsqr_correlate(shard, &jobs[i], &m) == nmsg_res_success) {
+				msgs[n_msgs++] = m;
+				if (n_msgs == MSG_BATCH_SZ) {
+					dnsqr_emit(ctx, msgs, n_msgs);
+					n_msgs = 0;
+				}
+			}
+			dnsqr_shard_expire(shard, msgs, &n_msgs);
+		}
+
+		/* once stopped, flush every remaining query */
+		if (stop) {
+			shard->stop = true;
+			dnsqr_shard_expire(shard, msgs, &n_msgs);
+		}
+
+		if (n_msgs > 0) {
+			dnsqr_emit(ctx, msgs, n_msgs);
+			n_msgs = 0;
+		}
+
+		if (shard->stop) {
+			pthread_mutex_lock(&ctx->msgs_lock);
+			ctx->num_done += 1;
+			pthread_cond_broadcast(&ctx->msgs_cond);
+			pthread_mutex_unlock(&ctx->msgs_lock);
+			return (NULL);
+		}
+	}
 }
 
 static nmsg_res
@@ -2100,7 +2951,6 @@ do_packet(dnsqr_ctx_t *ctx, nmsg_pcap_t pcap, nmsg_message_t *m,
 	struct nmsg_ipdg dg;
 	struct reasm_ip_entry *reasm_entry = NULL;
 	uint16_t flags;
-	uint8_t *new_pkt = NULL;
 	size_t new_pkt_len;
 
 	/* only operate on complete packets */
@@ -2112,8 +2962,10 @@ do_packet(dnsqr_ctx_t *ctx, nmsg_pcap_t pcap, nmsg_message_t *m,
 		return (res);
 
 	pthread_mutex_lock(&ctx->lock);
-	ctx->now.tv_sec = ts->tv_sec;
-	ctx->now.tv_nsec = ts->tv_nsec;
+	if (ctx->num_threads == 0) {
+		ctx->shards[0].now.tv_sec = ts->tv_sec;
+		ctx->shards[0].now.tv_nsec = ts->tv_nsec;
+	}
 #ifdef DEBUG
 	ctx->count_packet += 1;
 	if ((ctx->count_packet % 100000) == 0)
@@ -2122,12 +2974,15 @@ do_packet(dnsqr_ctx_t *ctx, nmsg_pcap_t pcap, nmsg_message_t *m,
 	is_frag = reasm_ip_next(ctx->reasm, dg.network, dg.len_network, ts, &reasm_entry);
 	pthread_mutex_unlock(&ctx->lock);
 
+	if (ctx->num_threads > 0)
+		dnsqr_tick(ctx, ts);
+
 	if (is_frag) {
 		if (reasm_entry != NULL) {
+			/* packets are copied out of the buffer before it is reused */
 			new_pkt_len = NMSG_IPSZ_MAX;
-			new_pkt = my_malloc(NMSG_IPSZ_MAX);
-			reasm_assemble(reasm_entry, new_pkt, &new_pkt_len);
-			res = nmsg_ipdg_parse_pcap_raw(&dg, DLT_RAW, new_pkt, new_pkt_len);
+			reasm_assemble(reasm_entry, ctx->reasm_buf, &new_pkt_len);
+			res = nmsg_ipdg_parse_pcap_raw(&dg, DLT_RAW, ctx->reasm_buf, new_pkt_len);
 			if (res != nmsg_res_success)
 				goto out;
 			if (nmsg_pcap_filter(pcap, dg.network, dg.len_network) == false) {
@@ -2142,8 +2997,7 @@ do_packet(dnsqr_ctx_t *ctx, nmsg_pcap_t pcap, nmsg_message_t *m,
 	if (dg.transport == NULL)
 		return (nmsg_res_again);
 
-	dnsqr = my_calloc(1, sizeof(*dnsqr));
-	nmsg__base__dns_qr__init(dnsqr);
+	dnsqr = dnsqr_new();
 
 	dnsqr->proto = dg.proto_transport;
 
@@ -2204,68 +3058,41 @@ do_packet(dnsqr_ctx_t *ctx, nmsg_pcap_t pcap, nmsg_message_t *m,
 		} else {
 			res = nmsg_res_again;
 		}
-	} else if (dg.proto_transport == IPPROTO_UDP && DNS_FLAG_QR(flags) == false) {
-		/* message is a query */
-		dnsqr->type = NMSG__BASE__DNS_QRTYPE__UDP_UNANSWERED_QUERY;
-		if (is_frag)
-			res = dnsqr_append_frag(dnsqr_append_query_packet, dnsqr, reasm_entry);
-		else
-			res = dnsqr_append_query_packet(dnsqr, dg.network, dg.len_network, ts);
-		if (res != nmsg_res_success)
-			goto out;
-		dnsqr_insert_query(ctx, dnsqr);
-		dnsqr = NULL;
-		res = nmsg_res_again;
 	} else if (dg.proto_transport == IPPROTO_UDP) {
-		/* message is a response */
-		Nmsg__Base__DnsQR *query;
-
-		dnsqr->rcode = DNS_FLAG_RCODE(flags);
-		dnsqr->has_rcode = true;
+		dnsqr_job_t job;
 
-		if (is_frag)
-			res = dnsqr_append_frag(dnsqr_append_response_packet, dnsqr, reasm_entry);
-		else
-			res = dnsqr_append_response_packet(dnsqr, dg.network, dg.len_network, ts);
+		if (DNS_FLAG_QR(flags) == false) {
+			/* message is a query */
+			dnsqr->type = NMSG__BASE__DNS_QRTYPE__UDP_UNANSWERED_QUERY;
+			if (is_frag)
+				res = dnsqr_append_frag(dnsqr_append_query_packet, dnsqr, reasm_entry);
+			else
+				res = dnsqr_append_query_packet(dnsqr, dg.network, dg.len_network, ts);
+		} else {
+			/* message is a response */
+			dnsqr->rcode = DNS_FLAG_RCODE(flags);
+			dnsqr->has_rcode = true;
+			if (is_frag)
+				res = dnsqr_append_frag(dnsqr_append_response_packet, dnsqr, reasm_entry);
+			else
+				res = dnsqr_append_response_packet(dnsqr, dg.network, dg.len_network, ts);
+		}
 		if (res != nmsg_res_success)
 			goto out;
 
-		query = dnsqr_retrieve(ctx, dnsqr, DNS_FLAG_RCODE(flags));
-		if (query == NULL) {
-			/* no corresponding query, this is an unsolicited response */
-
-			dnsqr->type = NMSG__BASE__DNS_QRTYPE__UDP_UNSOLICITED_RESPONSE;
-
-			if (do_filter_rd(ctx, flags)) {
-				res = nmsg_res_again;
-				goto out;
-			}
+		/* hand the message to the shard that owns its 9-tuple */
+		job.dnsqr = dnsqr;
+		job.ts = *ts;
+		job.hash = dnsqr_hash(dnsqr);
+		job.flags = flags;
+		dnsqr = NULL;
 
-			*m = dnsqr_to_message(ctx, dnsqr);
-			res = nmsg_res_success;
-#ifdef DEBUG
-			pthread_mutex_lock(&ctx->lock);
-			ctx->count_unsolicited_response += 1;
-			pthread_mutex_unlock(&ctx->lock);
-#endif
+		if (ctx->num_threads > 0) {
+			if (!dnsqr_dispatch(ctx, &job))
+				ctx->pending = job;
+			res = nmsg_res_again;
 		} else {
-			/* corresponding query, merge query and response */
-
-			dnsqr->type = NMSG__BASE__DNS_QRTYPE__UDP_QUERY_RESPONSE;
-			dnsqr_merge(query, dnsqr);
-
-			if (do_filter(ctx, dnsqr)) {
-				res = nmsg_res_again;
-				goto out;
-			}
-
-			*m = dnsqr_to_message(ctx, dnsqr);
-			res = nmsg_res_success;
-#ifdef DEBUG
-			pthread_mutex_lock(&ctx->lock);
-			ctx->count_query_response += 1;
-			pthread_mutex_unlock(&ctx->lock);
-#endif
+			res = dnsqr_correlate(&ctx->shards[0], &job, m);
 		}
 	} else if (dg.proto_transport == IPPROTO_TCP ||
 		   dg.proto_transport == IPPROTO_ICMP)
@@ -2276,14 +3103,91 @@ do_packet(dnsqr_ctx_t *ctx, nmsg_pcap_t pcap, nmsg_message_t *m,
 
 out:
 	if (dnsqr != NULL)
-		nmsg__base__dns_qr__free_unpacked(dnsqr, NULL);
-	if (new_pkt != NULL)
-		free(new_pkt);
+		dnsqr_free(dnsqr);
 	if (reasm_entry != NULL)
 		reasm_free_entry(reasm_entry);
 	return (res);
 }
 
+static void
+dnsqr_wait_msgs(dnsqr_ctx_t *ctx) {
+	struct timespec ts;
+
+	pthread_mutex_lock(&ctx->msgs_lock);
+	if (ctx->msgs_count == 0 && ctx->num_done < ctx->num_shards) {
+		nmsg_timespec_get(&ts);
+		ts.tv_nsec += 100 * 1000 * 1000;
+		if (ts.tv_nsec >= 1000 * 1000 * 1000) {
+			ts.tv_sec += 1;
+			ts.tv_nsec -= 1000 * 1000 * 1000;
+		}
+		pthread_cond_timedwait(&ctx->msgs_cond, &ctx->msgs_lock, &ts);
+	}
+	pthread_mutex_unlock(&ctx->msgs_lock);
+}
+
+static nmsg_res
+dnsqr_pkt_to_payload_thr(dnsqr_ctx_t *ctx, nmsg_pcap_t pcap, nmsg_message_t *m) {
+	nmsg_res res;
+	struct timespec ts;
+	struct pcap_pkthdr *pkt_hdr;
+	const uint8_t *pkt_data;
+
+	dnsqr_filter_check(ctx);
+
+	/* first hand out whatever the shard workers have emitted */
+	pthread_mutex_lock(&ctx->msgs_lock);
+	if (ctx->msgs_count > 0) {
+		*m = ctx->msgs[ctx->msgs_head];
+		if (ctx->msgs_count == MSG_QUEUE_SZ)
+			pthread_cond_broadcast(&ctx->msgs_cond);
+		ctx->msgs_head = (ctx->msgs_head + 1) % MSG_QUEUE_SZ;
+		ctx->msgs_count -= 1;
+		pthread_mutex_unlock(&ctx->msgs_lock);
+		return (nmsg_res_success);
+	}
+	if (ctx->num_done == ctx->num_shards) {
+		pthread_mutex_unlock(&ctx->msgs_lock);
+		return (nmsg_res_eof);
+	}
+	pthread_mutex_unlock(&ctx->msgs_lock);
+
+	/* retry a job that found the queue of its shard full */
+	if (ctx->pending.dnsqr != NULL) {
+		if (!dnsqr_dispatch(ctx, &ctx->pending)) {
+			dnsqr_wait_msgs(ctx);
+			return (nmsg_res_again);
+		}
+		ctx->pending.dnsqr = NULL;
+	}
+
+	if (ctx->stop) {
+		if (!ctx->stop_sent) {
+			for (unsigned i = 0; i < ctx->num_shards; i++) {
+				dnsqr_shard_t *shard = &ctx->shards[i];
+
+				pthread_mutex_lock(&shard->lock);
+				shard->stop_req = true;
+				pthread_cond_signal(&shard->cond);
+				pthread_mutex_unlock(&shard->lock);
+			}
+			ctx->stop_sent = true;
+		}
+		dnsqr_wait_msgs(ctx);
+		return (nmsg_res_again);
+	}
+
+	res = nmsg_pcap_input_read_raw(pcap, &pkt_hdr, &pkt_data, &ts);
+	if (res == nmsg_res_success) {
+		return (do_packet(ctx, pcap, m, pkt_data, pkt_hdr, &ts));
+	} else if (res == nmsg_res_eof) {
+		ctx->stop = true;
+		return (nmsg_res_again);
+	}
+
+	return (res);
+}
+
 static nmsg_res
 dnsqr_pkt_to_payload(void *clos, nmsg_pcap_t pcap, nmsg_message_t *m) {
 	Nmsg__Base__DnsQR *dnsqr;
@@ -2292,26 +3196,31 @@ dnsqr_pkt_to_payload(void *clos, nmsg_pcap_t pcap, nmsg_message_t *m) {
 	struct timespec ts;
 	struct pcap_pkthdr *pkt_hdr;
 	const uint8_t *pkt_data;
+	bool stop;
+
+	if (ctx->num_threads > 0)
+		return (dnsqr_pkt_to_payload_thr(ctx, pcap, m));
 
-	dnsqr = dnsqr_trim(ctx);
-	if (dnsqr != NULL) {
-		if (do_filter(ctx, dnsqr)) {
-			nmsg__base__dns_qr__free_unpacked(dnsqr, NULL);
+	dnsqr_filter_check(ctx);
+	dnsqr_filter_sync(ctx, &ctx->shards[0].filters);
+
+	/* hand out timed out queries before reading the next packet */
+	while ((dnsqr = dnsqr_trim(&ctx->shards[0])) != NULL) {
+		if (do_filter(&ctx->shards[0], dnsqr)) {
+			dnsqr_free(dnsqr);
 		} else {
 			*m = dnsqr_to_message(ctx, dnsqr);
-			nmsg__base__dns_qr__free_unpacked(dnsqr, NULL);
+			dnsqr_free(dnsqr);
 			return (nmsg_res_success);
 		}
-	} else {
-		bool stop;
+	}
 
-		pthread_mutex_lock(&ctx->lock);
-		stop = ctx->stop;
-		pthread_mutex_unlock(&ctx->lock);
+	pthread_mutex_lock(&ctx->lock);
+	stop = ctx->stop;
+	pthread_mutex_unlock(&ctx->lock);
 
-		if (stop == true)
-			return (nmsg_res_eof);
-	}
+	if (stop == true)
+		return (nmsg_res_eof);
 
 	res = nmsg_pcap_input_read_raw(pcap, &pkt_hdr, &pkt_data, &ts);
 	if (res == nmsg_res_success) {
@@ -2319,6 +3228,7 @@ dnsqr_pkt_to_payload(void *clos, nmsg_pcap_t pcap, nmsg_message_t *m) {
 	} else if (res == nmsg_res_eof) {
 		pthread_mutex_lock(&ctx->lock);
 		ctx->stop = true;
+		ctx->shards[0].stop = true;
 		pthread_mutex_unlock(&ctx->lock);
 		return (nmsg_res_again);
 	}
@@ -50,7 +50,7 @@ _nmsg_buf_avail(struct nmsg_buf *buf) {
 void
 _nmsg_buf_destroy(struct nmsg_buf **buf) {
 	if (*buf != NULL) {
-		if (_nmsg_global_autoclose == true)
+		if (_nmsg_global_autoclose == true && (*buf)->fd != -1)
 			close((*buf)->fd);
 		if ((*buf)->data != NULL)
 			free((*buf)->data);
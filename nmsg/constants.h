@@ -31,6 +31,16 @@
  */
 #define NMSG_VERSION		2U
 
+/**
+ * Four-octet magic sequence seen at the beginning of an NMSG container index.
+ */
+#define NMSG_INDEX_MAGIC	{'N', 'I', 'D', 'X'}
+
+/**
+ * Current version number of the NMSG container index format.
+ */
+#define NMSG_INDEX_VERSION	1U
+
 /**
  * Number of octets in an NMSG header (magic + version).
  */
@@ -113,4 +123,14 @@
  */
 #define NMSG_FLAG_FRAGMENT	0x02
 
+/**
+ * NMSG container is Zstandard compressed.
+ */
+#define NMSG_FLAG_ZSTD		0x04
+
+/**
+ * NMSG container is LZ4 compressed.
+ */
+#define NMSG_FLAG_LZ4		0x08
+
 #endif
@@ -22,6 +22,7 @@
 
 struct nmsg_container {
 	Nmsg__Nmsg	*nmsg;
+	struct nmsg_payload_ref	**refs;
 	size_t		bufsz;
 	size_t		estsz;
 	bool		do_sequence;
@@ -57,6 +58,17 @@ nmsg_container_init(size_t bufsz) {
 void
 nmsg_container_destroy(struct nmsg_container **c) {
 	if (*c != NULL) {
+		/* release payloads whose data is shared with other containers */
+		if ((*c)->refs != NULL) {
+			Nmsg__Nmsg *nmsg = (*c)->nmsg;
+
+			for (unsigned i = 0; i < nmsg->n_payloads; i++) {
+				if ((*c)->refs[i] != NULL)
+					_nmsg_payload_free_shared(&nmsg->payloads[i],
+								  &(*c)->refs[i]);
+			}
+			free((*c)->refs);
+		}
 		nmsg__nmsg__free_unpacked((*c)->nmsg, NULL);
 		free(*c);
 		*c = NULL;
@@ -97,6 +109,27 @@ nmsg_container_add(struct nmsg_container *c, nmsg_message_t msg) {
 		return (nmsg_res_memfail);
 	}
 
+	/* track shared payload data, the refs array is only allocated once a
+	 * shared payload is added and then kept the size of the payloads array */
+	if (c->refs != NULL) {
+		tmp = realloc(c->refs, c->nmsg->n_payloads * sizeof(*c->refs));
+		if (tmp == NULL) {
+			c->nmsg->n_payloads -= 1;
+			return (nmsg_res_memfail);
+		}
+		c->refs = tmp;
+	} else if (msg->ref != NULL) {
+		c->refs = calloc(c->nmsg->n_payloads, sizeof(*c->refs));
+		if (c->refs == NULL) {
+			c->nmsg->n_payloads -= 1;
+			return (nmsg_res_memfail);
+		}
+	}
+	if (c->refs != NULL) {
+		c->refs[c->nmsg->n_payloads - 1] = msg->ref;
+		msg->ref = NULL;
+	}
+
 	/* detach payload from msg object */
 	np = msg->np;
 	msg->np = NULL;
@@ -128,28 +161,74 @@ nmsg_container_get_num_payloads(struct nmsg_container *c) {
 	return (c->nmsg->n_payloads);
 }
 
+Nmsg__Nmsg *
+_nmsg_container_get_nmsg(struct nmsg_container *c) {
+	return (c->nmsg);
+}
+
+size_t
+nmsg_container_get_serialize_bufsz(struct nmsg_container *c, bool do_zlib) {
+	/* compressed output, with room for the codec's worst case expansion,
+	 * is followed by scratch space for packing the uncompressed container */
+	return ((do_zlib) ? (3 * c->estsz + NMSG_ZBUF_SLOP) : (c->estsz));
+}
+
 nmsg_res
 nmsg_container_serialize(struct nmsg_container *c,
 			 uint8_t **pbuf, size_t *buf_len,
 			 bool do_header, bool do_zlib,
 			 uint32_t sequence, uint64_t sequence_id)
+{
+	nmsg_res res;
+	nmsg_zbuf_t zbuf = NULL;
+
+	*buf_len = nmsg_container_get_serialize_bufsz(c, do_zlib);
+	*pbuf = malloc(*buf_len);
+	if (*pbuf == NULL)
+		return (nmsg_res_memfail);
+
+	if (do_zlib) {
+		zbuf = nmsg_zbuf_deflate_init();
+		if (zbuf == NULL) {
+			free(*pbuf);
+			return (nmsg_res_memfail);
+		}
+	}
+
+	res = nmsg_container_serialize_buf(c, *pbuf, buf_len, do_header, zbuf,
+					   sequence, sequence_id);
+	nmsg_zbuf_destroy(&zbuf);
+	if (res != nmsg_res_success) {
+		free(*pbuf);
+		*pbuf = NULL;
+	}
+
+	return (res);
+}
+
+nmsg_res
+nmsg_container_serialize_buf(struct nmsg_container *c,
+			     uint8_t *buf, size_t *buf_len,
+			     bool do_header, nmsg_zbuf_t zbuf,
+			     uint32_t sequence, uint64_t sequence_id)
 {
 	static const char magic[] = NMSG_MAGIC;
+	bool do_zlib = (zbuf != NULL);
 	size_t len = 0;
 	uint8_t flags;
-	uint8_t *buf;
+	uint8_t *buf_start = buf;
 	uint8_t *len_wire = NULL;
 	uint16_t version;
 
-	*pbuf = buf = malloc((do_zlib) ? (2 * c->estsz) : (c->estsz));
-	if (buf == NULL)
-		return (nmsg_res_memfail);
+	if (*buf_len < nmsg_container_get_serialize_bufsz(c, do_zlib))
+		return (nmsg_res_failure);
 
 	if (do_header) {
 		/* serialize header */
 		memcpy(buf, magic, sizeof(magic));
 		buf += sizeof(magic);
-		flags = (do_zlib) ? NMSG_FLAG_ZLIB : 0;
+		flags = (do_zlib) ? _nmsg_zbuf_compression_to_flag(
+			nmsg_zbuf_get_compression(zbuf)) : 0;
 		version = NMSG_VERSION | (flags << 8);
 		version = htons(version);
 		memcpy(buf, &version, sizeof(version));
@@ -175,28 +254,15 @@ nmsg_container_serialize(struct nmsg_container *c,
 		len = nmsg__nmsg__pack(c->nmsg, buf);
 	} else {
 		nmsg_res res;
-		nmsg_zbuf_t zbuf;
 		size_t ulen;
 		u_char *zb_tmp;
 
-		zb_tmp = malloc(c->estsz);
-		if (zb_tmp == NULL) {
-			free(*pbuf);
-			return (nmsg_res_memfail);
-		}
-
-		zbuf = nmsg_zbuf_deflate_init();
-		if (zbuf == NULL) {
-			free(zb_tmp);
-			free(*pbuf);
-			return (nmsg_res_memfail);
-		}
-
+		/* pack into the scratch space at the end of the buffer, then
+		 * compress into the space following the header */
+		zb_tmp = buf_start + 2 * c->estsz + NMSG_ZBUF_SLOP;
 		ulen = nmsg__nmsg__pack(c->nmsg, zb_tmp);
-		len = 2 * c->estsz;
+		len = (zb_tmp - buf);
 		res = nmsg_zbuf_deflate(zbuf, ulen, zb_tmp, &len, buf);
-		nmsg_zbuf_destroy(&zbuf);
-		free(zb_tmp);
 		if (res != nmsg_res_success)
 			return (res);
 	}
@@ -122,6 +122,56 @@ nmsg_container_serialize(nmsg_container_t c, uint8_t **pbuf, size_t *buf_len,
 			 bool do_header, bool do_zlib,
 			 uint32_t sequence, uint64_t sequence_id);
 
+/**
+ * Get the size of the buffer that must be supplied to
+ * #nmsg_container_serialize_buf() in order to serialize an NMSG container
+ * object in its current state. Adding payloads to the container object will
+ * increase this value.
+ *
+ * \param[in] c Pointer to an nmsg_container_t object.
+ *
+ * \param[in] do_zlib Whether the container will be compressed with zlib.
+ * Compression requires additional space in the buffer, which is used for
+ * packing the container before it is compressed.
+ *
+ * \return Minimum size in bytes of the serialization buffer.
+ */
+size_t
+nmsg_container_get_serialize_bufsz(nmsg_container_t c, bool do_zlib);
+
+/**
+ * Serialize an NMSG container object into a buffer supplied by the caller.
+ * This is like #nmsg_container_serialize(), except that no memory is
+ * allocated, which allows the caller to reuse both the serialization buffer
+ * and the zlib deflate context across many containers.
+ *
+ * \param[in] c Pointer to an nmsg_container_t object.
+ *
+ * \param[in] buf Buffer that the serialized container will be written to.
+ *
+ * \param[in,out] buf_len On input, the size in bytes of 'buf', which must be
+ * at least the value returned by #nmsg_container_get_serialize_bufsz(). On
+ * output, the length in bytes of the serialized container.
+ *
+ * \param[in] do_header Whether to write the fixed-length NMSG header to the
+ * beginning of the buffer.
+ *
+ * \param[in] zb nmsg_zbuf_t object initialized with #nmsg_zbuf_deflate_init()
+ * that will be used to compress the variable-length part of the serialized
+ * NMSG container, or NULL to disable compression.
+ *
+ * \param[in] sequence See #nmsg_container_serialize().
+ *
+ * \param[in] sequence_id See #nmsg_container_serialize().
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_failure If 'buf' is too small.
+ */
+nmsg_res
+nmsg_container_serialize_buf(nmsg_container_t c, uint8_t *buf, size_t *buf_len,
+			     bool do_header, nmsg_zbuf_t zb,
+			     uint32_t sequence, uint64_t sequence_id);
+
 /**
  * Deserialize a collection of NMSG messages contained in a buffer containing a
  * serialized NMSG container. The serialized NMSG container must contain the
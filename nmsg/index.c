@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2013 by Farsight Security, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * An NMSG container index is a header (magic, version) followed by one
+ * record per container written to the indexed file. All fields are in network
+ * byte order:
+ *
+ *	uint32	record length, not including this field
+ *	uint64	file offset of the container, or of its first fragment
+ *	uint32	container length, including headers and all fragments
+ *	uint32	number of payloads
+ *	int64	earliest payload time, seconds
+ *	uint32	earliest payload time, nanoseconds
+ *	int64	latest payload time, seconds
+ *	uint32	latest payload time, nanoseconds
+ *	uint16	number of (vid, msgtype) pairs
+ *	uint16	number of sources
+ *	uint16	number of operators
+ *	uint16	number of groups
+ *	(uint32 vid, uint32 msgtype) pairs, then sources, operators, groups
+ *
+ * A set count of 0xffff means that the container holds more distinct values
+ * than were recorded, and that any value may be present. Readers skip any
+ * trailing record fields that they do not know about.
+ */
+
+/* Import. */
+
+#include "private.h"
+
+#include "libmy/ubuf.h"
+
+/* Macros. */
+
+#define INDEX_HDRSZ		8
+#define INDEX_RECSZ_MIN		52
+#define INDEX_RECSZ_MAX		(INDEX_RECSZ_MIN + \
+				 NMSG_INDEX_SET_MAX * 8 + \
+				 NMSG_INDEX_SET_MAX * 4 * 3)
+
+/* Forward. */
+
+static nmsg_res write_all(int fd, const uint8_t *, size_t);
+static void set_add(uint64_t *, uint16_t *, uint64_t);
+static int entry_cmp(const void *, const void *);
+static int ts_cmp(const struct timespec *, const struct timespec *);
+static uint64_t load_net64(const uint8_t *);
+static void store_net64(uint8_t *, uint64_t);
+
+/* Internal functions. */
+
+nmsg_res
+_nmsg_index_write_header(int fd) {
+	static const char magic[] = NMSG_INDEX_MAGIC;
+	uint8_t hdr[INDEX_HDRSZ];
+
+	memcpy(hdr, magic, sizeof(magic));
+	store_net16(hdr + 4, NMSG_INDEX_VERSION);
+	store_net16(hdr + 6, 0);
+
+	return (write_all(fd, hdr, sizeof(hdr)));
+}
+
+nmsg_res
+_nmsg_index_write_entry(int fd, struct nmsg_container *c, uint64_t offset,
+			size_t len)
+{
+	Nmsg__Nmsg *nmsg = _nmsg_container_get_nmsg(c);
+	uint64_t vals[nmsg_index_n_sets][NMSG_INDEX_SET_MAX];
+	uint16_t n_vals[nmsg_index_n_sets] = { 0 };
+	struct timespec first = { 0, 0 }, last = { 0, 0 };
+	uint8_t rec[INDEX_RECSZ_MAX], *p;
+
+	for (unsigned i = 0; i < nmsg->n_payloads; i++) {
+		Nmsg__NmsgPayload *np = nmsg->payloads[i];
+		struct timespec ts;
+
+		ts.tv_sec = np->time_sec;
+		ts.tv_nsec = np->time_nsec;
+		if (i == 0 || ts_cmp(&ts, &first) < 0)
+			first = ts;
+		if (i == 0 || ts_cmp(&ts, &last) > 0)
+			last = ts;
+
+		set_add(vals[nmsg_index_set_type], &n_vals[nmsg_index_set_type],
+			((uint64_t) np->vid << 32) | np->msgtype);
+		set_add(vals[nmsg_index_set_source], &n_vals[nmsg_index_set_source],
+			np->source);
+		set_add(vals[nmsg_index_set_operator], &n_vals[nmsg_index_set_operator],
+			np->operator_);
+		set_add(vals[nmsg_index_set_group], &n_vals[nmsg_index_set_group],
+			np->group);
+	}
+
+	p = rec + 4;
+	store_net64(p, offset);
+	store_net32(p + 8, (uint32_t) len);
+	store_net32(p + 12, (uint32_t) nmsg->n_payloads);
+	store_net64(p + 16, (uint64_t) first.tv_sec);
+	store_net32(p + 24, (uint32_t) first.tv_nsec);
+	store_net64(p + 28, (uint64_t) last.tv_sec);
+	store_net32(p + 36, (uint32_t) last.tv_nsec);
+	p += 40;
+	for (unsigned s = 0; s < nmsg_index_n_sets; s++) {
+		store_net16(p, n_vals[s]);
+		p += 2;
+	}
+	for (unsigned s = 0; s < nmsg_index_n_sets; s++) {
+		if (n_vals[s] == NMSG_INDEX_SET_ANY)
+			continue;
+		for (unsigned i = 0; i < n_vals[s]; i++) {
+			if (s == nmsg_index_set_type) {
+				store_net32(p, (uint32_t) (vals[s][i] >> 32));
+				p += 4;
+			}
+			store_net32(p, (uint32_t) vals[s][i]);
+			p += 4;
+		}
+	}
+	store_net32(rec, (uint32_t) (p - rec - 4));
+
+	return (write_all(fd, rec, p - rec));
+}
+
+nmsg_res
+_nmsg_index_load(int fd, struct nmsg_index **idx) {
+	static const char magic[] = NMSG_INDEX_MAGIC;
+	struct nmsg_index *x;
+	struct nmsg_index_entry *e;
+	ubuf *u;
+	const uint8_t *p, *end;
+	uint8_t rbuf[65536];
+	ssize_t bytes_read;
+	uint16_t version;
+	size_t n_alloc = 0;
+	bool sorted = true;
+	nmsg_res res = nmsg_res_success;
+
+	u = ubuf_init(sizeof(rbuf));
+	for (;;) {
+		bytes_read = read(fd, rbuf, sizeof(rbuf));
+		if (bytes_read < 0 && errno == EINTR)
+			continue;
+		if (bytes_read < 0) {
+			ubuf_destroy(&u);
+			return (nmsg_res_errno);
+		}
+		if (bytes_read == 0)
+			break;
+		ubuf_append(u, rbuf, bytes_read);
+	}
+
+	p = ubuf_data(u);
+	end = p + ubuf_size(u);
+	if (end - p < INDEX_HDRSZ || memcmp(p, magic, sizeof(magic)) != 0) {
+		ubuf_destroy(&u);
+		return (nmsg_res_magic_mismatch);
+	}
+	load_net16(p + 4, &version);
+	if (version != NMSG_INDEX_VERSION) {
+		ubuf_destroy(&u);
+		return (nmsg_res_version_mismatch);
+	}
+	p += INDEX_HDRSZ;
+
+	x = calloc(1, sizeof(*x));
+	if (x == NULL) {
+		ubuf_destroy(&u);
+		return (nmsg_res_memfail);
+	}
+
+	/* a truncated final record is the one that was being written when
+	 * the index was read or when its writer stopped, so it is ignored */
+	while (end - p >= 4) {
+		const uint8_t *q, *rec_end;
+		uint32_t reclen, v;
+		size_t n_total = 0, k = 0;
+
+		load_net32(p, &reclen);
+		if (reclen < INDEX_RECSZ_MIN - 4 || (size_t) (end - p - 4) < reclen)
+			break;
+		q = p + 4;
+		rec_end = q + reclen;
+
+		if (x->n_entries == n_alloc) {
+			struct nmsg_index_entry *entries;
+
+			n_alloc = n_alloc == 0 ? 1024 : 2 * n_alloc;
+			entries = realloc(x->entries, n_alloc * sizeof(*entries));
+			if (entries == NULL) {
+				res = nmsg_res_memfail;
+				break;
+			}
+			x->entries = entries;
+		}
+		e = &x->entries[x->n_entries];
+		memset(e, 0, sizeof(*e));
+
+		e->offset = load_net64(q);
+		load_net32(q + 8, &e->len);
+		load_net32(q + 12, &e->n_payloads);
+		e->first.tv_sec = (time_t) load_net64(q + 16);
+		load_net32(q + 24, &v);
+		e->first.tv_nsec = v;
+		e->last.tv_sec = (time_t) load_net64(q + 28);
+		load_net32(q + 36, &v);
+		e->last.tv_nsec = v;
+		q += 40;
+		for (unsigned s = 0; s < nmsg_index_n_sets; s++) {
+			load_net16(q, &e->n_vals[s]);
+			q += 2;
+			if (e->n_vals[s] != NMSG_INDEX_SET_ANY)
+				n_total += e->n_vals[s];
+		}
+		if (n_total > 0) {
+			e->vals = malloc(n_total * sizeof(*e->vals));
+			if (e->vals == NULL) {
+				res = nmsg_res_memfail;
+				break;
+			}
+		}
+		for (unsigned s = 0; s < nmsg_index_n_sets && res == nmsg_res_success; s++) {
+			if (e->n_vals[s] == NMSG_INDEX_SET_ANY)
+				continue;
+			for (unsigned i = 0; i < e->n_vals[s]; i++) {
+				size_t sz = (s == nmsg_index_set_type) ? 8 : 4;
+				uint32_t hi = 0, lo;
+
+				if ((size_t) (rec_end - q) < sz) {
+					res = nmsg_res_parse_error;
+					break;
+				}
+				if (s == nmsg_index_set_type) {
+					load_net32(q, &hi);
+					q += 4;
+				}
+				load_net32(q, &lo);
+				q += 4;
+				e->vals[k++] = ((uint64_t) hi << 32) | lo;
+			}
+		}
+		if (res != nmsg_res_success) {
+			free(e->vals);
+			break;
+		}
+
+		if (x->n_entries > 0 && e->offset < x->entries[x->n_entries - 1].offset)
+			sorted = false;
+		x->n_entries += 1;
+		p = rec_end;
+	}
+	ubuf_destroy(&u);
+
+	if (res != nmsg_res_success) {
+		_nmsg_index_destroy(&x);
+		return (res);
+	}
+
+	/* an index that was appended to by more than one writer may be out of
+	 * order */
+	if (!sorted)
+		qsort(x->entries, x->n_entries, sizeof(*x->entries), entry_cmp);
+
+	*idx = x;
+	return (nmsg_res_success);
+}
+
+void
+_nmsg_index_destroy(struct nmsg_index **idx) {
+	if (*idx == NULL)
+		return;
+	for (size_t i = 0; i < (*idx)->n_entries; i++)
+		free((*idx)->entries[i].vals);
+	free((*idx)->entries);
+	free(*idx);
+	*idx = NULL;
+}
+
+const struct nmsg_index_entry *
+_nmsg_index_find(struct nmsg_index *idx, uint64_t offset) {
+	size_t lo = 0, hi = idx->n_entries;
+
+	/* containers are usually looked up one after another */
+	for (size_t i = idx->cur; i < idx->cur + 2 && i < idx->n_entries; i++) {
+		if (idx->entries[i].offset == offset) {
+			idx->cur = i;
+			return (&idx->entries[i]);
+		}
+	}
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (idx->entries[mid].offset < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < idx->n_entries && idx->entries[lo].offset == offset) {
+		idx->cur = lo;
+		return (&idx->entries[lo]);
+	}
+	return (NULL);
+}
+
+const struct nmsg_index_entry *
+_nmsg_index_find_time(struct nmsg_index *idx, const struct timespec *ts) {
+	/* payload times are only roughly ordered within a file, so the first
+	 * container that may hold payloads at or after 'ts' is searched for in
+	 * file order */
+	for (size_t i = 0; i < idx->n_entries; i++) {
+		if (ts_cmp(&idx->entries[i].last, ts) >= 0) {
+			idx->cur = i;
+			return (&idx->entries[i]);
+		}
+	}
+	return (NULL);
+}
+
+bool
+_nmsg_index_entry_has(const struct nmsg_index_entry *e, nmsg_index_set set,
+		      uint64_t val)
+{
+	const uint64_t *vals = e->vals;
+
+	if (e->n_vals[set] == NMSG_INDEX_SET_ANY)
+		return (true);
+	for (unsigned s = 0; s < set; s++) {
+		if (e->n_vals[s] != NMSG_INDEX_SET_ANY)
+			vals += e->n_vals[s];
+	}
+	for (unsigned i = 0; i < e->n_vals[set]; i++) {
+		if (vals[i] == val)
+			return (true);
+	}
+	return (false);
+}
+
+bool
+_nmsg_index_time_in_range(const struct nmsg_stream_input *stream,
+			  const struct timespec *first,
+			  const struct timespec *last)
+{
+	if (stream->has_time_start && ts_cmp(last, &stream->time_start) < 0)
+		return (false);
+	if (stream->has_time_end && ts_cmp(first, &stream->time_end) > 0)
+		return (false);
+	return (true);
+}
+
+/* Private functions. */
+
+static nmsg_res
+write_all(int fd, const uint8_t *buf, size_t len) {
+	ssize_t bytes_written;
+
+	while (len > 0) {
+		bytes_written = write(fd, buf, len);
+		if (bytes_written < 0 && errno == EINTR)
+			continue;
+		if (bytes_written < 0) {
+			_nmsg_dprintf(1, "%s: write() failed: %s\n", __func__, strerror(errno));
+			return (nmsg_res_errno);
+		}
+		buf += bytes_written;
+		len -= bytes_written;
+	}
+	return (nmsg_res_success);
+}
+
+static void
+set_add(uint64_t *vals, uint16_t *n, uint64_t val) {
+	if (*n == NMSG_INDEX_SET_ANY)
+		return;
+	for (unsigned i = 0; i < *n; i++) {
+		if (vals[i] == val)
+			return;
+	}
+	if (*n == NMSG_INDEX_SET_MAX)
+		*n = NMSG_INDEX_SET_ANY;
+	else
+		vals[(*n)++] = val;
+}
+
+static int
+entry_cmp(const void *a, const void *b) {
+	const struct nmsg_index_entry *ea = a, *eb = b;
+
+	if (ea->offset < eb->offset)
+		return (-1);
+	return (ea->offset > eb->offset);
+}
+
+static int
+ts_cmp(const struct timespec *a, const struct timespec *b) {
+	if (a->tv_sec != b->tv_sec)
+		return (a->tv_sec < b->tv_sec ? -1 : 1);
+	if (a->tv_nsec != b->tv_nsec)
+		return (a->tv_nsec < b->tv_nsec ? -1 : 1);
+	return (0);
+}
+
+static uint64_t
+load_net64(const uint8_t *buf) {
+	uint32_t hi, lo;
+
+	load_net32(buf, &hi);
+	load_net32(buf + 4, &lo);
+	return (((uint64_t) hi << 32) | lo);
+}
+
+static void
+store_net64(uint8_t *buf, uint64_t val) {
+	store_net32(buf, (uint32_t) (val >> 32));
+	store_net32(buf + 4, (uint32_t) val);
+}
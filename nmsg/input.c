@@ -24,6 +24,9 @@ static nmsg_input_t	input_open_stream(nmsg_stream_type, int);
 static nmsg_input_t	input_open_stream_base(nmsg_stream_type);
 static nmsg_res		input_flush(nmsg_input_t input);
 static void		input_close_stream(nmsg_input_t input);
+#ifdef HAVE_RECVMMSG
+static void		input_recv_batch_destroy(struct nmsg_recv_batch **);
+#endif /* HAVE_RECVMMSG */
 
 /* Export. */
 
@@ -32,6 +35,50 @@ nmsg_input_open_file(int fd) {
 	return (input_open_stream(nmsg_stream_type_file, fd));
 }
 
+nmsg_input_t
+nmsg_input_open_mmap(int fd) {
+	struct nmsg_input *input;
+	struct stat st;
+	void *map;
+
+	/* only non-empty regular files can be mapped */
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+		return (nmsg_input_open_file(fd));
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return (nmsg_input_open_file(fd));
+
+	input = input_open_stream_base(nmsg_stream_type_file);
+	if (input == NULL) {
+		munmap(map, st.st_size);
+		return (NULL);
+	}
+
+	/* the nmsg_buf covers the entire mapping, so no reads are needed */
+	input->stream->buf = calloc(1, sizeof(*(input->stream->buf)));
+	if (input->stream->buf == NULL) {
+		munmap(map, st.st_size);
+		input_close_stream(input);
+		free(input);
+		return (NULL);
+	}
+	input->stream->map = map;
+	input->stream->map_len = st.st_size;
+	input->stream->buf->fd = fd;
+	input->stream->buf->bufsz = st.st_size;
+	input->stream->buf->data = input->stream->map;
+	input->stream->buf->pos = input->stream->map;
+	input->stream->buf->end = input->stream->map + st.st_size;
+	nmsg_timespec_get(&input->stream->now);
+
+#ifdef MADV_SEQUENTIAL
+	(void) madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+
+	return (input);
+}
+
 nmsg_input_t
 nmsg_input_open_sock(int fd) {
 	return (input_open_stream(nmsg_stream_type_sock, fd));
@@ -87,6 +134,7 @@ nmsg_input_open_null(void) {
 		return (NULL);
 	input->read_fp = _input_nmsg_read_null;
 	input->read_loop_fp = _input_nmsg_loop_null;
+	input->read_batch_fp = NULL;
 
 	return (input);
 }
@@ -212,6 +260,25 @@ nmsg_input_read(nmsg_input_t input, nmsg_message_t *msg) {
 	return (input->read_fp(input, msg));
 }
 
+nmsg_res
+nmsg_input_read_batch(nmsg_input_t input, nmsg_message_t *msgs, size_t max,
+		      size_t *n_msg)
+{
+	nmsg_res res;
+
+	*n_msg = 0;
+	if (max == 0)
+		return (nmsg_res_failure);
+
+	if (input->read_batch_fp != NULL)
+		return (input->read_batch_fp(input, msgs, max, n_msg));
+
+	res = input->read_fp(input, &msgs[0]);
+	if (res == nmsg_res_success)
+		*n_msg = 1;
+	return (res);
+}
+
 nmsg_res
 nmsg_input_loop(nmsg_input_t input, int cnt, nmsg_cb_message cb, void *user) {
 	int n_payloads = 0;
@@ -339,6 +406,180 @@ nmsg_input_set_verify_seqsrc(nmsg_input_t input, bool verify) {
 	return (nmsg_res_success);
 }
 
+#ifdef HAVE_RECVMMSG
+nmsg_res
+nmsg_input_set_recv_batch(nmsg_input_t input, unsigned n) {
+	struct nmsg_recv_batch *rb;
+
+	if (input->type != nmsg_input_type_stream ||
+	    input->stream->type != nmsg_stream_type_sock ||
+	    n > NMSG_RECV_BATCH_MAX)
+	{
+		return (nmsg_res_failure);
+	}
+
+	/* datagrams already in the ring must not be lost */
+	rb = input->stream->rb;
+	if (rb != NULL && rb->idx < rb->cnt)
+		return (nmsg_res_failure);
+	input_recv_batch_destroy(&input->stream->rb);
+
+	if (n <= 1)
+		return (nmsg_res_success);
+
+	rb = calloc(1, sizeof(*rb));
+	if (rb == NULL)
+		return (nmsg_res_memfail);
+	rb->n = n;
+	rb->bufs = calloc(n, sizeof(*rb->bufs));
+	rb->addrs = calloc(n, sizeof(*rb->addrs));
+	rb->mmsg = calloc(n, sizeof(*rb->mmsg));
+	rb->iov = calloc(n, sizeof(*rb->iov));
+	if (rb->bufs == NULL || rb->addrs == NULL ||
+	    rb->mmsg == NULL || rb->iov == NULL)
+	{
+		input_recv_batch_destroy(&rb);
+		return (nmsg_res_memfail);
+	}
+
+	for (unsigned i = 0; i < n; i++) {
+		rb->bufs[i] = _nmsg_buf_new(NMSG_IPSZ_MAX);
+		if (rb->bufs[i] == NULL) {
+			input_recv_batch_destroy(&rb);
+			return (nmsg_res_memfail);
+		}
+		/* the ring buffers don't own the socket */
+		rb->bufs[i]->fd = -1;
+		rb->bufs[i]->bufsz = NMSG_IPSZ_MAX;
+		_nmsg_buf_reset(rb->bufs[i]);
+
+		rb->iov[i].iov_base = rb->bufs[i]->data;
+		rb->iov[i].iov_len = rb->bufs[i]->bufsz;
+		rb->mmsg[i].msg_hdr.msg_iov = &rb->iov[i];
+		rb->mmsg[i].msg_hdr.msg_iovlen = 1;
+		rb->mmsg[i].msg_hdr.msg_name = &rb->addrs[i];
+	}
+
+	input->stream->rb = rb;
+	return (nmsg_res_success);
+}
+#else /* HAVE_RECVMMSG */
+nmsg_res
+nmsg_input_set_recv_batch(nmsg_input_t input __attribute__((unused)), unsigned n) {
+	if (n <= 1)
+		return (nmsg_res_success);
+	_nmsg_dprintf(1, "%s: compiled without recvmmsg() support\n", __func__);
+	return (nmsg_res_failure);
+}
+#endif /* HAVE_RECVMMSG */
+
+#ifdef HAVE_LIBURING
+nmsg_res
+nmsg_input_set_uring(nmsg_input_t input, unsigned depth) {
+	if (input->type != nmsg_input_type_stream ||
+	    input->stream->type != nmsg_stream_type_file ||
+	    input->stream->map != NULL ||
+	    depth > NMSG_URING_DEPTH_MAX)
+	{
+		return (nmsg_res_failure);
+	}
+
+	/* the file offset is restored to the first byte not yet consumed */
+	_nmsg_uring_destroy(&input->stream->uring);
+
+	if (depth == 0)
+		return (nmsg_res_success);
+
+	input->stream->uring = _nmsg_uring_init_reader(input->stream->buf->fd, depth);
+	if (input->stream->uring == NULL)
+		return (nmsg_res_failure);
+
+	return (nmsg_res_success);
+}
+#else /* HAVE_LIBURING */
+nmsg_res
+nmsg_input_set_uring(nmsg_input_t input __attribute__((unused)), unsigned depth) {
+	if (depth == 0)
+		return (nmsg_res_success);
+	_nmsg_dprintf(1, "%s: compiled without io_uring support\n", __func__);
+	return (nmsg_res_failure);
+}
+#endif /* HAVE_LIBURING */
+
+nmsg_res
+nmsg_input_set_index(nmsg_input_t input, int fd) {
+	struct nmsg_index *idx;
+	nmsg_res res;
+
+	if (input->type != nmsg_input_type_stream ||
+	    input->stream->type != nmsg_stream_type_file)
+	{
+		return (nmsg_res_failure);
+	}
+
+	res = _nmsg_index_load(fd, &idx);
+	if (res != nmsg_res_success)
+		return (res);
+	_nmsg_index_destroy(&input->stream->index);
+	input->stream->index = idx;
+
+	return (nmsg_res_success);
+}
+
+nmsg_res
+nmsg_input_set_time_range(nmsg_input_t input, const struct timespec *start,
+			  const struct timespec *end)
+{
+	struct nmsg_stream_input *stream;
+
+	if (input->type != nmsg_input_type_stream)
+		return (nmsg_res_failure);
+	stream = input->stream;
+
+	stream->has_time_start = (start != NULL);
+	if (start != NULL)
+		stream->time_start = *start;
+	stream->has_time_end = (end != NULL);
+	if (end != NULL)
+		stream->time_end = *end;
+	stream->do_time_range = (start != NULL || end != NULL);
+
+	return (nmsg_res_success);
+}
+
+nmsg_res
+nmsg_input_seek_time(nmsg_input_t input, const struct timespec *ts) {
+	const struct nmsg_index_entry *e;
+
+	if (input->type != nmsg_input_type_stream ||
+	    input->stream->type != nmsg_stream_type_file ||
+	    input->stream->index == NULL)
+	{
+		return (nmsg_res_failure);
+	}
+
+	e = _nmsg_index_find_time(input->stream->index, ts);
+	if (e == NULL)
+		return (nmsg_res_eof);
+
+	/* discard the rest of the current container */
+	if (input->stream->nmsg != NULL) {
+		input_flush(input);
+		input->stream->nmsg = NULL;
+	}
+
+	return (_input_nmsg_seek(input, e->offset));
+}
+
+nmsg_res
+nmsg_input_add_compression_dict(nmsg_input_t input,
+				const uint8_t *dict, size_t dict_len)
+{
+	if (input->type != nmsg_input_type_stream)
+		return (nmsg_res_failure);
+	return (nmsg_zbuf_load_dict(input->stream->zb, dict, dict_len, NULL));
+}
+
 nmsg_res
 nmsg_input_get_count_container_received(nmsg_input_t input, uint64_t *count) {
 	if (input->type == nmsg_input_type_stream) {
@@ -380,6 +621,13 @@ input_open_stream(nmsg_stream_type type, int fd) {
 	input->stream->buf->fd = fd;
 	input->stream->buf->bufsz = NMSG_RBUFSZ / 2;
 
+	/* file offsets are needed to seek with a container index */
+	if (type == nmsg_stream_type_file) {
+		off_t off = lseek(fd, 0, SEEK_CUR);
+		if (off != (off_t) -1)
+			input->stream->file_off = (uint64_t) off;
+	}
+
 	/* struct pollfd */
 	input->stream->pfd.fd = fd;
 	input->stream->pfd.events = POLLIN;
@@ -398,6 +646,7 @@ input_open_stream_base(nmsg_stream_type type) {
 	input->type = nmsg_input_type_stream;
 	input->read_fp = _input_nmsg_read;
 	input->read_loop_fp = _input_nmsg_loop;
+	input->read_batch_fp = _input_nmsg_read_batch;
 
 	/* nmsg_stream_input */
 	input->stream = calloc(1, sizeof(*(input->stream)));
@@ -447,10 +696,39 @@ input_close_stream(nmsg_input_t input) {
 
 	nmsg_zbuf_destroy(&input->stream->zb);
 	_input_frag_destroy(input->stream);
+	_nmsg_index_destroy(&input->stream->index);
+	if (input->stream->map != NULL) {
+		munmap(input->stream->map, input->stream->map_len);
+		input->stream->buf->data = NULL;
+	}
+#ifdef HAVE_LIBURING
+	_nmsg_uring_destroy(&input->stream->uring);
+#endif /* HAVE_LIBURING */
 	_nmsg_buf_destroy(&input->stream->buf);
+#ifdef HAVE_RECVMMSG
+	input_recv_batch_destroy(&input->stream->rb);
+#endif /* HAVE_RECVMMSG */
 	free(input->stream);
 }
 
+#ifdef HAVE_RECVMMSG
+static void
+input_recv_batch_destroy(struct nmsg_recv_batch **rb) {
+	if (*rb == NULL)
+		return;
+	if ((*rb)->bufs != NULL) {
+		for (unsigned i = 0; i < (*rb)->n; i++)
+			_nmsg_buf_destroy(&(*rb)->bufs[i]);
+		free((*rb)->bufs);
+	}
+	free((*rb)->addrs);
+	free((*rb)->mmsg);
+	free((*rb)->iov);
+	free(*rb);
+	*rb = NULL;
+}
+#endif /* HAVE_RECVMMSG */
+
 static nmsg_res
 input_flush(nmsg_input_t input) {
 	if (input->type == nmsg_input_type_stream) {
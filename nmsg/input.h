@@ -70,6 +70,28 @@ typedef enum {
 nmsg_input_t
 nmsg_input_open_file(int fd);
 
+/**
+ * Initialize a new NMSG stream input from a file, using a memory mapping of
+ * the file rather than read() calls. Containers are unpacked directly from the
+ * mapped pages, avoiding a copy into the input buffer. The kernel is advised
+ * that the mapping will be read sequentially and the pages ahead of the
+ * current position are prefetched.
+ *
+ * If 'fd' does not refer to a non-empty regular file, or cannot be mapped,
+ * this function behaves like nmsg_input_open_file().
+ *
+ * The mapping covers the file as it is when the input is opened. Data
+ * appended to the file later is not read, so a growing file is not followed,
+ * and the file must not be truncated while it is being read, since accessing
+ * mapped pages past the new end of the file raises SIGBUS.
+ *
+ * \param[in] fd Readable file descriptor of a regular file.
+ *
+ * \return Opaque pointer that is NULL on failure or non-NULL on success.
+ */
+nmsg_input_t
+nmsg_input_open_mmap(int fd);
+
 /**
  * Initialize a new NMSG stream input from a datagram socket source.
  *
@@ -231,6 +253,40 @@ nmsg_input_breakloop(nmsg_input_t input);
 nmsg_res
 nmsg_input_read(nmsg_input_t input, nmsg_message_t *msg);
 
+/**
+ * Read up to 'max' NMSG messages from an input with a single call.
+ *
+ * For NMSG stream inputs, the messages are taken from the payloads of a single
+ * NMSG container: the remainder of the container that is currently being
+ * read, or else the next container. Reading a container with more than 'max'
+ * payloads takes several calls. Other input types return at most one message
+ * per call.
+ *
+ * Batch reads and nmsg_input_read() calls may be mixed on the same input.
+ * The caller owns the returned messages, exactly as if they had been
+ * returned by nmsg_input_read().
+ *
+ * \param[in] input Valid nmsg_input_t.
+ *
+ * \param[out] msgs Array of at least 'max' elements where the nmsg_message_t
+ *	objects that were read will be stored.
+ *
+ * \param[in] max Maximum number of messages to read. Must be non-zero.
+ *
+ * \param[out] n_msg Number of messages stored in 'msgs'. Only non-zero if
+ *	#nmsg_res_success is returned.
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_failure
+ * \return #nmsg_res_again
+ * \return #nmsg_res_eof
+ * \return #nmsg_res_magic_mismatch
+ * \return #nmsg_res_version_mismatch
+ */
+nmsg_res
+nmsg_input_read_batch(nmsg_input_t input, nmsg_message_t *msgs, size_t max,
+		      size_t *n_msg);
+
 /**
  * Read zero, one, or more NMSG messages from a "null source" input. The caller
  * must supply a buffer containing the serialized NMSG container. This function
@@ -374,6 +430,150 @@ nmsg_input_set_byte_rate(nmsg_input_t input, size_t rate);
 nmsg_res
 nmsg_input_set_verify_seqsrc(nmsg_input_t input, bool verify);
 
+/**
+ * Configure batched datagram reception for a socket stream input. If 'n' is
+ * greater than 1, up to 'n' datagrams will be received per system call with
+ * recvmmsg() into a ring of receive buffers, and the NMSG containers in the
+ * ring will then be processed one datagram at a time. Sequence number
+ * tracking and fragment reassembly are performed per datagram, as with
+ * unbatched reception.
+ *
+ * Calling this function with 'n' set to 0 or 1 will disable batching.
+ *
+ * \param[in] input UDP socket based NMSG input object.
+ *
+ * \param[in] n Maximum number of datagrams to receive per system call. Must not
+ *	be larger than 1024.
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_memfail
+ * \return #nmsg_res_failure If the input is not a socket input, if received
+ *	datagrams are still pending in the ring, or if libnmsg was compiled
+ *	without recvmmsg() support.
+ */
+nmsg_res
+nmsg_input_set_recv_batch(nmsg_input_t input, unsigned n);
+
+/**
+ * Read a file stream input through io_uring. If 'depth' is non-zero, up to
+ * 'depth' fixed size reads are kept in flight ahead of the NMSG container
+ * parser at increasing file offsets, and each buffer is resubmitted at the
+ * next offset as soon as the parser has consumed it.
+ *
+ * Only regular files are supported, and the file must not grow while it is
+ * being read; the first short read is treated as the end of the file.
+ *
+ * Calling this function with 'depth' set to 0 will disable io_uring reads and
+ * restore the file offset to the first byte not yet consumed by the parser.
+ *
+ * \param[in] input NMSG file nmsg_input_t object.
+ *
+ * \param[in] depth Number of reads to keep in flight. Must not be larger than
+ *	256.
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_failure If the input is not a regular file input, if it
+ *	was opened with nmsg_input_open_mmap(), if the io_uring could not be
+ *	set up, or if libnmsg was compiled without io_uring support.
+ */
+nmsg_res
+nmsg_input_set_uring(nmsg_input_t input, unsigned depth);
+
+/**
+ * Load a container index for a file stream input. The index is read from 'fd'
+ * until end of file, and is usually a sidecar file written by
+ * nmsg_output_set_index() alongside the NMSG file that the input reads. The
+ * file descriptor is not closed.
+ *
+ * While an index is loaded, containers that the index shows to hold no
+ * payloads matching the input's time range (see nmsg_input_set_time_range())
+ * and its message type, source, operator, and group filters are skipped
+ * without being read or decompressed. Containers that are not in the index
+ * are read normally.
+ *
+ * \param[in] input NMSG file nmsg_input_t object.
+ *
+ * \param[in] fd Readable file descriptor of the index.
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_memfail
+ * \return #nmsg_res_errno If reading the index failed.
+ * \return #nmsg_res_magic_mismatch If 'fd' does not refer to an index.
+ * \return #nmsg_res_version_mismatch If the index format is not supported.
+ * \return #nmsg_res_failure If the input is not a file input.
+ */
+nmsg_res
+nmsg_input_set_index(nmsg_input_t input, int fd);
+
+/**
+ * Filter an NMSG input by payload time. Payloads with a timestamp earlier
+ * than 'start' or later than 'end' will be discarded. If a container index
+ * has been loaded with nmsg_input_set_index(), containers that hold only such
+ * payloads are skipped without being read.
+ *
+ * \param[in] input NMSG stream nmsg_input_t object.
+ *
+ * \param[in] start Earliest payload time, or NULL for no lower bound.
+ *
+ * \param[in] end Latest payload time, or NULL for no upper bound. Passing
+ *	NULL for both 'start' and 'end' disables the filter.
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_failure If the input is not an NMSG stream input.
+ */
+nmsg_res
+nmsg_input_set_time_range(nmsg_input_t input, const struct timespec *start,
+			  const struct timespec *end);
+
+/**
+ * Reposition a file stream input at the first container, in file order, that
+ * the container index shows may hold payloads with a timestamp at or after
+ * 'ts'. Any payloads remaining from the current container are discarded.
+ *
+ * Payload times are only roughly ordered within an NMSG file, so payloads
+ * earlier than 'ts' may still be read after seeking. Use
+ * nmsg_input_set_time_range() to discard them.
+ *
+ * This function must not be called while the input is being read by
+ * another thread, e.g. by an nmsg_io_t object.
+ *
+ * \param[in] input NMSG file nmsg_input_t object with a container index.
+ *
+ * \param[in] ts Payload time to seek to.
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_eof If no indexed container holds payloads at or after
+ *	'ts'.
+ * \return #nmsg_res_errno If the file could not be repositioned.
+ * \return #nmsg_res_failure If the input is not a file input, or if no index
+ *	has been loaded.
+ */
+nmsg_res
+nmsg_input_seek_time(nmsg_input_t input, const struct timespec *ts);
+
+/**
+ * Add a zstd dictionary to the set of dictionaries used to decompress the
+ * containers read by an NMSG stream input. Each zstd compressed container
+ * names the dictionary it was compressed with, if any, and is decoded with
+ * the loaded dictionary with the same ID. Containers that name a dictionary
+ * that has not been loaded cannot be decoded.
+ *
+ * \param[in] input NMSG stream nmsg_input_t object.
+ *
+ * \param[in] dict Dictionary, e.g. as created by nmsg_zbuf_train_dict(). The
+ *	dictionary is copied.
+ *
+ * \param[in] dict_len Length of the dictionary.
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_memfail
+ * \return #nmsg_res_failure
+ * \return #nmsg_res_notimpl If libnmsg was compiled without zstd support.
+ */
+nmsg_res
+nmsg_input_add_compression_dict(nmsg_input_t input,
+				const uint8_t *dict, size_t dict_len);
+
 /**
  * For UDP datagram socket nmsg_input_t objects, retrieve the total number of
  * NMSG containers that have been received since the nmsg_input_t object was
@@ -175,6 +175,7 @@ _input_frag_gc(struct nmsg_stream_input *stream) {
 
 static nmsg_res
 reassemble_frags(nmsg_input_t input, Nmsg__Nmsg **nmsg, struct nmsg_frag *fent) {
+	nmsg_compression_type codec;
 	nmsg_res res;
 	size_t len, padded_len;
 	uint8_t *payload, *ptr;
@@ -208,13 +209,19 @@ reassemble_frags(nmsg_input_t input, Nmsg__Nmsg **nmsg, struct nmsg_frag *fent)
 	free(fent->frags);
 
 	/* decompress */
-	if (input->stream->flags & NMSG_FLAG_ZLIB) {
+	res = _nmsg_zbuf_flags_to_compression(input->stream->flags, &codec);
+	if (res != nmsg_res_success) {
+		free(payload);
+		res = nmsg_res_parse_error;
+		goto reassemble_frags_out;
+	}
+	if (codec != nmsg_compression_none) {
 		size_t u_len;
 		u_char *u_buf, *z_buf;
 
 		z_buf = (u_char *) payload;
-		res = nmsg_zbuf_inflate(input->stream->zb, len, z_buf,
-					&u_len, &u_buf);
+		res = nmsg_zbuf_decompress(input->stream->zb, codec, len, z_buf,
+					   &u_len, &u_buf);
 		if (res != nmsg_res_success) {
 			free(payload);
 			goto reassemble_frags_out;
@@ -225,11 +232,7 @@ reassemble_frags(nmsg_input_t input, Nmsg__Nmsg **nmsg, struct nmsg_frag *fent)
 	}
 
 	/* unpack the defragmented payload */
-	*nmsg = nmsg__nmsg__unpack(NULL, len, payload);
-	if (nmsg != NULL)
-		res = nmsg_res_success;
-	else
-		res = nmsg_res_parse_error;
+	res = _input_nmsg_unpack(input, payload, len, nmsg);
 	free(payload);
 
 reassemble_frags_out:
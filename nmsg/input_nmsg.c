@@ -18,11 +18,23 @@
 
 #include "private.h"
 
+/* Macros. */
+
+#define NMSG_MMAP_READAHEAD	(16 * 1024 * 1024)
+
 /* Forward. */
 
+static void mmap_readahead(nmsg_input_t);
+static uint64_t input_offset(nmsg_input_t);
+static bool index_match(nmsg_input_t, const struct nmsg_index_entry *);
+static nmsg_res index_skip(nmsg_input_t);
 static nmsg_res read_file(nmsg_input_t, ssize_t *);
+static nmsg_res read_file_container(nmsg_input_t, ssize_t *);
 static nmsg_res do_read_file(nmsg_input_t, ssize_t, ssize_t);
 static nmsg_res do_read_sock(nmsg_input_t, ssize_t);
+#ifdef HAVE_RECVMMSG
+static nmsg_res do_read_sock_batch(nmsg_input_t, struct nmsg_buf **);
+#endif /* HAVE_RECVMMSG */
 
 /* Internal functions. */
 
@@ -32,7 +44,7 @@ _input_nmsg_read(nmsg_input_t input, nmsg_message_t *msg) {
 	nmsg_res res;
 
 	if (input->stream->nmsg != NULL &&
-	    input->stream->np_index >= input->stream->nmsg->n_payloads - 1)
+	    input->stream->np_index + 1 >= input->stream->nmsg->n_payloads)
 	{
 		input->stream->nmsg->n_payloads = 0;
 		nmsg__nmsg__free_unpacked(input->stream->nmsg, NULL);
@@ -46,6 +58,13 @@ _input_nmsg_read(nmsg_input_t input, nmsg_message_t *msg) {
 		if (res != nmsg_res_success)
 			return (res);
 		input->stream->np_index = 0;
+
+		/* every payload of the container may have been filtered out */
+		if (input->stream->nmsg->n_payloads == 0) {
+			nmsg__nmsg__free_unpacked(input->stream->nmsg, NULL);
+			input->stream->nmsg = NULL;
+			return (nmsg_res_again);
+		}
 	}
 
 	/* detach the payload from the original nmsg container */
@@ -53,7 +72,7 @@ _input_nmsg_read(nmsg_input_t input, nmsg_message_t *msg) {
 	input->stream->nmsg->payloads[input->stream->np_index] = NULL;
 
 	/* filter payload */
-	if (_input_nmsg_filter(input, input->stream->np_index, np) == false) {
+	if (_input_nmsg_filter(input, input->stream->nmsg, input->stream->np_index, np) == false) {
 		_nmsg_payload_free(&np);
 		return (nmsg_res_again);
 	}
@@ -73,6 +92,73 @@ _input_nmsg_read(nmsg_input_t input, nmsg_message_t *msg) {
 	return (nmsg_res_success);
 }
 
+nmsg_res
+_input_nmsg_read_batch(nmsg_input_t input, nmsg_message_t *msgs, size_t max,
+		       size_t *n_msg)
+{
+	struct nmsg_stream_input *stream = input->stream;
+	Nmsg__NmsgPayload *np;
+	nmsg_message_t msg;
+	nmsg_res res;
+
+	*n_msg = 0;
+
+	/* step past the last payload that was returned, as _input_nmsg_read()
+	 * does */
+	if (stream->nmsg != NULL && stream->np_index + 1 >= stream->nmsg->n_payloads) {
+		stream->nmsg->n_payloads = 0;
+		nmsg__nmsg__free_unpacked(stream->nmsg, NULL);
+		stream->nmsg = NULL;
+	} else if (stream->nmsg != NULL) {
+		stream->np_index += 1;
+	}
+
+	if (stream->nmsg == NULL) {
+		res = stream->stream_read_fp(input, &stream->nmsg);
+		if (res != nmsg_res_success)
+			return (res);
+		stream->np_index = 0;
+
+		/* every payload of the container may have been filtered out */
+		if (stream->nmsg->n_payloads == 0) {
+			nmsg__nmsg__free_unpacked(stream->nmsg, NULL);
+			stream->nmsg = NULL;
+			return (nmsg_res_again);
+		}
+	}
+
+	/* take payloads from the container until it or 'msgs' is exhausted,
+	 * leaving ->np_index at the last payload taken */
+	for (;;) {
+		np = stream->nmsg->payloads[stream->np_index];
+		stream->nmsg->payloads[stream->np_index] = NULL;
+
+		if (_input_nmsg_filter(input, stream->nmsg, stream->np_index, np)) {
+			msg = _nmsg_message_from_payload(np);
+			if (msg == NULL) {
+				_nmsg_payload_free(&np);
+				return (*n_msg > 0 ? nmsg_res_success : nmsg_res_memfail);
+			}
+			msgs[(*n_msg)++] = msg;
+
+			if (stream->brate != NULL)
+				_nmsg_brate_sleep(stream->brate, stream->nc_size,
+						  stream->nmsg->n_payloads,
+						  stream->np_index);
+		} else {
+			_nmsg_payload_free(&np);
+		}
+
+		if (*n_msg == max || stream->np_index + 1 >= stream->nmsg->n_payloads)
+			break;
+		stream->np_index += 1;
+	}
+
+	if (*n_msg == 0)
+		return (nmsg_res_again);
+	return (nmsg_res_success);
+}
+
 nmsg_res
 _input_nmsg_loop(nmsg_input_t input, int cnt, nmsg_cb_message cb, void *user) {
 	unsigned n;
@@ -95,7 +181,7 @@ _input_nmsg_loop(nmsg_input_t input, int cnt, nmsg_cb_message cb, void *user) {
 			nmsg = input->stream->nmsg;
 			for (n = 0; n < nmsg->n_payloads; n++) {
 				np = nmsg->payloads[n];
-				if (_input_nmsg_filter(input, n, np)) {
+				if (_input_nmsg_filter(input, nmsg, n, np)) {
 					msg = _nmsg_message_from_payload(np);
 					cb(msg, user);
 				}
@@ -122,7 +208,7 @@ _input_nmsg_loop(nmsg_input_t input, int cnt, nmsg_cb_message cb, void *user) {
 			nmsg = input->stream->nmsg;
 			for (n = 0; n < nmsg->n_payloads; n++) {
 				np = nmsg->payloads[n];
-				if (_input_nmsg_filter(input, n, np)) {
+				if (_input_nmsg_filter(input, nmsg, n, np)) {
 					if (n_payloads == cnt)
 						break;
 					n_payloads += 1;
@@ -144,12 +230,14 @@ _input_nmsg_loop(nmsg_input_t input, int cnt, nmsg_cb_message cb, void *user) {
 }
 
 bool
-_input_nmsg_filter(nmsg_input_t input, unsigned idx, Nmsg__NmsgPayload *np) {
-	assert(input->stream->nmsg != NULL);
+_input_nmsg_filter(nmsg_input_t input, Nmsg__Nmsg *nmsg, unsigned idx,
+		   Nmsg__NmsgPayload *np)
+{
+	assert(nmsg != NULL);
 
 	/* payload crc */
-	if (input->stream->nmsg->n_payload_crcs >= (idx + 1)) {
-		uint32_t wire_crc = input->stream->nmsg->payload_crcs[idx];
+	if (nmsg->n_payload_crcs >= (idx + 1)) {
+		uint32_t wire_crc = nmsg->payload_crcs[idx];
 		uint32_t calc_crc = my_crc32c(np->payload.data, np->payload.len);
 		if (ntohl(wire_crc) != calc_crc) {
 			_nmsg_dprintf(1, "libnmsg: WARNING: crc mismatch (%x != %x) [%s]\n",
@@ -158,6 +246,21 @@ _input_nmsg_filter(nmsg_input_t input, unsigned idx, Nmsg__NmsgPayload *np) {
 		}
 	}
 
+	return (_input_nmsg_filter_header(input, np));
+}
+
+bool
+_input_nmsg_filter_header(nmsg_input_t input, const Nmsg__NmsgPayload *np) {
+	/* time range */
+	if (input->stream->do_time_range) {
+		struct timespec ts;
+
+		ts.tv_sec = np->time_sec;
+		ts.tv_nsec = np->time_nsec;
+		if (!_nmsg_index_time_in_range(input->stream, &ts, &ts))
+			return (false);
+	}
+
 	/* (vid, msgtype) */
 	if (input->do_filter == true &&
 	    (input->filter_vid != np->vid ||
@@ -195,28 +298,30 @@ nmsg_res
 _input_nmsg_unpack_container(nmsg_input_t input, Nmsg__Nmsg **nmsg,
 			     uint8_t *buf, size_t buf_len)
 {
+	nmsg_compression_type codec;
 	nmsg_res res = nmsg_res_success;
 
 	input->stream->nc_size = buf_len + NMSG_HDRLSZ_V2;
 	_nmsg_dprintf(6, "%s: unpacking container len= %zd\n", __func__, buf_len);
 
+	res = _nmsg_zbuf_flags_to_compression(input->stream->flags, &codec);
+	if (res != nmsg_res_success)
+		return (nmsg_res_parse_error);
+
 	if (input->stream->flags & NMSG_FLAG_FRAGMENT) {
 		res = _input_frag_read(input, nmsg, buf, buf_len);
-	} else if (input->stream->flags & NMSG_FLAG_ZLIB) {
+	} else if (codec != nmsg_compression_none) {
 		size_t u_len;
 		u_char *u_buf;
 
-		res = nmsg_zbuf_inflate(input->stream->zb, buf_len, buf, &u_len, &u_buf);
+		res = nmsg_zbuf_decompress(input->stream->zb, codec,
+					   buf_len, buf, &u_len, &u_buf);
 		if (res != nmsg_res_success)
 			return (res);
-		*nmsg = nmsg__nmsg__unpack(NULL, u_len, u_buf);
+		res = _input_nmsg_unpack(input, u_buf, u_len, nmsg);
 		free(u_buf);
-		if (*nmsg == NULL)
-			return (nmsg_res_parse_error);
 	} else {
-		*nmsg = nmsg__nmsg__unpack(NULL, buf_len, buf);
-		if (*nmsg == NULL)
-			return (nmsg_res_parse_error);
+		res = _input_nmsg_unpack(input, buf, buf_len, nmsg);
 	}
 
 	return (res);
@@ -227,58 +332,80 @@ _input_nmsg_unpack_container2(const uint8_t *buf, size_t buf_len,
 			      unsigned flags, Nmsg__Nmsg **nmsg)
 {
 	nmsg_res res;
+	nmsg_zbuf_t zb = NULL;
+
+	if (flags & (NMSG_FLAG_ZLIB | NMSG_FLAG_ZSTD | NMSG_FLAG_LZ4)) {
+		zb = nmsg_zbuf_inflate_init();
+		if (zb == NULL)
+			return (nmsg_res_memfail);
+	}
+	res = _input_nmsg_decode_container(NULL, zb, buf, buf_len, flags, nmsg);
+	nmsg_zbuf_destroy(&zb);
+
+	return (res);
+}
+
+nmsg_res
+_input_nmsg_decode_container(nmsg_input_t input, nmsg_zbuf_t zb,
+			     const uint8_t *buf, size_t buf_len,
+			     unsigned flags, Nmsg__Nmsg **nmsg)
+{
+	nmsg_compression_type codec;
+	nmsg_res res;
 
 	/* fragmented containers aren't handled by this function */
 	if (flags & NMSG_FLAG_FRAGMENT)
 		return (nmsg_res_failure);
 
-	if (flags & NMSG_FLAG_ZLIB) {
+	res = _nmsg_zbuf_flags_to_compression(flags, &codec);
+	if (res != nmsg_res_success)
+		return (res);
+
+	if (codec != nmsg_compression_none) {
 		size_t u_len;
 		u_char *u_buf;
-		nmsg_zbuf_t zb;
 
-		zb = nmsg_zbuf_inflate_init();
-		if (zb == NULL)
-			return (nmsg_res_memfail);
-		res = nmsg_zbuf_inflate(zb, buf_len, (uint8_t *) buf, &u_len, &u_buf);
-		nmsg_zbuf_destroy(&zb);
+		res = nmsg_zbuf_decompress(zb, codec, buf_len, (uint8_t *) buf,
+					   &u_len, &u_buf);
 		if (res != nmsg_res_success)
 			return (res);
-		*nmsg = nmsg__nmsg__unpack(NULL, u_len, u_buf);
+		res = _input_nmsg_unpack(input, u_buf, u_len, nmsg);
 		free(u_buf);
-		if (*nmsg == NULL)
-			return (nmsg_res_failure);
 	} else {
-		*nmsg = nmsg__nmsg__unpack(NULL, buf_len, buf);
-		if (*nmsg == NULL)
-			return (nmsg_res_failure);
+		res = _input_nmsg_unpack(input, buf, buf_len, nmsg);
 	}
+	if (res == nmsg_res_parse_error)
+		res = nmsg_res_failure;
+
+	return (res);
+}
+
+nmsg_res
+_input_nmsg_unpack(nmsg_input_t input, const uint8_t *buf, size_t buf_len,
+		   Nmsg__Nmsg **nmsg)
+{
+	/* when payloads are filtered, only unpack the ones that pass */
+	if (input != NULL && _input_scan_enabled(input))
+		return (_input_scan_container(input, buf, buf_len, nmsg));
 
+	*nmsg = nmsg__nmsg__unpack(NULL, buf_len, buf);
+	if (*nmsg == NULL)
+		return (nmsg_res_parse_error);
 	return (nmsg_res_success);
 }
 
 nmsg_res
 _input_nmsg_read_container_file(nmsg_input_t input, Nmsg__Nmsg **nmsg) {
 	nmsg_res res;
-	ssize_t bytes_avail, msgsize = 0;
+	ssize_t msgsize = 0;
 
 	assert(input->stream->type == nmsg_stream_type_file);
 
 	/* read */
-	res = read_file(input, &msgsize);
+	res = read_file_container(input, &msgsize);
 	if (res != nmsg_res_success)
 		return (res);
 
-	/* ensure that the full NMSG container is available */
-	bytes_avail = _nmsg_buf_avail(input->stream->buf);
-	if (bytes_avail < msgsize) {
-		ssize_t bytes_to_read = msgsize - bytes_avail;
-
-		res = do_read_file(input, bytes_to_read, bytes_to_read);
-		if (res != nmsg_res_success)
-			return (res);
-	}
-
 	/* unpack message */
 	res = _input_nmsg_unpack_container(input, nmsg, input->stream->buf->pos, msgsize);
 	input->stream->buf->pos += msgsize;
@@ -286,6 +413,86 @@ _input_nmsg_read_container_file(nmsg_input_t input, Nmsg__Nmsg **nmsg) {
 	return (res);
 }
 
+nmsg_res
+_input_nmsg_read_container_raw(nmsg_input_t input, uint8_t **buf, size_t *buf_len,
+			       unsigned *flags, Nmsg__Nmsg **nmsg)
+{
+	nmsg_res res;
+	ssize_t msgsize = 0;
+
+	assert(input->stream->type == nmsg_stream_type_file);
+
+	*buf = NULL;
+	*nmsg = NULL;
+
+	/* read */
+	res = read_file_container(input, &msgsize);
+	if (res != nmsg_res_success)
+		return (res);
+	*flags = input->stream->flags;
+
+	if (input->stream->flags & NMSG_FLAG_FRAGMENT) {
+		/* fragment reassembly is stateful, so it is performed here */
+		res = _input_nmsg_unpack_container(input, nmsg,
+						   input->stream->buf->pos, msgsize);
+	} else {
+		*buf = malloc(msgsize);
+		if (*buf == NULL)
+			return (nmsg_res_memfail);
+		memcpy(*buf, input->stream->buf->pos, msgsize);
+		*buf_len = msgsize;
+		input->stream->nc_size = msgsize + NMSG_HDRLSZ_V2;
+	}
+	input->stream->buf->pos += msgsize;
+
+	return (res);
+}
+
+nmsg_res
+_input_nmsg_seek(nmsg_input_t input, uint64_t off) {
+	struct nmsg_stream_input *stream = input->stream;
+	struct nmsg_buf *buf = stream->buf;
+	uint64_t cur;
+#ifdef HAVE_LIBURING
+	unsigned depth = 0;
+#endif /* HAVE_LIBURING */
+
+	assert(stream->type == nmsg_stream_type_file);
+
+	if (stream->map != NULL) {
+		if (off > stream->map_len)
+			off = stream->map_len;
+		buf->pos = stream->map + off;
+		if (stream->map_advised < off)
+			stream->map_advised = off - off % NMSG_MMAP_READAHEAD;
+		return (nmsg_res_success);
+	}
+
+	/* stay within the data that has already been read if possible */
+	cur = input_offset(input);
+	if (off >= cur && off <= stream->file_off) {
+		buf->pos += off - cur;
+		return (nmsg_res_success);
+	}
+
+#ifdef HAVE_LIBURING
+	if (stream->uring != NULL) {
+		depth = stream->uring->depth;
+		_nmsg_uring_destroy(&stream->uring);
+	}
+#endif /* HAVE_LIBURING */
+	if (lseek(buf->fd, (off_t) off, SEEK_SET) == (off_t) -1)
+		return (nmsg_res_errno);
+	_nmsg_buf_reset(buf);
+	stream->file_off = off;
+#ifdef HAVE_LIBURING
+	if (depth > 0)
+		stream->uring = _nmsg_uring_init_reader(buf->fd, depth);
+#endif /* HAVE_LIBURING */
+
+	return (nmsg_res_success);
+}
+
 nmsg_res
 _input_nmsg_read_container_sock(nmsg_input_t input, Nmsg__Nmsg **nmsg) {
 	nmsg_res res;
@@ -295,8 +502,17 @@ _input_nmsg_read_container_sock(nmsg_input_t input, Nmsg__Nmsg **nmsg) {
 	assert(input->stream->type == nmsg_stream_type_sock);
 
 	/* read the NMSG container */
+#ifdef HAVE_RECVMMSG
+	if (input->stream->rb != NULL) {
+		res = do_read_sock_batch(input, &buf);
+	} else {
+		_nmsg_buf_reset(buf);
+		res = do_read_sock(input, buf->bufsz);
+	}
+#else /* HAVE_RECVMMSG */
 	_nmsg_buf_reset(buf);
 	res = do_read_sock(input, buf->bufsz);
+#endif /* HAVE_RECVMMSG */
 	if (res != nmsg_res_success) {
 		if (res == nmsg_res_read_failure)
 			return (res);
@@ -323,7 +539,7 @@ _input_nmsg_read_container_sock(nmsg_input_t input, Nmsg__Nmsg **nmsg) {
 
 	/* unpack message */
 	res = _input_nmsg_unpack_container(input, nmsg, buf->pos, msgsize);
-	input->stream->buf->pos += msgsize;
+	buf->pos += msgsize;
 
 	/* update counters */
 	if (*nmsg != NULL) {
@@ -445,6 +661,124 @@ _input_nmsg_deserialize_header(const uint8_t *buf, size_t buf_len,
 
 /* Private functions. */
 
+static nmsg_res
+read_file_container(nmsg_input_t input, ssize_t *msgsize) {
+	nmsg_res res;
+	ssize_t bytes_avail;
+
+	if (input->stream->index != NULL) {
+		res = index_skip(input);
+		if (res != nmsg_res_success)
+			return (res);
+	}
+
+	res = read_file(input, msgsize);
+	if (res != nmsg_res_success)
+		return (res);
+
+	/* ensure that the full NMSG container is available */
+	bytes_avail = _nmsg_buf_avail(input->stream->buf);
+	if (bytes_avail < *msgsize) {
+		ssize_t bytes_to_read = *msgsize - bytes_avail;
+
+		res = do_read_file(input, bytes_to_read, bytes_to_read);
+		if (res != nmsg_res_success)
+			return (res);
+	}
+
+	if (input->stream->map != NULL)
+		mmap_readahead(input);
+
+	return (nmsg_res_success);
+}
+
+static uint64_t
+input_offset(nmsg_input_t input) {
+	struct nmsg_stream_input *stream = input->stream;
+
+	if (stream->map != NULL)
+		return (stream->buf->pos - stream->map);
+	return (stream->file_off - _nmsg_buf_avail(stream->buf));
+}
+
+static bool
+index_match(nmsg_input_t input, const struct nmsg_index_entry *e) {
+	struct nmsg_stream_input *stream = input->stream;
+
+	if (stream->do_time_range &&
+	    !_nmsg_index_time_in_range(stream, &e->first, &e->last))
+	{
+		return (false);
+	}
+	if (input->do_filter &&
+	    !_nmsg_index_entry_has(e, nmsg_index_set_type,
+				   ((uint64_t) input->filter_vid << 32) |
+				   input->filter_msgtype))
+	{
+		return (false);
+	}
+	if (stream->source > 0 &&
+	    !_nmsg_index_entry_has(e, nmsg_index_set_source, stream->source))
+	{
+		return (false);
+	}
+	if (stream->operator > 0 &&
+	    !_nmsg_index_entry_has(e, nmsg_index_set_operator, stream->operator))
+	{
+		return (false);
+	}
+	if (stream->group > 0 &&
+	    !_nmsg_index_entry_has(e, nmsg_index_set_group, stream->group))
+	{
+		return (false);
+	}
+	return (true);
+}
+
+static nmsg_res
+index_skip(nmsg_input_t input) {
+	const struct nmsg_index_entry *e;
+	uint64_t off, skip_to;
+
+	/* find the end of the run of indexed containers at the current offset
+	 * that hold no wanted payloads, and seek past all of them at once.
+	 * containers that are not in the index are read normally. */
+	off = skip_to = input_offset(input);
+	for (;;) {
+		e = _nmsg_index_find(input->stream->index, off);
+		if (e == NULL || index_match(input, e))
+			break;
+		off = e->offset + e->len;
+		skip_to = off;
+	}
+	if (skip_to == input_offset(input))
+		return (nmsg_res_success);
+	return (_input_nmsg_seek(input, skip_to));
+}
+
+static void
+mmap_readahead(nmsg_input_t input) {
+	struct nmsg_stream_input *stream = input->stream;
+	size_t pos = stream->buf->pos - stream->map;
+	size_t len;
+
+	/* keep at least half of the readahead window in flight ahead of the
+	 * current position. the window offsets are multiples of the window
+	 * size and therefore page aligned. */
+	while (stream->map_advised < stream->map_len &&
+	       stream->map_advised < pos + NMSG_MMAP_READAHEAD / 2)
+	{
+		len = stream->map_len - stream->map_advised;
+		if (len > NMSG_MMAP_READAHEAD)
+			len = NMSG_MMAP_READAHEAD;
+#ifdef MADV_WILLNEED
+		(void) madvise(stream->map + stream->map_advised, len,
+			       MADV_WILLNEED);
+#endif
+		stream->map_advised += len;
+	}
+}
+
 static nmsg_res
 read_file(nmsg_input_t input, ssize_t *msgsize) {
 	static const char magic[] = NMSG_MAGIC;
@@ -542,6 +876,10 @@ do_read_file(nmsg_input_t input, ssize_t bytes_needed, ssize_t bytes_max) {
 	ssize_t bytes_read;
 	struct nmsg_buf *buf = input->stream->buf;
 
+	/* a mapped file is already entirely in the buffer */
+	if (input->stream->map != NULL)
+		return (nmsg_res_eof);
+
 	/* sanity check */
 	assert(bytes_needed <= bytes_max);
 
@@ -549,11 +887,18 @@ do_read_file(nmsg_input_t input, ssize_t bytes_needed, ssize_t bytes_max) {
 	assert((buf->end + bytes_max) <= (buf->data + NMSG_RBUFSZ));
 
 	while (bytes_needed > 0) {
+#ifdef HAVE_LIBURING
+		if (input->stream->uring != NULL)
+			bytes_read = _nmsg_uring_read(input->stream->uring,
+						      buf->end, bytes_max);
+		else
+#endif /* HAVE_LIBURING */
 		bytes_read = read(buf->fd, buf->end, bytes_max);
 		if (bytes_read < 0)
 			return (nmsg_res_failure);
 		if (bytes_read == 0)
 			return (nmsg_res_eof);
+		input->stream->file_off += bytes_read;
 		buf->end += bytes_read;
 		bytes_needed -= bytes_read;
 		bytes_max -= bytes_read;
@@ -596,3 +941,61 @@ do_read_sock(nmsg_input_t input, ssize_t bytes_max) {
 
 	return (nmsg_res_success);
 }
+
+#ifdef HAVE_RECVMMSG
+static nmsg_res
+do_read_sock_batch(nmsg_input_t input, struct nmsg_buf **pbuf) {
+	int ret;
+	struct nmsg_buf *buf;
+	struct nmsg_recv_batch *rb = input->stream->rb;
+
+	/* refill the ring once every received datagram has been drained */
+	if (rb->idx == rb->cnt) {
+		rb->idx = rb->cnt = 0;
+
+		if (input->stream->blocking_io == true) {
+			/* poll */
+			ret = poll(&input->stream->pfd, 1, NMSG_RBUF_TIMEOUT);
+			if (ret == 0 || (ret == -1 && errno == EINTR))
+				return (nmsg_res_again);
+			else if (ret == -1)
+				return (nmsg_res_read_failure);
+		}
+
+		for (unsigned i = 0; i < rb->n; i++)
+			rb->mmsg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+
+		/* read */
+		ret = recvmmsg(input->stream->buf->fd, rb->mmsg, rb->n,
+			       MSG_WAITFORONE, NULL);
+		nmsg_timespec_get(&input->stream->now);
+
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			return (nmsg_res_again);
+		if (ret < 0)
+			return (nmsg_res_read_failure);
+		if (ret == 0)
+			return (nmsg_res_again);
+
+		for (int i = 0; i < ret; i++) {
+			buf = rb->bufs[i];
+			buf->pos = buf->data;
+			buf->end = buf->data + rb->mmsg[i].msg_len;
+		}
+		rb->cnt = ret;
+	}
+
+	/* hand out the next datagram in the ring along with its sender, which
+	 * the seqsrc and fragment tracking code key on */
+	buf = rb->bufs[rb->idx];
+	memcpy(&input->stream->addr_ss, &rb->addrs[rb->idx],
+	       sizeof(input->stream->addr_ss));
+	rb->idx += 1;
+
+	if (buf->end == buf->pos)
+		return (nmsg_res_eof);
+	*pbuf = buf;
+
+	return (nmsg_res_success);
+}
+#endif /* HAVE_RECVMMSG */
@@ -69,6 +69,12 @@ nmsg_input_read_null(nmsg_input_t input, uint8_t *buf, size_t buf_len,
 	/* expire old outstanding fragments */
 	_input_frag_gc(input->stream);
 
+	/* every payload of the container may have been filtered out */
+	if (input->stream->nmsg != NULL && input->stream->nmsg->n_payloads == 0) {
+		nmsg__nmsg__free_unpacked(input->stream->nmsg, NULL);
+		input->stream->nmsg = NULL;
+	}
+
 	/* convert NMSG payloads to nmsg_message_t objects */
 	if (input->stream->nmsg != NULL) {
 		int msgarray_idx = 0;
@@ -90,7 +96,7 @@ nmsg_input_read_null(nmsg_input_t input, uint8_t *buf, size_t buf_len,
 			input->stream->nmsg->payloads[i] = NULL;
 
 			/* filter payload */
-			if (!_input_nmsg_filter(input, i, np)) {
+			if (!_input_nmsg_filter(input, input->stream->nmsg, i, np)) {
 				_nmsg_payload_free(&np);
 				*n_msg -= 1;
 				continue;
@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2013 by Farsight Security, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Filtering container scanner.
+ *
+ * When an input filters payloads, unpacking every payload of a container only
+ * to discard most of them is wasteful. Instead, the serialized Nmsg message is
+ * walked field by field, only the header fields of each NmsgPayload (vid,
+ * msgtype, time, source, operator, group) are decoded, and only the payloads
+ * that pass the input's filters are unpacked. Rejected payloads are neither
+ * allocated nor checksummed.
+ */
+
+/* Import. */
+
+#include "private.h"
+
+/* Macros. */
+
+#define WT_VARINT	0
+#define WT_FIXED64	1
+#define WT_BYTES	2
+#define WT_FIXED32	5
+
+/* Data structures. */
+
+struct scan_state {
+	Nmsg__NmsgPayload	**payloads;
+	unsigned		*index;		/* position in the container */
+	size_t			n_payloads;
+	size_t			n_alloc;
+	uint32_t		*crcs;
+	size_t			n_crcs;
+	size_t			n_crcs_alloc;
+};
+
+/* Forward. */
+
+static bool scan_varint(const uint8_t **, const uint8_t *, uint64_t *);
+static bool scan_skip(const uint8_t **, const uint8_t *, unsigned);
+static bool scan_payload_header(const uint8_t *, const uint8_t *, Nmsg__NmsgPayload *);
+static nmsg_res scan_add_payload(struct scan_state *, const uint8_t *, size_t, unsigned);
+static nmsg_res scan_add_crc(struct scan_state *, uint64_t);
+static void scan_state_free(struct scan_state *);
+
+/* Internal functions. */
+
+bool
+_input_scan_enabled(nmsg_input_t input) {
+	return (input->do_filter ||
+		input->stream->source > 0 ||
+		input->stream->operator > 0 ||
+		input->stream->group > 0 ||
+		input->stream->do_time_range);
+}
+
+nmsg_res
+_input_scan_container(nmsg_input_t input, const uint8_t *buf, size_t buf_len,
+		      Nmsg__Nmsg **nmsg)
+{
+	struct scan_state st = { 0 };
+	const uint8_t *p = buf, *end = buf + buf_len;
+	Nmsg__Nmsg *nc;
+	uint64_t tag, len, v;
+	unsigned n_seen = 0;
+	bool has_sequence = false, has_sequence_id = false;
+	uint32_t sequence = 0;
+	uint64_t sequence_id = 0;
+	nmsg_res res = nmsg_res_success;
+
+	while (p < end) {
+		if (!scan_varint(&p, end, &tag))
+			goto parse_error;
+
+		switch (tag) {
+		case (1 << 3) | WT_BYTES: {
+			/* payloads */
+			Nmsg__NmsgPayload hdr;
+
+			if (!scan_varint(&p, end, &len) || len > (uint64_t) (end - p))
+				goto parse_error;
+			nmsg__nmsg_payload__init(&hdr);
+			if (!scan_payload_header(p, p + len, &hdr))
+				goto parse_error;
+			if (_input_nmsg_filter_header(input, &hdr)) {
+				res = scan_add_payload(&st, p, len, n_seen);
+				if (res != nmsg_res_success)
+					goto out;
+			}
+			n_seen += 1;
+			p += len;
+			break;
+		}
+		case (2 << 3) | WT_VARINT:
+			/* payload_crcs */
+			if (!scan_varint(&p, end, &v))
+				goto parse_error;
+			res = scan_add_crc(&st, v);
+			if (res != nmsg_res_success)
+				goto out;
+			break;
+		case (2 << 3) | WT_BYTES: {
+			/* payload_crcs, packed */
+			const uint8_t *pend;
+
+			if (!scan_varint(&p, end, &len) || len > (uint64_t) (end - p))
+				goto parse_error;
+			pend = p + len;
+			while (p < pend) {
+				if (!scan_varint(&p, pend, &v))
+					goto parse_error;
+				res = scan_add_crc(&st, v);
+				if (res != nmsg_res_success)
+					goto out;
+			}
+			break;
+		}
+		case (3 << 3) | WT_VARINT:
+			if (!scan_varint(&p, end, &v))
+				goto parse_error;
+			sequence = (uint32_t) v;
+			has_sequence = true;
+			break;
+		case (4 << 3) | WT_VARINT:
+			if (!scan_varint(&p, end, &v))
+				goto parse_error;
+			sequence_id = v;
+			has_sequence_id = true;
+			break;
+		default:
+			if (!scan_skip(&p, end, (unsigned) (tag & 7)))
+				goto parse_error;
+			break;
+		}
+	}
+
+	nc = malloc(sizeof(*nc));
+	if (nc == NULL) {
+		res = nmsg_res_memfail;
+		goto out;
+	}
+	nmsg__nmsg__init(nc);
+	nc->n_payloads = st.n_payloads;
+	nc->payloads = st.payloads;
+	st.payloads = NULL;
+	nc->has_sequence = has_sequence;
+	nc->sequence = sequence;
+	nc->has_sequence_id = has_sequence_id;
+	nc->sequence_id = sequence_id;
+
+	/* keep the checksums of the payloads that were kept, at their new
+	 * positions. a container checksums either all or none of its payloads. */
+	if (st.n_crcs >= n_seen && st.n_payloads > 0) {
+		nc->payload_crcs = malloc(st.n_payloads * sizeof(*nc->payload_crcs));
+		if (nc->payload_crcs == NULL) {
+			nmsg__nmsg__free_unpacked(nc, NULL);
+			res = nmsg_res_memfail;
+			goto out;
+		}
+		for (size_t i = 0; i < st.n_payloads; i++)
+			nc->payload_crcs[i] = st.crcs[st.index[i]];
+		nc->n_payload_crcs = st.n_payloads;
+	}
+
+	*nmsg = nc;
+	goto out;
+
+parse_error:
+	res = nmsg_res_parse_error;
+out:
+	scan_state_free(&st);
+	return (res);
+}
+
+/* Private functions. */
+
+static bool
+scan_varint(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+	uint64_t val = 0;
+
+	for (unsigned shift = 0; shift < 64 && *p < end; shift += 7) {
+		uint8_t b = *(*p)++;
+
+		val |= (uint64_t) (b & 0x7f) << shift;
+		if ((b & 0x80) == 0) {
+			*v = val;
+			return (true);
+		}
+	}
+	return (false);
+}
+
+static bool
+scan_skip(const uint8_t **p, const uint8_t *end, unsigned wire_type) {
+	uint64_t v;
+
+	switch (wire_type) {
+	case WT_VARINT:
+		return (scan_varint(p, end, &v));
+	case WT_FIXED64:
+		v = 8;
+		break;
+	case WT_BYTES:
+		if (!scan_varint(p, end, &v))
+			return (false);
+		break;
+	case WT_FIXED32:
+		v = 4;
+		break;
+	default:
+		/* groups are not used by nmsg.proto */
+		return (false);
+	}
+	if (v > (uint64_t) (end - *p))
+		return (false);
+	*p += v;
+	return (true);
+}
+
+static bool
+scan_payload_header(const uint8_t *p, const uint8_t *end, Nmsg__NmsgPayload *np) {
+	uint64_t tag, v;
+
+	while (p < end) {
+		if (!scan_varint(&p, end, &tag))
+			return (false);
+
+		switch (tag) {
+		case (1 << 3) | WT_VARINT:
+			if (!scan_varint(&p, end, &v))
+				return (false);
+			np->vid = (uint32_t) v;
+			break;
+		case (2 << 3) | WT_VARINT:
+			if (!scan_varint(&p, end, &v))
+				return (false);
+			np->msgtype = (uint32_t) v;
+			break;
+		case (3 << 3) | WT_VARINT:
+			if (!scan_varint(&p, end, &v))
+				return (false);
+			np->time_sec = (int64_t) v;
+			break;
+		case (4 << 3) | WT_FIXED32:
+			if (end - p < 4)
+				return (false);
+			np->time_nsec = (uint32_t) p[0] |
+					(uint32_t) p[1] << 8 |
+					(uint32_t) p[2] << 16 |
+					(uint32_t) p[3] << 24;
+			p += 4;
+			break;
+		case (7 << 3) | WT_VARINT:
+			if (!scan_varint(&p, end, &v))
+				return (false);
+			np->source = (uint32_t) v;
+			np->has_source = true;
+			break;
+		case (8 << 3) | WT_VARINT:
+			if (!scan_varint(&p, end, &v))
+				return (false);
+			np->operator_ = (uint32_t) v;
+			np->has_operator_ = true;
+			break;
+		case (9 << 3) | WT_VARINT:
+			if (!scan_varint(&p, end, &v))
+				return (false);
+			np->group = (uint32_t) v;
+			np->has_group = true;
+			break;
+		default:
+			/* the payload data itself is stepped over */
+			if (!scan_skip(&p, end, (unsigned) (tag & 7)))
+				return (false);
+			break;
+		}
+	}
+	return (true);
+}
+
+static nmsg_res
+scan_add_payload(struct scan_state *st, const uint8_t *buf, size_t len,
+		 unsigned idx)
+{
+	Nmsg__NmsgPayload *np;
+
+	if (st->n_payloads == st->n_alloc) {
+		size_t n_alloc = st->n_alloc == 0 ? 16 : 2 * st->n_alloc;
+		Nmsg__NmsgPayload **payloads;
+		unsigned *index;
+
+		payloads = realloc(st->payloads, n_alloc * sizeof(*payloads));
+		if (payloads == NULL)
+			return (nmsg_res_memfail);
+		st->payloads = payloads;
+		index = realloc(st->index, n_alloc * sizeof(*index));
+		if (index == NULL)
+			return (nmsg_res_memfail);
+		st->index = index;
+		st->n_alloc = n_alloc;
+	}
+
+	np = nmsg__nmsg_payload__unpack(NULL, len, buf);
+	if (np == NULL)
+		return (nmsg_res_parse_error);
+	st->payloads[st->n_payloads] = np;
+	st->index[st->n_payloads] = idx;
+	st->n_payloads += 1;
+
+	return (nmsg_res_success);
+}
+
+static nmsg_res
+scan_add_crc(struct scan_state *st, uint64_t crc) {
+	if (st->n_crcs == st->n_crcs_alloc) {
+		size_t n_alloc = st->n_crcs_alloc == 0 ? 16 : 2 * st->n_crcs_alloc;
+		uint32_t *crcs;
+
+		crcs = realloc(st->crcs, n_alloc * sizeof(*crcs));
+		if (crcs == NULL)
+			return (nmsg_res_memfail);
+		st->crcs = crcs;
+		st->n_crcs_alloc = n_alloc;
+	}
+	st->crcs[st->n_crcs++] = (uint32_t) crc;
+
+	return (nmsg_res_success);
+}
+
+static void
+scan_state_free(struct scan_state *st) {
+	if (st->payloads != NULL) {
+		for (size_t i = 0; i < st->n_payloads; i++)
+			_nmsg_payload_free(&st->payloads[i]);
+		free(st->payloads);
+	}
+	free(st->index);
+	free(st->crcs);
+}
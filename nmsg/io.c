@@ -18,12 +18,22 @@
 
 #include "private.h"
 
+#include "libmy/lookup3.h"
+
+/* Macros. */
+
+/* maximum number of messages read from an input or written to an output
+ * queue with a single call */
+#define NMSG_IO_BATCH		64
+
 /* Private declarations. */
 
 struct nmsg_io;
 struct nmsg_io_input;
 struct nmsg_io_output;
 struct nmsg_io_thr;
+struct nmsg_io_job;
+struct nmsg_io_pipeline;
 
 struct nmsg_io_input {
 	ISC_LINK(struct nmsg_io_input)	link;
@@ -39,7 +49,20 @@ struct nmsg_io_output {
 	pthread_mutex_t			lock;
 	struct timespec			last;
 	void				*user;
-	uint64_t			count_nmsg_payload_out;
+	unsigned			idx;
+	atomic64_t			count_nmsg_payload_out;
+
+	/* writer thread and its queue */
+	struct nmsg_io_thr		*writer;
+	pthread_mutex_t			q_lock;
+	pthread_cond_t			q_cond_put;
+	pthread_cond_t			q_cond_get;
+	nmsg_message_t			*q;
+	unsigned			q_head;
+	unsigned			q_len;
+	bool				q_done;
+	uint64_t			count_queued;
+	uint64_t			count_dropped;
 };
 
 struct nmsg_io {
@@ -59,6 +82,15 @@ struct nmsg_io {
 	void				*atexit_user;
 	unsigned			n_inputs;
 	unsigned			n_outputs;
+	unsigned			n_decode_threads;
+	bool				decode_ordered;
+	unsigned			queue_depth;
+	nmsg_io_queue_policy		queue_policy;
+	struct nmsg_io_output		**output_array;
+	nmsg_io_key_fp			key_fp;
+	void				*key_user;
+	char				**hash_fields;
+	unsigned			n_hash_fields;
 };
 
 struct nmsg_io_thr {
@@ -69,6 +101,33 @@ struct nmsg_io_thr {
 	nmsg_res			res;
 	struct timespec			now;
 	struct nmsg_io_input		*io_input;
+	struct nmsg_io_pipeline		*pipeline;
+	struct nmsg_io_output		*io_output;
+	nmsg_container_t		*stage;
+	uint64_t			count_nmsg_payload_out;
+};
+
+struct nmsg_io_job {
+	ISC_LINK(struct nmsg_io_job)	link;
+	uint64_t			seq;
+	uint8_t				*buf;
+	size_t				buf_len;
+	unsigned			flags;
+	Nmsg__Nmsg			*nmsg;
+};
+
+struct nmsg_io_pipeline {
+	pthread_mutex_t			lock;
+	pthread_cond_t			cond_job;
+	pthread_cond_t			cond_space;
+	pthread_cond_t			cond_emit;
+	ISC_LIST(struct nmsg_io_job)	jobs;
+	unsigned			n_jobs;
+	unsigned			max_jobs;
+	uint64_t			seq_emit;
+	bool				eof;
+	bool				stop;
+	nmsg_res			res;
 };
 
 /* Forward. */
@@ -79,15 +138,71 @@ init_timespec_intervals(nmsg_io_t);
 static nmsg_res
 check_close_event(struct nmsg_io_thr *, struct nmsg_io_output *);
 
+static void
+io_flush_idle(struct nmsg_io_thr *);
+
 static void *
 io_thr_input(void *);
 
+static nmsg_res
+io_input_emit(struct nmsg_io_thr *, struct nmsg_io_output **, nmsg_message_t);
+
 static nmsg_res
 io_write(struct nmsg_io_thr *, struct nmsg_io_output *, nmsg_message_t);
 
+static nmsg_res
+io_write_batch(struct nmsg_io_thr *, struct nmsg_io_output *,
+	       nmsg_message_t *, size_t);
+
 static nmsg_res
 io_write_mirrored(struct nmsg_io_thr *, nmsg_message_t);
 
+static bool
+io_pipeline_eligible(struct nmsg_io_thr *);
+
+static void
+io_pipeline_read(struct nmsg_io_thr *);
+
+static void *
+io_thr_decode(void *);
+
+static nmsg_res
+io_pipeline_emit(struct nmsg_io_thr *, struct nmsg_io_job *,
+		 struct nmsg_io_output **);
+
+static void
+io_cond_wait(pthread_cond_t *, pthread_mutex_t *);
+
+static nmsg_res
+io_emit(struct nmsg_io_thr *, struct nmsg_io_output *, nmsg_message_t);
+
+static struct nmsg_io_output *
+io_hash_output(nmsg_io_t, nmsg_message_t);
+
+static uint32_t
+io_hash_fields(nmsg_io_t, nmsg_message_t);
+
+static nmsg_res
+io_enqueue(struct nmsg_io_thr *, struct nmsg_io_output *, nmsg_message_t);
+
+static void
+io_writers_start(nmsg_io_t);
+
+static nmsg_res
+io_writers_stop(nmsg_io_t);
+
+static void *
+io_thr_output(void *);
+
+static void
+io_stage_init(struct nmsg_io_thr *);
+
+static void
+io_stage_flush(struct nmsg_io_thr *, struct nmsg_io_output *);
+
+static void
+io_stage_destroy(struct nmsg_io_thr *);
+
 /* Export. */
 
 nmsg_io_t
@@ -135,6 +250,24 @@ nmsg_io_loop(nmsg_io_t io) {
 	if (io->interval > 0)
 		init_timespec_intervals(io);
 
+	if (io->queue_depth > 0)
+		io_writers_start(io);
+
+	/* index the outputs for the hash output mode */
+	if (io->output_mode == nmsg_io_output_mode_hash && io->n_outputs > 0) {
+		struct nmsg_io_output *io_output;
+
+		free(io->output_array);
+		io->output_array = calloc(io->n_outputs, sizeof(*io->output_array));
+		assert(io->output_array != NULL);
+		for (io_output = ISC_LIST_HEAD(io->io_outputs);
+		     io_output != NULL;
+		     io_output = ISC_LIST_NEXT(io_output, link))
+		{
+			io->output_array[io_output->idx] = io_output;
+		}
+	}
+
 	threadno = 0;
 	/* create io_input threads */
 	for (io_input = ISC_LIST_HEAD(io->io_inputs);
@@ -166,10 +299,15 @@ nmsg_io_loop(nmsg_io_t io) {
 				       iothr, nmsg_res_lookup(iothr->res));
 			res = nmsg_res_failure;
 		}
+		io->count_nmsg_payload_out += iothr->count_nmsg_payload_out;
 		free(iothr);
 		iothr = iothr_next;
 	}
 
+	/* drain the output queues and wait for the writer threads */
+	if (io->queue_depth > 0 && io_writers_stop(io) != nmsg_res_success)
+		res = nmsg_res_failure;
+
 	io->stopped = true;
 
 	return (res);
@@ -222,6 +360,9 @@ nmsg_io_destroy(nmsg_io_t *io) {
 		if (io_output->output != NULL) {
 			nmsg_output_close(&io_output->output);
 		}
+		pthread_mutex_destroy(&io_output->q_lock);
+		pthread_cond_destroy(&io_output->q_cond_put);
+		pthread_cond_destroy(&io_output->q_cond_get);
 		free(io_output);
 		io_output = io_output_next;
 	}
@@ -232,6 +373,10 @@ nmsg_io_destroy(nmsg_io_t *io) {
 			       " count_nmsg_payload_out=%" PRIu64 "\n",
 			       (*io),
 			       (*io)->count_nmsg_payload_out);
+	for (unsigned i = 0; i < (*io)->n_hash_fields; i++)
+		free((*io)->hash_fields[i]);
+	free((*io)->hash_fields);
+	free((*io)->output_array);
 	free(*io);
 	*io = NULL;
 }
@@ -274,9 +419,13 @@ nmsg_io_add_output(nmsg_io_t io, nmsg_output_t output, void *user) {
 	io_output->output = output;
 	io_output->user = user;
 	pthread_mutex_init(&io_output->lock, NULL);
+	pthread_mutex_init(&io_output->q_lock, NULL);
+	pthread_cond_init(&io_output->q_cond_put, NULL);
+	pthread_cond_init(&io_output->q_cond_get, NULL);
 
 	/* add to nmsg_io output list */
 	pthread_mutex_lock(&io->lock);
+	io_output->idx = io->n_outputs;
 	ISC_LIST_APPEND(io->io_outputs, io_output, link);
 	pthread_mutex_unlock(&io->lock);
 
@@ -525,10 +674,87 @@ nmsg_io_set_output_mode(nmsg_io_t io, nmsg_io_output_mode output_mode) {
 	switch (output_mode) {
 	case nmsg_io_output_mode_stripe:
 	case nmsg_io_output_mode_mirror:
+	case nmsg_io_output_mode_hash:
 		io->output_mode = output_mode;
 	}
 }
 
+void
+nmsg_io_set_output_hash_fp(nmsg_io_t io, nmsg_io_key_fp key_fp, void *user) {
+	io->key_fp = key_fp;
+	io->key_user = user;
+}
+
+nmsg_res
+nmsg_io_set_output_hash_fields(nmsg_io_t io, const char *fields) {
+	char *str, *tok, *saveptr = NULL;
+	char **hash_fields;
+
+	str = strdup(fields);
+	if (str == NULL)
+		return (nmsg_res_memfail);
+
+	for (tok = strtok_r(str, ",", &saveptr);
+	     tok != NULL;
+	     tok = strtok_r(NULL, ",", &saveptr))
+	{
+		hash_fields = realloc(io->hash_fields,
+				      (io->n_hash_fields + 1) * sizeof(char *));
+		if (hash_fields == NULL) {
+			free(str);
+			return (nmsg_res_memfail);
+		}
+		io->hash_fields = hash_fields;
+		io->hash_fields[io->n_hash_fields] = strdup(tok);
+		if (io->hash_fields[io->n_hash_fields] == NULL) {
+			free(str);
+			return (nmsg_res_memfail);
+		}
+		io->n_hash_fields += 1;
+	}
+	free(str);
+
+	return (nmsg_res_success);
+}
+
+void
+nmsg_io_set_decode_threads(nmsg_io_t io, unsigned n_threads, bool ordered) {
+	io->n_decode_threads = n_threads;
+	io->decode_ordered = ordered;
+}
+
+void
+nmsg_io_set_output_queue(nmsg_io_t io, unsigned depth,
+			 nmsg_io_queue_policy policy)
+{
+	io->queue_depth = depth;
+	switch (policy) {
+	case nmsg_io_queue_policy_block:
+	case nmsg_io_queue_policy_drop_newest:
+	case nmsg_io_queue_policy_drop_oldest:
+		io->queue_policy = policy;
+	}
+}
+
+void
+nmsg_io_get_output_queue_stats(nmsg_io_t io, uint64_t *count_queued,
+			       uint64_t *count_dropped)
+{
+	struct nmsg_io_output *io_output;
+
+	*count_queued = 0;
+	*count_dropped = 0;
+	for (io_output = ISC_LIST_HEAD(io->io_outputs);
+	     io_output != NULL;
+	     io_output = ISC_LIST_NEXT(io_output, link))
+	{
+		pthread_mutex_lock(&io_output->q_lock);
+		*count_queued += io_output->count_queued;
+		*count_dropped += io_output->count_dropped;
+		pthread_mutex_unlock(&io_output->q_lock);
+	}
+}
+
 /* Private functions. */
 
 static void
@@ -555,33 +781,85 @@ io_write(struct nmsg_io_thr *iothr, struct nmsg_io_output *io_output,
 	nmsg_io_t io = iothr->io;
 	nmsg_res res;
 
-	if (io->close_fp == NULL) {
+	if (io->close_fp != NULL) {
+		/* the output may be closed by another thread */
+		pthread_mutex_lock(&io_output->lock);
+		if (io_output->output == NULL) {
+			pthread_mutex_unlock(&io_output->lock);
+			nmsg_message_destroy(&msg);
+			return (nmsg_res_stop);
+		}
+	}
+
+	if (iothr->stage != NULL && _output_nmsg_can_stage(io_output->output)) {
+		res = _output_nmsg_write_staged(io_output->output,
+						&iothr->stage[io_output->idx],
+						msg);
+		nmsg_message_destroy(&msg);
+	} else {
 		res = nmsg_output_write(io_output->output, msg);
 		if (io_output->output->type != nmsg_output_type_callback)
 			nmsg_message_destroy(&msg);
-	} else {
+	}
+
+	if (io->close_fp != NULL)
+		pthread_mutex_unlock(&io_output->lock);
+
+	if (res != nmsg_res_success)
+		return (res);
+
+	atomic64_inc(&io_output->count_nmsg_payload_out);
+	iothr->count_nmsg_payload_out += 1;
+
+	return (res);
+}
+
+static nmsg_res
+io_write_batch(struct nmsg_io_thr *iothr, struct nmsg_io_output *io_output,
+	       nmsg_message_t *msgs, size_t n_msg)
+{
+	nmsg_io_t io = iothr->io;
+	nmsg_res res = nmsg_res_success;
+	size_t i;
+
+	if (io->close_fp != NULL) {
+		/* the output may be closed by another thread */
 		pthread_mutex_lock(&io_output->lock);
 		if (io_output->output == NULL) {
 			pthread_mutex_unlock(&io_output->lock);
+			for (i = 0; i < n_msg; i++)
+				nmsg_message_destroy(&msgs[i]);
 			return (nmsg_res_stop);
 		}
-		res = nmsg_output_write(io_output->output, msg);
-		if (io_output->output->type != nmsg_output_type_callback) {
-			pthread_mutex_unlock(&io_output->lock);
-			nmsg_message_destroy(&msg);
+	}
+
+	if (io_output->output->type == nmsg_output_type_callback) {
+		/* callback outputs take ownership of each message written */
+		for (i = 0; i < n_msg && res == nmsg_res_success; i++)
+			res = nmsg_output_write(io_output->output, msgs[i]);
+		for (; i < n_msg; i++)
+			nmsg_message_destroy(&msgs[i]);
+	} else {
+		if (iothr->stage != NULL && _output_nmsg_can_stage(io_output->output)) {
+			for (i = 0; i < n_msg && res == nmsg_res_success; i++)
+				res = _output_nmsg_write_staged(io_output->output,
+								&iothr->stage[io_output->idx],
+								msgs[i]);
 		} else {
-			pthread_mutex_unlock(&io_output->lock);
+			res = nmsg_output_write_batch(io_output->output, msgs, n_msg);
 		}
+		for (i = 0; i < n_msg; i++)
+			nmsg_message_destroy(&msgs[i]);
 	}
 
+	if (io->close_fp != NULL)
+		pthread_mutex_unlock(&io_output->lock);
+
 	if (res != nmsg_res_success)
 		return (res);
 
-	io_output->count_nmsg_payload_out += 1;
-
-	pthread_mutex_lock(&io->lock);
-	io->count_nmsg_payload_out += 1;
-	pthread_mutex_unlock(&io->lock);
+	atomic64_add((int) n_msg, &io_output->count_nmsg_payload_out);
+	iothr->count_nmsg_payload_out += n_msg;
 
 	return (res);
 }
@@ -602,8 +880,8 @@ check_close_event(struct nmsg_io_thr *iothr, struct nmsg_io_output *io_output) {
 
 	/* count check */
 	if (io->count > 0 &&
-	    io_output->count_nmsg_payload_out > 0 &&
-	    io_output->count_nmsg_payload_out % io->count == 0)
+	    atomic64_read(&io_output->count_nmsg_payload_out) > 0 &&
+	    atomic64_read(&io_output->count_nmsg_payload_out) % io->count == 0)
 	{
 		if (io->close_fp != NULL) {
 			/* close notification is enabled */
@@ -635,6 +913,7 @@ check_close_event(struct nmsg_io_thr *iothr, struct nmsg_io_output *io_output) {
 		if (io->close_fp != NULL) {
 			/* close notification is enabled */
 			struct timespec now = iothr->now;
+
 			now.tv_nsec = 0;
 			now.tv_sec = now.tv_sec - (now.tv_sec % io->interval);
 			io_output->last = now;
@@ -666,6 +945,28 @@ out:
 	return (res);
 }
 
+static void
+io_flush_idle(struct nmsg_io_thr *iothr) {
+	nmsg_io_t io = iothr->io;
+	struct nmsg_io_output *io_output;
+
+	/* write out presentation output that is waiting in its buffer */
+	for (io_output = ISC_LIST_HEAD(io->io_outputs);
+	     io_output != NULL;
+	     io_output = ISC_LIST_NEXT(io_output, link))
+	{
+		if (io->close_fp != NULL)
+			pthread_mutex_lock(&io_output->lock);
+		if (io_output->output != NULL &&
+		    io_output->output->type == nmsg_output_type_pres)
+		{
+			(void) nmsg_output_flush(io_output->output);
+		}
+		if (io->close_fp != NULL)
+			pthread_mutex_unlock(&io_output->lock);
+	}
+}
+
 static nmsg_res
 io_write_mirrored(struct nmsg_io_thr *iothr, nmsg_message_t msg) {
 	nmsg_message_t msgdup;
@@ -677,9 +978,18 @@ io_write_mirrored(struct nmsg_io_thr *iothr, nmsg_message_t msg) {
 	     io_output != NULL;
 	     io_output = ISC_LIST_NEXT(io_output, link))
 	{
-		msgdup = _nmsg_message_dup(msg);
+		/* the last output gets the original message */
+		if (ISC_LIST_NEXT(io_output, link) == NULL)
+			return (io_emit(iothr, io_output, msg));
+
+		/* the other outputs get copies that share its payload data */
+		msgdup = _nmsg_message_dup_shared(msg);
+		if (msgdup == NULL) {
+			res = nmsg_res_memfail;
+			break;
+		}
 
-		res = io_write(iothr, io_output, msgdup);
+		res = io_emit(iothr, io_output, msgdup);
 		if (res != nmsg_res_success)
 			break;
 	}
@@ -690,14 +1000,14 @@ io_write_mirrored(struct nmsg_io_thr *iothr, nmsg_message_t msg) {
 
 static void *
 io_thr_input(void *user) {
-	nmsg_message_t msg;
+	nmsg_message_t msgs[NMSG_IO_BATCH];
+	size_t n_msg, i;
 	nmsg_res res;
 	struct nmsg_io *io;
 	struct nmsg_io_input *io_input;
 	struct nmsg_io_output *io_output;
 	struct nmsg_io_thr *iothr;
 
-	msg = NULL;
 	iothr = (struct nmsg_io_thr *) user;
 	io = iothr->io;
 	io_input = iothr->io_input;
@@ -716,18 +1026,29 @@ io_thr_input(void *user) {
 	if (io->atstart_fp != NULL)
 		io->atstart_fp(iothr->threadno, io->atstart_user);
 
-	/* loop over input */
+	/* hand off to the decode pipeline, if enabled */
+	if (io_pipeline_eligible(iothr)) {
+		io_pipeline_read(iothr);
+		goto out;
+	}
+
+	io_stage_init(iothr);
+
+	/* loop over input, a container's worth of messages at a time */
 	for (;;) {
 		nmsg_timespec_get(&iothr->now);
-		res = nmsg_input_read(io_input->input, &msg);
+		res = nmsg_input_read_batch(io_input->input, msgs, NMSG_IO_BATCH,
+					    &n_msg);
 
 		if (io->stop == true) {
-			if (res == nmsg_res_success && msg != NULL)
-				nmsg_message_destroy(&msg);
+			for (i = 0; i < n_msg; i++)
+				nmsg_message_destroy(&msgs[i]);
 			break;
 		}
 		if (res == nmsg_res_again) {
-			res = check_close_event(iothr, io_output);
+			io_flush_idle(iothr);
+			if (io->queue_depth == 0)
+				res = check_close_event(iothr, io_output);
 			if (io->stop == true)
 				break;
 			continue;
@@ -737,38 +1058,664 @@ io_thr_input(void *user) {
 			break;
 		}
 
-		assert(msg != NULL);
+		for (i = 0; i < n_msg; i++) {
+			res = io_input_emit(iothr, &io_output, msgs[i]);
+			if (res != nmsg_res_success || io->stop == true)
+				break;
+		}
+		if (i < n_msg) {
+			/* discard the rest of the batch */
+			for (i += 1; i < n_msg; i++)
+				nmsg_message_destroy(&msgs[i]);
+			break;
+		}
+	}
+
+	io_stage_destroy(iothr);
 
-		io_input->count_nmsg_payload_in += 1;
+out:
+	/* call user function */
+	if (io->atexit_fp != NULL)
+		io->atexit_fp(iothr->threadno, io->atexit_user);
 
-		if (io->output_mode == nmsg_io_output_mode_stripe)
-			res = io_write(iothr, io_output, msg);
-		else if (io->output_mode == nmsg_io_output_mode_mirror)
-			res = io_write_mirrored(iothr, msg);
+	_nmsg_dprintfv(io->debug, 2,
+		       "nmsg_io: iothr=%p count_nmsg_payload_in=%" PRIu64 "\n",
+		       iothr, io_input->count_nmsg_payload_in);
+	return (NULL);
+}
+
+static nmsg_res
+io_input_emit(struct nmsg_io_thr *iothr, struct nmsg_io_output **io_output,
+	      nmsg_message_t msg)
+{
+	nmsg_io_t io = iothr->io;
+	nmsg_res res = nmsg_res_success;
+
+	iothr->io_input->count_nmsg_payload_in += 1;
+
+	if (io->output_mode == nmsg_io_output_mode_stripe) {
+		res = io_emit(iothr, *io_output, msg);
+	} else if (io->output_mode == nmsg_io_output_mode_mirror) {
+		res = io_write_mirrored(iothr, msg);
+	} else if (io->output_mode == nmsg_io_output_mode_hash) {
+		*io_output = io_hash_output(io, msg);
+		res = io_emit(iothr, *io_output, msg);
+	}
+
+	if (res != nmsg_res_success) {
+		iothr->res = res;
+		return (res);
+	}
+
+	if (io->queue_depth == 0)
+		(void) check_close_event(iothr, *io_output);
+	if (io->stop == true)
+		return (nmsg_res_success);
+
+	*io_output = ISC_LIST_NEXT(*io_output, link);
+	if (*io_output == NULL)
+		*io_output = ISC_LIST_HEAD(io->io_outputs);
+
+	return (nmsg_res_success);
+}
+
+static bool
+io_pipeline_eligible(struct nmsg_io_thr *iothr) {
+	nmsg_input_t input = iothr->io_input->input;
 
+	/* only file inputs can be read ahead of the decoders; the other input
+	 * types are bounded by the rate at which they are received */
+	return (iothr->io->n_decode_threads > 0 &&
+		input->type == nmsg_input_type_stream &&
+		input->stream->type == nmsg_stream_type_file);
+}
+
+static void
+io_pipeline_read(struct nmsg_io_thr *iothr) {
+	struct nmsg_io_pipeline pl;
+	struct nmsg_io_thr *workers;
+	struct nmsg_io_job *job;
+	nmsg_io_t io = iothr->io;
+	nmsg_input_t input = iothr->io_input->input;
+	nmsg_res res;
+	uint64_t seq = 0;
+	unsigned n_workers = io->n_decode_threads;
+
+	memset(&pl, 0, sizeof(pl));
+	pthread_mutex_init(&pl.lock, NULL);
+	pthread_cond_init(&pl.cond_job, NULL);
+	pthread_cond_init(&pl.cond_space, NULL);
+	pthread_cond_init(&pl.cond_emit, NULL);
+	ISC_LIST_INIT(pl.jobs);
+	pl.max_jobs = 2 * n_workers;
+	pl.res = nmsg_res_success;
+
+	/* create decode threads */
+	workers = calloc(n_workers, sizeof(*workers));
+	assert(workers != NULL);
+	for (unsigned i = 0; i < n_workers; i++) {
+		workers[i].io = io;
+		workers[i].io_input = iothr->io_input;
+		workers[i].threadno = i;
+		workers[i].pipeline = &pl;
+		assert(pthread_create(&workers[i].thr, NULL, io_thr_decode,
+				      &workers[i]) == 0);
+	}
+
+	_nmsg_dprintfv(io->debug, 4, "nmsg_io: started %u decode threads for "
+		       "input thread @ %p\n", n_workers, iothr);
+
+	/* frame raw containers and queue them to the decode threads */
+	for (;;) {
+		if (io->stop == true || pl.stop == true)
+			break;
+
+		job = calloc(1, sizeof(*job));
+		assert(job != NULL);
+		res = _input_nmsg_read_container_raw(input, &job->buf,
+						     &job->buf_len,
+						     &job->flags,
+						     &job->nmsg);
 		if (res != nmsg_res_success) {
+			free(job->buf);
+			free(job);
+			/* incomplete fragmented container */
+			if (res == nmsg_res_again)
+				continue;
 			iothr->res = res;
 			break;
 		}
-
-		res = check_close_event(iothr, io_output);
-		if (io->stop == true)
+		ISC_LINK_INIT(job, link);
+		job->seq = seq++;
+
+		pthread_mutex_lock(&pl.lock);
+		while (pl.n_jobs >= pl.max_jobs && !pl.stop && !io->stop)
+			io_cond_wait(&pl.cond_space, &pl.lock);
+		if (pl.stop || io->stop) {
+			pthread_mutex_unlock(&pl.lock);
+			free(job->buf);
+			if (job->nmsg != NULL)
+				nmsg__nmsg__free_unpacked(job->nmsg, NULL);
+			free(job);
 			break;
+		}
+		ISC_LIST_APPEND(pl.jobs, job, link);
+		pl.n_jobs += 1;
+		pthread_cond_signal(&pl.cond_job);
+		pthread_mutex_unlock(&pl.lock);
+	}
 
+	/* drain the queue and wait for the decode threads */
+	pthread_mutex_lock(&pl.lock);
+	pl.eof = true;
+	pthread_cond_broadcast(&pl.cond_job);
+	pthread_cond_broadcast(&pl.cond_emit);
+	pthread_mutex_unlock(&pl.lock);
+
+	for (unsigned i = 0; i < n_workers; i++) {
+		assert(pthread_join(workers[i].thr, NULL) == 0);
+		iothr->count_nmsg_payload_out += workers[i].count_nmsg_payload_out;
+	}
+	free(workers);
+
+	/* free any jobs left behind by an early stop */
+	while ((job = ISC_LIST_HEAD(pl.jobs)) != NULL) {
+		ISC_LIST_UNLINK(pl.jobs, job, link);
+		free(job->buf);
+		if (job->nmsg != NULL)
+			nmsg__nmsg__free_unpacked(job->nmsg, NULL);
+		free(job);
+	}
+
+	if (pl.res != nmsg_res_success)
+		iothr->res = pl.res;
+
+	pthread_cond_destroy(&pl.cond_job);
+	pthread_cond_destroy(&pl.cond_space);
+	pthread_cond_destroy(&pl.cond_emit);
+	pthread_mutex_destroy(&pl.lock);
+}
+
+static void *
+io_thr_decode(void *user) {
+	struct nmsg_io_thr *iothr = (struct nmsg_io_thr *) user;
+	struct nmsg_io_pipeline *pl = iothr->pipeline;
+	struct nmsg_io_output *io_output;
+	struct nmsg_io_job *job;
+	nmsg_io_t io = iothr->io;
+	nmsg_zbuf_t zb;
+	nmsg_res res;
+
+	/* start each decode thread on a different output */
+	io_output = ISC_LIST_HEAD(io->io_outputs);
+	for (int i = 0; i < iothr->threadno; i++) {
 		io_output = ISC_LIST_NEXT(io_output, link);
 		if (io_output == NULL)
 			io_output = ISC_LIST_HEAD(io->io_outputs);
+	}
+
+	/* staged containers would be handed off out of order */
+	if (!io->decode_ordered)
+		io_stage_init(iothr);
+
+	zb = _nmsg_zbuf_inflate_init_shared(iothr->io_input->input->stream->zb);
+	if (zb == NULL) {
+		res = nmsg_res_memfail;
+		goto fail;
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&pl->lock);
+		while (ISC_LIST_EMPTY(pl->jobs) && !pl->eof && !pl->stop && !io->stop)
+			io_cond_wait(&pl->cond_job, &pl->lock);
+		job = ISC_LIST_HEAD(pl->jobs);
+		if (job == NULL || pl->stop || io->stop) {
+			pthread_mutex_unlock(&pl->lock);
+			break;
+		}
+		ISC_LIST_UNLINK(pl->jobs, job, link);
+		pl->n_jobs -= 1;
+		pthread_cond_signal(&pl->cond_space);
+		pthread_mutex_unlock(&pl->lock);
+
+		/* inflate and unpack */
+		res = nmsg_res_success;
+		if (job->nmsg == NULL) {
+			res = _input_nmsg_decode_container(iothr->io_input->input,
+							   zb, job->buf,
+							   job->buf_len,
+							   job->flags,
+							   &job->nmsg);
+			free(job->buf);
+			job->buf = NULL;
+		}
+		if (res == nmsg_res_success)
+			res = io_pipeline_emit(iothr, job, &io_output);
+		if (job->nmsg != NULL)
+			nmsg__nmsg__free_unpacked(job->nmsg, NULL);
+		free(job);
+		if (res != nmsg_res_success)
+			goto fail;
+	}
+
+	io_stage_destroy(iothr);
+	nmsg_zbuf_destroy(&zb);
+	return (NULL);
+
+fail:
+	io_stage_destroy(iothr);
+	nmsg_zbuf_destroy(&zb);
+	pthread_mutex_lock(&pl->lock);
+	pl->stop = true;
+	if (res != nmsg_res_stop && pl->res == nmsg_res_success)
+		pl->res = res;
+	pthread_cond_broadcast(&pl->cond_job);
+	pthread_cond_broadcast(&pl->cond_space);
+	pthread_cond_broadcast(&pl->cond_emit);
+	pthread_mutex_unlock(&pl->lock);
+	return (NULL);
+}
 
+static nmsg_res
+io_pipeline_emit(struct nmsg_io_thr *iothr, struct nmsg_io_job *job,
+		 struct nmsg_io_output **io_output)
+{
+	struct nmsg_io_pipeline *pl = iothr->pipeline;
+	Nmsg__Nmsg *nmsg = job->nmsg;
+	Nmsg__NmsgPayload *np;
+	nmsg_io_t io = iothr->io;
+	nmsg_input_t input = iothr->io_input->input;
+	nmsg_message_t msg;
+	nmsg_res res = nmsg_res_success;
+	uint64_t count = 0;
+
+	/* wait for the preceding containers to be written */
+	if (io->decode_ordered) {
+		bool stop;
+
+		pthread_mutex_lock(&pl->lock);
+		while (pl->seq_emit != job->seq && !pl->stop && !io->stop)
+			io_cond_wait(&pl->cond_emit, &pl->lock);
+		stop = pl->stop || io->stop;
+		pthread_mutex_unlock(&pl->lock);
+		if (stop)
+			return (nmsg_res_stop);
+	}
+
+	nmsg_timespec_get(&iothr->now);
+
+	for (unsigned n = 0; n < nmsg->n_payloads; n++) {
+		/* detach the payload from the nmsg container */
+		np = nmsg->payloads[n];
+		nmsg->payloads[n] = NULL;
+
+		if (_input_nmsg_filter(input, nmsg, n, np) == false) {
+			_nmsg_payload_free(&np);
+			continue;
+		}
+
+		msg = _nmsg_message_from_payload(np);
+		if (msg == NULL) {
+			res = nmsg_res_memfail;
+			break;
+		}
+		count += 1;
+
+		if (io->output_mode == nmsg_io_output_mode_stripe) {
+			res = io_emit(iothr, *io_output, msg);
+		} else if (io->output_mode == nmsg_io_output_mode_mirror) {
+			res = io_write_mirrored(iothr, msg);
+		} else if (io->output_mode == nmsg_io_output_mode_hash) {
+			*io_output = io_hash_output(io, msg);
+			res = io_emit(iothr, *io_output, msg);
+		}
+		if (res != nmsg_res_success)
+			break;
+
+		if (io->queue_depth == 0)
+			(void) check_close_event(iothr, *io_output);
 		if (io->stop == true)
 			break;
+
+		*io_output = ISC_LIST_NEXT(*io_output, link);
+		if (*io_output == NULL)
+			*io_output = ISC_LIST_HEAD(io->io_outputs);
 	}
 
-	/* call user function */
-	if (io->atexit_fp != NULL)
-		io->atexit_fp(iothr->threadno, io->atexit_user);
+	/* free any payloads left over from an early exit */
+	for (unsigned n = 0; n < nmsg->n_payloads; n++) {
+		if (nmsg->payloads[n] != NULL)
+			_nmsg_payload_free(&nmsg->payloads[n]);
+	}
+	nmsg->n_payloads = 0;
+	free(nmsg->payloads);
+	nmsg->payloads = NULL;
+
+	pthread_mutex_lock(&pl->lock);
+	iothr->io_input->count_nmsg_payload_in += count;
+	if (io->decode_ordered) {
+		pl->seq_emit += 1;
+		pthread_cond_broadcast(&pl->cond_emit);
+	}
+	pthread_mutex_unlock(&pl->lock);
 
-	_nmsg_dprintfv(io->debug, 2,
-		       "nmsg_io: iothr=%p count_nmsg_payload_in=%" PRIu64 "\n",
-		       iothr, io_input->count_nmsg_payload_in);
+	if (res == nmsg_res_success && io->stop == true)
+		res = nmsg_res_stop;
+	return (res);
+}
+
+static void
+io_cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock) {
+	/* wake up periodically to notice nmsg_io_breakloop() */
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = 100 * 1000 * 1000 };
+	struct timespec abstime;
+
+	nmsg_timespec_get(&abstime);
+	nmsg_timespec_add(&ts, &abstime);
+	(void) pthread_cond_timedwait(cond, lock, &abstime);
+}
+
+static void
+io_stage_init(struct nmsg_io_thr *iothr) {
+	/* payloads staged by other threads would land on the wrong side of a
+	 * count or interval rotation, so staging is only used when there is
+	 * no close callback */
+	if (iothr->io->close_fp != NULL)
+		return;
+
+	/* one staging container per output, allocated on first use */
+	iothr->stage = calloc(iothr->io->n_outputs, sizeof(nmsg_container_t));
+}
+
+static void
+io_stage_flush(struct nmsg_io_thr *iothr, struct nmsg_io_output *io_output) {
+	nmsg_container_t *c;
+	nmsg_res res;
+
+	if (iothr->stage == NULL)
+		return;
+	c = &iothr->stage[io_output->idx];
+	if (*c == NULL)
+		return;
+
+	if (io_output->output != NULL &&
+	    _output_nmsg_can_stage(io_output->output))
+	{
+		res = _output_nmsg_flush_staged(io_output->output, c, false);
+		if (res != nmsg_res_success)
+			_nmsg_dprintfv(iothr->io->debug, 2,
+				       "nmsg_io: iothr=%p staged write failed: %s\n",
+				       iothr, nmsg_res_lookup(res));
+	}
+	nmsg_container_destroy(c);
+}
+
+static void
+io_stage_destroy(struct nmsg_io_thr *iothr) {
+	struct nmsg_io_output *io_output;
+	nmsg_io_t io = iothr->io;
+
+	if (iothr->stage == NULL)
+		return;
+
+	/* hand off the partially filled staging containers */
+	for (io_output = ISC_LIST_HEAD(io->io_outputs);
+	     io_output != NULL;
+	     io_output = ISC_LIST_NEXT(io_output, link))
+	{
+		io_stage_flush(iothr, io_output);
+	}
+	free(iothr->stage);
+	iothr->stage = NULL;
+}
+
+static nmsg_res
+io_emit(struct nmsg_io_thr *iothr, struct nmsg_io_output *io_output,
+	nmsg_message_t msg)
+{
+	if (iothr->io->queue_depth > 0)
+		return (io_enqueue(iothr, io_output, msg));
+	return (io_write(iothr, io_output, msg));
+}
+
+static nmsg_res
+io_enqueue(struct nmsg_io_thr *iothr, struct nmsg_io_output *io_output,
+	   nmsg_message_t msg)
+{
+	nmsg_io_t io = iothr->io;
+	nmsg_message_t drop = NULL;
+	unsigned depth = io->queue_depth;
+
+	pthread_mutex_lock(&io_output->q_lock);
+	if (io_output->q_len == depth) {
+		switch (io->queue_policy) {
+		case nmsg_io_queue_policy_block:
+			while (io_output->q_len == depth && !io->stop)
+				io_cond_wait(&io_output->q_cond_put,
+					     &io_output->q_lock);
+			if (io->stop) {
+				pthread_mutex_unlock(&io_output->q_lock);
+				nmsg_message_destroy(&msg);
+				return (nmsg_res_stop);
+			}
+			break;
+		case nmsg_io_queue_policy_drop_newest:
+			io_output->count_dropped += 1;
+			pthread_mutex_unlock(&io_output->q_lock);
+			nmsg_message_destroy(&msg);
+			return (nmsg_res_success);
+		case nmsg_io_queue_policy_drop_oldest:
+			drop = io_output->q[io_output->q_head];
+			io_output->q_head = (io_output->q_head + 1) % depth;
+			io_output->q_len -= 1;
+			io_output->count_dropped += 1;
+			break;
+		}
+	}
+	io_output->q[(io_output->q_head + io_output->q_len) % depth] = msg;
+	io_output->q_len += 1;
+	io_output->count_queued += 1;
+	if (io_output->q_len == 1)
+		pthread_cond_signal(&io_output->q_cond_get);
+	pthread_mutex_unlock(&io_output->q_lock);
+
+	if (drop != NULL)
+		nmsg_message_destroy(&drop);
+
+	return (nmsg_res_success);
+}
+
+static void
+io_writers_start(nmsg_io_t io) {
+	struct nmsg_io_output *io_output;
+	struct nmsg_io_thr *iothr;
+
+	for (io_output = ISC_LIST_HEAD(io->io_outputs);
+	     io_output != NULL;
+	     io_output = ISC_LIST_NEXT(io_output, link))
+	{
+		io_output->q = calloc(io->queue_depth, sizeof(nmsg_message_t));
+		assert(io_output->q != NULL);
+		io_output->q_head = 0;
+		io_output->q_len = 0;
+		io_output->q_done = false;
+
+		iothr = calloc(1, sizeof(*iothr));
+		assert(iothr != NULL);
+		iothr->io = io;
+		iothr->io_output = io_output;
+		iothr->threadno = io_output->idx;
+		io_output->writer = iothr;
+		assert(pthread_create(&iothr->thr, NULL, io_thr_output, iothr)
+		       == 0);
+	}
+}
+
+static nmsg_res
+io_writers_stop(nmsg_io_t io) {
+	struct nmsg_io_output *io_output;
+	struct nmsg_io_thr *iothr;
+	nmsg_res res = nmsg_res_success;
+
+	for (io_output = ISC_LIST_HEAD(io->io_outputs);
+	     io_output != NULL;
+	     io_output = ISC_LIST_NEXT(io_output, link))
+	{
+		pthread_mutex_lock(&io_output->q_lock);
+		io_output->q_done = true;
+		pthread_cond_signal(&io_output->q_cond_get);
+		pthread_mutex_unlock(&io_output->q_lock);
+	}
+
+	for (io_output = ISC_LIST_HEAD(io->io_outputs);
+	     io_output != NULL;
+	     io_output = ISC_LIST_NEXT(io_output, link))
+	{
+		iothr = io_output->writer;
+		assert(pthread_join(iothr->thr, NULL) == 0);
+		if (iothr->res != nmsg_res_success &&
+		    iothr->res != nmsg_res_stop)
+		{
+			_nmsg_dprintfv(io->debug, 2, "nmsg_io: writer iothr=%p %s\n",
+				       iothr, nmsg_res_lookup(iothr->res));
+			res = nmsg_res_failure;
+		}
+		io->count_nmsg_payload_out += iothr->count_nmsg_payload_out;
+		free(iothr);
+		io_output->writer = NULL;
+
+		/* discard anything left behind by an early stop */
+		while (io_output->q_len > 0) {
+			nmsg_message_destroy(&io_output->q[io_output->q_head]);
+			io_output->q_head = (io_output->q_head + 1) % io->queue_depth;
+			io_output->q_len -= 1;
+		}
+		free(io_output->q);
+		io_output->q = NULL;
+
+		_nmsg_dprintfv(io->debug, 2, "nmsg_io: io_output=%p"
+			       " count_queued=%" PRIu64
+			       " count_dropped=%" PRIu64 "\n",
+			       io_output,
+			       io_output->count_queued,
+			       io_output->count_dropped);
+	}
+
+	return (res);
+}
+
+static void *
+io_thr_output(void *user) {
+	struct nmsg_io_thr *iothr = (struct nmsg_io_thr *) user;
+	struct nmsg_io_output *io_output = iothr->io_output;
+	nmsg_io_t io = iothr->io;
+	nmsg_message_t msgs[NMSG_IO_BATCH];
+	size_t n_msg;
+	nmsg_res res;
+
+	_nmsg_dprintfv(io->debug, 4, "nmsg_io: started output thread @ %p\n", iothr);
+
+	io_stage_init(iothr);
+
+	for (;;) {
+		pthread_mutex_lock(&io_output->q_lock);
+		while (io_output->q_len == 0 && !io_output->q_done && !io->stop)
+			io_cond_wait(&io_output->q_cond_get, &io_output->q_lock);
+		if (io->stop || io_output->q_len == 0) {
+			bool done = io->stop || io_output->q_done;
+
+			pthread_mutex_unlock(&io_output->q_lock);
+			if (done)
+				break;
+
+			/* idle, check for an interval close event */
+			nmsg_timespec_get(&iothr->now);
+			(void) check_close_event(iothr, io_output);
+			continue;
+		}
+
+		/* take as many messages as possible, but don't write past the
+		 * next count close event */
+		n_msg = io_output->q_len < NMSG_IO_BATCH ? io_output->q_len : NMSG_IO_BATCH;
+		if (io->count > 0) {
+			uint64_t left = io->count -
+				atomic64_read(&io_output->count_nmsg_payload_out) % io->count;
+			if (n_msg > left)
+				n_msg = left;
+		}
+		for (size_t i = 0; i < n_msg; i++) {
+			msgs[i] = io_output->q[io_output->q_head];
+			io_output->q_head = (io_output->q_head + 1) % io->queue_depth;
+		}
+		if (io_output->q_len == io->queue_depth)
+			pthread_cond_broadcast(&io_output->q_cond_put);
+		io_output->q_len -= n_msg;
+		pthread_mutex_unlock(&io_output->q_lock);
+
+		nmsg_timespec_get(&iothr->now);
+		res = io_write_batch(iothr, io_output, msgs, n_msg);
+		if (res != nmsg_res_success) {
+			/* the inputs would block or drop forever otherwise */
+			iothr->res = res;
+			io->stop = true;
+			break;
+		}
+		(void) check_close_event(iothr, io_output);
+	}
+
+	io_stage_destroy(iothr);
+
+	_nmsg_dprintfv(io->debug, 4, "nmsg_io: output thread @ %p exiting\n", iothr);
 	return (NULL);
 }
+
+static struct nmsg_io_output *
+io_hash_output(nmsg_io_t io, nmsg_message_t msg) {
+	const void *key;
+	size_t len;
+	uint32_t hash;
+
+	if (io->key_fp != NULL) {
+		if (io->key_fp(msg, &key, &len, io->key_user) != nmsg_res_success) {
+			key = NULL;
+			len = 0;
+		}
+		hash = my_hashlittle(key, len, 0);
+	} else {
+		hash = io_hash_fields(io, msg);
+	}
+
+	return (io->output_array[hash % io->n_outputs]);
+}
+
+static uint32_t
+io_hash_fields(nmsg_io_t io, nmsg_message_t msg) {
+	uint32_t hash = 0;
+	uint32_t val;
+	void *data;
+	size_t len;
+
+	for (unsigned i = 0; i < io->n_hash_fields; i++) {
+		const char *field = io->hash_fields[i];
+
+		if (nmsg_message_get_field(msg, field, 0, &data, &len) ==
+		    nmsg_res_success)
+		{
+			hash = my_hashlittle(data, len, hash);
+			continue;
+		}
+
+		/* payload header fields */
+		if (strcmp(field, "source") == 0)
+			val = nmsg_message_get_source(msg);
+		else if (strcmp(field, "operator") == 0)
+			val = nmsg_message_get_operator(msg);
+		else if (strcmp(field, "group") == 0)
+			val = nmsg_message_get_group(msg);
+		else
+			continue;
+		hash = my_hashword(&val, 1, hash);
+	}
+
+	return (hash);
+}
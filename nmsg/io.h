@@ -64,9 +64,19 @@ typedef enum {
  */
 typedef enum {
 	nmsg_io_output_mode_stripe,	/*%< stripe payloads across output */
-	nmsg_io_output_mode_mirror	/*%< mirror payloads across output */
+	nmsg_io_output_mode_mirror,	/*%< mirror payloads across output */
+	nmsg_io_output_mode_hash	/*%< route payloads to output by key */
 } nmsg_io_output_mode;
 
+/**
+ * Behavior when an output queue is full. See nmsg_io_set_output_queue().
+ */
+typedef enum {
+	nmsg_io_queue_policy_block,	  /*%< wait for space in the queue */
+	nmsg_io_queue_policy_drop_newest, /*%< discard the incoming payload */
+	nmsg_io_queue_policy_drop_oldest  /*%< discard the oldest queued payload */
+} nmsg_io_queue_policy;
+
 /**
  * Structure for passing information about a close event between the nmsg_io
  * processing loop and the original caller. In order to receive these close
@@ -129,6 +139,25 @@ typedef void (*nmsg_io_close_fp)(struct nmsg_io_close_event *ce);
  */
 typedef void (*nmsg_io_user_fp)(unsigned threadno, void *user);
 
+/**
+ * Function for extracting the routing key of a message when using the
+ * #nmsg_io_output_mode_hash output mode.
+ *
+ * \param[in] msg Message object.
+ *
+ * \param[out] key Location to store a pointer to the key. The key must remain
+ *	valid until the message is modified or destroyed.
+ *
+ * \param[out] len Length of the key in bytes.
+ *
+ * \param[in] user User pointer passed to nmsg_io_set_output_hash_fp().
+ *
+ * \return #nmsg_res_success if a key was extracted. Otherwise the message is
+ *	routed as if its key were empty.
+ */
+typedef nmsg_res (*nmsg_io_key_fp)(nmsg_message_t msg, const void **key,
+				   size_t *len, void *user);
+
 /**
  * Initialize a new nmsg_io_t object.
  *
@@ -234,6 +263,11 @@ nmsg_io_add_input_fname(nmsg_io_t io, const char *fname, void *user);
  * Add an nmsg output to an nmsg_io_t object. When nmsg_io_loop() is called, the
  * input threads will cycle over and write payloads to the available outputs.
  *
+ * Payloads written to buffered NMSG stream outputs are accumulated into a
+ * container private to each input thread, and each full container is handed
+ * off to the output as a whole. Partially filled containers are written when
+ * the input thread exits or before a close event for the output is issued.
+ *
  * \param[in] io Valid nmsg_io_t object.
  *
  * \param[in] output Valid nmsg_output_t object.
@@ -388,18 +422,125 @@ nmsg_io_set_interval(nmsg_io_t io, unsigned interval);
 
 /**
  * Set the output mode behavior for an nmsg_io_t object. Nmsg payloads received
- * from inputs may be striped across available outputs (the default), or
- * mirrored across all available outputs.
+ * from inputs may be striped across available outputs (the default),
+ * mirrored across all available outputs, or routed to an output selected by
+ * hashing a key extracted from each payload.
  *
  * Since nmsg_io must synchronize access to individual outputs, the mirrored
  * output mode will limit the amount of parallelism that can be achieved.
  *
+ * The hash output mode requires the key to be configured with
+ * nmsg_io_set_output_hash_fp() or nmsg_io_set_output_hash_fields(). Payloads
+ * with equal keys are always written to the same output.
+ *
  * \param[in] io Valid nmsg_io_t object.
  *
- * \param[in] output_mode #nmsg_io_output_mode_stripe or
- *	#nmsg_io_output_mode_mirror.
+ * \param[in] output_mode #nmsg_io_output_mode_stripe,
+ *	#nmsg_io_output_mode_mirror, or #nmsg_io_output_mode_hash.
  */
 void
 nmsg_io_set_output_mode(nmsg_io_t io, nmsg_io_output_mode output_mode);
 
+/**
+ * Set the function used to extract the routing key of each message in the
+ * #nmsg_io_output_mode_hash output mode. The key is hashed and the hash
+ * selects one of the outputs, in the order they were added.
+ *
+ * \param[in] io Valid nmsg_io_t object.
+ *
+ * \param[in] key_fp Key extraction function.
+ *
+ * \param[in] user User pointer to be passed to the key extraction function.
+ */
+void
+nmsg_io_set_output_hash_fp(nmsg_io_t io, nmsg_io_key_fp key_fp, void *user);
+
+/**
+ * Route messages in the #nmsg_io_output_mode_hash output mode by the value of
+ * one or more named fields.
+ *
+ * 'fields' is a comma separated list of field names. Each is looked up with
+ * nmsg_message_get_field(). If a message has no field of that name, the names
+ * "source", "operator", and "group" refer to the payload header values.
+ * Fields which are not present in a message are skipped.
+ *
+ * \param[in] io Valid nmsg_io_t object.
+ *
+ * \param[in] fields Comma separated list of field names.
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_memfail
+ */
+nmsg_res
+nmsg_io_set_output_hash_fields(nmsg_io_t io, const char *fields);
+
+/**
+ * Decode containers read from file inputs using a pool of worker threads.
+ *
+ * By default each input is read, decompressed, unpacked, filtered, and written
+ * by a single thread. If decode threads are enabled, the input thread of each
+ * file input only frames raw containers (and reassembles fragmented ones),
+ * and 'n_threads' worker threads decompress, unpack, filter, and write the
+ * payloads. Other input types are not affected.
+ *
+ * If 'ordered' is true, the payloads from each container are written only
+ * after those of every preceding container, preserving the order of the input
+ * file. Otherwise containers are written in the order they finish decoding.
+ *
+ * Ingress rate limiting set with nmsg_input_set_byte_rate() is not applied to
+ * inputs processed by decode threads.
+ *
+ * \param[in] io Valid nmsg_io_t object.
+ *
+ * \param[in] n_threads Number of decode threads per file input, or 0 to
+ *	disable.
+ *
+ * \param[in] ordered Whether to preserve the container order of the input.
+ */
+void
+nmsg_io_set_decode_threads(nmsg_io_t io, unsigned n_threads, bool ordered);
+
+/**
+ * Write to each output from a dedicated writer thread.
+ *
+ * By default, input threads serialize, compress, and write payloads to the
+ * outputs themselves, so a slow output stalls the inputs. If an output queue
+ * depth is set, each output is given a writer thread fed by a queue of up to
+ * 'depth' payloads, and input threads only append to the queues. Count and
+ * interval close events are then issued from the writer threads.
+ *
+ * 'policy' determines what happens when a queue is full:
+ * #nmsg_io_queue_policy_block makes the input thread wait for space,
+ * #nmsg_io_queue_policy_drop_newest discards the payload being queued, and
+ * #nmsg_io_queue_policy_drop_oldest discards the payload at the head of the
+ * queue. Dropped payloads are counted, see nmsg_io_get_output_queue_stats().
+ *
+ * If a write to an output fails, the writer thread stops nmsg_io processing.
+ *
+ * \param[in] io Valid nmsg_io_t object.
+ *
+ * \param[in] depth Number of payloads per output queue, or 0 to disable the
+ *	writer threads.
+ *
+ * \param[in] policy Queue full behavior.
+ */
+void
+nmsg_io_set_output_queue(nmsg_io_t io, unsigned depth,
+			 nmsg_io_queue_policy policy);
+
+/**
+ * Retrieve the output queue counters of an nmsg_io_t object, summed across
+ * all outputs. See nmsg_io_set_output_queue().
+ *
+ * \param[in] io Valid nmsg_io_t object.
+ *
+ * \param[out] count_queued Number of payloads placed on output queues.
+ *
+ * \param[out] count_dropped Number of payloads discarded because an output
+ *	queue was full.
+ */
+void
+nmsg_io_get_output_queue_stats(nmsg_io_t io, uint64_t *count_queued,
+			       uint64_t *count_dropped);
+
 #endif /* NMSG_IO_H */
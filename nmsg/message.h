@@ -56,6 +56,11 @@
  *
  * nmsg_message_get_num_fields
  *
+ * Fields that are accessed repeatedly can be resolved once with
+ * nmsg_msgmod_field_accessor() and then accessed without a name lookup:
+ *
+ * nmsg_message_set_field_by_accessor() / nmsg_message_get_field_by_accessor()
+ *
  * For enum field types, there are several helper functions for converting
  * between the presentation and numeric forms of enum values:
  *
@@ -154,6 +159,10 @@ nmsg_message_get_msgtype(nmsg_message_t msg);
  * WARNING: experts only.
  *
  * Return the protobuf message object underlying (some) message objects.
+ *
+ * If the protobuf message was unpacked from a received payload, its fields
+ * are allocated from a per-message arena and must not be freed or
+ * reallocated by the caller. Use nmsg_message_set_field() to modify them.
  */
 void *
 nmsg_message_get_payload(nmsg_message_t msg);
@@ -267,6 +276,31 @@ nmsg_message_get_field_by_idx(nmsg_message_t msg,
 			      void **data,
 			      size_t *len);
 
+/**
+ * Get the value of a field. Field specified by an accessor handle obtained
+ * from nmsg_msgmod_field_accessor(), which avoids looking up the field by
+ * name on every call.
+ * \see nmsg_message_get_field()
+ *
+ * \param[in] msg Message object.
+ * \param[in] acc Field accessor handle.
+ * \param[in] val_idx Index of the field value to retrieve. Singleton fields
+ *	have only a single value index, 0.
+ * \param[out] data Location to store a pointer to the field value.
+ * \param[out] len Length of the field value in bytes. May be NULL.
+ *
+ * \return nmsg_res_success If the value was successfully retrieved.
+ * \return nmsg_res_failure If acc is NULL, the accessor belongs to a
+ *	different message module than the message, val_idx is out of range or
+ *	there was a catastrophic encoding error.
+ */
+nmsg_res
+nmsg_message_get_field_by_accessor(nmsg_message_t msg,
+				   nmsg_field_accessor_t acc,
+				   unsigned val_idx,
+				   void **data,
+				   size_t *len);
+
 /**
  * Get the field index of a named field.
  *
@@ -372,6 +406,31 @@ nmsg_message_set_field_by_idx(nmsg_message_t msg,
 			      const uint8_t *data,
 			      size_t len);
 
+/**
+ * Set a field to the specified value. Field specified by an accessor handle
+ * obtained from nmsg_msgmod_field_accessor().
+ * \see nmsg_message_set_field()
+ *
+ * \param[in] msg Message object.
+ * \param[in] acc Field accessor handle.
+ * \param[in] val_idx Index of the field value to be set. Must be zero if the
+ *	field is not a repeated field.
+ * \param[in] data Data buffer containing the value.
+ * \param[in] len Length of data buffer.
+ *
+ * \return nmsg_res_success If the value was successfully set.
+ * \return nmsg_res_failure If acc is NULL, the accessor belongs to a
+ *	different message module than the message, the field is read-only or
+ *	val_idx is out of range.
+ * \return nmsg_res_memfail
+ */
+nmsg_res
+nmsg_message_set_field_by_accessor(nmsg_message_t msg,
+				   nmsg_field_accessor_t acc,
+				   unsigned val_idx,
+				   const uint8_t *data,
+				   size_t len);
+
 /**
  * Convert an enum name to a numeric value.
  *
@@ -412,4 +471,20 @@ nmsg_res
 nmsg_message_enum_value_to_name_by_idx(nmsg_message_t msg, unsigned field_idx,
 				       unsigned value, const char **name);
 
+/**
+ * Retrieve the counters of the pools that message objects and their NMSG
+ * payload structures are allocated from.
+ *
+ * Each thread keeps a free list of released objects, and threads exchange
+ * batches of objects through a shared depot, so that objects released by one
+ * thread can be reused by another. The counters of other threads are added
+ * to the totals periodically, so they may lag slightly behind.
+ *
+ * \param[out] count_hit Number of objects reused from a pool.
+ *
+ * \param[out] count_miss Number of objects that had to be allocated.
+ */
+void
+nmsg_message_get_pool_stats(uint64_t *count_hit, uint64_t *count_miss);
+
 #endif /* NMSG_MESSAGE_H */
@@ -287,6 +287,25 @@ nmsg_msgmod_lookup(unsigned vid, unsigned msgtype);
 nmsg_msgmod_t
 nmsg_msgmod_lookup_byname(const char *vname, const char *mname);
 
+/**
+ * Resolve a field of a transparent message module to an accessor handle.
+ * The handle can be passed to nmsg_message_get_field_by_accessor() and
+ * nmsg_message_set_field_by_accessor() to access the field of any message
+ * of this module without looking up the field by name.
+ *
+ * The handle is owned by the message module and remains valid as long as the
+ * module is loaded. It must not be freed by the caller.
+ *
+ * \param[in] mod Message module.
+ *
+ * \param[in] field_name Name of the field.
+ *
+ * \return An accessor handle, or NULL if the module is not a transparent
+ *	module or has no field with the given name.
+ */
+nmsg_field_accessor_t
+nmsg_msgmod_field_accessor(nmsg_msgmod_t mod, const char *field_name);
+
 /**
  * Convert the human-readable name of a message type to a message type ID.
  *
@@ -56,35 +56,22 @@ nmsg_msgmod_lookup_byname(const char *vname, const char *mname) {
 unsigned
 nmsg_msgmod_vname_to_vid(const char *vname) {
 	struct nmsg_msgmodset *ms = _nmsg_global_msgmodset;
-	unsigned i, j;
+	unsigned vid;
 
 	assert(ms != NULL);
 
 	if (strcasecmp(vname, "ISC") == 0)
 		vname = "base";
 
-	for (i = 0; i <= ms->nv; i++) {
-		struct nmsg_msgvendor *msgv;
-		msgv = ms->vendors[i];
-
-		if (msgv != NULL) {
-			for (j = 0; j <= msgv->nm; j++) {
-				struct nmsg_msgmod *mod;
-				mod = msgv->msgtypes[j];
-
-				if (mod != NULL &&
-				    strcasecmp(mod->plugin->vendor.name, vname) == 0)
-					return (mod->plugin->vendor.id);
-			}
-		}
-	}
+	if (_nmsg_nameidx_lookup(ms->vnames, vname, &vid))
+		return (vid);
 	return (0);
 }
 
 unsigned
 nmsg_msgmod_mname_to_msgtype(unsigned vid, const char *mname) {
 	struct nmsg_msgmodset *ms = _nmsg_global_msgmodset;
-	unsigned i;
+	unsigned msgtype;
 
 	assert(ms != NULL);
 
@@ -94,15 +81,8 @@ nmsg_msgmod_mname_to_msgtype(unsigned vid, const char *mname) {
 		msgv = ms->vendors[vid];
 		if (msgv == NULL)
 			return (0);
-		for (i = 0; i <= msgv->nm; i++) {
-			struct nmsg_msgmod *mod;
-
-			mod = msgv->msgtypes[i];
-			if (mod != NULL) {
-				if (strcasecmp(mod->plugin->msgtype.name, mname) == 0)
-					return (mod->plugin->msgtype.id);
-			}
-		}
+		if (_nmsg_nameidx_lookup(msgv->mnames, mname, &msgtype))
+			return (msgtype);
 	}
 
 	return (0);
@@ -112,7 +92,6 @@ const char *
 nmsg_msgmod_vid_to_vname(unsigned vid) {
 	struct nmsg_msgmodset *ms = _nmsg_global_msgmodset;
 	struct nmsg_msgvendor *msgv;
-	unsigned i;
 
 	assert(ms != NULL);
 
@@ -121,39 +100,17 @@ nmsg_msgmod_vid_to_vname(unsigned vid) {
 	msgv = ms->vendors[vid];
 	if (msgv == NULL)
 		return (NULL);
-	for (i = 0; i <= msgv->nm; i++) {
-		struct nmsg_msgmod *mod;
-
-		mod = msgv->msgtypes[i];
-		if (mod != NULL && mod->plugin->vendor.id == vid)
-			return (mod->plugin->vendor.name);
-	}
-	return (NULL);
+	return (msgv->vname);
 }
 
 const char *
 nmsg_msgmod_msgtype_to_mname(unsigned vid, unsigned msgtype) {
-	struct nmsg_msgmodset *ms = _nmsg_global_msgmodset;
-	struct nmsg_msgvendor *msgv;
-	unsigned i;
-
-	assert(ms != NULL);
+	struct nmsg_msgmod *mod;
 
-	if (vid > ms->nv)
+	mod = nmsg_msgmod_lookup(vid, msgtype);
+	if (mod == NULL)
 		return (NULL);
-	msgv = ms->vendors[vid];
-	if (msgv == NULL)
-		return (NULL);
-	for (i = 0; i <= msgv->nm; i++) {
-		struct nmsg_msgmod *mod;
-
-		mod = msgv->msgtypes[i];
-		if (mod != NULL && mod->plugin->vendor.id == vid) {
-			if (mod->plugin->msgtype.id == msgtype)
-				return (mod->plugin->msgtype.name);
-		}
-	}
-	return (NULL);
+	return (mod->plugin->msgtype.name);
 }
 
 unsigned
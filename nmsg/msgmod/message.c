@@ -20,6 +20,10 @@
 
 #include "transparent.h"
 
+/* Forward. */
+
+static struct nmsg_message *message_alloc(void);
+
 /* Export. */
 
 struct nmsg_message *
@@ -28,7 +32,7 @@ nmsg_message_init(struct nmsg_msgmod *mod) {
 	nmsg_res res;
 
 	/* allocate space */
-	msg = calloc(1, sizeof(*msg));
+	msg = message_alloc();
 	if (msg == NULL)
 		return (NULL);
 
@@ -38,7 +42,7 @@ nmsg_message_init(struct nmsg_msgmod *mod) {
 	/* initialize ->message */
 	res = _nmsg_message_init_message(msg);
 	if (res != nmsg_res_success) {
-		free(msg);
+		_nmsg_pool_put(nmsg_pool_message, msg);
 		return (NULL);
 	}
 
@@ -46,7 +50,7 @@ nmsg_message_init(struct nmsg_msgmod *mod) {
 	res = _nmsg_message_init_payload(msg);
 	if (res != nmsg_res_success) {
 		free(msg->message);
-		free(msg);
+		_nmsg_pool_put(nmsg_pool_message, msg);
 		return (NULL);
 	}
 
@@ -84,7 +88,7 @@ _nmsg_message_dup(struct nmsg_message *msg) {
 	struct nmsg_message *msgdup;
 
 	/* allocate space */
-	msgdup = calloc(1, sizeof(*msgdup));
+	msgdup = message_alloc();
 	if (msgdup == NULL)
 		return (NULL);
 
@@ -98,17 +102,17 @@ _nmsg_message_dup(struct nmsg_message *msg) {
 	{
 		res = _nmsg_message_dup_protobuf(msg, &(msgdup->message));
 		if (res != nmsg_res_success) {
-			free(msgdup);
+			_nmsg_pool_put(nmsg_pool_message, msgdup);
 			return (NULL);
 		}
 	}
 
 	/* initialize ->np */
 	if (msg->np != NULL) {
-		msgdup->np = malloc(sizeof(*msg->np));
+		msgdup->np = _nmsg_pool_get(nmsg_pool_payload);
 		if (msgdup->np == NULL) {
 			free(msgdup->message);
-			free(msgdup);
+			_nmsg_pool_put(nmsg_pool_message, msgdup);
 			return (NULL);
 		}
 		memcpy(msgdup->np, msg->np, sizeof(*msg->np));
@@ -116,9 +120,9 @@ _nmsg_message_dup(struct nmsg_message *msg) {
 		if (msg->np->has_payload && msg->np->payload.data != NULL) {
 			msgdup->np->payload.data = malloc(msg->np->payload.len);
 			if (msgdup->np->payload.data == NULL) {
-				free(msgdup->np);
+				_nmsg_pool_put(nmsg_pool_payload, msgdup->np);
 				free(msgdup->message);
-				free(msgdup);
+				_nmsg_pool_put(nmsg_pool_message, msgdup);
 				return (NULL);
 			}
 			memcpy(msgdup->np->payload.data, msg->np->payload.data,
@@ -134,12 +138,56 @@ _nmsg_message_dup(struct nmsg_message *msg) {
 	return (msgdup);
 }
 
+struct nmsg_message *
+_nmsg_message_dup_shared(struct nmsg_message *msg) {
+	struct nmsg_message *msgdup;
+	nmsg_res res;
+
+	/* the payload must be up-to-date, since it can't be modified once
+	 * it is shared */
+	res = _nmsg_message_serialize(msg);
+	if (res != nmsg_res_success)
+		return (NULL);
+	if (msg->np == NULL || msg->np->payload.data == NULL)
+		return (_nmsg_message_dup(msg));
+
+	/* hand the payload data over to a reference */
+	if (msg->ref == NULL) {
+		msg->ref = malloc(sizeof(*msg->ref));
+		if (msg->ref == NULL)
+			return (NULL);
+		atomic_set(&msg->ref->refs, 1);
+		msg->ref->data = msg->np->payload.data;
+	}
+
+	/* allocate space */
+	msgdup = message_alloc();
+	if (msgdup == NULL)
+		return (NULL);
+	msgdup->mod = msg->mod;
+
+	/* copy ->np, sharing the payload data */
+	msgdup->np = _nmsg_pool_get(nmsg_pool_payload);
+	if (msgdup->np == NULL) {
+		_nmsg_pool_put(nmsg_pool_message, msgdup);
+		return (NULL);
+	}
+	memcpy(msgdup->np, msg->np, sizeof(*msg->np));
+	msgdup->np->base.n_unknown_fields = 0;
+	msgdup->np->base.unknown_fields = NULL;
+
+	atomic_inc(&msg->ref->refs);
+	msgdup->ref = msg->ref;
+
+	return (msgdup);
+}
+
 struct nmsg_message *
 _nmsg_message_from_payload(Nmsg__NmsgPayload *np) {
 	struct nmsg_message *msg;
 
 	/* allocate space */
-	msg = calloc(1, sizeof(*msg));
+	msg = message_alloc();
 	if (msg == NULL)
 		return (NULL);
 
@@ -179,14 +227,14 @@ nmsg_message_from_raw_payload(unsigned vid, unsigned msgtype,
 	nmsg_message_t msg;
 
 	/* allocate message object */
-	msg = calloc(1, sizeof(*msg));
+	msg = message_alloc();
 	if (msg == NULL)
 		return (NULL);
 
 	/* allocate the NmsgPayload */
-	msg->np = calloc(1, sizeof(*(msg->np)));
+	msg->np = _nmsg_pool_get(nmsg_pool_payload);
 	if (msg->np == NULL) {
-		free(msg);
+		_nmsg_pool_put(nmsg_pool_message, msg);
 		return (NULL);
 	}
 
@@ -226,7 +274,7 @@ nmsg_res
 _nmsg_message_init_payload(struct nmsg_message *msg) {
 	struct timespec ts;
 
-	msg->np = malloc(sizeof(*msg->np));
+	msg->np = _nmsg_pool_get(nmsg_pool_payload);
 	if (msg->np == NULL)
 		return (nmsg_res_memfail);
 	nmsg__nmsg_payload__init(msg->np);
@@ -244,16 +292,13 @@ nmsg_message_destroy(struct nmsg_message **msg) {
 	if ((*msg)->mod != NULL && (*msg)->mod->plugin->msg_fini != NULL)
 		(*msg)->mod->plugin->msg_fini(*msg, (*msg)->msg_clos);
 
-	if ((*msg)->message != NULL) {
-		protobuf_c_message_free_unpacked((*msg)->message, NULL);
-		(*msg)->message = NULL;
-	}
-	if ((*msg)->np != NULL)
-		_nmsg_payload_free(&(*msg)->np);
+	_nmsg_message_free_message(*msg);
+	if ((*msg)->np != NULL || (*msg)->ref != NULL)
+		_nmsg_payload_free_shared(&(*msg)->np, &(*msg)->ref);
 
 	nmsg_message_free_allocations(*msg);
 
-	free(*msg);
+	_nmsg_pool_put(nmsg_pool_message, *msg);
 	*msg = NULL;
 }
 
@@ -265,16 +310,56 @@ _nmsg_message_deserialize(struct nmsg_message *msg) {
 	if (msg->np != NULL) {
 		if (msg->mod == NULL || msg->np->has_payload == 0)
 			return (nmsg_res_failure);
-		msg->message = protobuf_c_message_unpack(msg->mod->plugin->pbdescr, NULL,
+
+		/* unpack into a single arena, which is released as a whole
+		 * rather than field by field */
+		msg->arena = _nmsg_arena_init(msg->mod->plugin->pbdescr->sizeof_message +
+					      2 * msg->np->payload.len);
+		if (msg->arena == NULL)
+			return (nmsg_res_memfail);
+		msg->message = protobuf_c_message_unpack(msg->mod->plugin->pbdescr,
+							 _nmsg_arena_allocator(msg->arena),
 							 msg->np->payload.len,
 							 msg->np->payload.data);
-		if (msg->message == NULL)
+		if (msg->message == NULL) {
+			_nmsg_arena_destroy(&msg->arena);
 			return (nmsg_res_memfail);
+		}
 		return (nmsg_res_success);
 	}
 	return (nmsg_res_failure);
 }
 
+nmsg_res
+_nmsg_message_own_message(struct nmsg_message *msg) {
+	ProtobufCMessage *m;
+	nmsg_res res;
+
+	if (msg->arena == NULL)
+		return (nmsg_res_success);
+
+	/* fields of an arena allocated message can't be individually freed or
+	 * reallocated, so a heap allocated copy is made before modifying it */
+	res = _nmsg_message_dup_protobuf(msg, &m);
+	if (res != nmsg_res_success)
+		return (res);
+	_nmsg_arena_destroy(&msg->arena);
+	msg->message = m;
+
+	return (nmsg_res_success);
+}
+
+void
+_nmsg_message_free_message(struct nmsg_message *msg) {
+	if (msg->arena != NULL) {
+		_nmsg_arena_destroy(&msg->arena);
+		msg->message = NULL;
+	} else if (msg->message != NULL) {
+		protobuf_c_message_free_unpacked(msg->message, NULL);
+		msg->message = NULL;
+	}
+}
+
 nmsg_res
 _nmsg_message_serialize(struct nmsg_message *msg) {
 	ProtobufCBufferSimple sbuf;
@@ -300,8 +385,15 @@ _nmsg_message_serialize(struct nmsg_message *msg) {
 
 		sz = protobuf_c_message_pack_to_buffer((ProtobufCMessage *) msg->message,
 						       (ProtobufCBuffer *) &sbuf);
-		if (msg->np->payload.data != NULL)
+		if (msg->ref != NULL) {
+			/* stop sharing the old payload data */
+			Nmsg__NmsgPayload *np = NULL;
+
+			msg->np->payload.data = NULL;
+			_nmsg_payload_free_shared(&np, &msg->ref);
+		} else if (msg->np->payload.data != NULL) {
 			free(msg->np->payload.data);
+		}
 
 		msg->np->has_payload = true;
 		msg->np->payload.data = sbuf.data;
@@ -328,6 +420,27 @@ nmsg_message_to_pres(struct nmsg_message *msg, char **pres, const char *endline)
 	}
 }
 
+nmsg_res
+_nmsg_message_to_pres_append(struct nmsg_message *msg, struct nmsg_strbuf *sb,
+			     const char *endline)
+{
+	char *pres;
+	nmsg_res res;
+
+	if (msg->mod != NULL && msg->mod->plugin->type == nmsg_msgmod_type_transparent)
+		return (_nmsg_message_payload_to_pres_append(msg, sb, endline));
+
+	res = nmsg_message_to_pres(msg, &pres, endline);
+	if (res != nmsg_res_success)
+		return (res);
+	if (pres != NULL) {
+		res = nmsg_strbuf_append_str(sb, pres, strlen(pres));
+		free(pres);
+	}
+
+	return (res);
+}
+
 nmsg_res
 nmsg_message_add_allocation(struct nmsg_message *msg, void *ptr) {
 	void *tmp;
@@ -387,10 +500,7 @@ nmsg_message_update(nmsg_message_t msg) {
 
 void
 nmsg_message_compact_payload(nmsg_message_t msg) {
-	if (msg->message != NULL) {
-		protobuf_c_message_free_unpacked(msg->message, NULL);
-		msg->message = NULL;
-	}
+	_nmsg_message_free_message(msg);
 }
 
 void
@@ -461,3 +571,25 @@ nmsg_message_set_group(nmsg_message_t msg, uint32_t group) {
 		msg->np->group = group;
 	}
 }
+
+void
+nmsg_message_get_pool_stats(uint64_t *count_hit, uint64_t *count_miss) {
+	uint64_t hit, miss;
+
+	_nmsg_pool_get_stats(nmsg_pool_message, count_hit, count_miss);
+	_nmsg_pool_get_stats(nmsg_pool_payload, &hit, &miss);
+	*count_hit += hit;
+	*count_miss += miss;
+}
+
+/* Private functions. */
+
+static struct nmsg_message *
+message_alloc(void) {
+	struct nmsg_message *msg;
+
+	msg = _nmsg_pool_get(nmsg_pool_message);
+	if (msg != NULL)
+		memset(msg, 0, sizeof(*msg));
+	return (msg);
+}
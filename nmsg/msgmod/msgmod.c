@@ -101,6 +101,21 @@ nmsg_msgmod_pkt_to_payload(struct nmsg_msgmod *mod, void *clos,
 		return (nmsg_res_notimpl);
 }
 
+nmsg_field_accessor_t
+nmsg_msgmod_field_accessor(struct nmsg_msgmod *mod, const char *field_name) {
+	struct nmsg_msgmod_field *field;
+
+	if (mod->plugin->type != nmsg_msgmod_type_transparent ||
+	    mod->accessors == NULL)
+		return (NULL);
+
+	field = _nmsg_msgmod_lookup_field(mod, field_name);
+	if (field == NULL)
+		return (NULL);
+
+	return (&mod->accessors[field - &mod->fields[0]]);
+}
+
 /* Internal use. */
 
 struct nmsg_msgmod *
@@ -145,12 +160,15 @@ _nmsg_msgmod_start(struct nmsg_msgmod_plugin *plugin) {
 
 	return (mod);
 err:
+	free(mod->accessors);
+	free(mod->fields);
 	free(mod);
 	return (NULL);
 }
 
 void
 _nmsg_msgmod_stop(struct nmsg_msgmod **mod) {
+	free((*mod)->accessors);
 	free((*mod)->fields);
 	free(*mod);
 	*mod = NULL;
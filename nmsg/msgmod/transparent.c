@@ -98,5 +98,15 @@ _nmsg_msgmod_load_field_descriptors(struct nmsg_msgmod *mod) {
 	      sizeof(struct nmsg_msgmod_field),
 	      _nmsg_msgmod_field_cmp);
 
+	/* create one accessor handle per field, in field table order */
+	mod->accessors = calloc(1, sizeof(struct nmsg_field_accessor) * mod->n_fields);
+	if (mod->accessors == NULL)
+		return (nmsg_res_memfail);
+
+	for (i = 0; i < mod->n_fields; i++) {
+		mod->accessors[i].mod = mod;
+		mod->accessors[i].field = &mod->fields[i];
+	}
+
 	return (nmsg_res_success);
 }
@@ -46,6 +46,10 @@ _nmsg_msgmod_module_fini(struct nmsg_msgmod *mod, void **cl);
 nmsg_res
 _nmsg_message_payload_to_pres(struct nmsg_message *msg, char **pres, const char *endline);
 
+nmsg_res
+_nmsg_message_payload_to_pres_append(struct nmsg_message *msg,
+				     struct nmsg_strbuf *sb, const char *endline);
+
 nmsg_res
 _nmsg_message_payload_to_pres_load(struct nmsg_message *msg,
 				   struct nmsg_msgmod_field *field, void *ptr,
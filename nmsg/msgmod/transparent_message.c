@@ -131,21 +131,17 @@ nmsg_message_get_field_type(struct nmsg_message *msg,
 		return (nmsg_res_failure);
 }
 
-nmsg_res
-nmsg_message_get_field_by_idx(nmsg_message_t msg, unsigned field_idx,
-			      unsigned val_idx,
-			      void **data, size_t *len)
+static nmsg_res
+get_field(nmsg_message_t msg, struct nmsg_msgmod_field *field,
+	  unsigned val_idx,
+	  void **data, size_t *len)
 {
 	ProtobufCBinaryData *bdata;
 	char **parray;
 	int *qptr;
 	size_t sz;
-	struct nmsg_msgmod_field *field;
 	void *ptr = NULL;
 
-	CHECK_TRANSPARENT();
-	GET_FIELD(field_idx);
-
 	if (field->flags & NMSG_MSGMOD_FIELD_HIDDEN)
 		return (nmsg_res_failure);
 
@@ -234,6 +230,31 @@ nmsg_message_get_field_by_idx(nmsg_message_t msg, unsigned field_idx,
 	return (nmsg_res_success);
 }
 
+nmsg_res
+nmsg_message_get_field_by_idx(nmsg_message_t msg, unsigned field_idx,
+			      unsigned val_idx,
+			      void **data, size_t *len)
+{
+	struct nmsg_msgmod_field *field;
+
+	CHECK_TRANSPARENT();
+	GET_FIELD(field_idx);
+
+	return (get_field(msg, field, val_idx, data, len));
+}
+
+nmsg_res
+nmsg_message_get_field_by_accessor(nmsg_message_t msg,
+				   nmsg_field_accessor_t acc,
+				   unsigned val_idx,
+				   void **data, size_t *len)
+{
+	if (acc == NULL || msg->mod != acc->mod)
+		return (nmsg_res_failure);
+
+	return (get_field(msg, acc->field, val_idx, data, len));
+}
+
 nmsg_res
 nmsg_message_get_field(nmsg_message_t msg, const char *field_name,
 		       unsigned val_idx,
@@ -251,25 +272,26 @@ nmsg_message_get_field(nmsg_message_t msg, const char *field_name,
 
 /* Export: setters. */
 
-nmsg_res
-nmsg_message_set_field_by_idx(struct nmsg_message *msg, unsigned field_idx,
-			      unsigned val_idx,
-			      const uint8_t *data, size_t len)
+static nmsg_res
+set_field(nmsg_message_t msg, struct nmsg_msgmod_field *field,
+	  unsigned val_idx,
+	  const uint8_t *data, size_t len)
 {
 	char **parray;
 	int *qptr;
 	size_t sz;
-	struct nmsg_msgmod_field *field;
 	void *ptr = NULL;
-
-	CHECK_TRANSPARENT();
-	GET_FIELD(field_idx);
+	nmsg_res res;
 
 	if (field->get != NULL || field->flags & NMSG_MSGMOD_FIELD_HIDDEN)
 		return (nmsg_res_failure);
 
 	DESERIALIZE();
 
+	res = _nmsg_message_own_message(msg);
+	if (res != nmsg_res_success)
+		return (res);
+
 	msg->updated = true;
 
 	qptr = PBFIELD_Q(msg->message, field);
@@ -415,6 +437,31 @@ nmsg_message_set_field_by_idx(struct nmsg_message *msg, unsigned field_idx,
 	return (nmsg_res_success);
 }
 
+nmsg_res
+nmsg_message_set_field_by_idx(struct nmsg_message *msg, unsigned field_idx,
+			      unsigned val_idx,
+			      const uint8_t *data, size_t len)
+{
+	struct nmsg_msgmod_field *field;
+
+	CHECK_TRANSPARENT();
+	GET_FIELD(field_idx);
+
+	return (set_field(msg, field, val_idx, data, len));
+}
+
+nmsg_res
+nmsg_message_set_field_by_accessor(nmsg_message_t msg,
+				   nmsg_field_accessor_t acc,
+				   unsigned val_idx,
+				   const uint8_t *data, size_t len)
+{
+	if (acc == NULL || msg->mod != acc->mod)
+		return (nmsg_res_failure);
+
+	return (set_field(msg, acc->field, val_idx, data, len));
+}
+
 nmsg_res
 nmsg_message_set_field(nmsg_message_t msg, const char *field_name,
 		       unsigned val_idx,
@@ -18,15 +18,46 @@
 
 #include "transparent.h"
 
+/* Forward. */
+
+static void append_key(struct nmsg_strbuf *, struct nmsg_msgmod_field *);
+static void append_cstr(struct nmsg_strbuf *, const char *);
+
+/* Internal functions. */
+
 nmsg_res
 _nmsg_message_payload_to_pres(struct nmsg_message *msg,
 			      char **pres, const char *endline)
+{
+	nmsg_res res;
+	struct nmsg_strbuf *sb;
+
+	/* allocate pres str buffer */
+	sb = nmsg_strbuf_init();
+	if (sb == NULL)
+		return (nmsg_res_memfail);
+
+	res = _nmsg_message_payload_to_pres_append(msg, sb, endline);
+	if (res != nmsg_res_success) {
+		nmsg_strbuf_destroy(&sb);
+		return (res);
+	}
+
+	/* cleanup */
+	*pres = sb->data;
+	free(sb);
+
+	return (nmsg_res_success);
+}
+
+nmsg_res
+_nmsg_message_payload_to_pres_append(struct nmsg_message *msg,
+				     struct nmsg_strbuf *sb, const char *endline)
 {
 	ProtobufCMessage *m;
 	nmsg_res res;
 	size_t n;
 	struct nmsg_msgmod_field *field;
-	struct nmsg_strbuf *sb;
 
 	/* unpack message */
 	res = _nmsg_message_deserialize(msg);
@@ -34,11 +65,6 @@ _nmsg_message_payload_to_pres(struct nmsg_message *msg,
 		return (res);
 	m = msg->message;
 
-	/* allocate pres str buffer */
-	sb = nmsg_strbuf_init();
-	if (sb == NULL)
-		return (nmsg_res_memfail);
-
 	/* convert each message field to presentation format */
 	for (n = 0; n < msg->mod->n_fields; n++) {
 		void *ptr;
@@ -66,7 +92,7 @@ _nmsg_message_payload_to_pres(struct nmsg_message *msg,
 				}
 				res = _nmsg_message_payload_to_pres_load(msg, field, ptr, sb, endline);
 				if (res != nmsg_res_success)
-					goto err;
+					return (res);
 				val_idx += 1;
 			}
 		} else if (PBFIELD_ONE_PRESENT(m, field)) {
@@ -74,7 +100,7 @@ _nmsg_message_payload_to_pres(struct nmsg_message *msg,
 
 			res = _nmsg_message_payload_to_pres_load(msg, field, ptr, sb, endline);
 			if (res != nmsg_res_success)
-				goto err;
+				return (res);
 		} else if (PBFIELD_REPEATED(field)) {
 			size_t i, n_entries;
 
@@ -86,20 +112,13 @@ _nmsg_message_payload_to_pres(struct nmsg_message *msg,
 
 				res = _nmsg_message_payload_to_pres_load(msg, field, &array[i * siz], sb, endline);
 				if (res != nmsg_res_success)
-					goto err;
+					return (res);
 			}
 		}
 	}
 
-	/* cleanup */
-	*pres = sb->data;
-	free(sb);
-
-	return (nmsg_res_success);
-
-err:
-	nmsg_strbuf_destroy(&sb);
-	return (res);
+	/* make sure an empty message still yields a string */
+	return (nmsg_strbuf_append_str(sb, "", 0));
 }
 
 nmsg_res
@@ -133,10 +152,9 @@ _nmsg_message_payload_to_pres_load(struct nmsg_message *msg,
 		break;
 	case nmsg_msgmod_ft_string:
 		bdata = (ProtobufCBinaryData *) ptr;
-		nmsg_strbuf_append(sb, "%s: %s%s",
-				   field->name,
-				   bdata->data,
-				   endline);
+		append_key(sb, field);
+		append_cstr(sb, (const char *) bdata->data);
+		append_cstr(sb, endline);
 		break;
 	case nmsg_msgmod_ft_mlstring:
 		bdata = (ProtobufCBinaryData *) ptr;
@@ -148,10 +166,9 @@ _nmsg_message_payload_to_pres_load(struct nmsg_message *msg,
 		break;
 	case nmsg_msgmod_ft_bool: {
 		protobuf_c_boolean *b = (protobuf_c_boolean *) ptr;
-		nmsg_strbuf_append(sb, "%s: %s%s",
-				   field->name,
-				   *b ? "True" : "False",
-				   endline);
+		append_key(sb, field);
+		append_cstr(sb, *b ? "True" : "False");
+		append_cstr(sb, endline);
 		break;
 	}
 	case nmsg_msgmod_ft_enum: {
@@ -165,10 +182,9 @@ _nmsg_message_payload_to_pres_load(struct nmsg_message *msg,
 		enum_value = *((unsigned *) ptr);
 		for (i = 0; i < enum_descr->n_values; i++) {
 			if ((unsigned) enum_descr->values[i].value == enum_value) {
-				nmsg_strbuf_append(sb, "%s: %s%s",
-						   field->name,
-						   enum_descr->values[i].name,
-						   endline);
+				append_key(sb, field);
+				append_cstr(sb, enum_descr->values[i].name);
+				append_cstr(sb, endline);
 				enum_found = true;
 			}
 		}
@@ -180,21 +196,15 @@ _nmsg_message_payload_to_pres_load(struct nmsg_message *msg,
 		break;
 	}
 	case nmsg_msgmod_ft_ip: {
-		char sip[INET6_ADDRSTRLEN];
-
 		bdata = (ProtobufCBinaryData *) ptr;
 		if (bdata->len == 4) {
-			if (inet_ntop(AF_INET, bdata->data, sip, sizeof(sip))) {
-				nmsg_strbuf_append(sb, "%s: %s%s",
-						   field->name,
-						   sip, endline);
-			}
+			append_key(sb, field);
+			_nmsg_strbuf_append_ip(sb, AF_INET, bdata->data);
+			append_cstr(sb, endline);
 		} else if (bdata->len == 16) {
-			if (inet_ntop(AF_INET6, bdata->data, sip, sizeof(sip))) {
-				nmsg_strbuf_append(sb, "%s: %s%s",
-						   field->name,
-						   sip, endline);
-			}
+			append_key(sb, field);
+			_nmsg_strbuf_append_ip(sb, AF_INET6, bdata->data);
+			append_cstr(sb, endline);
 		} else {
 			nmsg_strbuf_append(sb, "%s: <INVALID IP len=%zd>%s",
 					   field->name, bdata->len,
@@ -205,37 +215,49 @@ _nmsg_message_payload_to_pres_load(struct nmsg_message *msg,
 	case nmsg_msgmod_ft_uint16: {
 		uint32_t val;
 		memcpy(&val, ptr, sizeof(uint32_t));
-		nmsg_strbuf_append(sb, "%s: %hu%s", field->name, (uint16_t) val, endline);
+		append_key(sb, field);
+		_nmsg_strbuf_append_uint(sb, (uint16_t) val, 0);
+		append_cstr(sb, endline);
 		break;
 	}
 	case nmsg_msgmod_ft_uint32: {
 		uint32_t val;
 		memcpy(&val, ptr, sizeof(uint32_t));
-		nmsg_strbuf_append(sb, "%s: %u%s", field->name, val, endline);
+		append_key(sb, field);
+		_nmsg_strbuf_append_uint(sb, val, 0);
+		append_cstr(sb, endline);
 		break;
 	}
 	case nmsg_msgmod_ft_uint64: {
 		uint64_t val;
 		memcpy(&val, ptr, sizeof(uint64_t));
-		nmsg_strbuf_append(sb, "%s: %" PRIu64 "%s", field->name, val, endline);
+		append_key(sb, field);
+		_nmsg_strbuf_append_uint(sb, val, 0);
+		append_cstr(sb, endline);
 		break;
 	}
 	case nmsg_msgmod_ft_int16: {
 		int32_t val;
 		memcpy(&val, ptr, sizeof(int32_t));
-		nmsg_strbuf_append(sb, "%s: %hd%s", field->name, (int16_t) val, endline);
+		append_key(sb, field);
+		_nmsg_strbuf_append_int(sb, (int16_t) val);
+		append_cstr(sb, endline);
 		break;
 	}
 	case nmsg_msgmod_ft_int32: {
 		int32_t val;
 		memcpy(&val, ptr, sizeof(int32_t));
-		nmsg_strbuf_append(sb, "%s: %d%s", field->name, val, endline);
+		append_key(sb, field);
+		_nmsg_strbuf_append_int(sb, val);
+		append_cstr(sb, endline);
 		break;
 	}
 	case nmsg_msgmod_ft_int64: {
 		int64_t val;
 		memcpy(&val, ptr, sizeof(int64_t));
-		nmsg_strbuf_append(sb, "%s: %" PRIi64 "%s", field->name, val, endline);
+		append_key(sb, field);
+		_nmsg_strbuf_append_int(sb, val);
+		append_cstr(sb, endline);
 		break;
 	}
 	case nmsg_msgmod_ft_double: {
@@ -248,3 +270,18 @@ _nmsg_message_payload_to_pres_load(struct nmsg_message *msg,
 
 	return (nmsg_res_success);
 }
+
+/* Private functions. */
+
+static void
+append_key(struct nmsg_strbuf *sb, struct nmsg_msgmod_field *field) {
+	append_cstr(sb, field->name);
+	nmsg_strbuf_append_str(sb, ": ", 2);
+}
+
+static void
+append_cstr(struct nmsg_strbuf *sb, const char *str) {
+	if (str == NULL)
+		str = "(null)";
+	nmsg_strbuf_append_str(sb, str, strlen(str));
+}
@@ -70,13 +70,8 @@ _nmsg_msgmod_pres_to_payload(struct nmsg_msgmod *mod, void *cl, const char *pres
 			return (nmsg_res_parse_error);
 
 		/* find the field named by this key */
-		for (n = 0; n < mod->n_fields; n++) {
-			field = &mod->fields[n];
-			if (field->descr != NULL && strcmp(name, field->descr->name) == 0)
-				break;
-		}
-
-		if (field->descr == NULL)
+		field = _nmsg_msgmod_lookup_field(mod, name);
+		if (field == NULL || field->descr == NULL)
 			return (nmsg_res_parse_error);
 
 		/* find the value */
@@ -51,6 +51,8 @@ _nmsg_msgmodset_init(const char *plugin_path) {
 	assert(msgmodset != NULL);
 	msgmodset->vendors = calloc(1, sizeof(void *));
 	assert(msgmodset->vendors != NULL);
+	msgmodset->vnames = _nmsg_nameidx_init();
+	assert(msgmodset->vnames != NULL);
 
 	dir = opendir(plugin_path);
 	if (dir == NULL) {
@@ -178,9 +180,11 @@ _nmsg_msgmodset_destroy(struct nmsg_msgmodset **pms) {
 			if (mod != NULL)
 				_nmsg_msgmod_stop(&mod);
 		}
+		_nmsg_nameidx_destroy(&msgv->mnames);
 		free(msgv->msgtypes);
 		free(msgv);
 	}
+	_nmsg_nameidx_destroy(&ms->vnames);
 	free(ms->vendors);
 	free(ms);
 	*pms = NULL;
@@ -259,6 +263,7 @@ static void
 msgmodset_insert_module(struct nmsg_msgmodset *ms, struct nmsg_msgmod *mod) {
 	struct nmsg_msgvendor *msgv;
 	unsigned i, vid, max_msgtype;
+	nmsg_res res;
 
 	vid = mod->plugin->vendor.id;
 	max_msgtype = mod->plugin->msgtype.id;
@@ -278,6 +283,9 @@ msgmodset_insert_module(struct nmsg_msgmodset *ms, struct nmsg_msgmod *mod) {
 		assert(ms->vendors[vid] != NULL);
 		ms->vendors[vid]->msgtypes = calloc(1, sizeof(void *));
 		assert(ms->vendors[vid]->msgtypes != NULL);
+		ms->vendors[vid]->mnames = _nmsg_nameidx_init();
+		assert(ms->vendors[vid]->mnames != NULL);
+		ms->vendors[vid]->vname = mod->plugin->vendor.name;
 	}
 	msgv = ms->vendors[vid];
 	if (msgv->nm < max_msgtype) {
@@ -294,4 +302,11 @@ msgmodset_insert_module(struct nmsg_msgmodset *ms, struct nmsg_msgmod *mod) {
 			      "vendor id %u, message type %u\n", __func__,
 			      mod->plugin->vendor.id, mod->plugin->msgtype.id);
 	msgv->msgtypes[mod->plugin->msgtype.id] = mod;
+
+	/* index the vendor and message type names */
+	res = _nmsg_nameidx_insert(ms->vnames, mod->plugin->vendor.name, vid);
+	assert(res == nmsg_res_success);
+	res = _nmsg_nameidx_insert(msgv->mnames, mod->plugin->msgtype.name,
+				   mod->plugin->msgtype.id);
+	assert(res == nmsg_res_success);
 }
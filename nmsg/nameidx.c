@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2013 by Farsight Security, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Case-insensitive name -> number indexes.
+ *
+ * Used to resolve vendor names, message type names and aliases without
+ * scanning every loaded module or alias. Names are not copied, and must
+ * outlive the index.
+ */
+
+/* Import. */
+
+#include <ctype.h>
+
+#include "private.h"
+
+/* Macros. */
+
+#define NAMEIDX_SZ_INIT		16
+
+/* Data structures. */
+
+struct nameidx_entry {
+	struct nameidx_entry	*next;
+	const char		*name;
+	uint32_t		hash;
+	unsigned		value;
+};
+
+struct nmsg_nameidx {
+	struct nameidx_entry	**buckets;
+	size_t			n_buckets;
+	size_t			n_entries;
+};
+
+/* Forward. */
+
+static uint32_t nameidx_hash(const char *);
+static nmsg_res nameidx_grow(struct nmsg_nameidx *);
+
+/* Internal functions. */
+
+struct nmsg_nameidx *
+_nmsg_nameidx_init(void) {
+	struct nmsg_nameidx *idx;
+
+	idx = calloc(1, sizeof(*idx));
+	if (idx == NULL)
+		return (NULL);
+
+	idx->n_buckets = NAMEIDX_SZ_INIT;
+	idx->buckets = calloc(idx->n_buckets, sizeof(*idx->buckets));
+	if (idx->buckets == NULL) {
+		free(idx);
+		return (NULL);
+	}
+
+	return (idx);
+}
+
+void
+_nmsg_nameidx_destroy(struct nmsg_nameidx **pidx) {
+	struct nameidx_entry *e, *e_next;
+	struct nmsg_nameidx *idx = *pidx;
+
+	if (idx == NULL)
+		return;
+
+	for (size_t i = 0; i < idx->n_buckets; i++) {
+		for (e = idx->buckets[i]; e != NULL; e = e_next) {
+			e_next = e->next;
+			free(e);
+		}
+	}
+	free(idx->buckets);
+	free(idx);
+	*pidx = NULL;
+}
+
+nmsg_res
+_nmsg_nameidx_insert(struct nmsg_nameidx *idx, const char *name, unsigned value) {
+	struct nameidx_entry *e;
+	uint32_t hash;
+
+	hash = nameidx_hash(name);
+
+	/* if the name is already present, the lowest value wins */
+	for (e = idx->buckets[hash & (idx->n_buckets - 1)]; e != NULL; e = e->next) {
+		if (e->hash == hash && strcasecmp(e->name, name) == 0) {
+			if (value < e->value) {
+				e->name = name;
+				e->value = value;
+			}
+			return (nmsg_res_success);
+		}
+	}
+
+	if (idx->n_entries >= idx->n_buckets) {
+		if (nameidx_grow(idx) != nmsg_res_success)
+			return (nmsg_res_memfail);
+	}
+
+	e = malloc(sizeof(*e));
+	if (e == NULL)
+		return (nmsg_res_memfail);
+	e->name = name;
+	e->hash = hash;
+	e->value = value;
+	e->next = idx->buckets[hash & (idx->n_buckets - 1)];
+	idx->buckets[hash & (idx->n_buckets - 1)] = e;
+	idx->n_entries += 1;
+
+	return (nmsg_res_success);
+}
+
+bool
+_nmsg_nameidx_lookup(struct nmsg_nameidx *idx, const char *name, unsigned *value) {
+	struct nameidx_entry *e;
+	uint32_t hash;
+
+	if (idx == NULL)
+		return (false);
+
+	hash = nameidx_hash(name);
+	for (e = idx->buckets[hash & (idx->n_buckets - 1)]; e != NULL; e = e->next) {
+		if (e->hash == hash && strcasecmp(e->name, name) == 0) {
+			*value = e->value;
+			return (true);
+		}
+	}
+
+	return (false);
+}
+
+/* Private functions. */
+
+static uint32_t
+nameidx_hash(const char *name) {
+	/* FNV-1a over the case-folded name */
+	uint32_t hash = 2166136261U;
+
+	for (; *name != '\0'; name++) {
+		hash ^= (uint32_t) tolower((unsigned char) *name);
+		hash *= 16777619U;
+	}
+
+	return (hash);
+}
+
+static nmsg_res
+nameidx_grow(struct nmsg_nameidx *idx) {
+	struct nameidx_entry **buckets, *e, *e_next;
+	size_t n_buckets = idx->n_buckets * 2;
+
+	buckets = calloc(n_buckets, sizeof(*buckets));
+	if (buckets == NULL)
+		return (nmsg_res_memfail);
+
+	for (size_t i = 0; i < idx->n_buckets; i++) {
+		for (e = idx->buckets[i]; e != NULL; e = e_next) {
+			e_next = e->next;
+			e->next = buckets[e->hash & (n_buckets - 1)];
+			buckets[e->hash & (n_buckets - 1)] = e;
+		}
+	}
+	free(idx->buckets);
+	idx->buckets = buckets;
+	idx->n_buckets = n_buckets;
+
+	return (nmsg_res_success);
+}
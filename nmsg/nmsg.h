@@ -36,6 +36,7 @@ extern "C" {
 typedef enum nmsg_res nmsg_res;
 
 typedef struct nmsg_container *	nmsg_container_t;
+typedef struct nmsg_field_accessor *	nmsg_field_accessor_t;
 typedef struct nmsg_input *	nmsg_input_t;
 typedef struct nmsg_io *	nmsg_io_t;
 typedef struct nmsg_message *	nmsg_message_t;
@@ -48,6 +49,16 @@ typedef struct nmsg_random *	nmsg_random_t;
 typedef struct nmsg_strbuf *	nmsg_strbuf_t;
 typedef struct nmsg_zbuf *	nmsg_zbuf_t;
 
+/**
+ * NMSG container compression codecs.
+ */
+typedef enum {
+	nmsg_compression_none,	/*%< no compression */
+	nmsg_compression_zlib,	/*%< zlib (#NMSG_FLAG_ZLIB) */
+	nmsg_compression_zstd,	/*%< Zstandard (#NMSG_FLAG_ZSTD) */
+	nmsg_compression_lz4,	/*%< LZ4 (#NMSG_FLAG_LZ4) */
+} nmsg_compression_type;
+
 /**
  * Generic ID to name map.
  */
@@ -264,9 +275,11 @@ The magic value (#NMSG_MAGIC) is always the four octet sequence 'N', 'M', 'S',
 \subsection flags Flags
 <div class="subsection">
 
-This is a bit field of flags. Currently two values are defined.  #NMSG_FLAG_ZLIB
-indicates that the data content has been compressed.  #NMSG_FLAG_FRAGMENT
-indicates that the data content starts a special fragmentation header.
+This is a bit field of flags. Currently four values are defined.
+#NMSG_FLAG_ZLIB, #NMSG_FLAG_ZSTD, and #NMSG_FLAG_LZ4 indicate that the data
+content has been compressed with the respective codec. At most one of them may
+be set.  #NMSG_FLAG_FRAGMENT indicates that the data content starts a special
+fragmentation header.
 
 </div>
 
@@ -280,6 +293,17 @@ variable length part should be deflated with zlib and interpreted as an
 
 </div>
 
+\subsubsection zstd NMSG_FLAG_ZSTD and NMSG_FLAG_LZ4
+<div class="subsubsection">
+
+These flags indicate that Zstandard or LZ4 compression, respectively, has been
+applied to the variable length part in place of zlib. As with #NMSG_FLAG_ZLIB,
+the compressed data is preceded by the length of the uncompressed data as an
+unsigned 32 bit integer in network byte order. Readers that do not support a
+codec will fail to decode containers compressed with it.
+
+</div>
+
 \subsubsection frag NMSG_FLAG_FRAGMENT
 <div class="subsubsection">
 
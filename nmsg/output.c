@@ -67,19 +67,33 @@ nmsg_output_open_pres(int fd) {
 		return (NULL);
 	output->type = nmsg_output_type_pres;
 	output->write_fp = _output_pres_write;
+	output->flush_fp = _output_pres_flush;
 
 	output->pres = calloc(1, sizeof(*(output->pres)));
 	if (output->pres == NULL) {
 		free(output);
 		return (NULL);
 	}
+	output->pres->sb = nmsg_strbuf_init();
+	if (output->pres->sb == NULL ||
+	    nmsg_strbuf_append_str(output->pres->sb, "", 0) != nmsg_res_success)
+	{
+		if (output->pres->sb != NULL)
+			nmsg_strbuf_destroy(&output->pres->sb);
+		free(output->pres);
+		free(output);
+		return (NULL);
+	}
 	output->pres->fp = fdopen(fd, "w");
 	if (output->pres->fp == NULL) {
+		nmsg_strbuf_destroy(&output->pres->sb);
 		free(output->pres);
 		free(output);
 		return (NULL);
 	}
 	output->pres->endline = strdup("\n");
+	output->pres->tty = isatty(fd) ? true : false;
+	nmsg_timespec_get(&output->pres->drained);
 	pthread_mutex_init(&output->pres->lock, NULL);
 
 	return (output);
@@ -130,6 +144,48 @@ nmsg_output_write(nmsg_output_t output, nmsg_message_t msg) {
 	return (res);
 }
 
+nmsg_res
+nmsg_output_write_batch(nmsg_output_t output, nmsg_message_t *msgs,
+			size_t n_msg)
+{
+	size_t i, run;
+	nmsg_res res;
+
+	if (output->write_batch_fp == NULL) {
+		for (i = 0; i < n_msg; i++) {
+			res = nmsg_output_write(output, msgs[i]);
+			if (res != nmsg_res_success)
+				return (res);
+		}
+		return (nmsg_res_success);
+	}
+
+	/* hand each run of messages that pass the filter to the output at
+	 * once */
+	for (i = 0; i < n_msg; i = run) {
+		for (run = i; run < n_msg; run++) {
+			res = _nmsg_message_serialize(msgs[run]);
+			if (res != nmsg_res_success)
+				return (res);
+			if (output->do_filter == true &&
+			    (output->filter_vid != msgs[run]->np->vid ||
+			     output->filter_msgtype != msgs[run]->np->msgtype))
+			{
+				break;
+			}
+		}
+		if (run > i) {
+			res = output->write_batch_fp(output, &msgs[i], run - i);
+			if (res != nmsg_res_success)
+				return (res);
+		}
+		if (run < n_msg)
+			run += 1;	/* skip the filtered message */
+	}
+
+	return (nmsg_res_success);
+}
+
 nmsg_res
 nmsg_output_close(nmsg_output_t *output) {
 	nmsg_res res;
@@ -138,6 +194,13 @@ nmsg_output_close(nmsg_output_t *output) {
 	switch ((*output)->type) {
 	case nmsg_output_type_stream:
 		res = _output_nmsg_flush(*output);
+		_output_nmsg_batch_destroy(&(*output)->stream->batch);
+#ifdef HAVE_LIBURING
+		_nmsg_uring_destroy(&(*output)->stream->uring);
+#endif /* HAVE_LIBURING */
+		nmsg_zbuf_destroy(&(*output)->stream->zb);
+		free((*output)->stream->wbuf);
+		free((*output)->stream->zdict);
 		if ((*output)->stream->random != NULL)
 			nmsg_random_destroy(&((*output)->stream->random));
 #ifdef HAVE_LIBXS
@@ -152,10 +215,14 @@ nmsg_output_close(nmsg_output_t *output) {
 			if (_nmsg_global_autoclose)
 				close((*output)->stream->fd);
 		}
+		if ((*output)->stream->index_fd != -1 && _nmsg_global_autoclose)
+			close((*output)->stream->index_fd);
 		nmsg_container_destroy(&(*output)->stream->c);
 		free((*output)->stream);
 		break;
 	case nmsg_output_type_pres:
+		res = _output_pres_flush(*output);
+		nmsg_strbuf_destroy(&(*output)->pres->sb);
 		fclose((*output)->pres->fp);
 		free((*output)->pres->endline);
 		free((*output)->pres);
@@ -219,11 +286,180 @@ nmsg_output_set_rate(nmsg_output_t output, nmsg_rate_t rate) {
 	output->stream->rate = rate;
 }
 
+nmsg_res
+nmsg_output_set_batch(nmsg_output_t output, unsigned max_count,
+		      size_t max_bytes, unsigned max_delay_ms)
+{
+	struct nmsg_output_batch *b = NULL;
+	nmsg_res res;
+
+	if (output->type != nmsg_output_type_stream)
+		return (nmsg_res_failure);
+	if (output->stream->type != nmsg_stream_type_file &&
+	    output->stream->type != nmsg_stream_type_sock)
+	{
+		return (nmsg_res_failure);
+	}
+
+	if (max_count > 0 || max_bytes > 0 || max_delay_ms > 0) {
+		b = calloc(1, sizeof(*b));
+		if (b == NULL)
+			return (nmsg_res_memfail);
+		b->max_count = max_count;
+		b->max_bytes = max_bytes;
+		b->max_delay.tv_sec = max_delay_ms / 1000;
+		b->max_delay.tv_nsec = (max_delay_ms % 1000) * 1000000;
+	}
+
+	pthread_mutex_lock(&output->stream->lock);
+	res = _output_nmsg_batch_flush(output);
+	_output_nmsg_batch_destroy(&output->stream->batch);
+	output->stream->batch = b;
+	pthread_mutex_unlock(&output->stream->lock);
+
+	return (res);
+}
+
+nmsg_res
+nmsg_output_set_index(nmsg_output_t output, int fd) {
+	off_t off;
+	nmsg_res res;
+
+	if (output->type != nmsg_output_type_stream ||
+	    output->stream->type != nmsg_stream_type_file)
+	{
+		return (nmsg_res_failure);
+	}
+
+	/* container offsets are counted from the current file offset */
+	off = lseek(output->stream->fd, 0, SEEK_CUR);
+	if (off == (off_t) -1)
+		return (nmsg_res_failure);
+
+	pthread_mutex_lock(&output->stream->lock);
+	if (output->stream->index_fd != -1 || fd < 0) {
+		res = nmsg_res_failure;
+		goto out;
+	}
+	res = _nmsg_index_write_header(fd);
+	if (res != nmsg_res_success)
+		goto out;
+	output->stream->index_fd = fd;
+	output->stream->index_off = (uint64_t) off;
+out:
+	pthread_mutex_unlock(&output->stream->lock);
+
+	return (res);
+}
+
+#ifdef HAVE_LIBURING
+nmsg_res
+nmsg_output_set_uring(nmsg_output_t output, unsigned depth) {
+	struct nmsg_uring *u = NULL;
+	nmsg_res res;
+
+	if (output->type != nmsg_output_type_stream ||
+	    output->stream->type != nmsg_stream_type_file ||
+	    depth > NMSG_URING_DEPTH_MAX)
+	{
+		return (nmsg_res_failure);
+	}
+
+	pthread_mutex_lock(&output->stream->lock);
+	if (output->stream->uring != NULL) {
+		res = _nmsg_uring_drain(output->stream->uring);
+		_nmsg_uring_destroy(&output->stream->uring);
+		if (res != nmsg_res_success)
+			goto out;
+	}
+	res = nmsg_res_success;
+	if (depth > 0) {
+		/* a container, its header, and some compression overhead fit in
+		 * a single registered buffer */
+		u = _nmsg_uring_init_writer(output->stream->fd, depth,
+					    output->stream->bufsz +
+					    NMSG_HDRLSZ_V2 + NMSG_ZBUF_SLOP);
+		if (u == NULL)
+			res = nmsg_res_failure;
+	}
+	output->stream->uring = u;
+out:
+	pthread_mutex_unlock(&output->stream->lock);
+
+	return (res);
+}
+#else /* HAVE_LIBURING */
+nmsg_res
+nmsg_output_set_uring(nmsg_output_t output __attribute__((unused)), unsigned depth) {
+	if (depth == 0)
+		return (nmsg_res_success);
+	_nmsg_dprintf(1, "%s: compiled without io_uring support\n", __func__);
+	return (nmsg_res_failure);
+}
+#endif /* HAVE_LIBURING */
+
 void
 nmsg_output_set_zlibout(nmsg_output_t output, bool zlibout) {
 	if (output->type != nmsg_output_type_stream)
 		return;
-	output->stream->do_zlib = zlibout;
+	nmsg_output_set_compression(output,
+				    zlibout ? nmsg_compression_zlib : nmsg_compression_none,
+				    0);
+}
+
+nmsg_res
+nmsg_output_set_compression(nmsg_output_t output,
+			    nmsg_compression_type codec, int level)
+{
+	if (output->type != nmsg_output_type_stream)
+		return (nmsg_res_failure);
+	if (codec != nmsg_compression_none &&
+	    !nmsg_zbuf_compression_supported(codec))
+	{
+		return (nmsg_res_notimpl);
+	}
+
+	pthread_mutex_lock(&output->stream->lock);
+	if (output->stream->compression != codec ||
+	    output->stream->compression_level != level)
+	{
+		/* the compression context will be recreated on next use */
+		nmsg_zbuf_destroy(&output->stream->zb);
+		output->stream->compression = codec;
+		output->stream->compression_level = level;
+	}
+	pthread_mutex_unlock(&output->stream->lock);
+
+	return (nmsg_res_success);
+}
+
+nmsg_res
+nmsg_output_set_compression_dict(nmsg_output_t output,
+				 const uint8_t *dict, size_t dict_len)
+{
+	uint8_t *zdict = NULL;
+
+	if (output->type != nmsg_output_type_stream)
+		return (nmsg_res_failure);
+	if (!nmsg_zbuf_compression_supported(nmsg_compression_zstd))
+		return (nmsg_res_notimpl);
+
+	if (dict != NULL) {
+		zdict = malloc(dict_len);
+		if (zdict == NULL)
+			return (nmsg_res_memfail);
+		memcpy(zdict, dict, dict_len);
+	}
+
+	pthread_mutex_lock(&output->stream->lock);
+	free(output->stream->zdict);
+	output->stream->zdict = zdict;
+	output->stream->zdict_len = (zdict != NULL) ? dict_len : 0;
+	/* the compression context will be recreated on next use */
+	nmsg_zbuf_destroy(&output->stream->zb);
+	pthread_mutex_unlock(&output->stream->lock);
+
+	return (nmsg_res_success);
 }
 
 void
@@ -288,6 +524,7 @@ output_open_stream_base(nmsg_stream_type type, size_t bufsz) {
 		return (NULL);
 	output->type = nmsg_output_type_stream;
 	output->write_fp = _output_nmsg_write;
+	output->write_batch_fp = _output_nmsg_write_batch;
 	output->flush_fp = _output_nmsg_flush;
 
 	/* nmsg_stream_output */
@@ -299,6 +536,7 @@ output_open_stream_base(nmsg_stream_type type, size_t bufsz) {
 	pthread_mutex_init(&output->stream->lock, NULL);
 	output->stream->type = type;
 	output->stream->buffered = true;
+	output->stream->index_fd = -1;
 
 	/* seed the rng, needed for fragment and sequence IDs */
 	output->stream->random = nmsg_random_init();
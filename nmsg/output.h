@@ -149,7 +149,8 @@ nmsg_output_open_callback(nmsg_cb_message cb, void *user);
  * This function writes out any messages in the output buffer.
  *
  * This function is only implemented for byte-stream and datagram socket
- * nmsg outputs.
+ * nmsg outputs, and for presentation outputs, which buffer formatted messages
+ * unless nmsg_output_set_buffered() has disabled buffering.
  *
  * \param[in] output nmsg_output_t object.
  *
@@ -175,6 +176,30 @@ nmsg_output_flush(nmsg_output_t output);
 nmsg_res
 nmsg_output_write(nmsg_output_t output, nmsg_message_t msg);
 
+/**
+ * Write an array of nmsg messages to an nmsg_output_t object.
+ *
+ * This is equivalent to calling nmsg_output_write() for each message in turn,
+ * but NMSG stream outputs add the whole batch to their containers while
+ * holding their lock only once.
+ *
+ * Like nmsg_output_write(), this function does not deallocate the messages.
+ * If writing a message fails, the remaining messages are not written.
+ *
+ * \param[in] output nmsg_output_t object.
+ *
+ * \param[in] msgs Array of nmsg messages to be serialized and written to
+ *	'output'.
+ *
+ * \param[in] n_msg Number of messages in 'msgs'.
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_failure
+ */
+nmsg_res
+nmsg_output_write_batch(nmsg_output_t output, nmsg_message_t *msgs,
+			size_t n_msg);
+
 /**
  * Close an nmsg_output_t object.
  *
@@ -238,6 +263,99 @@ nmsg_output_set_filter_msgtype_byname(nmsg_output_t output,
 void
 nmsg_output_set_rate(nmsg_output_t output, nmsg_rate_t rate);
 
+/**
+ * Batch the datagrams or buffers written by an NMSG stream output. Serialized
+ * containers and fragments are queued and then written with as few system
+ * calls as possible: with sendmmsg() for socket outputs, or writev() for file
+ * outputs. The queue is flushed when any of the configured limits is reached,
+ * and by nmsg_output_flush() and nmsg_output_close().
+ *
+ * The delay limit is only checked when a new buffer is queued, so a queue
+ * that is not followed by further writes will not be sent until the output is
+ * flushed.
+ *
+ * Output rate limiting configured with nmsg_output_set_rate() is still applied
+ * per container, before the container is queued.
+ *
+ * Calling this function with all limits set to 0 will disable batching. Any
+ * queued buffers are written out before the new configuration takes effect.
+ *
+ * \param[in] output NMSG file or socket nmsg_output_t object.
+ *
+ * \param[in] max_count Maximum number of queued buffers, or 0 for no limit.
+ *
+ * \param[in] max_bytes Maximum number of queued bytes, or 0 for no limit.
+ *
+ * \param[in] max_delay_ms Maximum number of milliseconds between queueing the
+ *	first buffer and flushing the queue, or 0 for no limit.
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_memfail
+ * \return #nmsg_res_failure If the output is not a file or socket output.
+ * \return #nmsg_res_errno If flushing the queued buffers failed.
+ */
+nmsg_res
+nmsg_output_set_batch(nmsg_output_t output, unsigned max_count,
+		      size_t max_bytes, unsigned max_delay_ms);
+
+/**
+ * Write a file stream output through io_uring. If 'depth' is non-zero, each
+ * serialized NMSG container is copied into one of 'depth' registered buffers
+ * and written asynchronously at an explicit file offset, so that up to
+ * 'depth' writes may be in flight while the next container is being built.
+ * Containers too large for a registered buffer are written synchronously.
+ *
+ * A failed write is reported by a subsequent write, by nmsg_output_flush(), or
+ * by nmsg_output_close(), all of which wait for the writes in flight to
+ * complete.
+ *
+ * Only regular files that were not opened with O_APPEND are supported.
+ *
+ * Calling this function with 'depth' set to 0 will wait for any writes in
+ * flight and disable io_uring writes.
+ *
+ * \param[in] output NMSG file nmsg_output_t object.
+ *
+ * \param[in] depth Number of writes to keep in flight. Must not be larger
+ *	than 256.
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_failure If the output is not a regular file output, if the
+ *	io_uring could not be set up, or if libnmsg was compiled without
+ *	io_uring support.
+ * \return #nmsg_res_errno If a write in flight failed.
+ */
+nmsg_res
+nmsg_output_set_uring(nmsg_output_t output, unsigned depth);
+
+/**
+ * Write a container index for a file stream output. For each NMSG container
+ * written to the output, a record of its file offset and length, its number
+ * of payloads, the time range of its payloads, and the sets of (vid, msgtype),
+ * source, operator, and group values of its payloads is written to 'fd'. An
+ * input can load the index with nmsg_input_set_index() to seek by time and to
+ * skip containers that hold no wanted payloads.
+ *
+ * Container offsets are counted from the output's file offset when this
+ * function is called, so it must be called before the first payload is
+ * written. The index file descriptor is closed when the output is closed.
+ *
+ * If a container or its index record cannot be written, indexing stops for
+ * the rest of the output, so that the index never points at the wrong data.
+ *
+ * \param[in] output NMSG file nmsg_output_t object.
+ *
+ * \param[in] fd Writable file descriptor of the index, usually a new sidecar
+ *	file.
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_errno If the index header could not be written.
+ * \return #nmsg_res_failure If the output is not a seekable file output, or
+ *	if an index has already been set.
+ */
+nmsg_res
+nmsg_output_set_index(nmsg_output_t output, int fd);
+
 /**
  * Set the line continuation string for presentation format output. The default
  * is "\n".
@@ -298,4 +416,53 @@ nmsg_output_set_group(nmsg_output_t output, unsigned group);
 void
 nmsg_output_set_zlibout(nmsg_output_t output, bool zlibout);
 
+/**
+ * Set the compression codec and level for an NMSG stream output. The setting
+ * takes effect starting with the next container written. Compressed
+ * containers are flagged with the codec used, so that inputs can detect it
+ * automatically.
+ *
+ * nmsg_output_set_zlibout() is equivalent to calling this function with
+ * #nmsg_compression_zlib or #nmsg_compression_none and a level of 0.
+ *
+ * \param[in] output NMSG stream nmsg_output_t object.
+ *
+ * \param[in] codec Compression codec, or #nmsg_compression_none to disable
+ *	compression.
+ *
+ * \param[in] level Codec specific compression level, or 0 for the codec's
+ *	default level. See nmsg_zbuf_compress_init().
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_failure If the output is not an NMSG stream output.
+ * \return #nmsg_res_notimpl If libnmsg was compiled without support for the
+ *	codec.
+ */
+nmsg_res
+nmsg_output_set_compression(nmsg_output_t output,
+			    nmsg_compression_type codec, int level);
+
+/**
+ * Set the zstd dictionary used to compress the containers written by an NMSG
+ * stream output. The dictionary is only used if the output's compression
+ * codec is #nmsg_compression_zstd. Readers must load the same dictionary with
+ * nmsg_input_add_compression_dict() in order to decode the containers; the
+ * dictionary ID is carried in each compressed container.
+ *
+ * \param[in] output NMSG stream nmsg_output_t object.
+ *
+ * \param[in] dict Dictionary, e.g. as created by nmsg_zbuf_train_dict(), or
+ *	NULL to stop using a dictionary. The dictionary is copied.
+ *
+ * \param[in] dict_len Length of the dictionary.
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_memfail
+ * \return #nmsg_res_failure If the output is not an NMSG stream output.
+ * \return #nmsg_res_notimpl If libnmsg was compiled without zstd support.
+ */
+nmsg_res
+nmsg_output_set_compression_dict(nmsg_output_t output,
+				 const uint8_t *dict, size_t dict_len);
+
 #endif /* NMSG_OUTPUT_H */
@@ -26,10 +26,12 @@ static void	header_serialize(uint8_t *buf, uint8_t flags, uint32_t len);
 nmsg_res
 _output_frag_write(nmsg_output_t output) {
 	Nmsg__NmsgFragment nf;
-	int i;
+	struct iovec *iov;
+	unsigned i, n_frags;
 	nmsg_res res;
-	size_t len, fragpos, fragsz, fraglen, max_fragsz;
-	uint8_t flags = 0, *packed, *frag_packed, *frag_packed_container;
+	size_t len, fragpos, fragsz, fraglen, max_fragsz, frag_slotsz;
+	size_t frags_len = 0;
+	uint8_t flags = 0, *packed, *frags, *frag_packed, *frag_packed_container;
 
 	assert(output->type == nmsg_output_type_stream);
 
@@ -45,33 +47,19 @@ _output_frag_write(nmsg_output_t output) {
 	nmsg__nmsg_fragment__init(&nf);
 	max_fragsz = output->stream->bufsz - 32;
 
-	res = nmsg_container_serialize(output->stream->c,
-				       &packed,
-				       &len,
-				       false, /* do_header */
-				       output->stream->do_zlib,
-				       output->stream->sequence,
-				       output->stream->sequence_id
-	);
-	if (output->stream->do_sequence)
-		output->stream->sequence += 1;
-
-	if (output->stream->do_zlib)
-		flags |= NMSG_FLAG_ZLIB;
-
+	res = _output_nmsg_serialize(output, false /* do_header */, &len);
 	if (res != nmsg_res_success)
-		return (res);
+		goto frag_out;
+	packed = output->stream->wbuf;
 
-	if (output->stream->do_zlib && len <= max_fragsz) {
-		/* write out the unfragmented NMSG container */
+	flags |= _nmsg_zbuf_compression_to_flag(output->stream->compression);
 
-		if (output->stream->type == nmsg_stream_type_sock) {
-			res = _output_nmsg_write_sock(output, packed, len);
-		} else if (output->stream->type == nmsg_stream_type_file) {
-			res = _output_nmsg_write_file(output, packed, len);
-		} else if (output->stream->type == nmsg_stream_type_xs) {
-			assert(0);
-		}
+	if (output->stream->compression != nmsg_compression_none &&
+	    len <= max_fragsz)
+	{
+		/* write out the unfragmented NMSG container */
+		res = _output_nmsg_write_wbuf(output, len);
+		_output_nmsg_index_container(output, res, len);
 		goto frag_out;
 	}
 
@@ -81,17 +69,25 @@ _output_frag_write(nmsg_output_t output) {
 	nf.last = len / max_fragsz;
 	nf.crc = htonl(my_crc32c(packed, len));
 	nf.has_crc = true;
+	n_frags = nf.last + 1;
+
+	/* allocate one block large enough to hold every serialized fragment,
+	 * and an iovec for each */
+	frag_slotsz = NMSG_HDRLSZ_V2 + output->stream->bufsz + 32;
+	frags = malloc(n_frags * frag_slotsz);
+	iov = malloc(n_frags * sizeof(*iov));
+	if (frags == NULL || iov == NULL) {
+		free(frags);
+		free(iov);
+		res = nmsg_res_memfail;
+		goto frag_out;
+	}
+
 	for (fragpos = 0, i = 0;
 	     fragpos < len;
 	     fragpos += max_fragsz, i++)
 	{
-		/* allocate a buffer large enough to hold one serialized fragment */
-		frag_packed = malloc(NMSG_HDRLSZ_V2 + output->stream->bufsz + 32);
-		if (frag_packed == NULL) {
-			free(packed);
-			res = nmsg_res_memfail;
-			goto frag_out;
-		}
+		frag_packed = frags + i * frag_slotsz;
 		frag_packed_container = frag_packed + NMSG_HDRLSZ_V2;
 
 		/* serialize the fragment */
@@ -103,16 +99,22 @@ _output_frag_write(nmsg_output_t output) {
 		header_serialize(frag_packed, flags, fraglen);
 		fraglen += NMSG_HDRLSZ_V2;
 
-		/* send the serialized fragment */
-		if (output->stream->type == nmsg_stream_type_sock) {
-			res = _output_nmsg_write_sock(output, frag_packed, fraglen);
-		} else if (output->stream->type == nmsg_stream_type_file) {
-			res = _output_nmsg_write_file(output, frag_packed, fraglen);
-		} else {
-			assert(0);
-		}
+		iov[i].iov_base = frag_packed;
+		iov[i].iov_len = fraglen;
+		frags_len += fraglen;
+	}
+
+	/* send the serialized fragments */
+	if (output->stream->batch != NULL) {
+		res = _output_nmsg_batch_add(output, iov, i, frags);
+		if (res == nmsg_res_memfail)
+			free(frags);
+	} else {
+		res = _output_nmsg_writev(output, iov, i);
+		free(frags);
 	}
-	free(packed);
+	free(iov);
+	_output_nmsg_index_container(output, res, frags_len);
 
 frag_out:
 	nmsg_container_destroy(&output->stream->c);
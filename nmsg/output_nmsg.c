@@ -18,12 +18,22 @@
 
 #include "private.h"
 
-/* Forward. */
+/* Macros. */
 
-#ifdef HAVE_LIBXS
-static void free_wrapper(void *, void *);
+#ifndef IOV_MAX
+# define IOV_MAX 1024
 #endif
 
+#define NMSG_SENDMMSG_CHUNK	64
+
+/* Forward. */
+
+static void set_ids(nmsg_output_t, Nmsg__NmsgPayload *);
+static nmsg_res write_locked(nmsg_output_t, nmsg_message_t);
+static nmsg_res batch_queue(nmsg_output_t, uint8_t *buf, size_t len);
+static nmsg_res writev_file(nmsg_output_t, struct iovec *, unsigned);
+static nmsg_res writev_sock(nmsg_output_t, struct iovec *, unsigned);
+
 /* Internal functions. */
 
 nmsg_res
@@ -36,6 +46,18 @@ _output_nmsg_flush(nmsg_output_t output) {
 		if (output->stream->rate != NULL)
 			nmsg_rate_sleep(output->stream->rate);
 	}
+	if (output->stream->batch != NULL && output->stream->batch->n > 0) {
+		nmsg_res bres = _output_nmsg_batch_flush(output);
+		if (res == nmsg_res_success)
+			res = bres;
+	}
+#ifdef HAVE_LIBURING
+	if (output->stream->uring != NULL) {
+		nmsg_res ures = _nmsg_uring_drain(output->stream->uring);
+		if (res == nmsg_res_success)
+			res = ures;
+	}
+#endif /* HAVE_LIBURING */
 	pthread_mutex_unlock(&output->stream->lock);
 
 	return (res);
@@ -43,51 +65,115 @@ _output_nmsg_flush(nmsg_output_t output) {
 
 nmsg_res
 _output_nmsg_write(nmsg_output_t output, nmsg_message_t msg) {
-	Nmsg__NmsgPayload *np;
 	nmsg_res res;
-	bool did_write = false;
 
 	assert(msg->np != NULL);
-	np = msg->np;
 
 	/* set source, output, group if necessary */
-	if (output->stream->source != 0) {
-		np->source = output->stream->source;
-		np->has_source = 1;
-	}
-	if (output->stream->operator != 0) {
-		np->operator_ = output->stream->operator;
-		np->has_operator_ = 1;
-	}
-	if (output->stream->group != 0) {
-		np->group = output->stream->group;
-		np->has_group = 1;
+	set_ids(output, msg->np);
+
+	pthread_mutex_lock(&output->stream->lock);
+	res = write_locked(output, msg);
+	pthread_mutex_unlock(&output->stream->lock);
+
+	return (res);
+}
+
+nmsg_res
+_output_nmsg_write_batch(nmsg_output_t output, nmsg_message_t *msgs,
+			 size_t n_msg)
+{
+	nmsg_res res = nmsg_res_success;
+
+	for (size_t i = 0; i < n_msg; i++) {
+		assert(msgs[i]->np != NULL);
+		set_ids(output, msgs[i]->np);
 	}
 
 	pthread_mutex_lock(&output->stream->lock);
+	for (size_t i = 0; i < n_msg && res == nmsg_res_success; i++)
+		res = write_locked(output, msgs[i]);
+	pthread_mutex_unlock(&output->stream->lock);
 
-	res = nmsg_container_add(output->stream->c, msg);
+	return (res);
+}
+
+bool
+_output_nmsg_can_stage(nmsg_output_t output) {
+	return (output->type == nmsg_output_type_stream &&
+		output->stream->buffered == true);
+}
 
+nmsg_res
+_output_nmsg_write_staged(nmsg_output_t output, nmsg_container_t *c,
+			  nmsg_message_t msg)
+{
+	nmsg_res res;
+
+	res = _nmsg_message_serialize(msg);
+	if (res != nmsg_res_success)
+		return (res);
+
+	if (output->do_filter == true &&
+	    (output->filter_vid != msg->np->vid ||
+	     output->filter_msgtype != msg->np->msgtype))
+	{
+		return (nmsg_res_success);
+	}
+
+	if (*c == NULL) {
+		*c = nmsg_container_init(output->stream->bufsz);
+		if (*c == NULL)
+			return (nmsg_res_memfail);
+		nmsg_container_set_sequence(*c, output->stream->do_sequence);
+	}
+
+	/* set source, output, group if necessary */
+	set_ids(output, msg->np);
+
+	/* the staging container is private to the caller, so the output is
+	 * only locked when a whole container is handed off */
+	res = nmsg_container_add(*c, msg);
 	if (res == nmsg_res_container_full) {
-		res = _output_nmsg_write_container(output);
+		res = _output_nmsg_flush_staged(output, c, false);
 		if (res != nmsg_res_success)
-			goto out;
-		res = nmsg_container_add(output->stream->c, msg);
-		if (res == nmsg_res_container_overfull)
-			res = _output_frag_write(output);
-		did_write = true;
-	} else if (res == nmsg_res_success && output->stream->buffered == false) {
-		res = _output_nmsg_write_container(output);
-		did_write = true;
-	} else if (res == nmsg_res_container_overfull) {
-		res = _output_frag_write(output);
-		did_write = true;
+			return (res);
+		res = nmsg_container_add(*c, msg);
 	}
+	if (res == nmsg_res_container_overfull)
+		res = _output_nmsg_flush_staged(output, c, true);
 
-out:
-	if (did_write && output->stream->rate != NULL)
-		nmsg_rate_sleep(output->stream->rate);
-	pthread_mutex_unlock(&output->stream->lock);
+	return (res);
+}
+
+nmsg_res
+_output_nmsg_flush_staged(nmsg_output_t output, nmsg_container_t *c,
+			  bool overfull)
+{
+	struct nmsg_stream_output *stream = output->stream;
+	nmsg_container_t c_cur;
+	nmsg_res res;
+
+	if (*c == NULL || nmsg_container_get_num_payloads(*c) == 0)
+		return (nmsg_res_success);
+
+	pthread_mutex_lock(&stream->lock);
+
+	/* swap the staging container in as the current container. the write
+	 * functions replace it with an empty one, which becomes the new
+	 * staging container. */
+	c_cur = stream->c;
+	stream->c = *c;
+	if (overfull)
+		res = _output_frag_write(output);
+	else
+		res = _output_nmsg_write_container(output);
+	*c = stream->c;
+	stream->c = c_cur;
+
+	if (stream->rate != NULL)
+		nmsg_rate_sleep(stream->rate);
+	pthread_mutex_unlock(&stream->lock);
 
 	return (res);
 }
@@ -96,29 +182,118 @@ nmsg_res
 _output_nmsg_write_container(nmsg_output_t output) {
 	nmsg_res res;
 	size_t buf_len;
-	uint8_t *buf;
-
-	res = nmsg_container_serialize(output->stream->c,
-				       &buf,
-				       &buf_len,
-				       true, /* do_header */
-				       output->stream->do_zlib,
-				       output->stream->sequence,
-				       output->stream->sequence_id
-	);
-	if (output->stream->do_sequence)
-		output->stream->sequence += 1;
 
+	res = _output_nmsg_serialize(output, true /* do_header */, &buf_len);
 	if (res != nmsg_res_success)
 		goto out;
 
+	res = _output_nmsg_write_wbuf(output, buf_len);
+	_output_nmsg_index_container(output, res, buf_len);
+
+out:
+	nmsg_container_destroy(&output->stream->c);
+	output->stream->c = nmsg_container_init(output->stream->bufsz);
+	if (output->stream->c == NULL)
+		return (nmsg_res_memfail);
+	nmsg_container_set_sequence(output->stream->c, output->stream->do_sequence);
+	return (res);
+}
+
+void
+_output_nmsg_index_container(nmsg_output_t output, nmsg_res write_res, size_t len) {
+	struct nmsg_stream_output *stream = output->stream;
+	nmsg_res res = write_res;
+
+	if (stream->index_fd == -1)
+		return;
+
+	if (res == nmsg_res_success)
+		res = _nmsg_index_write_entry(stream->index_fd, stream->c,
+					      stream->index_off, len);
+	stream->index_off += len;
+
+	/* an index with a gap in it would misdirect seeks */
+	if (res != nmsg_res_success) {
+		_nmsg_dprintf(1, "%s: disabling the container index: %s\n",
+			      __func__, nmsg_res_lookup(res));
+		if (_nmsg_global_autoclose)
+			close(stream->index_fd);
+		stream->index_fd = -1;
+	}
+}
+
+nmsg_res
+_output_nmsg_serialize(nmsg_output_t output, bool do_header, size_t *len) {
+	struct nmsg_stream_output *stream = output->stream;
+	bool do_compress = (stream->compression != nmsg_compression_none);
+	nmsg_res res;
+	size_t bufsz;
+
+	/* the compression context is kept until the codec is changed */
+	if (do_compress && stream->zb == NULL) {
+		stream->zb = nmsg_zbuf_compress_init(stream->compression,
+						     stream->compression_level);
+		if (stream->zb == NULL)
+			return (nmsg_res_memfail);
+		if (stream->zdict != NULL &&
+		    stream->compression == nmsg_compression_zstd)
+		{
+			res = nmsg_zbuf_load_dict(stream->zb, stream->zdict,
+						  stream->zdict_len, NULL);
+			if (res != nmsg_res_success) {
+				nmsg_zbuf_destroy(&stream->zb);
+				return (res);
+			}
+		}
+	}
+
+	/* grow the serialization buffer if necessary */
+	bufsz = nmsg_container_get_serialize_bufsz(stream->c, do_compress);
+	if (bufsz > stream->wbuf_sz) {
+		uint8_t *wbuf;
+
+		wbuf = realloc(stream->wbuf, bufsz);
+		if (wbuf == NULL)
+			return (nmsg_res_memfail);
+		stream->wbuf = wbuf;
+		stream->wbuf_sz = bufsz;
+	}
+
+	*len = stream->wbuf_sz;
+	res = nmsg_container_serialize_buf(stream->c,
+					   stream->wbuf,
+					   len,
+					   do_header,
+					   do_compress ? stream->zb : NULL,
+					   stream->sequence,
+					   stream->sequence_id
+	);
+	if (stream->do_sequence)
+		stream->sequence += 1;
+
+	return (res);
+}
+
+nmsg_res
+_output_nmsg_write_wbuf(nmsg_output_t output, size_t len) {
+	uint8_t *buf = output->stream->wbuf;
+	nmsg_res res = nmsg_res_failure;
+
+	if (output->stream->batch != NULL) {
+		/* the batch queue takes ownership of the buffer, a new one
+		 * will be allocated on the next write */
+		output->stream->wbuf = NULL;
+		output->stream->wbuf_sz = 0;
+		return (batch_queue(output, buf, len));
+	}
+
 	if (output->stream->type == nmsg_stream_type_sock) {
-		res = _output_nmsg_write_sock(output, buf, buf_len);
+		res = _output_nmsg_write_sock(output, buf, len);
 	} else if (output->stream->type == nmsg_stream_type_file) {
-		res = _output_nmsg_write_file(output, buf, buf_len);
+		res = _output_nmsg_write_file(output, buf, len);
 	} else if (output->stream->type == nmsg_stream_type_xs) {
 #ifdef HAVE_LIBXS
-		res = _output_nmsg_write_xs(output, buf, buf_len);
+		res = _output_nmsg_write_xs(output, buf, len);
 #else /* HAVE_LIBXS */
 		assert(output->stream->type != nmsg_stream_type_xs);
 #endif /* HAVE_LIBXS */
@@ -126,40 +301,31 @@ _output_nmsg_write_container(nmsg_output_t output) {
 		assert(0);
 	}
 
-out:
-	nmsg_container_destroy(&output->stream->c);
-	output->stream->c = nmsg_container_init(output->stream->bufsz);
-	if (output->stream->c == NULL)
-		return (nmsg_res_memfail);
-	nmsg_container_set_sequence(output->stream->c, output->stream->do_sequence);
 	return (res);
 }
 
 nmsg_res
-_output_nmsg_write_sock(nmsg_output_t output, uint8_t *buf, size_t len) {
+_output_nmsg_write_sock(nmsg_output_t output, const uint8_t *buf, size_t len) {
 	ssize_t bytes_written;
 
 	bytes_written = write(output->stream->fd, buf, len);
 	if (bytes_written < 0) {
 		_nmsg_dprintf(1, "%s: write() failed: %s\n", __func__, strerror(errno));
-		free(buf);
 		return (nmsg_res_errno);
 	}
-	free(buf);
 	assert((size_t) bytes_written == len);
 	return (nmsg_res_success);
 }
 
 #ifdef HAVE_LIBXS
 nmsg_res
-_output_nmsg_write_xs(nmsg_output_t output, uint8_t *buf, size_t len) {
+_output_nmsg_write_xs(nmsg_output_t output, const uint8_t *buf, size_t len) {
 	nmsg_res res = nmsg_res_success;
 	xs_msg_t xmsg;
 
-	if (xs_msg_init_data(&xmsg, buf, len, free_wrapper, NULL)) {
-		free(buf);
+	if (xs_msg_init_size(&xmsg, len))
 		return (nmsg_res_failure);
-	}
+	memcpy(xs_msg_data(&xmsg), buf, len);
 
 	for (;;) {
 		int ret;
@@ -190,31 +356,269 @@ _output_nmsg_write_xs(nmsg_output_t output, uint8_t *buf, size_t len) {
 #endif /* HAVE_LIBXS */
 
 nmsg_res
-_output_nmsg_write_file(nmsg_output_t output, uint8_t *buf, size_t len) {
+_output_nmsg_write_file(nmsg_output_t output, const uint8_t *buf, size_t len) {
 	ssize_t bytes_written;
 	const uint8_t *ptr = buf;
 
+#ifdef HAVE_LIBURING
+	if (output->stream->uring != NULL)
+		return (_nmsg_uring_write(output->stream->uring, buf, len));
+#endif /* HAVE_LIBURING */
+
 	while (len) {
 		bytes_written = write(output->stream->fd, ptr, len);
 		if (bytes_written < 0 && errno == EINTR)
 			continue;
 		if (bytes_written < 0) {
 			_nmsg_dprintf(1, "%s: write() failed: %s\n", __func__, strerror(errno));
-			free(buf);
 			return (nmsg_res_errno);
 		}
 		ptr += bytes_written;
 		len -= bytes_written;
 	}
-	free(buf);
 	return (nmsg_res_success);
 }
 
+nmsg_res
+_output_nmsg_writev(nmsg_output_t output, struct iovec *iov, unsigned n_iov) {
+	if (output->stream->type == nmsg_stream_type_sock)
+		return (writev_sock(output, iov, n_iov));
+	else if (output->stream->type == nmsg_stream_type_file)
+		return (writev_file(output, iov, n_iov));
+	assert(0);
+	return (nmsg_res_failure);
+}
+
+nmsg_res
+_output_nmsg_batch_add(nmsg_output_t output, const struct iovec *iov,
+		       unsigned n_iov, void *to_free)
+{
+	struct nmsg_output_batch *b = output->stream->batch;
+	struct timespec now;
+
+	assert(b != NULL);
+	if (n_iov == 0)
+		return (nmsg_res_success);
+
+	/* grow the queue, all or nothing */
+	if (b->n + n_iov > b->n_alloc) {
+		struct iovec *new_iov;
+		void **new_frees;
+		unsigned n_alloc = 2 * b->n_alloc;
+
+		if (n_alloc < b->n + n_iov)
+			n_alloc = b->n + n_iov;
+		new_iov = realloc(b->iov, n_alloc * sizeof(*new_iov));
+		if (new_iov == NULL)
+			return (nmsg_res_memfail);
+		b->iov = new_iov;
+		new_frees = realloc(b->frees, n_alloc * sizeof(*new_frees));
+		if (new_frees == NULL)
+			return (nmsg_res_memfail);
+		b->frees = new_frees;
+		b->n_alloc = n_alloc;
+	}
+
+	nmsg_timespec_get(&now);
+	if (b->n == 0) {
+		b->deadline = now;
+		nmsg_timespec_add(&b->max_delay, &b->deadline);
+	}
+
+	/* 'to_free' is released only after the last of the buffers that point
+	 * into it has been written */
+	for (unsigned i = 0; i < n_iov; i++) {
+		b->iov[b->n] = iov[i];
+		b->frees[b->n] = (i == n_iov - 1) ? to_free : NULL;
+		b->bytes += iov[i].iov_len;
+		b->n += 1;
+	}
+
+	/* flush on count, byte budget, or latency deadline */
+	if ((b->max_count > 0 && b->n >= b->max_count) ||
+	    (b->max_bytes > 0 && b->bytes >= b->max_bytes) ||
+	    ((b->max_delay.tv_sec > 0 || b->max_delay.tv_nsec > 0) &&
+	     (now.tv_sec > b->deadline.tv_sec ||
+	      (now.tv_sec == b->deadline.tv_sec &&
+	       now.tv_nsec >= b->deadline.tv_nsec))))
+	{
+		return (_output_nmsg_batch_flush(output));
+	}
+
+	return (nmsg_res_success);
+}
+
+nmsg_res
+_output_nmsg_batch_flush(nmsg_output_t output) {
+	struct nmsg_output_batch *b = output->stream->batch;
+	nmsg_res res;
+
+	if (b == NULL || b->n == 0)
+		return (nmsg_res_success);
+
+	res = _output_nmsg_writev(output, b->iov, b->n);
+
+	for (unsigned i = 0; i < b->n; i++)
+		free(b->frees[i]);
+	b->n = 0;
+	b->bytes = 0;
+
+	return (res);
+}
+
+void
+_output_nmsg_batch_destroy(struct nmsg_output_batch **b) {
+	if (*b != NULL) {
+		for (unsigned i = 0; i < (*b)->n; i++)
+			free((*b)->frees[i]);
+		free((*b)->iov);
+		free((*b)->frees);
+		free(*b);
+		*b = NULL;
+	}
+}
+
 /* Private functions. */
 
-#ifdef HAVE_LIBXS
+static nmsg_res
+write_locked(nmsg_output_t output, nmsg_message_t msg) {
+	nmsg_res res;
+	bool did_write = false;
+
+	res = nmsg_container_add(output->stream->c, msg);
+
+	if (res == nmsg_res_container_full) {
+		res = _output_nmsg_write_container(output);
+		if (res != nmsg_res_success)
+			goto out;
+		res = nmsg_container_add(output->stream->c, msg);
+		if (res == nmsg_res_container_overfull)
+			res = _output_frag_write(output);
+		did_write = true;
+	} else if (res == nmsg_res_success && output->stream->buffered == false) {
+		res = _output_nmsg_write_container(output);
+		did_write = true;
+	} else if (res == nmsg_res_container_overfull) {
+		res = _output_frag_write(output);
+		did_write = true;
+	}
+
+out:
+	if (did_write && output->stream->rate != NULL)
+		nmsg_rate_sleep(output->stream->rate);
+
+	return (res);
+}
+
 static void
-free_wrapper(void *ptr, void *hint __attribute__((unused))) {
-	free(ptr);
+set_ids(nmsg_output_t output, Nmsg__NmsgPayload *np) {
+	if (output->stream->source != 0) {
+		np->source = output->stream->source;
+		np->has_source = 1;
+	}
+	if (output->stream->operator != 0) {
+		np->operator_ = output->stream->operator;
+		np->has_operator_ = 1;
+	}
+	if (output->stream->group != 0) {
+		np->group = output->stream->group;
+		np->has_group = 1;
+	}
 }
-#endif
+
+static nmsg_res
+batch_queue(nmsg_output_t output, uint8_t *buf, size_t len) {
+	struct iovec iov;
+	nmsg_res res;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	res = _output_nmsg_batch_add(output, &iov, 1, buf);
+	if (res == nmsg_res_memfail)
+		free(buf);
+	return (res);
+}
+
+static nmsg_res
+writev_file(nmsg_output_t output, struct iovec *iov, unsigned n_iov) {
+	ssize_t bytes_written;
+
+#ifdef HAVE_LIBURING
+	/* each buffer becomes its own asynchronous write */
+	if (output->stream->uring != NULL) {
+		for (unsigned i = 0; i < n_iov; i++) {
+			nmsg_res res = _nmsg_uring_write(output->stream->uring,
+							 iov[i].iov_base,
+							 iov[i].iov_len);
+			if (res != nmsg_res_success)
+				return (res);
+		}
+		return (nmsg_res_success);
+	}
+#endif /* HAVE_LIBURING */
+
+	while (n_iov > 0) {
+		bytes_written = writev(output->stream->fd, iov,
+				       n_iov > IOV_MAX ? IOV_MAX : n_iov);
+		if (bytes_written < 0 && errno == EINTR)
+			continue;
+		if (bytes_written < 0) {
+			_nmsg_dprintf(1, "%s: writev() failed: %s\n", __func__, strerror(errno));
+			return (nmsg_res_errno);
+		}
+
+		/* skip over the fully written buffers, then resume in the
+		 * middle of a partially written one */
+		while (n_iov > 0 && (size_t) bytes_written >= iov->iov_len) {
+			bytes_written -= iov->iov_len;
+			iov++;
+			n_iov--;
+		}
+		if (n_iov > 0) {
+			iov->iov_base = (uint8_t *) iov->iov_base + bytes_written;
+			iov->iov_len -= bytes_written;
+		}
+	}
+	return (nmsg_res_success);
+}
+
+static nmsg_res
+writev_sock(nmsg_output_t output, struct iovec *iov, unsigned n_iov) {
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr mmsg[NMSG_SENDMMSG_CHUNK];
+	unsigned cnt;
+	int ret;
+
+	/* each buffer is sent as its own datagram */
+	while (n_iov > 0) {
+		cnt = (n_iov > NMSG_SENDMMSG_CHUNK) ? NMSG_SENDMMSG_CHUNK : n_iov;
+		memset(mmsg, 0, cnt * sizeof(*mmsg));
+		for (unsigned i = 0; i < cnt; i++) {
+			mmsg[i].msg_hdr.msg_iov = &iov[i];
+			mmsg[i].msg_hdr.msg_iovlen = 1;
+		}
+		ret = sendmmsg(output->stream->fd, mmsg, cnt, 0);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			_nmsg_dprintf(1, "%s: sendmmsg() failed: %s\n", __func__, strerror(errno));
+			return (nmsg_res_errno);
+		}
+		iov += ret;
+		n_iov -= ret;
+	}
+#else /* HAVE_SENDMMSG */
+	ssize_t bytes_written;
+
+	for (unsigned i = 0; i < n_iov; i++) {
+		bytes_written = write(output->stream->fd, iov[i].iov_base, iov[i].iov_len);
+		if (bytes_written < 0) {
+			_nmsg_dprintf(1, "%s: write() failed: %s\n", __func__, strerror(errno));
+			return (nmsg_res_errno);
+		}
+		assert((size_t) bytes_written == iov[i].iov_len);
+	}
+#endif /* HAVE_SENDMMSG */
+	return (nmsg_res_success);
+}
+
@@ -18,66 +18,192 @@
 
 #include "private.h"
 
+/* Macros. */
+
+/* size above which buffered presentation output is written out */
+#define PRES_WRITE_SZ		(64 * 1024)
+
+/* seconds that buffered presentation output may be held back */
+#define PRES_WRITE_SECS		1
+
+#define SECS_PER_DAY		86400
+
+/* Forward. */
+
+static void pres_append_cstr(struct nmsg_strbuf *, const char *);
+static void pres_append_when(struct nmsg_pres *, int64_t sec, uint32_t nsec);
+static nmsg_res pres_drain(struct nmsg_pres *);
+
 /* Internal functions. */
 
 nmsg_res
 _output_pres_write(nmsg_output_t output, nmsg_message_t msg) {
 	Nmsg__NmsgPayload *np;
+	struct nmsg_pres *pres = output->pres;
+	struct nmsg_strbuf *sb = pres->sb;
 	const char *vname = NULL;
 	const char *mname = NULL;
-	char *pres_data;
-	char when[32];
+	size_t mark;
 	nmsg_msgmod_t mod;
-	nmsg_res res;
-	struct tm *tm;
-	time_t t;
+	nmsg_res res = nmsg_res_success;
+	struct timespec now;
 
 	np = msg->np;
 
 	/* lock output */
-	pthread_mutex_lock(&output->pres->lock);
+	pthread_mutex_lock(&pres->lock);
+
+	/* remember where this message starts, in case it must be discarded */
+	mark = nmsg_strbuf_len(sb);
 
-	t = np->time_sec;
-	tm = gmtime(&t);
-	strftime(when, sizeof(when), "%Y-%m-%d %T", tm);
 	mod = nmsg_msgmod_lookup(np->vid, np->msgtype);
 	if (mod != NULL) {
-		res = nmsg_message_to_pres(msg, &pres_data, output->pres->endline);
-		if (res != nmsg_res_success)
+		vname = mod->plugin->vendor.name;
+		mname = mod->plugin->msgtype.name;
+	} else {
+		vname = nmsg_msgmod_vid_to_vname(np->vid);
+	}
+
+	/* [len] [when] [vid:msgtype vname mname] [source] [operator] [group] */
+	nmsg_strbuf_append_str(sb, "[", 1);
+	_nmsg_strbuf_append_uint(sb, np->has_payload ? np->payload.len : 0, 0);
+	nmsg_strbuf_append_str(sb, "] [", 3);
+	pres_append_when(pres, np->time_sec, np->time_nsec);
+	nmsg_strbuf_append_str(sb, "] [", 3);
+	_nmsg_strbuf_append_int(sb, (int32_t) np->vid);
+	nmsg_strbuf_append_str(sb, ":", 1);
+	_nmsg_strbuf_append_int(sb, (int32_t) np->msgtype);
+	nmsg_strbuf_append_str(sb, " ", 1);
+	pres_append_cstr(sb, vname ? vname : "(unknown)");
+	nmsg_strbuf_append_str(sb, " ", 1);
+	pres_append_cstr(sb, mname ? mname : "(unknown)");
+	nmsg_strbuf_append_str(sb, "] [", 3);
+	_nmsg_strbuf_append_hex(sb, np->has_source ? np->source : 0, 8);
+	nmsg_strbuf_append_str(sb, "] [", 3);
+	if (np->has_operator_)
+		pres_append_cstr(sb, nmsg_alias_by_key(nmsg_alias_operator, np->operator_));
+	nmsg_strbuf_append_str(sb, "] [", 3);
+	if (np->has_group)
+		pres_append_cstr(sb, nmsg_alias_by_key(nmsg_alias_group, np->group));
+	nmsg_strbuf_append_str(sb, "] ", 2);
+	pres_append_cstr(sb, pres->endline);
+
+	if (mod != NULL) {
+		res = _nmsg_message_to_pres_append(msg, sb, pres->endline);
+		if (res != nmsg_res_success) {
+			/* discard the partially formatted message */
+			if (sb->data != NULL) {
+				sb->pos = sb->data + mark;
+				*(sb->pos) = '\0';
+			}
 			goto out;
+		}
+	} else {
+		nmsg_strbuf_append(sb, "<UNKNOWN NMSG %u:%u>%s",
+				   np->vid, np->msgtype, pres->endline);
+	}
+	nmsg_strbuf_append_str(sb, "\n", 1);
+
+	if (sb->data == NULL) {
+		res = nmsg_res_memfail;
+		goto out;
+	}
+
+	/* terminals are written to a line at a time, like a stdio stream */
+	if (pres->flush || pres->tty || nmsg_strbuf_len(sb) >= PRES_WRITE_SZ) {
+		res = pres_drain(pres);
 	} else {
-		nmsg_asprintf(&pres_data, "<UNKNOWN NMSG %u:%u>%s",
-			      np->vid, np->msgtype,
-			      output->pres->endline);
+		/* a slow stream of messages must not be held back for long */
+		nmsg_timespec_get(&now);
+		nmsg_timespec_sub(&pres->drained, &now);
+		if (now.tv_sec >= PRES_WRITE_SECS)
+			res = pres_drain(pres);
 	}
-	vname = nmsg_msgmod_vid_to_vname(np->vid);
-	mname = nmsg_msgmod_msgtype_to_mname(np->vid, np->msgtype);
-	fprintf(output->pres->fp, "[%zu] [%s.%09u] [%d:%d %s %s] "
-		"[%08x] [%s] [%s] %s%s",
-		np->has_payload ? np->payload.len : 0,
-		when, np->time_nsec,
-		np->vid, np->msgtype,
-		vname ? vname : "(unknown)",
-		mname ? mname : "(unknown)",
-		np->has_source ? np->source : 0,
-
-		np->has_operator_ ?
-			nmsg_alias_by_key(nmsg_alias_operator, np->operator_)
-			: "",
-
-		np->has_group ?
-			nmsg_alias_by_key(nmsg_alias_group, np->group)
-			: "",
-
-		output->pres->endline, pres_data);
-	fputs("\n", output->pres->fp);
-	if (output->pres->flush)
-		fflush(output->pres->fp);
-
-	free(pres_data);
 out:
 	/* unlock output */
+	pthread_mutex_unlock(&pres->lock);
+
+	return (res);
+}
+
+nmsg_res
+_output_pres_flush(nmsg_output_t output) {
+	nmsg_res res;
+
+	pthread_mutex_lock(&output->pres->lock);
+	res = pres_drain(output->pres);
 	pthread_mutex_unlock(&output->pres->lock);
 
+	return (res);
+}
+
+/* Private functions. */
+
+static void
+pres_append_cstr(struct nmsg_strbuf *sb, const char *str) {
+	if (str == NULL)
+		str = "(null)";
+	nmsg_strbuf_append_str(sb, str, strlen(str));
+}
+
+static void
+pres_append_when(struct nmsg_pres *pres, int64_t sec, uint32_t nsec) {
+	struct nmsg_strbuf *sb = pres->sb;
+	int64_t day, tod;
+
+	day = sec / SECS_PER_DAY;
+	tod = sec % SECS_PER_DAY;
+	if (tod < 0) {
+		tod += SECS_PER_DAY;
+		day -= 1;
+	}
+
+	/* the date only changes once a day, so format it only then */
+	if (!pres->when_valid || day != pres->when_day) {
+		struct tm tm;
+		time_t t = (time_t) (day * SECS_PER_DAY);
+
+		if (gmtime_r(&t, &tm) == NULL)
+			memset(&tm, 0, sizeof(tm));
+		pres->when_len = strftime(pres->when, sizeof(pres->when),
+					  "%Y-%m-%d ", &tm);
+		pres->when_day = day;
+		pres->when_valid = true;
+	}
+
+	nmsg_strbuf_append_str(sb, pres->when, pres->when_len);
+	_nmsg_strbuf_append_uint(sb, tod / 3600, 2);
+	nmsg_strbuf_append_str(sb, ":", 1);
+	_nmsg_strbuf_append_uint(sb, (tod / 60) % 60, 2);
+	nmsg_strbuf_append_str(sb, ":", 1);
+	_nmsg_strbuf_append_uint(sb, tod % 60, 2);
+	nmsg_strbuf_append_str(sb, ".", 1);
+	_nmsg_strbuf_append_uint(sb, nsec, 9);
+}
+
+static nmsg_res
+pres_drain(struct nmsg_pres *pres) {
+	struct nmsg_strbuf *sb = pres->sb;
+	const char *p = sb->data;
+	size_t len = nmsg_strbuf_len(sb);
+	ssize_t bytes_written;
+	int fd = fileno(pres->fp);
+
+	while (len > 0) {
+		bytes_written = write(fd, p, len);
+		if (bytes_written < 0) {
+			if (errno == EINTR)
+				continue;
+			_nmsg_dprintf(1, "%s: write() failed: %s\n", __func__,
+				      strerror(errno));
+			_nmsg_strbuf_clear(sb);
+			return (nmsg_res_errno);
+		}
+		p += bytes_written;
+		len -= bytes_written;
+	}
+	_nmsg_strbuf_clear(sb);
+	nmsg_timespec_get(&pres->drained);
+
 	return (nmsg_res_success);
 }
@@ -24,10 +24,8 @@ void
 _nmsg_payload_free_all(Nmsg__Nmsg *nc) {
 	unsigned i;
 
-	for (i = 0; i < nc->n_payloads; i++) {
-		nmsg__nmsg_payload__free_unpacked(nc->payloads[i], NULL);
-		nc->payloads[i] = NULL;
-	}
+	for (i = 0; i < nc->n_payloads; i++)
+		_nmsg_payload_free(&nc->payloads[i]);
 	nc->n_payloads = 0;
 }
 
@@ -50,10 +48,39 @@ _nmsg_payload_calc_crcs(Nmsg__Nmsg *nc) {
 
 void
 _nmsg_payload_free(Nmsg__NmsgPayload **np) {
-	nmsg__nmsg_payload__free_unpacked(*np, NULL);
+	if (*np == NULL)
+		return;
+
+	/* release the fields that nmsg__nmsg_payload__free_unpacked() would,
+	 * then return the structure itself to the payload pool */
+	for (unsigned i = 0; i < (*np)->base.n_unknown_fields; i++)
+		free((*np)->base.unknown_fields[i].data);
+	free((*np)->base.unknown_fields);
+	free((*np)->payload.data);
+	_nmsg_pool_put(nmsg_pool_payload, *np);
 	*np = NULL;
 }
 
+void
+_nmsg_payload_free_shared(Nmsg__NmsgPayload **np, struct nmsg_payload_ref **ref) {
+	if (*ref == NULL) {
+		if (*np != NULL)
+			_nmsg_payload_free(np);
+		return;
+	}
+
+	/* the payload data belongs to the reference */
+	if (*np != NULL) {
+		(*np)->payload.data = NULL;
+		_nmsg_payload_free(np);
+	}
+	if (atomic_dec_and_test(&(*ref)->refs)) {
+		free((*ref)->data);
+		free(*ref);
+	}
+	*ref = NULL;
+}
+
 size_t
 _nmsg_payload_size(const Nmsg__NmsgPayload *np) {
 	size_t sz;
@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2013 by Farsight Security, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Object pools for message objects and NMSG payload structures.
+ *
+ * Each thread keeps a free list per object type, so that the common case of
+ * allocating and releasing an object takes no locks. Objects are usually
+ * created by input threads and released by output threads, so a thread whose
+ * free list grows too long moves a batch of objects to a shared depot, from
+ * which a thread whose free list is empty takes a whole batch at a time.
+ *
+ * Pooled objects are plain malloc() allocations of the pool's object size, so
+ * objects allocated elsewhere (e.g. payloads unpacked by protobuf-c) may be
+ * released into a pool, and pooled objects may be released with free().
+ */
+
+/* Import. */
+
+#include <pthread.h>
+
+#include "private.h"
+
+#include "libmy/atomic_64.h"
+
+/* Macros. */
+
+#define POOL_BATCH		64
+#define POOL_CACHE_MAX		(2 * POOL_BATCH)
+#define POOL_DEPOT_MAX		256
+#define POOL_FLUSH_OPS		1024
+
+/* Data structures. */
+
+struct pool_obj {
+	struct pool_obj		*next;
+	struct pool_obj		*next_batch;
+};
+
+struct pool_cache {
+	struct pool_obj		*head;
+	unsigned		count;
+	uint64_t		count_hit;
+	uint64_t		count_miss;
+	unsigned		n_ops;
+};
+
+struct pool_tcache {
+	struct pool_cache	caches[nmsg_pool_n_types];
+};
+
+struct pool {
+	size_t			size;
+	pthread_mutex_t		lock;
+	struct pool_obj		*batches;
+	unsigned		n_batches;
+	atomic64_t		count_hit;
+	atomic64_t		count_miss;
+};
+
+/* Globals. */
+
+static struct pool pools[nmsg_pool_n_types] = {
+	[nmsg_pool_message] = {
+		.size = sizeof(struct nmsg_message),
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	},
+	[nmsg_pool_payload] = {
+		.size = sizeof(Nmsg__NmsgPayload),
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	},
+};
+
+static __thread struct pool_tcache *tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+/* Forward. */
+
+static struct pool_tcache *get_tcache(void);
+static void tcache_init_key(void);
+static void tcache_destroy(void *);
+static void cache_flush_stats(struct pool *, struct pool_cache *);
+static void cache_release(struct pool *, struct pool_cache *, unsigned);
+
+/* Internal functions. */
+
+void *
+_nmsg_pool_get(nmsg_pool_type type) {
+	struct pool *pool = &pools[type];
+	struct pool_tcache *tc = get_tcache();
+	struct pool_cache *c;
+	struct pool_obj *obj;
+
+	if (tc == NULL) {
+		atomic64_inc(&pool->count_miss);
+		return (malloc(pool->size));
+	}
+	c = &tc->caches[type];
+
+	if (c->head == NULL) {
+		/* refill the free list with a batch from the depot */
+		pthread_mutex_lock(&pool->lock);
+		if (pool->batches != NULL) {
+			c->head = pool->batches;
+			pool->batches = c->head->next_batch;
+			pool->n_batches -= 1;
+			c->count = POOL_BATCH;
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	if (++c->n_ops == POOL_FLUSH_OPS)
+		cache_flush_stats(pool, c);
+
+	obj = c->head;
+	if (obj == NULL) {
+		c->count_miss += 1;
+		return (malloc(pool->size));
+	}
+	c->head = obj->next;
+	c->count -= 1;
+	c->count_hit += 1;
+
+	return (obj);
+}
+
+void
+_nmsg_pool_put(nmsg_pool_type type, void *ptr) {
+	struct pool *pool = &pools[type];
+	struct pool_tcache *tc;
+	struct pool_cache *c;
+	struct pool_obj *obj = ptr;
+
+	if (ptr == NULL)
+		return;
+
+	tc = get_tcache();
+	if (tc == NULL) {
+		free(ptr);
+		return;
+	}
+	c = &tc->caches[type];
+
+	obj->next = c->head;
+	c->head = obj;
+	c->count += 1;
+
+	if (c->count >= POOL_CACHE_MAX)
+		cache_release(pool, c, POOL_BATCH);
+}
+
+void
+_nmsg_pool_get_stats(nmsg_pool_type type, uint64_t *count_hit, uint64_t *count_miss) {
+	struct pool *pool = &pools[type];
+	struct pool_tcache *tc = tcache;
+
+	*count_hit = atomic64_read(&pool->count_hit);
+	*count_miss = atomic64_read(&pool->count_miss);
+
+	/* include the calling thread's unflushed counters */
+	if (tc != NULL) {
+		*count_hit += tc->caches[type].count_hit;
+		*count_miss += tc->caches[type].count_miss;
+	}
+}
+
+/* Private functions. */
+
+static struct pool_tcache *
+get_tcache(void) {
+	if (tcache != NULL)
+		return (tcache);
+
+	pthread_once(&tcache_once, tcache_init_key);
+	tcache = calloc(1, sizeof(*tcache));
+	if (tcache == NULL)
+		return (NULL);
+
+	/* return the cached objects to the depot when the thread exits */
+	if (pthread_setspecific(tcache_key, tcache) != 0) {
+		free(tcache);
+		tcache = NULL;
+	}
+	return (tcache);
+}
+
+static void
+tcache_init_key(void) {
+	int rc;
+
+	rc = pthread_key_create(&tcache_key, tcache_destroy);
+	assert(rc == 0);
+}
+
+static void
+tcache_destroy(void *data) {
+	struct pool_tcache *tc = data;
+
+	for (unsigned type = 0; type < nmsg_pool_n_types; type++) {
+		struct pool_cache *c = &tc->caches[type];
+
+		while (c->count >= POOL_BATCH)
+			cache_release(&pools[type], c, POOL_BATCH);
+		while (c->head != NULL) {
+			struct pool_obj *obj = c->head;
+
+			c->head = obj->next;
+			free(obj);
+		}
+		c->count = 0;
+		cache_flush_stats(&pools[type], c);
+	}
+	free(tc);
+	tcache = NULL;
+}
+
+static void
+cache_flush_stats(struct pool *pool, struct pool_cache *c) {
+	if (c->count_hit > 0)
+		__sync_add_and_fetch(&pool->count_hit.counter, c->count_hit);
+	if (c->count_miss > 0)
+		__sync_add_and_fetch(&pool->count_miss.counter, c->count_miss);
+	c->count_hit = 0;
+	c->count_miss = 0;
+	c->n_ops = 0;
+}
+
+static void
+cache_release(struct pool *pool, struct pool_cache *c, unsigned n) {
+	struct pool_obj *batch, *tail;
+
+	/* detach the first 'n' objects of the free list as a batch */
+	batch = tail = c->head;
+	for (unsigned i = 1; i < n; i++)
+		tail = tail->next;
+	c->head = tail->next;
+	c->count -= n;
+	tail->next = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->n_batches < POOL_DEPOT_MAX) {
+		batch->next_batch = pool->batches;
+		pool->batches = batch;
+		pool->n_batches += 1;
+		batch = NULL;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	/* the depot is full, return the memory to the system */
+	while (batch != NULL) {
+		struct pool_obj *next = batch->next;
+
+		free(batch);
+		batch = next;
+	}
+}
@@ -29,8 +29,10 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
@@ -53,6 +55,20 @@
 
 #include <zlib.h>
 
+#ifdef HAVE_LIBZSTD
+# include <zstd.h>
+# include <zdict.h>
+#endif /* HAVE_LIBZSTD */
+
+#ifdef HAVE_LIBLZ4
+# include <lz4.h>
+# include <lz4hc.h>
+#endif /* HAVE_LIBLZ4 */
+
+#ifdef HAVE_LIBURING
+# include <liburing.h>
+#endif /* HAVE_LIBURING */
+
 #include <protobuf-c/protobuf-c.h>
 
 #ifdef HAVE_LIBXS
@@ -65,6 +81,8 @@
 #include "msgmod_plugin.h"
 #include "ipreasm.h"
 
+#include "libmy/atomic.h"
+#include "libmy/atomic_64.h"
 #include "libmy/crc32c.h"
 #include "libmy/list.h"
 #include "libmy/tree.h"
@@ -77,6 +95,12 @@
 
 #define NMSG_SEQSRC_GC_INTERVAL	120
 #define NMSG_FRAG_GC_INTERVAL	30
+#define NMSG_RECV_BATCH_MAX	1024
+#define NMSG_URING_DEPTH_MAX	256
+#define NMSG_URING_RBUFSZ	(1024 * 1024)
+#define NMSG_INDEX_SET_MAX	16
+#define NMSG_INDEX_SET_ANY	0xffff
+#define NMSG_ZBUF_SLOP		128
 #define NMSG_MSG_MODULE_PREFIX	"nmsg_msg" XSTR(NMSG_MSGMOD_VERSION)
 #define NMSG_NSEC_PER_SEC	1000000000
 
@@ -119,6 +143,7 @@ struct nmsg_output;
 struct nmsg_msgmod;
 struct nmsg_msgmod_field;
 struct nmsg_msgmod_clos;
+struct nmsg_nameidx;
 struct nmsg_pcap;
 struct nmsg_pres;
 struct nmsg_stream_input;
@@ -137,8 +162,12 @@ extern struct nmsg_msgmodset *	_nmsg_global_msgmodset;
 typedef nmsg_res (*nmsg_input_read_fp)(struct nmsg_input *, nmsg_message_t *);
 typedef nmsg_res (*nmsg_input_read_loop_fp)(struct nmsg_input *, int,
 					    nmsg_cb_message, void *);
+typedef nmsg_res (*nmsg_input_read_batch_fp)(struct nmsg_input *, nmsg_message_t *,
+					     size_t, size_t *);
 typedef nmsg_res (*nmsg_input_stream_read_fp)(struct nmsg_input *, Nmsg__Nmsg **);
 typedef nmsg_res (*nmsg_output_write_fp)(struct nmsg_output *, nmsg_message_t);
+typedef nmsg_res (*nmsg_output_write_batch_fp)(struct nmsg_output *, nmsg_message_t *,
+					       size_t);
 typedef nmsg_res (*nmsg_output_flush_fp)(struct nmsg_output *);
 
 /* Data types. */
@@ -196,6 +225,93 @@ struct nmsg_buf {
 	u_char			*end;	/* one byte beyond valid data */
 };
 
+#ifdef HAVE_RECVMMSG
+/* nmsg_recv_batch: used by nmsg_stream_input */
+struct nmsg_recv_batch {
+	unsigned		n;	/* number of ring slots */
+	unsigned		idx;	/* next slot to be drained */
+	unsigned		cnt;	/* number of slots filled by recvmmsg() */
+	struct nmsg_buf		**bufs;
+	struct sockaddr_storage	*addrs;
+	struct mmsghdr		*mmsg;
+	struct iovec		*iov;
+};
+#endif /* HAVE_RECVMMSG */
+
+#ifdef HAVE_LIBURING
+/* nmsg_uring_slot: used by nmsg_uring */
+struct nmsg_uring_slot {
+	uint8_t			*data;
+	size_t			len;	/* request length */
+	size_t			pos;	/* bytes consumed by the reader */
+	off_t			off;	/* file offset of the request */
+	int			res;	/* completion result */
+	bool			busy;	/* request in flight */
+};
+
+/* nmsg_uring: used by nmsg_stream_input, nmsg_stream_output */
+struct nmsg_uring {
+	struct io_uring		ring;
+	int			fd;
+	bool			writer;
+	bool			fixed;	/* buffers are registered */
+	unsigned		depth;
+	size_t			bufsz;
+	struct nmsg_uring_slot	*slots;
+	struct iovec		*iov;
+	unsigned		head;	/* next slot to consume or fill */
+	unsigned		inflight;
+	off_t			off;	/* file offset of the next request */
+	nmsg_res		error;	/* deferred write error */
+};
+#endif /* HAVE_LIBURING */
+
+/* nmsg_index_set: the value sets recorded in an nmsg_index_entry */
+typedef enum {
+	nmsg_pool_message,		/* struct nmsg_message */
+	nmsg_pool_payload,		/* Nmsg__NmsgPayload */
+	nmsg_pool_n_types,
+} nmsg_pool_type;
+
+typedef enum {
+	nmsg_index_set_type,		/* (vid << 32) | msgtype */
+	nmsg_index_set_source,
+	nmsg_index_set_operator,
+	nmsg_index_set_group,
+	nmsg_index_n_sets,
+} nmsg_index_set;
+
+/* nmsg_index_entry: used by nmsg_index */
+struct nmsg_index_entry {
+	uint64_t		offset;	/* of the container or first fragment */
+	uint32_t		len;	/* including headers and all fragments */
+	uint32_t		n_payloads;
+	struct timespec		first;
+	struct timespec		last;
+	uint16_t		n_vals[nmsg_index_n_sets];  /* or NMSG_INDEX_SET_ANY */
+	uint64_t		*vals;	/* the sets, one after the other */
+};
+
+/* nmsg_index: used by nmsg_stream_input */
+struct nmsg_index {
+	struct nmsg_index_entry	*entries;	/* sorted by offset */
+	size_t			n_entries;
+	size_t			cur;		/* last entry found */
+};
+
+/* nmsg_output_batch: used by nmsg_stream_output */
+struct nmsg_output_batch {
+	unsigned		max_count;
+	size_t			max_bytes;
+	struct timespec		max_delay;
+	struct timespec		deadline;
+	unsigned		n;
+	unsigned		n_alloc;
+	size_t			bytes;
+	struct iovec		*iov;
+	void			**frees;
+};
+
 /* nmsg_pcap: used by nmsg_input */
 struct nmsg_pcap {
 	int			datalink;
@@ -216,16 +332,39 @@ struct nmsg_pres {
 	pthread_mutex_t		lock;
 	FILE			*fp;
 	bool			flush;
+	bool			tty;
+	struct timespec		drained;
 	char			*endline;
+	struct nmsg_strbuf	*sb;
+	bool			when_valid;
+	int64_t			when_day;
+	char			when[32];
+	size_t			when_len;
 };
 
 /* nmsg_stream_input: used by nmsg_input */
 struct nmsg_stream_input {
 	nmsg_stream_type	type;
 	struct nmsg_buf		*buf;
+#ifdef HAVE_RECVMMSG
+	struct nmsg_recv_batch	*rb;
+#endif /* HAVE_RECVMMSG */
 #ifdef HAVE_LIBXS
 	void			*xs;
 #endif /* HAVE_LIBXS */
+#ifdef HAVE_LIBURING
+	struct nmsg_uring	*uring;
+#endif /* HAVE_LIBURING */
+	u_char			*map;
+	size_t			map_len;
+	size_t			map_advised;
+	uint64_t		file_off;	/* file offset of buf->end */
+	struct nmsg_index	*index;
+	bool			do_time_range;
+	bool			has_time_start;
+	bool			has_time_end;
+	struct timespec		time_start;
+	struct timespec		time_end;
 	Nmsg__Nmsg		*nmsg;
 	unsigned		np_index;
 	size_t			nc_size;
@@ -259,7 +398,16 @@ struct nmsg_stream_output {
 #ifdef HAVE_LIBXS
 	void			*xs;
 #endif /* HAVE_LIBXS */
+#ifdef HAVE_LIBURING
+	struct nmsg_uring	*uring;
+#endif /* HAVE_LIBURING */
 	nmsg_container_t	c;
+	struct nmsg_output_batch *batch;
+	int			index_fd;
+	uint64_t		index_off;	/* file offset of the next container */
+	nmsg_zbuf_t		zb;
+	uint8_t			*wbuf;
+	size_t			wbuf_sz;
 	size_t			bufsz;
 	nmsg_random_t		random;
 	nmsg_rate_t		rate;
@@ -267,7 +415,10 @@ struct nmsg_stream_output {
 	unsigned		source;
 	unsigned		operator;
 	unsigned		group;
-	bool			do_zlib;
+	nmsg_compression_type	compression;
+	int			compression_level;
+	uint8_t			*zdict;
+	size_t			zdict_len;
 	bool			do_sequence;
 	uint32_t		sequence;
 	uint64_t		sequence_id;
@@ -298,6 +449,7 @@ struct nmsg_input {
 	};
 	nmsg_input_read_fp	read_fp;
 	nmsg_input_read_loop_fp	read_loop_fp;
+	nmsg_input_read_batch_fp read_batch_fp;
 
 	bool			do_filter;
 	unsigned		filter_vid;
@@ -314,6 +466,7 @@ struct nmsg_output {
 		struct nmsg_callback_output	*callback;
 	};
 	nmsg_output_write_fp	write_fp;
+	nmsg_output_write_batch_fp write_batch_fp;
 	nmsg_output_flush_fp	flush_fp;
 
 	bool			do_filter;
@@ -327,12 +480,31 @@ struct nmsg_message {
 	nmsg_msgmod_t		mod;
 	ProtobufCMessage	*message;
 	Nmsg__NmsgPayload	*np;
+	struct nmsg_payload_ref	*ref;
 	void			*msg_clos;
 	size_t			n_allocs;
 	void			**allocs;
+	struct nmsg_arena	*arena;
 	bool			updated;
 };
 
+/* nmsg_arena: allocator that ->message of a message object may have been
+ * unpacked with, see arena.c */
+struct nmsg_arena {
+	ProtobufCAllocator	allocator;
+	struct nmsg_arena_chunk	*chunks;
+	uint8_t			*pos;
+	uint8_t			*end;
+	size_t			chunk_size;
+};
+
+/* nmsg_payload_ref: reference counted, immutable payload data shared by the
+ * ->np members of several messages or containers */
+struct nmsg_payload_ref {
+	atomic_t		refs;
+	uint8_t			*data;
+};
+
 	/**
 	 * an nmsg_message MUST always have a non-NULL ->np member.
 	 *
@@ -385,19 +557,27 @@ struct nmsg_msgmod_clos {
 
 struct nmsg_msgvendor {
 	struct nmsg_msgmod	**msgtypes;
-	char			*vname;
+	const char		*vname;
+	struct nmsg_nameidx	*mnames;
 	size_t			nm;
 };
 
 struct nmsg_msgmod {
 	struct nmsg_msgmod_plugin	*plugin;
 	struct nmsg_msgmod_field	*fields;
+	struct nmsg_field_accessor	*accessors;
 	size_t				n_fields;
 };
 
+struct nmsg_field_accessor {
+	struct nmsg_msgmod		*mod;
+	struct nmsg_msgmod_field	*field;
+};
+
 struct nmsg_msgmodset {
 	ISC_LIST(struct nmsg_dlmod)	dlmods;
 	struct nmsg_msgvendor		**vendors;
+	struct nmsg_nameidx		*vnames;
 	size_t				nv;
 };
 
@@ -408,6 +588,12 @@ struct nmsg_msgmodset {
 nmsg_res		_nmsg_alias_init(void);
 void			_nmsg_alias_fini(void);
 
+/* from arena.c */
+
+struct nmsg_arena *	_nmsg_arena_init(size_t size);
+void			_nmsg_arena_destroy(struct nmsg_arena **arena);
+ProtobufCAllocator *	_nmsg_arena_allocator(struct nmsg_arena *arena);
+
 /* from buf.c */
 
 ssize_t			_nmsg_buf_avail(struct nmsg_buf *buf);
@@ -416,6 +602,9 @@ struct nmsg_buf *	_nmsg_buf_new(size_t sz);
 void			_nmsg_buf_destroy(struct nmsg_buf **buf);
 void			_nmsg_buf_reset(struct nmsg_buf *buf);
 
+/* from container.c */
+Nmsg__Nmsg *		_nmsg_container_get_nmsg(struct nmsg_container *);
+
 /* from dlmod.c */
 
 struct nmsg_dlmod *	_nmsg_dlmod_init(const char *path);
@@ -431,35 +620,71 @@ void			_nmsg_msgmod_stop(struct nmsg_msgmod **mod);
 nmsg_res		_nmsg_message_init_message(struct nmsg_message *msg);
 nmsg_res		_nmsg_message_init_payload(struct nmsg_message *msg);
 nmsg_res		_nmsg_message_deserialize(struct nmsg_message *msg);
+nmsg_res		_nmsg_message_own_message(struct nmsg_message *msg);
+void			_nmsg_message_free_message(struct nmsg_message *msg);
 nmsg_res		_nmsg_message_serialize(struct nmsg_message *msg);
 nmsg_message_t		_nmsg_message_from_payload(Nmsg__NmsgPayload *np);
 nmsg_message_t		_nmsg_message_dup(struct nmsg_message *msg);
 nmsg_res		_nmsg_message_dup_protobuf(const struct nmsg_message *msg, ProtobufCMessage **dst);
+nmsg_message_t		_nmsg_message_dup_shared(struct nmsg_message *msg);
+nmsg_res		_nmsg_message_to_pres_append(struct nmsg_message *msg, struct nmsg_strbuf *sb, const char *endline);
+
+/* from pool.c */
+
+void *			_nmsg_pool_get(nmsg_pool_type type);
+void			_nmsg_pool_put(nmsg_pool_type type, void *ptr);
+void			_nmsg_pool_get_stats(nmsg_pool_type type, uint64_t *count_hit, uint64_t *count_miss);
 
 /* from msgmodset.c */
 
 struct nmsg_msgmodset *	_nmsg_msgmodset_init(const char *path);
 void			_nmsg_msgmodset_destroy(struct nmsg_msgmodset **);
 
+/* from nameidx.c */
+
+struct nmsg_nameidx *	_nmsg_nameidx_init(void);
+void			_nmsg_nameidx_destroy(struct nmsg_nameidx **);
+nmsg_res		_nmsg_nameidx_insert(struct nmsg_nameidx *, const char *name, unsigned value);
+bool			_nmsg_nameidx_lookup(struct nmsg_nameidx *, const char *name, unsigned *value);
+
+/* from strbuf.c */
+
+void			_nmsg_strbuf_clear(struct nmsg_strbuf *sb);
+nmsg_res		_nmsg_strbuf_append_uint(struct nmsg_strbuf *sb, uint64_t val, unsigned width);
+nmsg_res		_nmsg_strbuf_append_int(struct nmsg_strbuf *sb, int64_t val);
+nmsg_res		_nmsg_strbuf_append_hex(struct nmsg_strbuf *sb, uint64_t val, unsigned width);
+nmsg_res		_nmsg_strbuf_append_ip(struct nmsg_strbuf *sb, int af, const void *addr);
+
 /* from payload.c */
 void			_nmsg_payload_free_all(Nmsg__Nmsg *nc);
 void			_nmsg_payload_calc_crcs(Nmsg__Nmsg *nc);
 void			_nmsg_payload_free(Nmsg__NmsgPayload **np);
 size_t			_nmsg_payload_size(const Nmsg__NmsgPayload *np);
+void			_nmsg_payload_free_shared(Nmsg__NmsgPayload **np, struct nmsg_payload_ref **ref);
 
 /* from input_frag.c */
 nmsg_res		_input_frag_read(nmsg_input_t, Nmsg__Nmsg **, uint8_t *buf, size_t buf_len);
 void			_input_frag_destroy(struct nmsg_stream_input *);
 void			_input_frag_gc(struct nmsg_stream_input *);
 
+/* from input_scan.c */
+bool			_input_scan_enabled(nmsg_input_t);
+nmsg_res		_input_scan_container(nmsg_input_t, const uint8_t *, size_t, Nmsg__Nmsg **);
+
 /* from input_nmsg.c */
-bool			_input_nmsg_filter(nmsg_input_t, unsigned, Nmsg__NmsgPayload *);
+bool			_input_nmsg_filter(nmsg_input_t, Nmsg__Nmsg *, unsigned, Nmsg__NmsgPayload *);
+bool			_input_nmsg_filter_header(nmsg_input_t, const Nmsg__NmsgPayload *);
 nmsg_res		_input_nmsg_read(nmsg_input_t, nmsg_message_t *);
+nmsg_res		_input_nmsg_read_batch(nmsg_input_t, nmsg_message_t *, size_t, size_t *);
 nmsg_res		_input_nmsg_loop(nmsg_input_t, int, nmsg_cb_message, void *);
 nmsg_res		_input_nmsg_unpack_container(nmsg_input_t, Nmsg__Nmsg **, uint8_t *, size_t);
 nmsg_res		_input_nmsg_unpack_container2(const uint8_t *, size_t, unsigned, Nmsg__Nmsg **);
+nmsg_res		_input_nmsg_decode_container(nmsg_input_t, nmsg_zbuf_t, const uint8_t *, size_t, unsigned, Nmsg__Nmsg **);
+nmsg_res		_input_nmsg_unpack(nmsg_input_t, const uint8_t *, size_t, Nmsg__Nmsg **);
+nmsg_res		_input_nmsg_read_container_raw(nmsg_input_t, uint8_t **, size_t *, unsigned *, Nmsg__Nmsg **);
 nmsg_res		_input_nmsg_read_container_file(nmsg_input_t, Nmsg__Nmsg **);
 nmsg_res		_input_nmsg_read_container_sock(nmsg_input_t, Nmsg__Nmsg **);
+nmsg_res		_input_nmsg_seek(nmsg_input_t, uint64_t offset);
 #ifdef HAVE_LIBXS
 nmsg_res		_input_nmsg_read_container_xs(nmsg_input_t, Nmsg__Nmsg **);
 #endif /* HAVE_LIBXS */
@@ -493,15 +718,56 @@ nmsg_res		_output_frag_write(nmsg_output_t);
 /* from output_nmsg.c */
 nmsg_res		_output_nmsg_flush(nmsg_output_t);
 nmsg_res		_output_nmsg_write(nmsg_output_t, nmsg_message_t);
+nmsg_res		_output_nmsg_write_batch(nmsg_output_t, nmsg_message_t *, size_t);
 nmsg_res		_output_nmsg_write_container(nmsg_output_t);
-nmsg_res		_output_nmsg_write_sock(nmsg_output_t, uint8_t *buf, size_t len);
-nmsg_res		_output_nmsg_write_file(nmsg_output_t, uint8_t *buf, size_t len);
+bool			_output_nmsg_can_stage(nmsg_output_t);
+nmsg_res		_output_nmsg_write_staged(nmsg_output_t, nmsg_container_t *, nmsg_message_t);
+nmsg_res		_output_nmsg_flush_staged(nmsg_output_t, nmsg_container_t *, bool overfull);
+void			_output_nmsg_index_container(nmsg_output_t, nmsg_res write_res, size_t len);
+nmsg_res		_output_nmsg_serialize(nmsg_output_t, bool do_header, size_t *len);
+nmsg_res		_output_nmsg_write_wbuf(nmsg_output_t, size_t len);
+nmsg_res		_output_nmsg_write_sock(nmsg_output_t, const uint8_t *buf, size_t len);
+nmsg_res		_output_nmsg_write_file(nmsg_output_t, const uint8_t *buf, size_t len);
+nmsg_res		_output_nmsg_writev(nmsg_output_t, struct iovec *iov, unsigned n_iov);
+nmsg_res		_output_nmsg_batch_add(nmsg_output_t, const struct iovec *iov, unsigned n_iov, void *to_free);
+nmsg_res		_output_nmsg_batch_flush(nmsg_output_t);
+void			_output_nmsg_batch_destroy(struct nmsg_output_batch **);
 #ifdef HAVE_LIBXS
-nmsg_res		_output_nmsg_write_xs(nmsg_output_t, uint8_t *buf, size_t len);
+nmsg_res		_output_nmsg_write_xs(nmsg_output_t, const uint8_t *buf, size_t len);
 #endif /* HAVE_LIBXS */
 
 /* from output_pres.c */
 nmsg_res		_output_pres_write(nmsg_output_t, nmsg_message_t);
+nmsg_res		_output_pres_flush(nmsg_output_t);
+
+/* from zbuf.c */
+unsigned		_nmsg_zbuf_compression_to_flag(nmsg_compression_type);
+nmsg_res		_nmsg_zbuf_flags_to_compression(unsigned flags, nmsg_compression_type *);
+nmsg_zbuf_t		_nmsg_zbuf_inflate_init_shared(nmsg_zbuf_t parent);
+
+/* from index.c */
+nmsg_res		_nmsg_index_write_header(int fd);
+nmsg_res		_nmsg_index_write_entry(int fd, struct nmsg_container *, uint64_t offset, size_t len);
+nmsg_res		_nmsg_index_load(int fd, struct nmsg_index **);
+void			_nmsg_index_destroy(struct nmsg_index **);
+const struct nmsg_index_entry *
+			_nmsg_index_find(struct nmsg_index *, uint64_t offset);
+const struct nmsg_index_entry *
+			_nmsg_index_find_time(struct nmsg_index *, const struct timespec *);
+bool			_nmsg_index_entry_has(const struct nmsg_index_entry *, nmsg_index_set, uint64_t val);
+bool			_nmsg_index_time_in_range(const struct nmsg_stream_input *,
+						  const struct timespec *first,
+						  const struct timespec *last);
+
+/* from uring.c */
+#ifdef HAVE_LIBURING
+struct nmsg_uring *	_nmsg_uring_init_reader(int fd, unsigned depth);
+struct nmsg_uring *	_nmsg_uring_init_writer(int fd, unsigned depth, size_t bufsz);
+void			_nmsg_uring_destroy(struct nmsg_uring **);
+ssize_t			_nmsg_uring_read(struct nmsg_uring *, void *buf, size_t len);
+nmsg_res		_nmsg_uring_write(struct nmsg_uring *, const void *buf, size_t len);
+nmsg_res		_nmsg_uring_drain(struct nmsg_uring *);
+#endif /* HAVE_LIBURING */
 
 /* from brate.c */
 struct nmsg_brate *	_nmsg_brate_init(size_t target_byte_rate);
@@ -22,6 +22,12 @@
 
 #define DEFAULT_STRBUF_ALLOC_SZ		1024
 
+/* Forward. */
+
+static void strbuf_fail(struct nmsg_strbuf *);
+static nmsg_res strbuf_grow(struct nmsg_strbuf *, size_t needed);
+static nmsg_res strbuf_reserve(struct nmsg_strbuf *, size_t len);
+
 /* Export. */
 
 struct nmsg_strbuf *
@@ -54,55 +60,52 @@ nmsg_strbuf_append(struct nmsg_strbuf *sb, const char *fmt, ...) {
 		sb->bufsz = DEFAULT_STRBUF_ALLOC_SZ;
 	}
 
-	/* determine how many bytes are needed */
+	/* determine how many bytes of buffer space are available */
+	avail = sb->bufsz - (sb->pos - sb->data);
+	assert(avail >= 0);
+
+	/* try to print to the end of the strbuf */
 	va_start(args, fmt);
 	va_copy(args_copy, args);
-	needed = vsnprintf(NULL, 0, fmt, args_copy) + 1;
+	status = vsnprintf(sb->pos, avail, fmt, args_copy);
 	va_end(args_copy);
-	if (needed < 0) {
-		free(sb->data);
-		sb->pos = sb->data = NULL;
-		sb->bufsz = 0;
+	if (status < 0) {
+		va_end(args);
+		strbuf_fail(sb);
 		return (nmsg_res_failure);
 	}
+	needed = status + 1;
 
-	/* determine how many bytes of buffer space are available */
-	avail = sb->bufsz - (sb->pos - sb->data);
-	assert(avail >= 0);
-
-	/* increase buffer size if necessary */
+	/* increase buffer size and print again if the output was truncated */
 	if (needed > avail) {
-		size_t offset;
-		ssize_t new_bufsz = 2 * sb->bufsz;
-		void *ptr = sb->data;
-
-		offset = sb->pos - sb->data;
-
-		while (new_bufsz - (ssize_t) sb->bufsz < needed)
-			new_bufsz *= 2;
-		assert(sb->bufsz > 0);
-		ptr = realloc(sb->data, new_bufsz);
-		if (ptr == NULL) {
-			free(sb->data);
-			sb->pos = sb->data = NULL;
-			sb->bufsz = 0;
+		if (strbuf_grow(sb, needed) != nmsg_res_success) {
+			va_end(args);
 			return (nmsg_res_memfail);
 		}
-		sb->data = ptr;
-		sb->pos = sb->data + offset;
-		sb->bufsz = new_bufsz;
+		status = vsnprintf(sb->pos, needed, fmt, args);
+		if (status < 0) {
+			va_end(args);
+			strbuf_fail(sb);
+			return (nmsg_res_failure);
+		}
 	}
+	va_end(args);
+	sb->pos += status;
 
-	/* print to the end of the strbuf */
-	status = vsnprintf(sb->pos, needed + 1, fmt, args);
-	if (status >= 0)
-		sb->pos += status;
-	else {
-		free(sb->data);
-		sb->pos = sb->data = NULL;
-		sb->bufsz = 0;
-		return (nmsg_res_failure);
-	}
+	return (nmsg_res_success);
+}
+
+nmsg_res
+nmsg_strbuf_append_str(struct nmsg_strbuf *sb, const char *str, size_t len) {
+	nmsg_res res;
+
+	res = strbuf_reserve(sb, len);
+	if (res != nmsg_res_success)
+		return (res);
+
+	memcpy(sb->pos, str, len);
+	sb->pos += len;
+	*(sb->pos) = '\0';
 
 	return (nmsg_res_success);
 }
@@ -130,3 +133,145 @@ nmsg_strbuf_reset(struct nmsg_strbuf *sb) {
 
 	return (nmsg_res_success);
 }
+
+/* Internal functions. */
+
+void
+_nmsg_strbuf_clear(struct nmsg_strbuf *sb) {
+	sb->pos = sb->data;
+	if (sb->data != NULL)
+		*(sb->pos) = '\0';
+}
+
+nmsg_res
+_nmsg_strbuf_append_uint(struct nmsg_strbuf *sb, uint64_t val, unsigned width) {
+	char buf[20];
+	char *p = &buf[sizeof(buf)];
+	size_t len;
+
+	do {
+		*(--p) = '0' + (val % 10);
+		val /= 10;
+	} while (val != 0);
+
+	len = &buf[sizeof(buf)] - p;
+	while (len < width && len < sizeof(buf)) {
+		*(--p) = '0';
+		len++;
+	}
+
+	return (nmsg_strbuf_append_str(sb, p, len));
+}
+
+nmsg_res
+_nmsg_strbuf_append_int(struct nmsg_strbuf *sb, int64_t val) {
+	nmsg_res res;
+
+	if (val < 0) {
+		res = nmsg_strbuf_append_str(sb, "-", 1);
+		if (res != nmsg_res_success)
+			return (res);
+		return (_nmsg_strbuf_append_uint(sb, -((uint64_t) val), 0));
+	}
+	return (_nmsg_strbuf_append_uint(sb, (uint64_t) val, 0));
+}
+
+nmsg_res
+_nmsg_strbuf_append_hex(struct nmsg_strbuf *sb, uint64_t val, unsigned width) {
+	static const char hex[] = "0123456789abcdef";
+	char buf[16];
+	char *p = &buf[sizeof(buf)];
+	size_t len;
+
+	do {
+		*(--p) = hex[val & 0xf];
+		val >>= 4;
+	} while (val != 0);
+
+	len = &buf[sizeof(buf)] - p;
+	while (len < width && len < sizeof(buf)) {
+		*(--p) = '0';
+		len++;
+	}
+
+	return (nmsg_strbuf_append_str(sb, p, len));
+}
+
+nmsg_res
+_nmsg_strbuf_append_ip(struct nmsg_strbuf *sb, int af, const void *addr) {
+	char buf[INET6_ADDRSTRLEN];
+	const uint8_t *a = addr;
+	size_t len;
+
+	if (af == AF_INET) {
+		char *p = buf;
+
+		for (unsigned i = 0; i < 4; i++) {
+			unsigned v = a[i];
+
+			if (i > 0)
+				*p++ = '.';
+			if (v >= 100)
+				*p++ = '0' + v / 100;
+			if (v >= 10)
+				*p++ = '0' + (v / 10) % 10;
+			*p++ = '0' + v % 10;
+		}
+		len = p - buf;
+	} else {
+		if (inet_ntop(af, addr, buf, sizeof(buf)) == NULL)
+			return (nmsg_res_failure);
+		len = strlen(buf);
+	}
+
+	return (nmsg_strbuf_append_str(sb, buf, len));
+}
+
+/* Private functions. */
+
+static void
+strbuf_fail(struct nmsg_strbuf *sb) {
+	free(sb->data);
+	sb->pos = sb->data = NULL;
+	sb->bufsz = 0;
+}
+
+static nmsg_res
+strbuf_grow(struct nmsg_strbuf *sb, size_t needed) {
+	size_t offset;
+	size_t new_bufsz = 2 * sb->bufsz;
+	void *ptr;
+
+	offset = sb->pos - sb->data;
+
+	assert(sb->bufsz > 0);
+	while (new_bufsz - offset < needed)
+		new_bufsz *= 2;
+	ptr = realloc(sb->data, new_bufsz);
+	if (ptr == NULL) {
+		strbuf_fail(sb);
+		return (nmsg_res_memfail);
+	}
+	sb->data = ptr;
+	sb->pos = sb->data + offset;
+	sb->bufsz = new_bufsz;
+
+	return (nmsg_res_success);
+}
+
+static nmsg_res
+strbuf_reserve(struct nmsg_strbuf *sb, size_t len) {
+	/* allocate a data buffer if necessary */
+	if (sb->data == NULL) {
+		sb->pos = sb->data = malloc(DEFAULT_STRBUF_ALLOC_SZ);
+		if (sb->data == NULL)
+			return (nmsg_res_memfail);
+		sb->bufsz = DEFAULT_STRBUF_ALLOC_SZ;
+	}
+
+	/* leave room for the terminating NUL */
+	if ((size_t) (sb->bufsz - (sb->pos - sb->data)) < len + 1)
+		return (strbuf_grow(sb, len + 1));
+
+	return (nmsg_res_success);
+}
@@ -64,6 +64,21 @@ void nmsg_strbuf_destroy(struct nmsg_strbuf **sb);
  */
 nmsg_res nmsg_strbuf_append(struct nmsg_strbuf *sb, const char *fmt, ...);
 
+/**
+ * Append a string of known length to a string buffer, without going through
+ * vsnprintf.
+ *
+ * \param[in] sb string buffer.
+ *
+ * \param[in] str string to append. Need not be NUL-terminated.
+ *
+ * \param[in] len number of bytes of str to append.
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_memfail
+ */
+nmsg_res nmsg_strbuf_append_str(struct nmsg_strbuf *sb, const char *str, size_t len);
+
 /**
  * Reset a string buffer.
  *
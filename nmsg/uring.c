@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 2013 by Farsight Security, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Import. */
+
+#include "private.h"
+
+#ifdef HAVE_LIBURING
+
+/* Forward. */
+
+static struct nmsg_uring *uring_init(int fd, unsigned depth, size_t bufsz, bool writer);
+static nmsg_res uring_submit(struct nmsg_uring *, unsigned);
+static nmsg_res uring_reap(struct nmsg_uring *);
+static nmsg_res uring_pwrite(int fd, const uint8_t *buf, size_t len, off_t off);
+
+/* Internal functions. */
+
+struct nmsg_uring *
+_nmsg_uring_init_reader(int fd, unsigned depth) {
+	struct nmsg_uring *u;
+
+	u = uring_init(fd, depth, NMSG_URING_RBUFSZ, false);
+	if (u == NULL)
+		return (NULL);
+
+	/* start reading ahead of the caller into every buffer */
+	for (unsigned i = 0; i < u->depth; i++) {
+		u->slots[i].off = u->off;
+		u->slots[i].len = u->bufsz;
+		u->off += u->bufsz;
+		if (uring_submit(u, i) != nmsg_res_success) {
+			_nmsg_uring_destroy(&u);
+			return (NULL);
+		}
+	}
+	return (u);
+}
+
+struct nmsg_uring *
+_nmsg_uring_init_writer(int fd, unsigned depth, size_t bufsz) {
+	int flags;
+
+	/* writes are issued at explicit offsets, which O_APPEND would ignore */
+	flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || (flags & O_APPEND) != 0)
+		return (NULL);
+
+	return (uring_init(fd, depth, bufsz, true));
+}
+
+void
+_nmsg_uring_destroy(struct nmsg_uring **u) {
+	struct nmsg_uring_slot *slot;
+	off_t off;
+
+	if (*u == NULL)
+		return;
+
+	while ((*u)->inflight > 0) {
+		if (uring_reap(*u) != nmsg_res_success)
+			break;
+	}
+
+	/* leave the file offset where a plain read() or write() would have */
+	if ((*u)->writer) {
+		off = (*u)->off;
+	} else {
+		slot = &(*u)->slots[(*u)->head];
+		off = slot->off + slot->pos;
+	}
+	(void) lseek((*u)->fd, off, SEEK_SET);
+
+	if ((*u)->fixed)
+		(void) io_uring_unregister_buffers(&(*u)->ring);
+	io_uring_queue_exit(&(*u)->ring);
+
+	for (unsigned i = 0; i < (*u)->depth; i++)
+		free((*u)->slots[i].data);
+	free((*u)->slots);
+	free((*u)->iov);
+	free(*u);
+	*u = NULL;
+}
+
+ssize_t
+_nmsg_uring_read(struct nmsg_uring *u, void *buf, size_t len) {
+	struct nmsg_uring_slot *slot;
+	size_t n;
+
+	for (;;) {
+		slot = &u->slots[u->head];
+		while (slot->busy) {
+			if (uring_reap(u) != nmsg_res_success)
+				return (-1);
+		}
+
+		if (slot->res == -EINTR || slot->res == -EAGAIN) {
+			if (uring_submit(u, u->head) != nmsg_res_success)
+				return (-1);
+			continue;
+		}
+		if (slot->res < 0) {
+			errno = -slot->res;
+			return (-1);
+		}
+
+		if (slot->pos < (size_t) slot->res) {
+			n = (size_t) slot->res - slot->pos;
+			if (n > len)
+				n = len;
+			memcpy(buf, slot->data + slot->pos, n);
+			slot->pos += n;
+			return (n);
+		}
+
+		/* a short read of a regular file is the end of the file */
+		if ((size_t) slot->res < slot->len)
+			return (0);
+
+		/* recycle the drained buffer behind the last outstanding read */
+		slot->off = u->off;
+		slot->pos = 0;
+		u->off += slot->len;
+		if (uring_submit(u, u->head) != nmsg_res_success)
+			return (-1);
+		u->head = (u->head + 1) % u->depth;
+	}
+}
+
+nmsg_res
+_nmsg_uring_write(struct nmsg_uring *u, const void *buf, size_t len) {
+	struct nmsg_uring_slot *slot;
+	nmsg_res res;
+
+	if (u->error != nmsg_res_success)
+		return (u->error);
+
+	if (len > u->bufsz) {
+		/* too large for a registered buffer, write it synchronously */
+		res = uring_pwrite(u->fd, buf, len, u->off);
+		if (res == nmsg_res_success)
+			u->off += len;
+		return (res);
+	}
+
+	slot = &u->slots[u->head];
+	while (slot->busy) {
+		res = uring_reap(u);
+		if (res != nmsg_res_success)
+			return (res);
+	}
+	if (u->error != nmsg_res_success)
+		return (u->error);
+
+	memcpy(slot->data, buf, len);
+	slot->len = len;
+	slot->off = u->off;
+	u->off += len;
+	res = uring_submit(u, u->head);
+	if (res != nmsg_res_success)
+		return (res);
+	u->head = (u->head + 1) % u->depth;
+
+	return (nmsg_res_success);
+}
+
+nmsg_res
+_nmsg_uring_drain(struct nmsg_uring *u) {
+	nmsg_res res;
+
+	while (u->inflight > 0) {
+		res = uring_reap(u);
+		if (res != nmsg_res_success)
+			return (res);
+	}
+	return (u->error);
+}
+
+/* Private functions. */
+
+static struct nmsg_uring *
+uring_init(int fd, unsigned depth, size_t bufsz, bool writer) {
+	struct nmsg_uring *u;
+	struct stat st;
+	int ret;
+
+	if (depth == 0 || depth > NMSG_URING_DEPTH_MAX)
+		return (NULL);
+
+	/* only regular files have offsets to read ahead of or write at */
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+		return (NULL);
+
+	u = calloc(1, sizeof(*u));
+	if (u == NULL)
+		return (NULL);
+	u->fd = fd;
+	u->writer = writer;
+	u->depth = depth;
+	u->bufsz = bufsz;
+	u->error = nmsg_res_success;
+
+	u->off = lseek(fd, 0, SEEK_CUR);
+	if (u->off == (off_t) -1) {
+		free(u);
+		return (NULL);
+	}
+
+	ret = io_uring_queue_init(depth, &u->ring, 0);
+	if (ret < 0) {
+		_nmsg_dprintf(1, "%s: io_uring_queue_init() failed: %s\n",
+			      __func__, strerror(-ret));
+		free(u);
+		return (NULL);
+	}
+
+	u->slots = calloc(depth, sizeof(*u->slots));
+	u->iov = calloc(depth, sizeof(*u->iov));
+	if (u->slots == NULL || u->iov == NULL)
+		goto fail;
+	for (unsigned i = 0; i < depth; i++) {
+		if (posix_memalign((void **) &u->slots[i].data, 4096, bufsz) != 0) {
+			u->slots[i].data = NULL;
+			goto fail;
+		}
+		u->iov[i].iov_base = u->slots[i].data;
+		u->iov[i].iov_len = bufsz;
+	}
+
+	/* registration can fail against RLIMIT_MEMLOCK, which only costs the
+	 * per-request page pinning that fixed buffers would have saved */
+	u->fixed = (io_uring_register_buffers(&u->ring, u->iov, depth) == 0);
+
+	return (u);
+
+fail:
+	if (u->slots != NULL) {
+		for (unsigned i = 0; i < depth; i++)
+			free(u->slots[i].data);
+	}
+	free(u->slots);
+	free(u->iov);
+	io_uring_queue_exit(&u->ring);
+	free(u);
+	return (NULL);
+}
+
+static nmsg_res
+uring_submit(struct nmsg_uring *u, unsigned i) {
+	struct nmsg_uring_slot *slot = &u->slots[i];
+	struct io_uring_sqe *sqe;
+	int ret;
+
+	sqe = io_uring_get_sqe(&u->ring);
+	if (sqe == NULL)
+		return (nmsg_res_failure);
+
+	if (u->writer) {
+		if (u->fixed)
+			io_uring_prep_write_fixed(sqe, u->fd, slot->data,
+						  slot->len, slot->off, i);
+		else
+			io_uring_prep_write(sqe, u->fd, slot->data,
+					    slot->len, slot->off);
+	} else {
+		if (u->fixed)
+			io_uring_prep_read_fixed(sqe, u->fd, slot->data,
+						 slot->len, slot->off, i);
+		else
+			io_uring_prep_read(sqe, u->fd, slot->data,
+					   slot->len, slot->off);
+	}
+	io_uring_sqe_set_data(sqe, slot);
+
+	ret = io_uring_submit(&u->ring);
+	if (ret < 0) {
+		errno = -ret;
+		return (nmsg_res_errno);
+	}
+	slot->busy = true;
+	slot->res = 0;
+	u->inflight += 1;
+
+	return (nmsg_res_success);
+}
+
+static nmsg_res
+uring_reap(struct nmsg_uring *u) {
+	struct io_uring_cqe *cqe;
+	struct nmsg_uring_slot *slot;
+	size_t done;
+	int ret;
+
+	do {
+		ret = io_uring_wait_cqe(&u->ring, &cqe);
+	} while (ret == -EINTR);
+	if (ret < 0) {
+		errno = -ret;
+		return (nmsg_res_errno);
+	}
+
+	slot = io_uring_cqe_get_data(cqe);
+	slot->res = cqe->res;
+	slot->busy = false;
+	u->inflight -= 1;
+	io_uring_cqe_seen(&u->ring, cqe);
+
+	if (!u->writer || (slot->res >= 0 && (size_t) slot->res == slot->len))
+		return (nmsg_res_success);
+
+	/* the first write error is reported by the next write or drain; short
+	 * or interrupted writes are completed synchronously */
+	if (slot->res < 0 && slot->res != -EINTR && slot->res != -EAGAIN) {
+		if (u->error == nmsg_res_success) {
+			_nmsg_dprintf(1, "%s: write failed: %s\n",
+				      __func__, strerror(-slot->res));
+			errno = -slot->res;
+			u->error = nmsg_res_errno;
+		}
+		return (nmsg_res_success);
+	}
+	done = slot->res > 0 ? (size_t) slot->res : 0;
+	if (u->error == nmsg_res_success)
+		u->error = uring_pwrite(u->fd, slot->data + done,
+					slot->len - done, slot->off + done);
+
+	return (nmsg_res_success);
+}
+
+static nmsg_res
+uring_pwrite(int fd, const uint8_t *buf, size_t len, off_t off) {
+	ssize_t bytes_written;
+
+	while (len > 0) {
+		bytes_written = pwrite(fd, buf, len, off);
+		if (bytes_written < 0 && errno == EINTR)
+			continue;
+		if (bytes_written == 0) {
+			/* no progress, and errno was not set */
+			errno = EIO;
+			return (nmsg_res_errno);
+		}
+		if (bytes_written < 0)
+			return (nmsg_res_errno);
+		buf += bytes_written;
+		off += bytes_written;
+		len -= bytes_written;
+	}
+	return (nmsg_res_success);
+}
+
+#endif /* HAVE_LIBURING */
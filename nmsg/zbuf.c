@@ -27,29 +27,92 @@ typedef enum nmsg_zbuf_type {
 
 struct nmsg_zbuf {
 	nmsg_zbuf_type		type;
+	nmsg_compression_type	codec;
+	int			level;
 	z_stream		zs;
+	struct nmsg_zbuf	*dict_parent;
+#ifdef HAVE_LIBZSTD
+	ZSTD_CCtx		*zstd_cctx;
+	ZSTD_DCtx		*zstd_dctx;
+	ZSTD_CDict		*zstd_cdict;
+	ZSTD_DDict		**zstd_ddicts;
+	unsigned		n_zstd_ddicts;
+#endif /* HAVE_LIBZSTD */
 };
 
+static const struct {
+	nmsg_compression_type	codec;
+	const char		*name;
+	unsigned		flag;
+} codecs[] = {
+	{ nmsg_compression_zlib,	"zlib",	NMSG_FLAG_ZLIB },
+	{ nmsg_compression_zstd,	"zstd",	NMSG_FLAG_ZSTD },
+	{ nmsg_compression_lz4,		"lz4",	NMSG_FLAG_LZ4 },
+};
+
+/* Forward. */
+
+static nmsg_res	zbuf_deflate_zlib(nmsg_zbuf_t, size_t, u_char *, size_t *, u_char *);
+static nmsg_res	zbuf_inflate_zlib(nmsg_zbuf_t, size_t, u_char *, size_t, u_char *);
+#ifdef HAVE_LIBZSTD
+static nmsg_res	zbuf_deflate_zstd(nmsg_zbuf_t, size_t, u_char *, size_t *, u_char *);
+static nmsg_res	zbuf_inflate_zstd(nmsg_zbuf_t, size_t, u_char *, size_t, u_char *);
+#endif /* HAVE_LIBZSTD */
+#ifdef HAVE_LIBLZ4
+static nmsg_res	zbuf_deflate_lz4(nmsg_zbuf_t, size_t, u_char *, size_t *, u_char *);
+static nmsg_res	zbuf_inflate_lz4(nmsg_zbuf_t, size_t, u_char *, size_t, u_char *);
+#endif /* HAVE_LIBLZ4 */
+
 /* Export. */
 
 nmsg_zbuf_t
 nmsg_zbuf_deflate_init(void) {
+	return (nmsg_zbuf_compress_init(nmsg_compression_zlib, 0));
+}
+
+nmsg_zbuf_t
+nmsg_zbuf_compress_init(nmsg_compression_type codec, int level) {
 	int zret;
 	struct nmsg_zbuf *zb;
 
-	zb = malloc(sizeof(*zb));
+	if (!nmsg_zbuf_compression_supported(codec))
+		return (NULL);
+
+	zb = calloc(1, sizeof(*zb));
 	if (zb == NULL)
 		return (NULL);
 
 	zb->type = nmsg_zbuf_type_deflate;
-	zb->zs.zalloc = Z_NULL;
-	zb->zs.zfree = Z_NULL;
-	zb->zs.opaque = Z_NULL;
+	zb->codec = codec;
+	zb->level = level;
 
-	zret = deflateInit(&zb->zs, Z_DEFAULT_COMPRESSION);
-	if (zret != Z_OK) {
-		free(zb);
-		return (NULL);
+	switch (codec) {
+	case nmsg_compression_zlib:
+		zb->zs.zalloc = Z_NULL;
+		zb->zs.zfree = Z_NULL;
+		zb->zs.opaque = Z_NULL;
+
+		if (level == 0)
+			level = Z_DEFAULT_COMPRESSION;
+		else if (level > Z_BEST_COMPRESSION)
+			level = Z_BEST_COMPRESSION;
+		zret = deflateInit(&zb->zs, level);
+		if (zret != Z_OK) {
+			free(zb);
+			return (NULL);
+		}
+		break;
+#ifdef HAVE_LIBZSTD
+	case nmsg_compression_zstd:
+		zb->zstd_cctx = ZSTD_createCCtx();
+		if (zb->zstd_cctx == NULL) {
+			free(zb);
+			return (NULL);
+		}
+		break;
+#endif /* HAVE_LIBZSTD */
+	default:
+		break;
 	}
 
 	return (zb);
@@ -60,11 +123,12 @@ nmsg_zbuf_inflate_init(void) {
 	int zret;
 	struct nmsg_zbuf *zb;
 
-	zb = malloc(sizeof(*zb));
+	zb = calloc(1, sizeof(*zb));
 	if (zb == NULL)
 		return (NULL);
 
 	zb->type = nmsg_zbuf_type_inflate;
+	zb->codec = nmsg_compression_zlib;
 	zb->zs.zalloc = Z_NULL;
 	zb->zs.zfree = Z_NULL;
 	zb->zs.opaque = Z_NULL;
@@ -80,39 +144,213 @@ nmsg_zbuf_inflate_init(void) {
 	return (zb);
 }
 
+nmsg_zbuf_t
+_nmsg_zbuf_inflate_init_shared(nmsg_zbuf_t parent) {
+	struct nmsg_zbuf *zb;
+
+	assert(parent->type == nmsg_zbuf_type_inflate);
+
+	zb = nmsg_zbuf_inflate_init();
+	if (zb != NULL)
+		zb->dict_parent = parent;
+
+	return (zb);
+}
+
 void
 nmsg_zbuf_destroy(nmsg_zbuf_t *zb) {
 	if (*zb != NULL) {
-		if ((*zb)->type == nmsg_zbuf_type_deflate)
-			deflateEnd(&(*zb)->zs);
-		else if ((*zb)->type == nmsg_zbuf_type_inflate)
+		if ((*zb)->type == nmsg_zbuf_type_deflate) {
+			if ((*zb)->codec == nmsg_compression_zlib)
+				deflateEnd(&(*zb)->zs);
+		} else if ((*zb)->type == nmsg_zbuf_type_inflate) {
 			inflateEnd(&(*zb)->zs);
+		}
+#ifdef HAVE_LIBZSTD
+		ZSTD_freeCCtx((*zb)->zstd_cctx);
+		ZSTD_freeDCtx((*zb)->zstd_dctx);
+		ZSTD_freeCDict((*zb)->zstd_cdict);
+		for (unsigned i = 0; i < (*zb)->n_zstd_ddicts; i++)
+			ZSTD_freeDDict((*zb)->zstd_ddicts[i]);
+		free((*zb)->zstd_ddicts);
+#endif /* HAVE_LIBZSTD */
 		free(*zb);
 		*zb = NULL;
 	}
 }
 
+nmsg_compression_type
+nmsg_zbuf_get_compression(nmsg_zbuf_t zb) {
+	return (zb->codec);
+}
+
+bool
+nmsg_zbuf_compression_supported(nmsg_compression_type codec) {
+	switch (codec) {
+	case nmsg_compression_zlib:
+		return (true);
+#ifdef HAVE_LIBZSTD
+	case nmsg_compression_zstd:
+		return (true);
+#endif /* HAVE_LIBZSTD */
+#ifdef HAVE_LIBLZ4
+	case nmsg_compression_lz4:
+		return (true);
+#endif /* HAVE_LIBLZ4 */
+	default:
+		return (false);
+	}
+}
+
+nmsg_res
+nmsg_zbuf_compression_lookup(const char *name, nmsg_compression_type *codec) {
+	if (strcasecmp(name, "none") == 0) {
+		*codec = nmsg_compression_none;
+		return (nmsg_res_success);
+	}
+	for (unsigned i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+		if (strcasecmp(name, codecs[i].name) == 0) {
+			*codec = codecs[i].codec;
+			return (nmsg_res_success);
+		}
+	}
+	return (nmsg_res_failure);
+}
+
+#ifdef HAVE_LIBZSTD
+nmsg_res
+nmsg_zbuf_load_dict(nmsg_zbuf_t zb, const uint8_t *dict, size_t dict_len,
+		    unsigned *dict_id)
+{
+	unsigned id;
+
+	id = ZDICT_getDictID(dict, dict_len);
+	if (id == 0) {
+		_nmsg_dprintf(1, "%s: not a zstd dictionary\n", __func__);
+		return (nmsg_res_failure);
+	}
+
+	if (zb->type == nmsg_zbuf_type_deflate) {
+		ZSTD_CDict *cdict;
+
+		if (zb->codec != nmsg_compression_zstd)
+			return (nmsg_res_failure);
+		cdict = ZSTD_createCDict(dict, dict_len,
+					 zb->level != 0 ? zb->level : ZSTD_CLEVEL_DEFAULT);
+		if (cdict == NULL)
+			return (nmsg_res_memfail);
+		ZSTD_freeCDict(zb->zstd_cdict);
+		zb->zstd_cdict = cdict;
+	} else {
+		ZSTD_DDict *ddict, **ddicts;
+
+		/* replace any dictionary with the same ID */
+		ddict = ZSTD_createDDict(dict, dict_len);
+		if (ddict == NULL)
+			return (nmsg_res_memfail);
+		for (unsigned i = 0; i < zb->n_zstd_ddicts; i++) {
+			if (ZSTD_getDictID_fromDDict(zb->zstd_ddicts[i]) == id) {
+				ZSTD_freeDDict(zb->zstd_ddicts[i]);
+				zb->zstd_ddicts[i] = ddict;
+				goto out;
+			}
+		}
+		ddicts = realloc(zb->zstd_ddicts,
+				 (zb->n_zstd_ddicts + 1) * sizeof(*ddicts));
+		if (ddicts == NULL) {
+			ZSTD_freeDDict(ddict);
+			return (nmsg_res_memfail);
+		}
+		zb->zstd_ddicts = ddicts;
+		zb->zstd_ddicts[zb->n_zstd_ddicts++] = ddict;
+	}
+
+out:
+	if (dict_id != NULL)
+		*dict_id = id;
+	return (nmsg_res_success);
+}
+
+nmsg_res
+nmsg_zbuf_train_dict(const uint8_t *samples, const size_t *sample_sizes,
+		     unsigned n_samples, size_t dict_cap,
+		     uint8_t **dict, size_t *dict_len)
+{
+	size_t ret;
+
+	*dict = malloc(dict_cap);
+	if (*dict == NULL)
+		return (nmsg_res_memfail);
+
+	ret = ZDICT_trainFromBuffer(*dict, dict_cap, samples, sample_sizes, n_samples);
+	if (ZDICT_isError(ret)) {
+		_nmsg_dprintf(1, "%s: ZDICT_trainFromBuffer() failed: %s\n",
+			      __func__, ZDICT_getErrorName(ret));
+		free(*dict);
+		*dict = NULL;
+		return (nmsg_res_failure);
+	}
+	*dict_len = ret;
+
+	return (nmsg_res_success);
+}
+#else /* HAVE_LIBZSTD */
+nmsg_res
+nmsg_zbuf_load_dict(nmsg_zbuf_t zb __attribute__((unused)),
+		    const uint8_t *dict __attribute__((unused)),
+		    size_t dict_len __attribute__((unused)),
+		    unsigned *dict_id __attribute__((unused)))
+{
+	return (nmsg_res_notimpl);
+}
+
+nmsg_res
+nmsg_zbuf_train_dict(const uint8_t *samples __attribute__((unused)),
+		     const size_t *sample_sizes __attribute__((unused)),
+		     unsigned n_samples __attribute__((unused)),
+		     size_t dict_cap __attribute__((unused)),
+		     uint8_t **dict __attribute__((unused)),
+		     size_t *dict_len __attribute__((unused)))
+{
+	return (nmsg_res_notimpl);
+}
+#endif /* HAVE_LIBZSTD */
+
 nmsg_res
 nmsg_zbuf_deflate(nmsg_zbuf_t zb, size_t len, u_char *buf,
 		  size_t *z_len, u_char *z_buf)
 {
-	int zret;
+	nmsg_res res;
+
+	assert(zb->type == nmsg_zbuf_type_deflate);
+	assert(*z_len > sizeof(uint32_t));
 
 	store_net32(z_buf, (uint32_t) len);
 	z_buf += 4;
+	*z_len -= sizeof(uint32_t);
 
-	zb->zs.avail_in = len;
-	zb->zs.next_in = buf;
-	zb->zs.avail_out = *z_len;
-	zb->zs.next_out = z_buf;
-
-	zret = deflate(&zb->zs, Z_FINISH);
-	assert(zret == Z_STREAM_END);
-	assert(zb->zs.avail_in == 0);
-	*z_len = *z_len - zb->zs.avail_out + sizeof(uint32_t);
-	assert(deflateReset(&zb->zs) == Z_OK);
-	assert(*z_len > 0);
+	switch (zb->codec) {
+	case nmsg_compression_zlib:
+		res = zbuf_deflate_zlib(zb, len, buf, z_len, z_buf);
+		break;
+#ifdef HAVE_LIBZSTD
+	case nmsg_compression_zstd:
+		res = zbuf_deflate_zstd(zb, len, buf, z_len, z_buf);
+		break;
+#endif /* HAVE_LIBZSTD */
+#ifdef HAVE_LIBLZ4
+	case nmsg_compression_lz4:
+		res = zbuf_deflate_lz4(zb, len, buf, z_len, z_buf);
+		break;
+#endif /* HAVE_LIBLZ4 */
+	default:
+		res = nmsg_res_notimpl;
+		break;
+	}
+	if (res != nmsg_res_success)
+		return (res);
 
+	*z_len += sizeof(uint32_t);
 	return (nmsg_res_success);
 }
 
@@ -120,28 +358,233 @@ nmsg_res
 nmsg_zbuf_inflate(nmsg_zbuf_t zb, size_t z_len, u_char *z_buf,
 		  size_t *u_len, u_char **u_buf)
 {
-	int zret;
+	return (nmsg_zbuf_decompress(zb, nmsg_compression_zlib,
+				     z_len, z_buf, u_len, u_buf));
+}
+
+nmsg_res
+nmsg_zbuf_decompress(nmsg_zbuf_t zb, nmsg_compression_type codec,
+		     size_t z_len, u_char *z_buf,
+		     size_t *u_len, u_char **u_buf)
+{
+	nmsg_res res;
 	uint32_t my_ulen;
 
+	assert(zb->type == nmsg_zbuf_type_inflate);
+
+	if (z_len < sizeof(uint32_t))
+		return (nmsg_res_failure);
 	load_net32(z_buf, &my_ulen);
 	z_buf += 4;
+	z_len -= 4;
 	*u_len = my_ulen;
 
 	*u_buf = malloc(*u_len);
 	if (*u_buf == NULL)
 		return (nmsg_res_memfail);
 
+	switch (codec) {
+	case nmsg_compression_zlib:
+		res = zbuf_inflate_zlib(zb, z_len, z_buf, *u_len, *u_buf);
+		break;
+#ifdef HAVE_LIBZSTD
+	case nmsg_compression_zstd:
+		res = zbuf_inflate_zstd(zb, z_len, z_buf, *u_len, *u_buf);
+		break;
+#endif /* HAVE_LIBZSTD */
+#ifdef HAVE_LIBLZ4
+	case nmsg_compression_lz4:
+		res = zbuf_inflate_lz4(zb, z_len, z_buf, *u_len, *u_buf);
+		break;
+#endif /* HAVE_LIBLZ4 */
+	default:
+		_nmsg_dprintf(1, "%s: unsupported compression codec %u\n",
+			      __func__, codec);
+		res = nmsg_res_notimpl;
+		break;
+	}
+	if (res != nmsg_res_success) {
+		free(*u_buf);
+		*u_buf = NULL;
+	}
+
+	return (res);
+}
+
+/* Internal functions. */
+
+unsigned
+_nmsg_zbuf_compression_to_flag(nmsg_compression_type codec) {
+	for (unsigned i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+		if (codecs[i].codec == codec)
+			return (codecs[i].flag);
+	}
+	return (0);
+}
+
+nmsg_res
+_nmsg_zbuf_flags_to_compression(unsigned flags, nmsg_compression_type *codec) {
+	*codec = nmsg_compression_none;
+	for (unsigned i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+		if (flags & codecs[i].flag) {
+			/* at most one codec flag may be set */
+			if (*codec != nmsg_compression_none)
+				return (nmsg_res_failure);
+			*codec = codecs[i].codec;
+		}
+	}
+	return (nmsg_res_success);
+}
+
+/* Private functions. */
+
+static nmsg_res
+zbuf_deflate_zlib(nmsg_zbuf_t zb, size_t len, u_char *buf,
+		  size_t *z_len, u_char *z_buf)
+{
+	int zret;
+
+	zb->zs.avail_in = len;
+	zb->zs.next_in = buf;
+	zb->zs.avail_out = *z_len;
+	zb->zs.next_out = z_buf;
+
+	zret = deflate(&zb->zs, Z_FINISH);
+	assert(zret == Z_STREAM_END);
+	assert(zb->zs.avail_in == 0);
+	*z_len = *z_len - zb->zs.avail_out;
+	assert(deflateReset(&zb->zs) == Z_OK);
+	assert(*z_len > 0);
+
+	return (nmsg_res_success);
+}
+
+static nmsg_res
+zbuf_inflate_zlib(nmsg_zbuf_t zb, size_t z_len, u_char *z_buf,
+		  size_t u_len, u_char *u_buf)
+{
+	int zret;
+
 	zb->zs.avail_in = z_len;
 	zb->zs.next_in = z_buf;
-	zb->zs.avail_out = *u_len;
-	zb->zs.next_out = *u_buf;
+	zb->zs.avail_out = u_len;
+	zb->zs.next_out = u_buf;
 
 	zret = inflate(&zb->zs, Z_NO_FLUSH);
 	if (zret != Z_STREAM_END || zb->zs.avail_out != 0) {
-		free(*u_buf);
+		inflateReset(&zb->zs);
 		return (nmsg_res_failure);
 	}
 	assert(inflateReset(&zb->zs) == Z_OK);
 
 	return (nmsg_res_success);
 }
+
+#ifdef HAVE_LIBZSTD
+static nmsg_res
+zbuf_deflate_zstd(nmsg_zbuf_t zb, size_t len, u_char *buf,
+		  size_t *z_len, u_char *z_buf)
+{
+	size_t ret;
+
+	if (zb->zstd_cdict != NULL) {
+		/* the dictionary ID is recorded in the zstd frame header */
+		ret = ZSTD_compress_usingCDict(zb->zstd_cctx, z_buf, *z_len,
+					       buf, len, zb->zstd_cdict);
+	} else {
+		ret = ZSTD_compressCCtx(zb->zstd_cctx, z_buf, *z_len,
+					buf, len, zb->level);
+	}
+	if (ZSTD_isError(ret)) {
+		_nmsg_dprintf(1, "%s: ZSTD_compressCCtx() failed: %s\n",
+			      __func__, ZSTD_getErrorName(ret));
+		return (nmsg_res_failure);
+	}
+	*z_len = ret;
+
+	return (nmsg_res_success);
+}
+
+static nmsg_res
+zbuf_inflate_zstd(nmsg_zbuf_t zb, size_t z_len, u_char *z_buf,
+		  size_t u_len, u_char *u_buf)
+{
+	ZSTD_DDict *ddict = NULL;
+	unsigned dict_id;
+	size_t ret;
+
+	/* the decompression context is created on first use */
+	if (zb->zstd_dctx == NULL) {
+		zb->zstd_dctx = ZSTD_createDCtx();
+		if (zb->zstd_dctx == NULL)
+			return (nmsg_res_memfail);
+	}
+
+	/* select the dictionary named by the frame header, if any */
+	dict_id = ZSTD_getDictID_fromFrame(z_buf, z_len);
+	if (dict_id != 0) {
+		/* a shared zbuf uses the dictionaries loaded into its parent */
+		nmsg_zbuf_t dzb = zb->dict_parent != NULL ? zb->dict_parent : zb;
+
+		for (unsigned i = 0; i < dzb->n_zstd_ddicts; i++) {
+			if (ZSTD_getDictID_fromDDict(dzb->zstd_ddicts[i]) == dict_id) {
+				ddict = dzb->zstd_ddicts[i];
+				break;
+			}
+		}
+		if (ddict == NULL) {
+			_nmsg_dprintf(1, "%s: zstd dictionary %u not loaded\n",
+				      __func__, dict_id);
+			return (nmsg_res_failure);
+		}
+		ret = ZSTD_decompress_usingDDict(zb->zstd_dctx, u_buf, u_len,
+						 z_buf, z_len, ddict);
+	} else {
+		ret = ZSTD_decompressDCtx(zb->zstd_dctx, u_buf, u_len, z_buf, z_len);
+	}
+	if (ZSTD_isError(ret) || ret != u_len)
+		return (nmsg_res_failure);
+
+	return (nmsg_res_success);
+}
+#endif /* HAVE_LIBZSTD */
+
+#ifdef HAVE_LIBLZ4
+static nmsg_res
+zbuf_deflate_lz4(nmsg_zbuf_t zb, size_t len, u_char *buf,
+		 size_t *z_len, u_char *z_buf)
+{
+	int ret;
+
+	/* positive levels select the high compression mode */
+	if (zb->level > 0) {
+		ret = LZ4_compress_HC((const char *) buf, (char *) z_buf,
+				      (int) len, (int) *z_len, zb->level);
+	} else {
+		ret = LZ4_compress_default((const char *) buf, (char *) z_buf,
+					   (int) len, (int) *z_len);
+	}
+	if (ret <= 0) {
+		_nmsg_dprintf(1, "%s: LZ4 compression failed\n", __func__);
+		return (nmsg_res_failure);
+	}
+	*z_len = (size_t) ret;
+
+	return (nmsg_res_success);
+}
+
+static nmsg_res
+zbuf_inflate_lz4(nmsg_zbuf_t zb __attribute__((unused)),
+		 size_t z_len, u_char *z_buf,
+		 size_t u_len, u_char *u_buf)
+{
+	int ret;
+
+	ret = LZ4_decompress_safe((const char *) z_buf, (char *) u_buf,
+				  (int) z_len, (int) u_len);
+	if (ret < 0 || (size_t) ret != u_len)
+		return (nmsg_res_failure);
+
+	return (nmsg_res_success);
+}
+#endif /* HAVE_LIBLZ4 */
@@ -31,6 +31,21 @@
 nmsg_zbuf_t
 nmsg_zbuf_deflate_init(void);
 
+/**
+ * Initialize an nmsg_zbuf_t object for compression with the given codec.
+ *
+ * \param[in] codec Compression codec. Must not be #nmsg_compression_none.
+ *
+ * \param[in] level Codec specific compression level, or 0 for the codec's
+ *	default level. For #nmsg_compression_lz4, a positive level selects the
+ *	LZ4 high compression mode.
+ *
+ * \return Opaque pointer that is NULL on failure or non-NULL on success. NULL
+ *	is also returned if libnmsg was compiled without support for the codec.
+ */
+nmsg_zbuf_t
+nmsg_zbuf_compress_init(nmsg_compression_type codec, int level);
+
 /**
  * Initialize an nmsg_zbuf_t object for inflation.
  *
@@ -48,20 +63,115 @@ void
 nmsg_zbuf_destroy(nmsg_zbuf_t *zb);
 
 /**
- * Deflate a buffer.
+ * Get the compression codec of an nmsg_zbuf_t object initialized for
+ * compression.
+ *
+ * \param[in] zb nmsg_zbuf_t object.
+ */
+nmsg_compression_type
+nmsg_zbuf_get_compression(nmsg_zbuf_t zb);
+
+/**
+ * Determine whether libnmsg was compiled with support for a compression codec.
+ *
+ * \param[in] codec Compression codec.
+ */
+bool
+nmsg_zbuf_compression_supported(nmsg_compression_type codec);
+
+/**
+ * Look up a compression codec by name ("none", "zlib", "zstd", or "lz4").
+ *
+ * \param[in] name Codec name.
+ *
+ * \param[out] codec Pointer to where the codec will be stored.
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_failure
+ */
+nmsg_res
+nmsg_zbuf_compression_lookup(const char *name, nmsg_compression_type *codec);
+
+/**
+ * Load a zstd dictionary into an nmsg_zbuf_t object.
+ *
+ * If 'zb' was initialized for compression with #nmsg_compression_zstd, the
+ * dictionary replaces any previously loaded dictionary and is used to compress
+ * all subsequent buffers. The ID of the dictionary is recorded in each
+ * compressed buffer.
+ *
+ * If 'zb' was initialized for inflation, the dictionary is added to the set of
+ * dictionaries that is searched by ID when decompressing zstd buffers. Any
+ * previously loaded dictionary with the same ID is replaced.
+ *
+ * \param[in] zb nmsg_zbuf_t object.
  *
- * \param[in] zb nmsg_zbuf_t object initialized for deflation.
+ * \param[in] dict Dictionary, e.g. as created by nmsg_zbuf_train_dict(). The
+ *	dictionary is copied.
+ *
+ * \param[in] dict_len Length of the dictionary.
+ *
+ * \param[out] dict_id Optional pointer to where the ID of the dictionary will be
+ *	stored.
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_memfail
+ * \return #nmsg_res_failure If 'dict' is not a zstd dictionary or 'zb' is a
+ *	compression object for a codec other than zstd.
+ * \return #nmsg_res_notimpl If libnmsg was compiled without zstd support.
+ */
+nmsg_res
+nmsg_zbuf_load_dict(nmsg_zbuf_t zb, const uint8_t *dict, size_t dict_len,
+		    unsigned *dict_id);
+
+/**
+ * Train a zstd dictionary from a set of sample buffers. For best results the
+ * samples should be serialized, uncompressed NMSG containers (without the NMSG
+ * header) similar in size and content to those that will be compressed.
+ *
+ * \param[in] samples Concatenated sample buffers.
+ *
+ * \param[in] sample_sizes Array containing the length of each sample.
+ *
+ * \param[in] n_samples Number of samples.
+ *
+ * \param[in] dict_cap Maximum size of the dictionary.
+ *
+ * \param[out] dict Pointer to where the dictionary will be stored. Should be
+ *	freed by the caller with free().
+ *
+ * \param[out] dict_len Pointer to where the length of the dictionary will be
+ *	stored.
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_memfail
+ * \return #nmsg_res_failure If training failed, for instance because there
+ *	were too few samples.
+ * \return #nmsg_res_notimpl If libnmsg was compiled without zstd support.
+ */
+nmsg_res
+nmsg_zbuf_train_dict(const uint8_t *samples, const size_t *sample_sizes,
+		     unsigned n_samples, size_t dict_cap,
+		     uint8_t **dict, size_t *dict_len);
+
+/**
+ * Deflate a buffer. Despite the name, the codec that the nmsg_zbuf_t object
+ * was initialized with is used.
+ *
+ * \param[in] zb nmsg_zbuf_t object initialized for compression.
  *
  * \param[in] len length of buffer to compress.
  *
  * \param[in] buf buffer to compress.
  *
- * \param[out] z_len length of compressed buffer.
+ * \param[in,out] z_len on input, size of the compressed buffer. On output,
+ *	length of the compressed data.
  *
- * \param[out] z_buf compressed buffer. Allocated by the caller and should be at
- *	least as large as 'buf'.
+ * \param[out] z_buf compressed buffer. Allocated by the caller and should be
+ *	somewhat larger than 'buf', since incompressible data expands slightly.
  *
  * \return #nmsg_res_success
+ * \return #nmsg_res_failure
  */
 nmsg_res
 nmsg_zbuf_deflate(nmsg_zbuf_t zb, size_t len, u_char *buf,
@@ -89,4 +199,33 @@ nmsg_res
 nmsg_zbuf_inflate(nmsg_zbuf_t zb, size_t z_len, u_char *z_buf,
 		  size_t *u_len, u_char **u_buf);
 
+/**
+ * Decompress a buffer that was compressed with the given codec. Like
+ * nmsg_zbuf_inflate(), which is equivalent to calling this function with
+ * #nmsg_compression_zlib.
+ *
+ * \param[in] zb nmsg_zbuf_t object initialized for inflation.
+ *
+ * \param[in] codec Compression codec the buffer was compressed with.
+ *
+ * \param[in] z_len length of compressed buffer.
+ *
+ * \param[in] z_buf compressed buffer.
+ *
+ * \param[out] u_len length of uncompressed buffer.
+ *
+ * \param[out] u_buf pointer to uncompressed buffer. Should be freed by the
+ *	caller with free().
+ *
+ * \return #nmsg_res_success
+ * \return #nmsg_res_memfail
+ * \return #nmsg_res_failure
+ * \return #nmsg_res_notimpl If libnmsg was compiled without support for the
+ *	codec.
+ */
+nmsg_res
+nmsg_zbuf_decompress(nmsg_zbuf_t zb, nmsg_compression_type codec,
+		     size_t z_len, u_char *z_buf,
+		     size_t *u_len, u_char **u_buf);
+
 #endif /* NMSG_ZBUF_H */
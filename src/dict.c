@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2013 by Farsight Security, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Import. */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nmsgtool.h"
+
+#include "libmy/ubuf.h"
+
+/* Data structures. */
+
+VECTOR_GENERATE(size_vec, size_t);
+
+struct train_state {
+	pthread_mutex_t		lock;
+	nmsg_container_t	c;
+	size_t			bufsz;
+	ubuf			*samples;
+	size_vec		*sizes;
+	bool			full;
+};
+
+static struct train_state	ts = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* Forward. */
+
+static void	train_cb(nmsg_message_t, void *);
+static void	train_add_sample(void);
+
+/* Functions. */
+
+void
+load_dict(nmsgtool_ctx *c) {
+	struct stat st;
+	ssize_t bytes_read;
+	size_t len = 0;
+	int fd;
+
+	fd = open_rfile(c->dict_file);
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		fprintf(stderr, "%s: unable to read dictionary %s\n",
+			argv_program, c->dict_file);
+		exit(1);
+	}
+	c->dict_len = (size_t) st.st_size;
+	c->dict = malloc(c->dict_len);
+	assert(c->dict != NULL);
+
+	while (len < c->dict_len) {
+		bytes_read = read(fd, c->dict + len, c->dict_len - len);
+		if (bytes_read < 0 && errno == EINTR)
+			continue;
+		if (bytes_read <= 0) {
+			fprintf(stderr, "%s: unable to read dictionary %s: %s\n",
+				argv_program, c->dict_file, strerror(errno));
+			exit(1);
+		}
+		len += bytes_read;
+	}
+	close(fd);
+
+	if (c->debug >= 2)
+		fprintf(stderr, "%s: loaded %zu byte dictionary from %s\n",
+			argv_program, c->dict_len, c->dict_file);
+}
+
+void
+add_train_dict_output(nmsgtool_ctx *c) {
+	nmsg_output_t output;
+	nmsg_res res;
+
+	ts.bufsz = c->mtu;
+	ts.c = nmsg_container_init(ts.bufsz);
+	assert(ts.c != NULL);
+	ts.samples = ubuf_init(DEFAULT_TRAIN_DICT_SAMPLES);
+	ts.sizes = size_vec_init(1024);
+
+	output = nmsg_output_open_callback(train_cb, c);
+	if (output == NULL) {
+		fprintf(stderr, "%s: nmsg_output_open_callback() failed\n",
+			argv_program);
+		exit(1);
+	}
+	res = nmsg_io_add_output(c->io, output, NULL);
+	if (res != nmsg_res_success) {
+		fprintf(stderr, "%s: nmsg_io_add_output() failed\n",
+			argv_program);
+		exit(1);
+	}
+	c->n_outputs += 1;
+}
+
+int
+train_dict(nmsgtool_ctx *c) {
+	nmsg_res res;
+	uint8_t *dict;
+	size_t dict_len, len = 0;
+	ssize_t bytes_written;
+	int fd;
+
+	/* the last, partially filled container is a sample too */
+	pthread_mutex_lock(&ts.lock);
+	if (nmsg_container_get_num_payloads(ts.c) > 0)
+		train_add_sample();
+	nmsg_container_destroy(&ts.c);
+	pthread_mutex_unlock(&ts.lock);
+
+	if (c->debug >= 2)
+		fprintf(stderr, "%s: training dictionary from %zu containers "
+			"(%zu bytes)\n", argv_program,
+			size_vec_size(ts.sizes), ubuf_size(ts.samples));
+
+	res = nmsg_zbuf_train_dict(ubuf_data(ts.samples),
+				   size_vec_data(ts.sizes),
+				   (unsigned) size_vec_size(ts.sizes),
+				   DEFAULT_TRAIN_DICT_SIZE,
+				   &dict, &dict_len);
+	ubuf_destroy(&ts.samples);
+	size_vec_destroy(&ts.sizes);
+	if (res != nmsg_res_success) {
+		fprintf(stderr, "%s: unable to train dictionary: %s\n",
+			argv_program, nmsg_res_lookup(res));
+		return (EXIT_FAILURE);
+	}
+
+	fd = open_wfile(c->train_dict_file);
+	while (len < dict_len) {
+		bytes_written = write(fd, dict + len, dict_len - len);
+		if (bytes_written < 0 && errno == EINTR)
+			continue;
+		if (bytes_written < 0) {
+			fprintf(stderr, "%s: unable to write dictionary %s: %s\n",
+				argv_program, c->train_dict_file, strerror(errno));
+			free(dict);
+			return (EXIT_FAILURE);
+		}
+		len += bytes_written;
+	}
+	close(fd);
+	free(dict);
+
+	if (c->debug >= 2)
+		fprintf(stderr, "%s: wrote %zu byte dictionary to %s\n",
+			argv_program, dict_len, c->train_dict_file);
+
+	return (EXIT_SUCCESS);
+}
+
+/* Private functions. */
+
+static void
+train_cb(nmsg_message_t msg, void *user __attribute__((unused))) {
+	nmsg_res res;
+
+	pthread_mutex_lock(&ts.lock);
+	if (ts.full)
+		goto out;
+
+	/* accumulate payloads into containers of the same size as those that
+	 * the dictionary will be used to compress */
+	res = nmsg_container_add(ts.c, msg);
+	if (res == nmsg_res_container_full) {
+		train_add_sample();
+		res = nmsg_container_add(ts.c, msg);
+	}
+	if (res == nmsg_res_container_overfull)
+		train_add_sample();
+out:
+	pthread_mutex_unlock(&ts.lock);
+	nmsg_message_destroy(&msg);
+}
+
+static void
+train_add_sample(void) {
+	nmsg_res res;
+	uint8_t *buf;
+	size_t buf_len;
+
+	res = nmsg_container_serialize(ts.c, &buf, &buf_len,
+				       false, /* do_header */
+				       false, /* do_zlib */
+				       0, 0);
+	if (res == nmsg_res_success) {
+		ubuf_append(ts.samples, buf, buf_len);
+		size_vec_add(ts.sizes, buf_len);
+		free(buf);
+	}
+	if (ubuf_size(ts.samples) >= DEFAULT_TRAIN_DICT_SAMPLES)
+		ts.full = true;
+
+	nmsg_container_destroy(&ts.c);
+	ts.c = nmsg_container_init(ts.bufsz);
+	assert(ts.c != NULL);
+}
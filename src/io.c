@@ -17,6 +17,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,6 +34,33 @@
 
 static const int on = 1;
 
+static void
+load_index(nmsgtool_ctx *c, nmsg_input_t input, const char *fname) {
+	char *idxname;
+	nmsg_res res;
+	int fd;
+
+	/* files without an index are read in full */
+	nmsg_asprintf(&idxname, "%s.idx", fname);
+	assert(idxname != NULL);
+	fd = open(idxname, O_RDONLY);
+	if (fd == -1) {
+		if (c->debug >= 2)
+			fprintf(stderr, "%s: no index %s: %s\n",
+				argv_program, idxname, strerror(errno));
+		free(idxname);
+		return;
+	}
+	res = nmsg_input_set_index(input, fd);
+	close(fd);
+	if (res != nmsg_res_success)
+		fprintf(stderr, "%s: ignoring index %s: %s\n",
+			argv_program, idxname, nmsg_res_lookup(res));
+	else if (c->debug >= 2)
+		fprintf(stderr, "%s: loaded index %s\n", argv_program, idxname);
+	free(idxname);
+}
+
 void
 add_sock_input(nmsgtool_ctx *c, const char *ss) {
 	char *t;
@@ -102,6 +130,14 @@ add_sock_input(nmsgtool_ctx *c, const char *ss) {
 				argv_program);
 			exit(1);
 		}
+		if (c->recv_batch > 1) {
+			res = nmsg_input_set_recv_batch(input, c->recv_batch);
+			if (res != nmsg_res_success) {
+				fprintf(stderr, "%s: nmsg_input_set_recv_batch() failed\n",
+					argv_program);
+				exit(1);
+			}
+		}
 		setup_nmsg_input(c, input);
 		res = nmsg_io_add_input(c->io, input, NULL);
 		if (res != nmsg_res_success) {
@@ -180,6 +216,15 @@ add_sock_output(nmsgtool_ctx *c, const char *ss) {
 			}
 			nmsg_output_set_rate(output, nr);
 		}
+		if (c->send_batch > 1) {
+			res = nmsg_output_set_batch(output, c->send_batch, 0,
+						    DEFAULT_SEND_BATCH_DELAY);
+			if (res != nmsg_res_success) {
+				fprintf(stderr, "%s: nmsg_output_set_batch() failed\n",
+					argv_program);
+				exit(1);
+			}
+		}
 		if (c->kicker != NULL) {
 			res = nmsg_io_add_output(c->io, output, (void *) -1);
 		} else {
@@ -266,7 +311,10 @@ add_file_input(nmsgtool_ctx *c, const char *fname) {
 	nmsg_input_t input;
 	nmsg_res res;
 
-	input = nmsg_input_open_file(open_rfile(fname));
+	if (c->mmap)
+		input = nmsg_input_open_mmap(open_rfile(fname));
+	else
+		input = nmsg_input_open_file(open_rfile(fname));
 	if (input == NULL) {
 		fprintf(stderr, "%s: nmsg_input_open_file() failed\n",
 			argv_program);
@@ -281,6 +329,20 @@ add_file_input(nmsgtool_ctx *c, const char *fname) {
 			fprintf(stderr, "%s: %s ingress rate limit set to %u bytes/sec\n",
 				argv_program, fname, c->byte_rate);
 	}
+	if (c->index && strcmp(fname, "-") != 0) {
+		load_index(c, input, fname);
+
+		/* skip straight to the first container that may be in range */
+		if (c->has_time_start)
+			(void) nmsg_input_seek_time(input, &c->time_start);
+	}
+	if (c->uring > 0 && !c->mmap &&
+	    nmsg_input_set_uring(input, c->uring) != nmsg_res_success &&
+	    c->debug >= 2)
+	{
+		fprintf(stderr, "%s: not using io_uring for %s\n",
+			argv_program, fname);
+	}
 	setup_nmsg_input(c, input);
 	res = nmsg_io_add_input(c->io, input, NULL);
 	if (res != nmsg_res_success) {
@@ -314,7 +376,7 @@ add_file_output(nmsgtool_ctx *c, const char *fname) {
 				argv_program);
 			exit(1);
 		}
-		setup_nmsg_output(c, output);
+		setup_nmsg_file_output(c, output, kf->curname);
 		res = nmsg_io_add_output(c->io, output, (void *) kf);
 	} else {
 		output = nmsg_output_open_file(open_wfile(fname),
@@ -324,7 +386,7 @@ add_file_output(nmsgtool_ctx *c, const char *fname) {
 				argv_program);
 			exit(1);
 		}
-		setup_nmsg_output(c, output);
+		setup_nmsg_file_output(c, output, fname);
 		res = nmsg_io_add_output(c->io, output, NULL);
 	}
 	if (res != nmsg_res_success) {
@@ -186,6 +186,24 @@ static argv_t args[] = {
 		NULL,
 		"compress nmsg output" },
 
+	{ '\0', "compress",
+		ARGV_CHAR_P,
+		&ctx.compress_str,
+		"codec[:level]",
+		"compress nmsg output with zlib, zstd, or lz4" },
+
+	{ '\0', "dict",
+		ARGV_CHAR_P,
+		&ctx.dict_file,
+		"file",
+		"zstd dictionary for nmsg inputs and outputs" },
+
+	{ '\0', "train-dict",
+		ARGV_CHAR_P,
+		&ctx.train_dict_file,
+		"file",
+		"train zstd dictionary from inputs and write to file" },
+
 	{ 'D', "daemon",
 		ARGV_BOOL,
 		&ctx.daemon,
@@ -210,18 +228,78 @@ static argv_t args[] = {
 		NULL,
 		"print version" },
 
+	{ '\0', "hash",
+		ARGV_CHAR_P,
+		&ctx.hash_fields_str,
+		"field[,field...]",
+		"route payloads to data outputs by field values" },
+
 	{ '\0', "mirror",
 		ARGV_BOOL,
 		&ctx.mirror,
 		NULL,
 		"mirror payloads across data outputs" },
 
+	{ '\0', "decode-threads",
+		ARGV_INT,
+		&ctx.decode_threads,
+		"n",
+		"decode nmsg file inputs with n threads" },
+
+	{ '\0', "unordered",
+		ARGV_BOOL,
+		&ctx.unordered,
+		NULL,
+		"don't preserve input order with --decode-threads" },
+
+	{ '\0', "index",
+		ARGV_BOOL,
+		&ctx.index,
+		NULL,
+		"read and write .idx container indexes of nmsg files" },
+
+	{ '\0', "mmap",
+		ARGV_BOOL,
+		&ctx.mmap,
+		NULL,
+		"memory-map nmsg file inputs" },
+
+	{ '\0', "outqueue",
+		ARGV_INT,
+		&ctx.out_queue,
+		"n",
+		"queue up to n payloads per output writer thread" },
+
+	{ '\0', "outqueue-policy",
+		ARGV_CHAR_P,
+		&ctx.out_queue_policy_str,
+		"policy",
+		"block, drop-newest, or drop-oldest" },
+
+	{ '\0', "recvbatch",
+		ARGV_INT,
+		&ctx.recv_batch,
+		"n",
+		"receive up to n datagrams per syscall on socket inputs" },
+
+	{ '\0', "sendbatch",
+		ARGV_INT,
+		&ctx.send_batch,
+		"n",
+		"send up to n datagrams per syscall on socket outputs" },
+
 	{ '\0', "unbuffered",
 		ARGV_BOOL,
 		&ctx.unbuffered,
 		NULL,
 		"don't buffer writes to outputs" },
 
+	{ '\0', "uring",
+		ARGV_INT,
+		&ctx.uring,
+		"n",
+		"keep n io_uring requests in flight on nmsg files" },
+
 	{ '\0',	"setsource",
 		ARGV_CHAR_P,
 		&ctx.set_source_str,
@@ -258,6 +336,12 @@ static argv_t args[] = {
 		"grname",
 		"only process payloads with this group name" },
 
+	{ '\0', "timerange",
+		ARGV_CHAR_P,
+		&ctx.time_range_str,
+		"start,end",
+		"only process payloads within these epoch times" },
+
 	{ ARGV_LAST, 0, 0, 0, 0, 0 }
 };
 
@@ -271,6 +355,7 @@ static void signal_handler(int);
 
 int main(int argc, char **argv) {
 	nmsg_res res;
+	int rc = EXIT_SUCCESS;
 
 	/* parse command line arguments */
 	argv_process(args, argc, argv);
@@ -302,6 +387,8 @@ int main(int argc, char **argv) {
 
 	/* run the nmsg_io engine */
 	res = nmsg_io_loop(ctx.io);
+	if (ctx.train_dict_file != NULL && res == nmsg_res_success)
+		rc = train_dict(&ctx);
 
 	/* cleanup */
 	if (ctx.pidfile != NULL) {
@@ -316,8 +403,11 @@ int main(int argc, char **argv) {
 		xs_term(ctx.xs_ctx);
 #endif /* HAVE_LIBXS */
 	free(ctx.endline_str);
+	free(ctx.dict);
 	argv_cleanup(args);
 
+	if (rc != EXIT_SUCCESS)
+		return (rc);
 	return (res);
 }
 
@@ -334,11 +424,43 @@ setup_nmsg_output(nmsgtool_ctx *c, nmsg_output_t output) {
 	nmsg_output_set_buffered(output, !(c->unbuffered));
 	nmsg_output_set_endline(output, c->endline_str);
 	nmsg_output_set_zlibout(output, c->zlibout);
+	if (c->compress_str != NULL)
+		nmsg_output_set_compression(output, c->compression,
+					    c->compression_level);
+	if (c->dict != NULL)
+		nmsg_output_set_compression_dict(output, c->dict, c->dict_len);
 	nmsg_output_set_source(output, c->set_source);
 	nmsg_output_set_operator(output, c->set_operator);
 	nmsg_output_set_group(output, c->set_group);
 }
 
+void
+setup_nmsg_file_output(nmsgtool_ctx *c, nmsg_output_t output, const char *fname) {
+	setup_nmsg_output(c, output);
+	if (c->index && strcmp(fname, "-") != 0) {
+		char *idxname;
+
+		nmsg_asprintf(&idxname, "%s.idx", fname);
+		assert(idxname != NULL);
+		if (nmsg_output_set_index(output, open_wfile(idxname)) != nmsg_res_success) {
+			fprintf(stderr, "%s: unable to write index %s\n",
+				argv_program, idxname);
+			exit(1);
+		}
+		if (c->debug >= 2)
+			fprintf(stderr, "%s: writing index %s\n",
+				argv_program, idxname);
+		free(idxname);
+	}
+	if (c->uring > 0 &&
+	    nmsg_output_set_uring(output, c->uring) != nmsg_res_success &&
+	    c->debug >= 2)
+	{
+		fprintf(stderr, "%s: not using io_uring for nmsg file output\n",
+			argv_program);
+	}
+}
+
 void
 setup_nmsg_input(nmsgtool_ctx *c, nmsg_input_t input) {
 	if (c->vid != 0 && c->msgtype != 0)
@@ -346,6 +468,17 @@ setup_nmsg_input(nmsgtool_ctx *c, nmsg_input_t input) {
 	nmsg_input_set_filter_source(input, c->get_source);
 	nmsg_input_set_filter_operator(input, c->get_operator);
 	nmsg_input_set_filter_group(input, c->get_group);
+	if (c->has_time_start || c->has_time_end)
+		nmsg_input_set_time_range(input,
+					  c->has_time_start ? &c->time_start : NULL,
+					  c->has_time_end ? &c->time_end : NULL);
+	if (c->dict != NULL &&
+	    nmsg_input_add_compression_dict(input, c->dict, c->dict_len) != nmsg_res_success)
+	{
+		fprintf(stderr, "%s: nmsg_input_add_compression_dict() failed\n",
+			argv_program);
+		exit(1);
+	}
 }
 
 /* Private functions. */
@@ -385,7 +518,7 @@ io_close(struct nmsg_io_close_event *ce) {
 			kickfile_rotate(kf);
 			*(ce->output) = nmsg_output_open_file(
 				open_wfile(kf->tmpname), NMSG_WBUFSZ_MAX);
-			setup_nmsg_output(&ctx, *(ce->output));
+			setup_nmsg_file_output(&ctx, *(ce->output), kf->curname);
 			if (ctx.debug >= 2)
 				fprintf(stderr,
 					"%s: reopened nmsg file output: %s\n",
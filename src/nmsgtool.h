@@ -48,13 +48,20 @@ typedef struct {
 	argv_array_t	r_pcapfile, r_pcapif;
 	argv_array_t	w_nmsg, w_pres, w_sock, w_xsock;
 	bool		help, mirror, unbuffered, zlibout, daemon, version;
+	bool		unordered, mmap, index;
 	char		*endline, *kicker, *mname, *vname, *bpfstr;
 	int		debug;
-	unsigned	mtu, count, interval, rate, freq, byte_rate;
+	unsigned	mtu, count, interval, rate, freq, byte_rate, recv_batch;
+	unsigned	send_batch, decode_threads, out_queue, uring;
 	char		*set_source_str, *set_operator_str, *set_group_str;
 	char		*get_source_str, *get_operator_str, *get_group_str;
 	char		*pidfile;
 	char		*username;
+	char		*compress_str;
+	char		*out_queue_policy_str;
+	char		*hash_fields_str;
+	char		*time_range_str;
+	char		*dict_file, *train_dict_file;
 
 	/* state */
 	char		*endline_str;
@@ -66,6 +73,12 @@ typedef struct {
 	unsigned	vid, msgtype;
 	unsigned	set_source, set_operator, set_group;
 	unsigned	get_source, get_operator, get_group;
+	nmsg_compression_type	compression;
+	int		compression_level;
+	uint8_t		*dict;
+	size_t		dict_len;
+	bool		has_time_start, has_time_end;
+	struct timespec	time_start, time_end;
 } nmsgtool_ctx;
 
 /* Macros. */
@@ -87,6 +100,9 @@ typedef struct {
 #endif
 
 #define DEFAULT_FREQ	10
+#define DEFAULT_SEND_BATCH_DELAY	100
+#define DEFAULT_TRAIN_DICT_SIZE		(110 * 1024)
+#define DEFAULT_TRAIN_DICT_SAMPLES	(64 * 1024 * 1024)
 
 /* Function prototypes. */
 
@@ -96,6 +112,7 @@ FILE *pidfile_open(const char *pidfile);
 int getsock(nmsgtool_sockaddr *, const char *, unsigned *, unsigned *);
 int open_rfile(const char *);
 int open_wfile(const char *);
+int train_dict(nmsgtool_ctx *);
 void add_file_input(nmsgtool_ctx *, const char *);
 void add_file_output(nmsgtool_ctx *, const char *);
 void add_pcapfile_input(nmsgtool_ctx *, nmsg_msgmod_t, const char *);
@@ -104,10 +121,13 @@ void add_pres_input(nmsgtool_ctx *, nmsg_msgmod_t, const char *);
 void add_pres_output(nmsgtool_ctx *, const char *);
 void add_sock_input(nmsgtool_ctx *, const char *);
 void add_sock_output(nmsgtool_ctx *, const char *);
+void add_train_dict_output(nmsgtool_ctx *);
 void add_xsock_input(nmsgtool_ctx *, const char *);
 void add_xsock_output(nmsgtool_ctx *, const char *);
+void load_dict(nmsgtool_ctx *);
 void pidfile_write(FILE *);
 void process_args(nmsgtool_ctx *);
+void setup_nmsg_file_output(nmsgtool_ctx *, nmsg_output_t, const char *);
 void setup_nmsg_input(nmsgtool_ctx *, nmsg_input_t);
 void setup_nmsg_output(nmsgtool_ctx *, nmsg_output_t);
 void usage(const char *);
@@ -25,6 +25,19 @@
 
 #include "nmsgtool.h"
 
+static bool
+parse_time(const char *s, struct timespec *ts) {
+	char *t;
+	double d;
+
+	d = strtod(s, &t);
+	if (*s == '\0' || *t != '\0' || d < 0)
+		return (false);
+	ts->tv_sec = (time_t) d;
+	ts->tv_nsec = (long) ((d - (double) ts->tv_sec) * 1E9);
+	return (true);
+}
+
 static void
 droproot(nmsgtool_ctx *c, FILE *fp_pidfile) {
 	struct passwd *pw = NULL;
@@ -118,6 +131,67 @@ process_args(nmsgtool_ctx *c) {
 		nmsg_io_set_interval(c->io, c->interval);
 	if (c->mirror == true)
 		nmsg_io_set_output_mode(c->io, nmsg_io_output_mode_mirror);
+	if (c->hash_fields_str != NULL) {
+		if (c->mirror == true)
+			usage("--hash and --mirror are mutually exclusive");
+		if (nmsg_io_set_output_hash_fields(c->io, c->hash_fields_str)
+		    != nmsg_res_success)
+		{
+			fprintf(stderr, "%s: nmsg_io_set_output_hash_fields() failed\n",
+				argv_program);
+			exit(1);
+		}
+		nmsg_io_set_output_mode(c->io, nmsg_io_output_mode_hash);
+	}
+	if (c->decode_threads > 0)
+		nmsg_io_set_decode_threads(c->io, c->decode_threads, !c->unordered);
+	if (c->out_queue > 0) {
+		nmsg_io_queue_policy policy = nmsg_io_queue_policy_block;
+
+		if (c->out_queue_policy_str == NULL ||
+		    strcmp(c->out_queue_policy_str, "block") == 0)
+			policy = nmsg_io_queue_policy_block;
+		else if (strcmp(c->out_queue_policy_str, "drop-newest") == 0)
+			policy = nmsg_io_queue_policy_drop_newest;
+		else if (strcmp(c->out_queue_policy_str, "drop-oldest") == 0)
+			policy = nmsg_io_queue_policy_drop_oldest;
+		else
+			usage("invalid output queue policy");
+		nmsg_io_set_output_queue(c->io, c->out_queue, policy);
+	}
+
+	/* output compression */
+	if (c->compress_str != NULL) {
+		char *codec_str, *level_str;
+
+		codec_str = strdup(c->compress_str);
+		level_str = strchr(codec_str, ':');
+		if (level_str != NULL) {
+			*level_str++ = '\0';
+			c->compression_level = (int) strtol(level_str, &t, 0);
+			if (*level_str == '\0' || *t != '\0')
+				usage("invalid compression level");
+		}
+		if (nmsg_zbuf_compression_lookup(codec_str, &c->compression) != nmsg_res_success)
+			usage("unknown compression codec");
+		if (c->compression != nmsg_compression_none &&
+		    !nmsg_zbuf_compression_supported(c->compression))
+		{
+			usage("compression codec not supported by libnmsg");
+		}
+		if (c->debug >= 2)
+			fprintf(stderr, "%s: output compression set to %s (level %d)\n",
+				argv_program, codec_str, c->compression_level);
+		free(codec_str);
+	}
+
+	/* zstd dictionary */
+	if (c->dict_file != NULL || c->train_dict_file != NULL) {
+		if (!nmsg_zbuf_compression_supported(nmsg_compression_zstd))
+			usage("dictionaries require zstd support in libnmsg");
+	}
+	if (c->dict_file != NULL)
+		load_dict(c);
 
 	/* bpf string */
 	if (c->bpfstr == NULL) {
@@ -204,6 +278,25 @@ process_args(nmsgtool_ctx *c) {
 				c->get_group);
 	}
 
+	/* payload time range */
+	if (c->time_range_str != NULL) {
+		char *start_str, *end_str;
+
+		start_str = strdup(c->time_range_str);
+		end_str = strchr(start_str, ',');
+		if (end_str == NULL)
+			usage("time range must be start,end");
+		*end_str++ = '\0';
+		c->has_time_start = (*start_str != '\0');
+		c->has_time_end = (*end_str != '\0');
+		if ((c->has_time_start && !parse_time(start_str, &c->time_start)) ||
+		    (c->has_time_end && !parse_time(end_str, &c->time_end)))
+		{
+			usage("invalid time range");
+		}
+		free(start_str);
+	}
+
 	/* -V, -T sanity check */
 	if (ARGV_ARRAY_COUNT(c->r_pres) > 0 ||
 	    ARGV_ARRAY_COUNT(c->r_pcapfile) > 0 ||
@@ -312,6 +405,13 @@ process_args(nmsgtool_ctx *c) {
 #undef process_args_loop
 #undef process_args_loop_mod
 
+	/* dictionary training replaces the outputs */
+	if (c->train_dict_file != NULL) {
+		if (c->n_outputs > 0)
+			usage("--train-dict cannot be combined with outputs");
+		add_train_dict_output(c);
+	}
+
 	/* validation */
 	if (c->n_inputs == 0)
 		usage("no data sources specified");
@@ -0,0 +1,297 @@
+#!/usr/bin/env bash
+
+NMSGTOOL="../../src/nmsgtool"
+
+ERR="^libnmsg: WARNING: crc mismatch"
+
+# use the message modules from the build tree, and the test alias files
+export NMSG_MSGMOD_DIR="${NMSG_MSGMOD_DIR:-../../nmsg/base/.libs}"
+export NMSG_OPALIAS_FILE="nmsg.opalias"
+export NMSG_GRALIAS_FILE="nmsg.gralias"
+
+tmpdir=$(mktemp -d)
+trap 'rm -rf "$tmpdir"' EXIT
+
+# byte 4 of a container header holds its flags
+container_flags () {
+    od -An -tx1 -j4 -N1 "$1" | tr -d ' \n'
+}
+
+# presentation output: input.pres holds input.nmsg as it was formatted with
+# stdio, and must be reproduced byte for byte
+n="presentation output"
+$NMSGTOOL -r input.nmsg -o - > $tmpdir/input.pres
+if cmp -s input.pres $tmpdir/input.pres; then
+    echo "PASS: $n"
+else
+    echo "FAIL: $n"
+fi
+
+# compression round trips: each codec must set its header flag, and the
+# payloads read back must be written out exactly as the uncompressed input
+for x in input.nmsg incompressible.nmsg; do
+    $NMSGTOOL -r $x -w $tmpdir/plain.nmsg
+
+    for codec in zlib:01 zstd:04 zstd:19:04 lz4:08; do
+        flag="${codec##*:}"
+        codec="${codec%:*}"
+        n="compression round trip ($codec, $x)"
+        y="$tmpdir/compressed.nmsg"
+
+        if $NMSGTOOL -r $x --compress $codec -w $y 2>&1 | grep -q "not supported"; then
+            echo "SKIP: $n"
+            continue
+        fi
+
+        if [ "$(container_flags $y)" != "$flag" ]; then
+            echo "FAIL: $n [flags=$(container_flags $y), expected=$flag]"
+            continue
+        fi
+
+        if $NMSGTOOL -r $y -w $tmpdir/roundtrip.nmsg 2>&1 | grep -q "$ERR"; then
+            echo "FAIL: $n [crc mismatch]"
+        elif cmp -s $tmpdir/plain.nmsg $tmpdir/roundtrip.nmsg; then
+            echo "PASS: $n"
+        else
+            echo "FAIL: $n"
+        fi
+    done
+done
+
+# container indexes: reading with --index must return the same payloads as a
+# full scan with the same filters. input.nmsg payloads are 60 seconds apart,
+# starting at 1388534400.
+$NMSGTOOL -r input.nmsg --unbuffered --index -w $tmpdir/indexed.nmsg
+
+n="container index written"
+if [ -s $tmpdir/indexed.nmsg.idx ]; then
+    echo "PASS: $n"
+else
+    echo "FAIL: $n"
+fi
+
+# a truncated final record is ignored, and its container is read in full
+cp $tmpdir/indexed.nmsg $tmpdir/truncated.nmsg
+idxsize=$(wc -c < $tmpdir/indexed.nmsg.idx)
+head -c $((idxsize - 3)) $tmpdir/indexed.nmsg.idx > $tmpdir/truncated.nmsg.idx
+
+while read -r filters; do
+    $NMSGTOOL -r $tmpdir/indexed.nmsg $filters -e ' ' -o $tmpdir/scan.pres
+
+    for x in indexed truncated; do
+        n="container index ($x, $filters)"
+
+        $NMSGTOOL -r $tmpdir/$x.nmsg --index $filters -e ' ' \
+            -o $tmpdir/index.pres 2> $tmpdir/index.err
+
+        if grep -q "ignoring index" $tmpdir/index.err; then
+            echo "FAIL: $n [index not loaded]"
+        elif [ ! -s $tmpdir/scan.pres ]; then
+            echo "FAIL: $n [no payloads]"
+        elif cmp -s $tmpdir/scan.pres $tmpdir/index.pres; then
+            echo "PASS: $n"
+        else
+            echo "FAIL: $n"
+        fi
+    done
+done <<END
+--timerange 1388535600,1388536800
+--timerange 1388536500,
+--timerange ,1388535000.5
+--timerange 1388537220,
+-V base -T email
+--getsource 0x2
+-V base -T logline --getsource 0x3 --timerange 1388535000,1388536000
+END
+
+# header filters: payloads filtered while scanning the containers of a
+# CRC-enabled file must match the payloads selected from the presentation
+# form of the unfiltered file, and their checksums must still verify
+n="header filter (none)"
+$NMSGTOOL -r input.nmsg -e ' ' -o $tmpdir/all.pres 2> $tmpdir/all.err
+if grep -q "$ERR" $tmpdir/all.err; then
+    echo "FAIL: $n [crc mismatch]"
+elif [ $(wc -l < $tmpdir/all.pres) -ne 48 ]; then
+    echo "FAIL: $n [payload count]"
+else
+    echo "PASS: $n"
+fi
+
+while IFS='|' read -r filters pattern1 pattern2; do
+    n="header filter ($filters)"
+
+    $NMSGTOOL -r input.nmsg $filters -e ' ' \
+        -o $tmpdir/scan.pres 2> $tmpdir/scan.err
+    grep -F -- "$pattern1" $tmpdir/all.pres | grep -F -- "$pattern2" \
+        > $tmpdir/expected.pres
+
+    if grep -q "$ERR" $tmpdir/scan.err; then
+        echo "FAIL: $n [crc mismatch]"
+    elif [ ! -s $tmpdir/expected.pres ]; then
+        echo "FAIL: $n [no payloads]"
+    elif cmp -s $tmpdir/expected.pres $tmpdir/scan.pres; then
+        echo "PASS: $n"
+    else
+        echo "FAIL: $n"
+    fi
+done <<END
+-V base -T logline|[1:6 base logline]|
+-V base -T email|[1:2 base email]|
+--getsource 0x2|[00000002]|
+--getoperator op-two|[op-two]|
+--getgroup gr-one|[gr-one]|
+-V base -T email --getoperator op-one|[1:2 base email]|[op-one]
+--getsource 0x3 --getgroup gr-two|[00000003]|[gr-two]
+END
+
+# hashed outputs: every payload must go to exactly one output, and payloads
+# with the same key value must go to the same output. print_key prints the
+# values of the given bracketed header column.
+print_key () {
+    awk -F '\\] \\[' -v col=$1 '{ sub(/\].*/, "", $col); print $col }' | sort -u
+}
+
+$NMSGTOOL -r input.nmsg -e ' ' -o - | sort > $tmpdir/unhashed.pres
+
+while read -r field col; do
+    n="hash ($field)"
+
+    rm -f $tmpdir/hash?.nmsg
+    $NMSGTOOL -r input.nmsg --hash $field \
+        -w $tmpdir/hash1.nmsg -w $tmpdir/hash2.nmsg
+    for x in 1 2; do
+        $NMSGTOOL -r $tmpdir/hash$x.nmsg -e ' ' -o $tmpdir/hash$x.pres
+        print_key $col < $tmpdir/hash$x.pres > $tmpdir/hash$x.keys
+    done
+    sort $tmpdir/hash1.pres $tmpdir/hash2.pres > $tmpdir/hashed.pres
+
+    if ! cmp -s $tmpdir/unhashed.pres $tmpdir/hashed.pres; then
+        echo "FAIL: $n"
+    elif [ -n "$(comm -12 $tmpdir/hash1.keys $tmpdir/hash2.keys)" ]; then
+        echo "FAIL: $n [key in both outputs]"
+    else
+        echo "PASS: $n"
+    fi
+done <<END
+source 4
+operator 5
+group 6
+END
+
+# decode pipeline: decoding containers on several threads must give the same
+# payloads as decoding them on the input thread, in the same order unless
+# --unordered is given. compressed copies of the inputs are decoded as well.
+decode_inputs="input.nmsg incompressible.nmsg"
+for x in input incompressible; do
+    for codec in zlib zstd; do
+        y="$tmpdir/$x-$codec.nmsg"
+        if ! $NMSGTOOL -r $x.nmsg --compress $codec -w $y 2>&1 | grep -q "not supported"; then
+            decode_inputs="$decode_inputs $y"
+        fi
+    done
+done
+
+for x in $decode_inputs; do
+    $NMSGTOOL -r $x -e ' ' -o $tmpdir/decode.pres
+
+    n="decode threads ($(basename $x))"
+    $NMSGTOOL -r $x --decode-threads 4 -e ' ' -o $tmpdir/threads.pres
+    if [ ! -s $tmpdir/decode.pres ]; then
+        echo "FAIL: $n [no payloads]"
+    elif cmp -s $tmpdir/decode.pres $tmpdir/threads.pres; then
+        echo "PASS: $n"
+    else
+        echo "FAIL: $n"
+    fi
+
+    n="decode threads unordered ($(basename $x))"
+    $NMSGTOOL -r $x --decode-threads 4 --unordered -e ' ' -o - |
+        sort > $tmpdir/threads.pres
+    if sort $tmpdir/decode.pres | cmp -s - $tmpdir/threads.pres; then
+        echo "PASS: $n"
+    else
+        echo "FAIL: $n"
+    fi
+done
+
+# output queues: writing through a blocking writer thread queue must produce
+# the same file as writing directly. the dropping policies may lose payloads
+# from a short queue, but must only write payloads from the input.
+$NMSGTOOL -r input.nmsg -w $tmpdir/direct.nmsg
+$NMSGTOOL -r input.nmsg -e ' ' -o - | sort > $tmpdir/direct.pres
+
+n="output queue (block)"
+$NMSGTOOL -r input.nmsg --outqueue 4 --outqueue-policy block \
+    -w $tmpdir/queued.nmsg
+if [ ! -s $tmpdir/direct.nmsg ]; then
+    echo "FAIL: $n [no payloads]"
+elif cmp -s $tmpdir/direct.nmsg $tmpdir/queued.nmsg; then
+    echo "PASS: $n"
+else
+    echo "FAIL: $n"
+fi
+
+for policy in drop-newest drop-oldest; do
+    n="output queue ($policy)"
+
+    rm -f $tmpdir/queued.nmsg
+    if ! $NMSGTOOL -r input.nmsg --outqueue 1 --outqueue-policy $policy \
+        -w $tmpdir/queued.nmsg
+    then
+        echo "FAIL: $n [exit status]"
+        continue
+    fi
+
+    $NMSGTOOL -r $tmpdir/queued.nmsg -e ' ' -o - | sort > $tmpdir/queued.pres
+    if [ -n "$(comm -13 $tmpdir/direct.pres $tmpdir/queued.pres)" ]; then
+        echo "FAIL: $n [not a subset of the input]"
+    else
+        echo "PASS: $n"
+    fi
+done
+
+# mirrored outputs: every output must receive the same byte stream as a
+# single unmirrored output
+n="mirror"
+$NMSGTOOL -r input.nmsg --mirror -w $tmpdir/mirror1.nmsg -w $tmpdir/mirror2.nmsg
+if [ ! -s $tmpdir/mirror1.nmsg ]; then
+    echo "FAIL: $n [no payloads]"
+elif ! cmp -s $tmpdir/mirror1.nmsg $tmpdir/mirror2.nmsg; then
+    echo "FAIL: $n [outputs differ]"
+elif ! cmp -s $tmpdir/direct.nmsg $tmpdir/mirror1.nmsg; then
+    echo "FAIL: $n [differs from unmirrored output]"
+else
+    echo "PASS: $n"
+fi
+
+# memory-mapped inputs must be read exactly like ordinary file inputs
+mmap_inputs="input.nmsg incompressible.nmsg $tmpdir/input-zlib.nmsg"
+if [ -s $tmpdir/input-zstd.nmsg ]; then
+    mmap_inputs="$mmap_inputs $tmpdir/input-zstd.nmsg"
+fi
+
+for x in $mmap_inputs; do
+    n="mmap ($(basename $x))"
+
+    $NMSGTOOL -r $x -e ' ' -o $tmpdir/read.pres
+    $NMSGTOOL -r $x --mmap -e ' ' -o $tmpdir/mmap.pres
+    if [ ! -s $tmpdir/read.pres ]; then
+        echo "FAIL: $n [no payloads]"
+    elif cmp -s $tmpdir/read.pres $tmpdir/mmap.pres; then
+        echo "PASS: $n"
+    else
+        echo "FAIL: $n"
+    fi
+done
+
+# io_uring file output must write the same file as the ordinary writer
+n="uring output"
+if $NMSGTOOL -dd -r input.nmsg --uring 8 -w $tmpdir/uring.nmsg 2>&1 |
+    grep -q "not using io_uring"
+then
+    echo "SKIP: $n"
+elif cmp -s $tmpdir/direct.nmsg $tmpdir/uring.nmsg; then
+    echo "PASS: $n"
+else
+    echo "FAIL: $n"
+fi
@@ -0,0 +1,57 @@
+#!/usr/bin/env bash
+
+NMSGTOOL="../../src/nmsgtool"
+
+# use the message modules from the build tree
+export NMSG_MSGMOD_DIR="${NMSG_MSGMOD_DIR:-../../nmsg/base/.libs}"
+
+# dnsqr.pcap.gz spans 8 seconds of queries and responses, some of them
+# fragmented, retransmitted, unanswered or unsolicited. a short timeout makes
+# unanswered queries expire during the capture as well as at its end.
+export DNSQR_QUERY_TIMEOUT=2
+
+tmpdir=$(mktemp -d)
+trap 'rm -rf "$tmpdir"' EXIT
+
+gzip -dc dnsqr.pcap.gz > $tmpdir/dnsqr.pcap
+
+# print each message on one line and sort them, since threaded correlation
+# emits messages in no particular order
+dnsqr_messages () {
+    $NMSGTOOL -V base -T dnsqr -p $tmpdir/dnsqr.pcap -e ' ' -o - |
+        awk '/^\[[0-9]+\] \[/ { if (m != "") print m; m = $0; next }
+             { m = m "\\n" $0 }
+             END { if (m != "") print m }' |
+        sort
+}
+
+DNSQR_NUM_THREADS=1 dnsqr_messages > $tmpdir/inline.txt
+
+for type in UDP_QUERY_RESPONSE UDP_UNANSWERED_QUERY UDP_UNSOLICITED_RESPONSE; do
+    n="dnsqr inline ($type)"
+    if grep -q "type: $type " $tmpdir/inline.txt; then
+        echo "PASS: $n"
+    else
+        echo "FAIL: $n"
+    fi
+done
+
+# threaded correlation must emit the same messages as inline correlation. with
+# small job queues, jobs are parked until their shard catches up and ticks are
+# skipped for busy shards.
+while read -r threads queue; do
+    n="dnsqr threads ($threads, queue $queue)"
+    DNSQR_NUM_THREADS=$threads DNSQR_JOB_QUEUE_SIZE=$queue dnsqr_messages \
+        > $tmpdir/threaded.txt
+    if cmp -s $tmpdir/inline.txt $tmpdir/threaded.txt; then
+        echo "PASS: $n"
+    else
+        echo "FAIL: $n"
+    fi
+done <<END
+2 4096
+3 4096
+4 4096
+2 4
+4 1
+END